@@ -219,13 +219,20 @@ static bool tb_lookup_cmp(const void *p, const void *d)
     return false;
 }
 
+/* Number of entries of the per-vCPU lookup cache, 0 to disable it.  */
+unsigned int tb_lookup_cache_size = TB_LOOKUP_CACHE_DEFAULT_SIZE;
+
 static TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
                                           target_ulong cs_base, uint32_t flags,
                                           uint32_t cflags)
 {
+    CPUJumpCache *jc = cpu->tb_jmp_cache;
+    TBLookupCacheSet *set = NULL;
+    TranslationBlock *tb;
     tb_page_addr_t phys_pc;
     struct tb_desc desc;
     uint32_t h;
+    int i;
 
     desc.env = cpu->env_ptr;
     desc.cs_base = cs_base;
@@ -240,7 +247,26 @@ static TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
     desc.page_addr0 = phys_pc;
     h = tb_hash_func(phys_pc, (TARGET_TB_PCREL ? 0 : pc),
                      flags, cflags, *cpu->trace_dstate);
-    return qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
+
+    /*
+     * Try the per-vCPU cache first, which avoids touching the buckets
+     * of the global table that are shared with all other vCPUs.
+     */
+    if (jc->l2) {
+        set = tb_lookup_cache_set(jc, h);
+        for (i = 0; i < TB_LOOKUP_CACHE_WAYS; i++) {
+            tb = qatomic_rcu_read(&set->tb[i]);
+            if (tb && tb_lookup_cmp(tb, &desc)) {
+                return tb;
+            }
+        }
+    }
+
+    tb = qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
+    if (tb && set) {
+        tb_lookup_cache_insert(set, tb);
+    }
+    return tb;
 }
 
 /* Might cause an exception, so have a longjmp destination ready */
@@ -1054,11 +1080,17 @@ void tcg_exec_realizefn(CPUState *cpu, Error **errp)
     }
 
     cpu->tb_jmp_cache = g_new0(CPUJumpCache, 1);
+    if (tb_lookup_cache_size) {
+        size_t n_sets = tb_lookup_cache_size / TB_LOOKUP_CACHE_WAYS;
+
+        cpu->tb_jmp_cache->l2 = g_new0(TBLookupCacheSet, n_sets);
+        cpu->tb_jmp_cache->l2_mask = n_sets - 1;
+    }
     tlb_init(cpu);
 #ifndef CONFIG_USER_ONLY
     tcg_iommu_init_notifier_list(cpu);
 #endif /* !CONFIG_USER_ONLY */
-    /* qemu_plugin_vcpu_init_hook delayed until cpu_index assigned. */
+    /* qemu_plugin_vcpu_init_hook delayed until the vCPU is set up. */
 }
 
 /* undo the initializations in reverse order */
@@ -1070,6 +1102,7 @@ void tcg_exec_unrealizefn(CPUState *cpu)
 #endif /* !CONFIG_USER_ONLY */
 
     tlb_destroy(cpu);
+    g_free(cpu->tb_jmp_cache->l2);
     g_free(cpu->tb_jmp_cache);
 }
 
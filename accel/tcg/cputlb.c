@@ -91,6 +91,20 @@ static inline size_t sizeof_tlb(CPUTLBDescFast *fast)
     return fast->mask + (1 << CPU_TLB_ENTRY_BITS);
 }
 
+/* Number of victim tlb entries for vCPUs created from now on.  */
+size_t tlb_vtlb_size = CPU_VTLB_DEFAULT_SIZE;
+
+static inline size_t vtlb_n_entries(CPUTLBDesc *desc)
+{
+    return (desc->vset_mask + 1) * CPU_VTLB_WAYS;
+}
+
+/* Return the index of the first way of the victim tlb set for @page.  */
+static inline size_t vtlb_set_index(CPUTLBDesc *desc, target_ulong page)
+{
+    return ((page >> TARGET_PAGE_BITS) & desc->vset_mask) * CPU_VTLB_WAYS;
+}
+
 static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
                              size_t max_entries)
 {
@@ -230,7 +244,7 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->large_page_mask = -1;
     desc->vindex = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
-    memset(desc->vtable, -1, sizeof(desc->vtable));
+    memset(desc->vtable, -1, vtlb_n_entries(desc) * sizeof(CPUTLBEntry));
 }
 
 static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx,
@@ -252,6 +266,9 @@ static void tlb_mmu_init(CPUTLBDesc *desc, CPUTLBDescFast *fast, int64_t now)
     fast->mask = (n_entries - 1) << CPU_TLB_ENTRY_BITS;
     fast->table = g_new(CPUTLBEntry, n_entries);
     desc->fulltlb = g_new(CPUTLBEntryFull, n_entries);
+    desc->vset_mask = tlb_vtlb_size / CPU_VTLB_WAYS - 1;
+    desc->vtable = g_new(CPUTLBEntry, tlb_vtlb_size);
+    desc->vfulltlb = g_new(CPUTLBEntryFull, tlb_vtlb_size);
     tlb_mmu_flush_locked(desc, fast);
 }
 
@@ -293,32 +310,112 @@ void tlb_destroy(CPUState *cpu)
 
         g_free(fast->table);
         g_free(desc->fulltlb);
+        g_free(desc->vtable);
+        g_free(desc->vfulltlb);
+    }
+}
+
+/*
+ * Flushes requested by other vCPUs do not get a work item each.  They are
+ * accumulated in the pending state of the target vCPU, merging adjacent
+ * ranges, and a single work item performs all of them before the target
+ * executes any more guest code.  A burst of broadcast invalidations then
+ * costs one exit of each target vCPU instead of one exit per flush.
+ */
+static void tlb_flush_pending_async_work(CPUState *cpu, run_on_cpu_data data);
+
+/* Called with tlb_c.lock held.  Try to extend a pending range with @r.  */
+static bool tlb_merge_pending_locked(CPUTLBCommon *c,
+                                     const CPUTLBFlushRange *r)
+{
+    unsigned int i;
+
+    for (i = 0; i < c->pending_n_ranges; i++) {
+        CPUTLBFlushRange *p = &c->pending[i];
+
+        if (p->bits == r->bits && p->idxmap == r->idxmap &&
+            r->addr <= p->addr + p->len && p->addr <= r->addr + r->len) {
+            target_ulong end = MAX(p->addr + p->len, r->addr + r->len);
+
+            p->addr = MIN(p->addr, r->addr);
+            p->len = end - p->addr;
+            return true;
+        }
     }
+    return false;
 }
 
-/* flush_all_helper: run fn across all cpus
+/**
+ * tlb_queue_flush:
+ * @cpu: cpu on which to flush, other than the current one
+ * @idxmap: set of mmu_idx to flush completely
+ * @r: range to flush, or %NULL
  *
- * If the wait flag is set then the src cpu's helper will be queued as
- * "safe" work and the loop exited creating a synchronisation point
- * where all queued work will be finished before execution starts
- * again.
+ * Record a flush to be performed by @cpu, and queue the work item that
+ * performs it unless one is already pending.
  */
-static void flush_all_helper(CPUState *src, run_on_cpu_func fn,
-                             run_on_cpu_data d)
+static void tlb_queue_flush(CPUState *cpu, uint16_t idxmap,
+                            const CPUTLBFlushRange *r)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBCommon *c = &env_tlb(env)->c;
+    bool queue;
+
+    qemu_spin_lock(&c->lock);
+    c->pending_idxmap |= idxmap;
+    if (r && (r->idxmap & ~c->pending_idxmap) &&
+        !tlb_merge_pending_locked(c, r)) {
+        if (c->pending_n_ranges < CPU_TLB_PENDING_RANGES) {
+            c->pending[c->pending_n_ranges++] = *r;
+        } else {
+            /* Too many disjoint ranges, flush the whole mmu_idx instead. */
+            c->pending_idxmap |= r->idxmap;
+        }
+    }
+
+    queue = !c->pending_queued;
+    c->pending_queued = true;
+    qatomic_set(&c->remote_flush_count, c->remote_flush_count + 1);
+    if (!queue) {
+        qatomic_set(&c->coalesced_flush_count, c->coalesced_flush_count + 1);
+    }
+    qemu_spin_unlock(&c->lock);
+
+    if (queue) {
+        async_run_on_cpu(cpu, tlb_flush_pending_async_work, RUN_ON_CPU_NULL);
+    }
+}
+
+/* Describe a flush of the single page @addr.  */
+static inline CPUTLBFlushRange tlb_flush_page_range(target_ulong addr,
+                                                    uint16_t idxmap)
+{
+    return (CPUTLBFlushRange) {
+        .addr = addr,
+        .len = TARGET_PAGE_SIZE,
+        .idxmap = idxmap,
+        .bits = TARGET_LONG_BITS,
+    };
+}
+
+/* Queue a flush on all cpus but @src.  */
+static void tlb_queue_flush_all_cpus(CPUState *src, uint16_t idxmap,
+                                     const CPUTLBFlushRange *r)
 {
     CPUState *cpu;
 
     CPU_FOREACH(cpu) {
         if (cpu != src) {
-            async_run_on_cpu(cpu, fn, d);
+            tlb_queue_flush(cpu, idxmap, r);
         }
     }
 }
 
-void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
+void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide,
+                      size_t *premote, size_t *pcoalesced)
 {
     CPUState *cpu;
-    size_t full = 0, part = 0, elide = 0;
+    size_t full = 0, part = 0, elide = 0, remote = 0, coalesced = 0;
 
     CPU_FOREACH(cpu) {
         CPUArchState *env = cpu->env_ptr;
@@ -326,10 +423,29 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
         full += qatomic_read(&env_tlb(env)->c.full_flush_count);
         part += qatomic_read(&env_tlb(env)->c.part_flush_count);
         elide += qatomic_read(&env_tlb(env)->c.elide_flush_count);
+        remote += qatomic_read(&env_tlb(env)->c.remote_flush_count);
+        coalesced += qatomic_read(&env_tlb(env)->c.coalesced_flush_count);
     }
     *pfull = full;
     *ppart = part;
     *pelide = elide;
+    *premote = remote;
+    *pcoalesced = coalesced;
+}
+
+void tlb_vtlb_counts(size_t *phit, size_t *pmiss)
+{
+    CPUState *cpu;
+    size_t hit = 0, miss = 0;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+
+        hit += qatomic_read(&env_tlb(env)->c.vtlb_hit_count);
+        miss += qatomic_read(&env_tlb(env)->c.vtlb_miss_count);
+    }
+    *phit = hit;
+    *pmiss = miss;
 }
 
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
@@ -378,8 +494,7 @@ void tlb_flush_by_mmuidx(CPUState *cpu, uint16_t idxmap)
     tlb_debug("mmu_idx: 0x%" PRIx16 "\n", idxmap);
 
     if (cpu->created && !qemu_cpu_is_self(cpu)) {
-        async_run_on_cpu(cpu, tlb_flush_by_mmuidx_async_work,
-                         RUN_ON_CPU_HOST_INT(idxmap));
+        tlb_queue_flush(cpu, idxmap, NULL);
     } else {
         tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(idxmap));
     }
@@ -396,7 +511,7 @@ void tlb_flush_by_mmuidx_all_cpus(CPUState *src_cpu, uint16_t idxmap)
 
     tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
 
-    flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
+    tlb_queue_flush_all_cpus(src_cpu, idxmap, NULL);
     fn(src_cpu, RUN_ON_CPU_HOST_INT(idxmap));
 }
 
@@ -411,7 +526,7 @@ void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu, uint16_t idxmap)
 
     tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
 
-    flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
+    tlb_queue_flush_all_cpus(src_cpu, idxmap, NULL);
     async_safe_run_on_cpu(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
 }
 
@@ -458,6 +573,24 @@ static bool tlb_flush_entry_mask_locked(CPUTLBEntry *tlb_entry,
     return false;
 }
 
+/*
+ * Called with tlb_c.lock held.
+ * Choose the victim tlb entry that receives an entry evicted for @page:
+ * a free way of its set if there is one, otherwise any way of the set.
+ */
+static size_t vtlb_victim_index_locked(CPUTLBDesc *desc, target_ulong page)
+{
+    size_t set = vtlb_set_index(desc, page);
+    size_t k;
+
+    for (k = set; k < set + CPU_VTLB_WAYS; k++) {
+        if (tlb_entry_is_empty(&desc->vtable[k])) {
+            return k;
+        }
+    }
+    return set + desc->vindex++ % CPU_VTLB_WAYS;
+}
+
 static inline bool tlb_flush_entry_locked(CPUTLBEntry *tlb_entry,
                                           target_ulong page)
 {
@@ -470,10 +603,22 @@ static void tlb_flush_vtlb_page_mask_locked(CPUArchState *env, int mmu_idx,
                                             target_ulong mask)
 {
     CPUTLBDesc *d = &env_tlb(env)->d[mmu_idx];
-    int k;
+    size_t k, n;
 
     assert_cpu_is_self(env_cpu(env));
-    for (k = 0; k < CPU_VTLB_SIZE; k++) {
+
+    /*
+     * Only the set for @page can match, unless @mask ignores some
+     * of the bits that select the set.
+     */
+    if ((~mask >> TARGET_PAGE_BITS) & d->vset_mask) {
+        k = 0;
+        n = vtlb_n_entries(d);
+    } else {
+        k = vtlb_set_index(d, page);
+        n = k + CPU_VTLB_WAYS;
+    }
+    for (; k < n; k++) {
         if (tlb_flush_entry_mask_locked(&d->vtable[k], page, mask)) {
             tlb_n_used_entries_dec(env, mmu_idx);
         }
@@ -548,7 +693,7 @@ static void tlb_flush_page_by_mmuidx_async_0(CPUState *cpu,
  * @data: encoded addr + idxmap
  *
  * Helper for tlb_flush_page_by_mmuidx and friends, called through
- * async_run_on_cpu.  The idxmap parameter is encoded in the page
+ * async_safe_run_on_cpu.  The idxmap parameter is encoded in the page
  * offset of the target_ptr field.  This limits the set of mmu_idx
  * that can be passed via this method.
  */
@@ -573,7 +718,7 @@ typedef struct {
  * @data: allocated addr + idxmap
  *
  * Helper for tlb_flush_page_by_mmuidx and friends, called through
- * async_run_on_cpu.  The addr+idxmap parameters are stored in a
+ * async_safe_run_on_cpu.  The addr+idxmap parameters are stored in a
  * TLBFlushPageByMMUIdxData structure that has been allocated
  * specifically for this helper.  Free the structure when done.
  */
@@ -595,22 +740,10 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, uint16_t idxmap)
 
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_page_by_mmuidx_async_0(cpu, addr, idxmap);
-    } else if (idxmap < TARGET_PAGE_SIZE) {
-        /*
-         * Most targets have only a few mmu_idx.  In the case where
-         * we can stuff idxmap into the low TARGET_PAGE_BITS, avoid
-         * allocating memory for this operation.
-         */
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
+        CPUTLBFlushRange r = tlb_flush_page_range(addr, idxmap);
 
-        /* Otherwise allocate a structure, freed by the worker.  */
-        d->addr = addr;
-        d->idxmap = idxmap;
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_2,
-                         RUN_ON_CPU_HOST_PTR(d));
+        tlb_queue_flush(cpu, 0, &r);
     }
 }
 
@@ -622,35 +755,15 @@ void tlb_flush_page(CPUState *cpu, target_ulong addr)
 void tlb_flush_page_by_mmuidx_all_cpus(CPUState *src_cpu, target_ulong addr,
                                        uint16_t idxmap)
 {
+    CPUTLBFlushRange r;
+
     tlb_debug("addr: "TARGET_FMT_lx" mmu_idx:%"PRIx16"\n", addr, idxmap);
 
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
-    /*
-     * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
-     */
-    if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-    } else {
-        CPUState *dst_cpu;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                TLBFlushPageByMMUIdxData *d
-                    = g_new(TLBFlushPageByMMUIdxData, 1);
-
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
-    }
-
+    r = tlb_flush_page_range(addr, idxmap);
+    tlb_queue_flush_all_cpus(src_cpu, 0, &r);
     tlb_flush_page_by_mmuidx_async_0(src_cpu, addr, idxmap);
 }
 
@@ -663,36 +776,28 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                               target_ulong addr,
                                               uint16_t idxmap)
 {
+    CPUTLBFlushRange r;
+
     tlb_debug("addr: "TARGET_FMT_lx" mmu_idx:%"PRIx16"\n", addr, idxmap);
 
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
+    r = tlb_flush_page_range(addr, idxmap);
+    tlb_queue_flush_all_cpus(src_cpu, 0, &r);
+
     /*
-     * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
+     * Most targets have only a few mmu_idx.  In the case where
+     * we can stuff idxmap into the low TARGET_PAGE_BITS, avoid
+     * allocating memory for this operation.
      */
     if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_1,
                               RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        CPUState *dst_cpu;
-        TLBFlushPageByMMUIdxData *d;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                d = g_new(TLBFlushPageByMMUIdxData, 1);
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
+        /* Otherwise allocate a structure, freed by the worker.  */
+        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
 
-        d = g_new(TLBFlushPageByMMUIdxData, 1);
         d->addr = addr;
         d->idxmap = idxmap;
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_2,
@@ -755,15 +860,8 @@ static void tlb_flush_range_locked(CPUArchState *env, int midx,
     }
 }
 
-typedef struct {
-    target_ulong addr;
-    target_ulong len;
-    uint16_t idxmap;
-    uint16_t bits;
-} TLBFlushRangeData;
-
 static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
-                                              TLBFlushRangeData d)
+                                              CPUTLBFlushRange d)
 {
     CPUArchState *env = cpu->env_ptr;
     int mmu_idx;
@@ -804,16 +902,45 @@ static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
 static void tlb_flush_range_by_mmuidx_async_1(CPUState *cpu,
                                               run_on_cpu_data data)
 {
-    TLBFlushRangeData *d = data.host_ptr;
+    CPUTLBFlushRange *d = data.host_ptr;
     tlb_flush_range_by_mmuidx_async_0(cpu, *d);
     g_free(d);
 }
 
+static void tlb_flush_pending_async_work(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBCommon *c = &env_tlb(env)->c;
+    CPUTLBFlushRange ranges[CPU_TLB_PENDING_RANGES];
+    unsigned int i, n;
+    uint16_t idxmap;
+
+    qemu_spin_lock(&c->lock);
+    idxmap = c->pending_idxmap;
+    n = c->pending_n_ranges;
+    memcpy(ranges, c->pending, n * sizeof(ranges[0]));
+    c->pending_idxmap = 0;
+    c->pending_n_ranges = 0;
+    c->pending_queued = false;
+    qemu_spin_unlock(&c->lock);
+
+    if (idxmap) {
+        tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(idxmap));
+    }
+    for (i = 0; i < n; i++) {
+        /* Skip the mmu_idx that were flushed completely above.  */
+        ranges[i].idxmap &= ~idxmap;
+        if (ranges[i].idxmap) {
+            tlb_flush_range_by_mmuidx_async_0(cpu, ranges[i]);
+        }
+    }
+}
+
 void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
                                target_ulong len, uint16_t idxmap,
                                unsigned bits)
 {
-    TLBFlushRangeData d;
+    CPUTLBFlushRange d;
 
     /*
      * If all bits are significant, and len is small,
@@ -838,10 +965,7 @@ void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_range_by_mmuidx_async_0(cpu, d);
     } else {
-        /* Otherwise allocate a structure, freed by the worker.  */
-        TLBFlushRangeData *p = g_memdup(&d, sizeof(d));
-        async_run_on_cpu(cpu, tlb_flush_range_by_mmuidx_async_1,
-                         RUN_ON_CPU_HOST_PTR(p));
+        tlb_queue_flush(cpu, 0, &d);
     }
 }
 
@@ -855,8 +979,7 @@ void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu,
                                         target_ulong addr, target_ulong len,
                                         uint16_t idxmap, unsigned bits)
 {
-    TLBFlushRangeData d;
-    CPUState *dst_cpu;
+    CPUTLBFlushRange d;
 
     /*
      * If all bits are significant, and len is small,
@@ -878,16 +1001,7 @@ void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
-    CPU_FOREACH(dst_cpu) {
-        if (dst_cpu != src_cpu) {
-            TLBFlushRangeData *p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu,
-                             tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
-        }
-    }
-
+    tlb_queue_flush_all_cpus(src_cpu, 0, &d);
     tlb_flush_range_by_mmuidx_async_0(src_cpu, d);
 }
 
@@ -905,8 +1019,7 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                                uint16_t idxmap,
                                                unsigned bits)
 {
-    TLBFlushRangeData d, *p;
-    CPUState *dst_cpu;
+    CPUTLBFlushRange d, *p;
 
     /*
      * If all bits are significant, and len is small,
@@ -928,14 +1041,7 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
-    CPU_FOREACH(dst_cpu) {
-        if (dst_cpu != src_cpu) {
-            p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
-        }
-    }
+    tlb_queue_flush_all_cpus(src_cpu, 0, &d);
 
     p = g_memdup(&d, sizeof(d));
     async_safe_run_on_cpu(src_cpu, tlb_flush_range_by_mmuidx_async_1,
@@ -1035,7 +1141,8 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
                                          start1, length);
         }
 
-        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        n = vtlb_n_entries(&env_tlb(env)->d[mmu_idx]);
+        for (i = 0; i < n; i++) {
             tlb_reset_dirty_range_locked(&env_tlb(env)->d[mmu_idx].vtable[i],
                                          start1, length);
         }
@@ -1068,9 +1175,12 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
     }
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        int k;
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
-            tlb_set_dirty1_locked(&env_tlb(env)->d[mmu_idx].vtable[k], vaddr);
+        CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+        size_t k = vtlb_set_index(desc, vaddr);
+        size_t n = k + CPU_VTLB_WAYS;
+
+        for (; k < n; k++) {
+            tlb_set_dirty1_locked(&desc->vtable[k], vaddr);
         }
     }
     qemu_spin_unlock(&env_tlb(env)->c.lock);
@@ -1220,7 +1330,7 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
      * different page; otherwise just overwrite the stale data.
      */
     if (!tlb_hit_page_anyprot(te, vaddr_page) && !tlb_entry_is_empty(te)) {
-        unsigned vidx = desc->vindex++ % CPU_VTLB_SIZE;
+        size_t vidx = vtlb_victim_index_locked(desc, vaddr_page);
         CPUTLBEntry *tv = &desc->vtable[vidx];
 
         /* Evict the old entry into the victim tlb.  */
@@ -1461,10 +1571,12 @@ static inline target_ulong tlb_read_ofs(CPUTLBEntry *entry, size_t ofs)
 static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
                            size_t elt_ofs, target_ulong page)
 {
-    size_t vidx;
+    CPUTLBCommon *c = &env_tlb(env)->c;
+    size_t vidx = vtlb_set_index(&env_tlb(env)->d[mmu_idx], page);
+    size_t vend = vidx + CPU_VTLB_WAYS;
 
     assert_cpu_is_self(env_cpu(env));
-    for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
+    for (; vidx < vend; ++vidx) {
         CPUTLBEntry *vtlb = &env_tlb(env)->d[mmu_idx].vtable[vidx];
         target_ulong cmp;
 
@@ -1489,9 +1601,11 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
             CPUTLBEntryFull *f2 = &env_tlb(env)->d[mmu_idx].vfulltlb[vidx];
             CPUTLBEntryFull tmpf;
             tmpf = *f1; *f1 = *f2; *f2 = tmpf;
+            qatomic_set(&c->vtlb_hit_count, c->vtlb_hit_count + 1);
             return true;
         }
     }
+    qatomic_set(&c->vtlb_miss_count, c->vtlb_miss_count + 1);
     return false;
 }
 
@@ -32,6 +32,13 @@ typedef struct PageDesc {
 #endif
 #ifdef CONFIG_SOFTMMU
     QemuSpin lock;
+    /*
+     * Number of code writes since a TB was last added to or removed from
+     * the page; once it is large enough, @code_bitmap tracks the bytes
+     * covered by TBs.
+     */
+    unsigned int code_write_count;
+    unsigned long *code_bitmap;
 #endif
 } PageDesc;
 
@@ -102,7 +109,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu, target_ulong pc,
 G_NORETURN void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 void page_init(void);
 void tb_htable_init(void);
+extern unsigned int tb_lookup_cache_size;
+#ifdef CONFIG_SOFTMMU
+extern size_t tlb_vtlb_size;
+#endif
 void tb_reset_jump(TranslationBlock *tb, int n);
+void tb_evict(CPUState *cpu);
 TranslationBlock *tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                                tb_page_addr_t phys_page2);
 bool tb_invalidate_phys_page_unwind(tb_page_addr_t addr, uintptr_t pc);
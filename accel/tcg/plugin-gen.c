@@ -41,6 +41,12 @@
  * optimization to avoid generating redundant operations. For instance, for the
  * second and all subsequent callbacks of an event, we do not need to reload the
  * CPU's index into a TCG temp, since the first callback did it already.
+ *
+ * Inline operations and conditional callbacks do not follow this scheme: the
+ * ops they need depend on the operation, on whether it applies to a per-vCPU
+ * scoreboard and on the condition, so there is no single template to copy.
+ * Their empty callbacks only mark the insertion point, and the ops are
+ * generated directly in front of it by setting tcg_ctx->emit_before_op.
  */
 #include "qemu/osdep.h"
 #include "tcg/tcg.h"
@@ -73,6 +79,7 @@ enum plugin_gen_from {
 enum plugin_gen_cb {
     PLUGIN_GEN_CB_UDATA,
     PLUGIN_GEN_CB_INLINE,
+    PLUGIN_GEN_CB_COND,
     PLUGIN_GEN_CB_MEM,
     PLUGIN_GEN_ENABLE_MEM_HELPER,
     PLUGIN_GEN_DISABLE_MEM_HELPER,
@@ -124,20 +131,11 @@ static void gen_empty_udata_cb(void)
 }
 
 /*
- * For now we only support addi_i64.
- * When we support more ops, we can generate one empty inline cb for each.
+ * Inline ops and conditional callbacks are generated by inject_direct_cb(),
+ * so only the plugin_cb_start/end markers are needed.
  */
-static void gen_empty_inline_cb(void)
+static void gen_empty_direct_cb(void)
 {
-    TCGv_i64 val = tcg_temp_new_i64();
-    TCGv_ptr ptr = tcg_const_ptr(NULL); /* overwritten later */
-
-    tcg_gen_ld_i64(val, ptr, 0);
-    /* pass an immediate != 0 so that it doesn't get optimized away */
-    tcg_gen_addi_i64(val, val, 0xdeadface);
-    tcg_gen_st_i64(val, ptr, 0);
-    tcg_temp_free_ptr(ptr);
-    tcg_temp_free_i64(val);
 }
 
 static void gen_empty_mem_cb(TCGv addr, uint32_t info)
@@ -190,7 +188,8 @@ static void plugin_gen_empty_callback(enum plugin_gen_from from)
         /* fall through */
     case PLUGIN_GEN_FROM_TB:
         gen_wrapped(from, PLUGIN_GEN_CB_UDATA, gen_empty_udata_cb);
-        gen_wrapped(from, PLUGIN_GEN_CB_INLINE, gen_empty_inline_cb);
+        gen_wrapped(from, PLUGIN_GEN_CB_INLINE, gen_empty_direct_cb);
+        gen_wrapped(from, PLUGIN_GEN_CB_COND, gen_empty_direct_cb);
         break;
     default:
         g_assert_not_reached();
@@ -224,7 +223,7 @@ void plugin_gen_empty_mem_callback(TCGv addr, uint32_t info)
     fn.mem_fn = gen_empty_mem_cb;
     gen_mem_wrapped(PLUGIN_GEN_CB_MEM, &fn, addr, info, true);
 
-    fn.inline_fn = gen_empty_inline_cb;
+    fn.inline_fn = gen_empty_direct_cb;
     gen_mem_wrapped(PLUGIN_GEN_CB_INLINE, &fn, 0, info, false);
 }
 
@@ -325,19 +324,6 @@ static TCGOp *copy_extu_tl_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_ld_i64(TCGOp **begin_op, TCGOp *op)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* 2x ld_i32 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-    } else {
-        /* ld_i64 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i64);
-    }
-    return op;
-}
-
 static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TCG_TARGET_REG_BITS == 32) {
@@ -351,21 +337,6 @@ static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_add_i64(TCGOp **begin_op, TCGOp *op, uint64_t v)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* all 32-bit backends must implement add2_i32 */
-        g_assert(TCG_TARGET_HAS_add2_i32);
-        op = copy_op(begin_op, op, INDEX_op_add2_i32);
-        op->args[4] = tcgv_i32_arg(tcg_constant_i32(v));
-        op->args[5] = tcgv_i32_arg(tcg_constant_i32(v >> 32));
-    } else {
-        op = copy_op(begin_op, op, INDEX_op_add_i64);
-        op->args[2] = tcgv_i64_arg(tcg_constant_i64(v));
-    }
-    return op;
-}
-
 static TCGOp *copy_st_ptr(TCGOp **begin_op, TCGOp *op)
 {
     if (UINTPTR_MAX == UINT32_MAX) {
@@ -438,25 +409,6 @@ static TCGOp *append_udata_cb(const struct qemu_plugin_dyn_cb *cb,
     return op;
 }
 
-static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
-                               TCGOp *begin_op, TCGOp *op,
-                               int *unused)
-{
-    /* const_ptr */
-    op = copy_const_ptr(&begin_op, op, cb->userp);
-
-    /* ld_i64 */
-    op = copy_ld_i64(&begin_op, op);
-
-    /* add_i64 */
-    op = copy_add_i64(&begin_op, op, cb->inline_insn.imm);
-
-    /* st_i64 */
-    op = copy_st_i64(&begin_op, op);
-
-    return op;
-}
-
 static TCGOp *append_mem_cb(const struct qemu_plugin_dyn_cb *cb,
                             TCGOp *begin_op, TCGOp *op, int *cb_idx)
 {
@@ -542,10 +494,133 @@ inject_udata_cb(const GArray *cbs, TCGOp *begin_op)
     inject_cb_type(cbs, begin_op, append_udata_cb, op_ok);
 }
 
+/* Load the address of the uint64_t an inline op or a condition refers to */
+static TCGv_ptr gen_plugin_u64_ptr(qemu_plugin_u64 entry, void *ptr)
+{
+    GArray *arr = entry.score ? entry.score->data : NULL;
+    TCGv_i32 cpu_index;
+    TCGv_ptr addr;
+
+    if (!arr) {
+        return tcg_const_ptr(ptr);
+    }
+
+    cpu_index = tcg_temp_new_i32();
+    addr = tcg_temp_new_ptr();
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    tcg_gen_muli_i32(cpu_index, cpu_index, g_array_get_element_size(arr));
+    tcg_gen_ext_i32_ptr(addr, cpu_index);
+    tcg_gen_addi_ptr(addr, addr, (intptr_t)(arr->data + entry.offset));
+    tcg_temp_free_i32(cpu_index);
+    return addr;
+}
+
+static void gen_inline_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGv_ptr ptr = gen_plugin_u64_ptr(cb->inline_insn.entry, cb->userp);
+    TCGv_i64 val;
+
+    switch (cb->inline_insn.op) {
+    case QEMU_PLUGIN_INLINE_ADD_U64:
+        val = tcg_temp_new_i64();
+        tcg_gen_ld_i64(val, ptr, 0);
+        tcg_gen_addi_i64(val, val, cb->inline_insn.imm);
+        tcg_gen_st_i64(val, ptr, 0);
+        tcg_temp_free_i64(val);
+        break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        tcg_gen_st_i64(tcg_constant_i64(cb->inline_insn.imm), ptr, 0);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    tcg_temp_free_ptr(ptr);
+}
+
+static TCGCond plugin_cond_to_tcgcond(enum qemu_plugin_cond cond)
+{
+    switch (cond) {
+    case QEMU_PLUGIN_COND_EQ:
+        return TCG_COND_EQ;
+    case QEMU_PLUGIN_COND_NE:
+        return TCG_COND_NE;
+    case QEMU_PLUGIN_COND_LT:
+        return TCG_COND_LTU;
+    case QEMU_PLUGIN_COND_LE:
+        return TCG_COND_LEU;
+    case QEMU_PLUGIN_COND_GT:
+        return TCG_COND_GTU;
+    case QEMU_PLUGIN_COND_GE:
+        return TCG_COND_GEU;
+    default:
+        /* NEVER and ALWAYS are handled at registration time */
+        g_assert_not_reached();
+    }
+}
+
+static void gen_cond_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGCond cond = plugin_cond_to_tcgcond(cb->cond.cond);
+    TCGv_ptr ptr = gen_plugin_u64_ptr(cb->cond.entry, NULL);
+    TCGv_i64 val = tcg_temp_new_i64();
+    TCGLabel *skip = gen_new_label();
+    TCGv_i32 cpu_index;
+    TCGOp *op;
+
+    tcg_gen_ld_i64(val, ptr, 0);
+    tcg_gen_brcondi_i64(tcg_invert_cond(cond), val, cb->cond.imm, skip);
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+
+    cpu_index = tcg_temp_new_i32();
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    gen_helper_plugin_vcpu_udata_cb(cpu_index, tcg_constant_ptr(cb->userp));
+    tcg_temp_free_i32(cpu_index);
+
+    /* as in copy_call(), redirect the call to the plugin's function */
+    op = QTAILQ_PREV(tcg_ctx->emit_before_op, link);
+    tcg_debug_assert(op->opc == INDEX_op_call);
+    tcg_debug_assert((uintptr_t)op->args[TCGOP_CALLO(op) + TCGOP_CALLI(op)] ==
+                     (uintptr_t)HELPER(plugin_vcpu_udata_cb));
+    op->args[TCGOP_CALLO(op) + TCGOP_CALLI(op)] = (uintptr_t)cb->f.vcpu_udata;
+
+    gen_set_label(skip);
+}
+
+typedef void (*direct_gen_fn)(const struct qemu_plugin_dyn_cb *cb);
+
+static void inject_direct_cb(const GArray *cbs, TCGOp *begin_op,
+                             direct_gen_fn gen, op_ok_fn ok)
+{
+    int i;
+
+    if (cbs && cbs->len) {
+        tcg_ctx->emit_before_op = begin_op;
+        for (i = 0; i < cbs->len; i++) {
+            struct qemu_plugin_dyn_cb *cb =
+                &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+            if (ok(begin_op, cb)) {
+                gen(cb);
+            }
+        }
+        tcg_ctx->emit_before_op = NULL;
+    }
+    rm_ops(begin_op);
+}
+
 static void
 inject_inline_cb(const GArray *cbs, TCGOp *begin_op, op_ok_fn ok)
 {
-    inject_cb_type(cbs, begin_op, append_inline_cb, ok);
+    inject_direct_cb(cbs, begin_op, gen_inline_cb, ok);
+}
+
+static void
+inject_cond_cb(const GArray *cbs, TCGOp *begin_op)
+{
+    inject_direct_cb(cbs, begin_op, gen_cond_cb, op_ok);
 }
 
 static void
@@ -655,6 +730,12 @@ static void plugin_gen_tb_inline(const struct qemu_plugin_tb *ptb,
     inject_inline_cb(ptb->cbs[PLUGIN_CB_INLINE], begin_op, op_ok);
 }
 
+static void plugin_gen_tb_cond(const struct qemu_plugin_tb *ptb,
+                               TCGOp *begin_op)
+{
+    inject_cond_cb(ptb->cbs[PLUGIN_CB_COND], begin_op);
+}
+
 static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
                                   TCGOp *begin_op, int insn_idx)
 {
@@ -671,6 +752,13 @@ static void plugin_gen_insn_inline(const struct qemu_plugin_tb *ptb,
                      begin_op, op_ok);
 }
 
+static void plugin_gen_insn_cond(const struct qemu_plugin_tb *ptb,
+                                 TCGOp *begin_op, int insn_idx)
+{
+    struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
+    inject_cond_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_COND], begin_op);
+}
+
 static void plugin_gen_mem_regular(const struct qemu_plugin_tb *ptb,
                                    TCGOp *begin_op, int insn_idx)
 {
@@ -737,6 +825,9 @@ static void pr_ops(void)
             case PLUGIN_GEN_CB_INLINE:
                 type = "inline";
                 break;
+            case PLUGIN_GEN_CB_COND:
+                type = "cond";
+                break;
             case PLUGIN_GEN_CB_MEM:
                 type = "mem";
                 break;
@@ -763,6 +854,14 @@ static void plugin_gen_inject(const struct qemu_plugin_tb *plugin_tb)
 
     pr_ops();
 
+    /*
+     * Inline ops and conditions are generated here, after translation,
+     * with temps of their own.  A temp freed by the translator may still
+     * be live where they are inserted, e.g. the old value of a
+     * non-atomic cmpxchg around its memory callbacks, so never reuse one.
+     */
+    memset(tcg_ctx->free_temps, 0, sizeof(tcg_ctx->free_temps));
+
     QTAILQ_FOREACH(op, &tcg_ctx->ops, link) {
         switch (op->opc) {
         case INDEX_op_insn_start:
@@ -785,6 +884,9 @@ static void plugin_gen_inject(const struct qemu_plugin_tb *plugin_tb)
                 case PLUGIN_GEN_CB_INLINE:
                     plugin_gen_tb_inline(plugin_tb, op);
                     break;
+                case PLUGIN_GEN_CB_COND:
+                    plugin_gen_tb_cond(plugin_tb, op);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -801,6 +903,9 @@ static void plugin_gen_inject(const struct qemu_plugin_tb *plugin_tb)
                 case PLUGIN_GEN_CB_INLINE:
                     plugin_gen_insn_inline(plugin_tb, op, insn_idx);
                     break;
+                case PLUGIN_GEN_CB_COND:
+                    plugin_gen_insn_cond(plugin_tb, op, insn_idx);
+                    break;
                 case PLUGIN_GEN_ENABLE_MEM_HELPER:
                     plugin_gen_enable_mem_helper(plugin_tb, op, insn_idx);
                     break;
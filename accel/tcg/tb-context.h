@@ -34,6 +34,7 @@ struct TBContext {
 
     /* statistics */
     unsigned tb_flush_count;
+    unsigned tb_evict_count; /* code buffer regions evicted */
     unsigned tb_phys_invalidate_count;
 };
 
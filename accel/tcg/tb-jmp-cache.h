@@ -12,6 +12,20 @@
 #define TB_JMP_CACHE_BITS 12
 #define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
 
+#define TB_LOOKUP_CACHE_WAYS 2
+#define TB_LOOKUP_CACHE_DEFAULT_SIZE (1 << 13)
+#define TB_LOOKUP_CACHE_MAX_SIZE (1 << 20)
+
+/*
+ * One set of the second-level lookup cache.  Entries are placed by the
+ * same hash as in the global QHT, so they only depend on the physical
+ * address of the TB and survive TLB flushes, unlike the jump cache.
+ * Accessed in parallel; all accesses to 'tb' must be atomic.
+ */
+typedef struct TBLookupCacheSet {
+    TranslationBlock *tb[TB_LOOKUP_CACHE_WAYS];
+} TBLookupCacheSet;
+
 /*
  * Accessed in parallel; all accesses to 'tb' must be atomic.
  * For TARGET_TB_PCREL, accesses to 'pc' must be protected by
@@ -24,6 +38,14 @@ struct CPUJumpCache {
         target_ulong pc;
 #endif
     } array[TB_JMP_CACHE_SIZE];
+
+    /*
+     * The second-level lookup cache, consulted on a jump cache miss
+     * before the global QHT, or NULL if disabled.  l2_mask contains
+     * the number of sets minus one.
+     */
+    TBLookupCacheSet *l2;
+    uint32_t l2_mask;
 };
 
 static inline TranslationBlock *
@@ -62,4 +84,54 @@ tb_jmp_cache_set(CPUJumpCache *jc, uint32_t hash,
 #endif
 }
 
+static inline TBLookupCacheSet *
+tb_lookup_cache_set(CPUJumpCache *jc, uint32_t hash)
+{
+    return &jc->l2[hash & jc->l2_mask];
+}
+
+/* Make @tb the most recently used entry of its set.  */
+static inline void
+tb_lookup_cache_insert(TBLookupCacheSet *set, TranslationBlock *tb)
+{
+    int i;
+
+    for (i = TB_LOOKUP_CACHE_WAYS - 1; i > 0; i--) {
+        qatomic_set(&set->tb[i], qatomic_read(&set->tb[i - 1]));
+    }
+    qatomic_set(&set->tb[0], tb);
+}
+
+static inline void
+tb_lookup_cache_remove(CPUJumpCache *jc, uint32_t hash, TranslationBlock *tb)
+{
+    TBLookupCacheSet *set;
+    int i;
+
+    if (jc == NULL || jc->l2 == NULL) {
+        return;
+    }
+    set = tb_lookup_cache_set(jc, hash);
+    for (i = 0; i < TB_LOOKUP_CACHE_WAYS; i++) {
+        if (qatomic_read(&set->tb[i]) == tb) {
+            qatomic_set(&set->tb[i], NULL);
+        }
+    }
+}
+
+static inline void tb_lookup_cache_flush(CPUJumpCache *jc)
+{
+    uint32_t i;
+    int j;
+
+    if (jc == NULL || jc->l2 == NULL) {
+        return;
+    }
+    for (i = 0; i <= jc->l2_mask; i++) {
+        for (j = 0; j < TB_LOOKUP_CACHE_WAYS; j++) {
+            qatomic_set(&jc->l2[i].tb[j], NULL);
+        }
+    }
+}
+
 #endif /* ACCEL_TCG_TB_JMP_CACHE_H */
@@ -18,6 +18,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bitmap.h"
 #include "exec/cputlb.h"
 #include "exec/log.h"
 #include "exec/exec-all.h"
@@ -50,6 +51,50 @@ void tb_htable_init(void)
     qht_init(&tb_ctx.htable, tb_cmp, CODE_GEN_HTABLE_SIZE, mode);
 }
 
+#ifdef CONFIG_SOFTMMU
+/*
+ * Number of writes to the code in a page after which they are filtered
+ * through a bitmap of the bytes that TBs were translated from, so that
+ * writes to data sharing the page stop walking (and invalidating) its TBs.
+ */
+#define SMC_BITMAP_USE_THRESHOLD 10
+
+static void invalidate_page_bitmap(PageDesc *p)
+{
+    assert_page_locked(p);
+    g_free(p->code_bitmap);
+    p->code_bitmap = NULL;
+    p->code_write_count = 0;
+}
+
+/* Mark the bytes of the page that are covered by its TBs */
+static void build_page_bitmap(PageDesc *p)
+{
+    int n, tb_start, tb_end;
+    TranslationBlock *tb;
+
+    assert_page_locked(p);
+    p->code_bitmap = bitmap_new(TARGET_PAGE_SIZE);
+
+    PAGE_FOR_EACH_TB(p, tb, n) {
+        /* NOTE: this is subtle as a TB may span two physical pages */
+        if (n == 0) {
+            tb_start = tb_page_addr0(tb) & ~TARGET_PAGE_MASK;
+            tb_end = tb_start + tb->size;
+            if (tb_end > TARGET_PAGE_SIZE) {
+                tb_end = TARGET_PAGE_SIZE;
+            }
+        } else {
+            tb_start = 0;
+            tb_end = ((tb_page_addr0(tb) + tb->size) & ~TARGET_PAGE_MASK);
+        }
+        bitmap_set(p->code_bitmap, tb_start, tb_end - tb_start);
+    }
+}
+#else
+static inline void invalidate_page_bitmap(PageDesc *p) { }
+#endif
+
 /* Set to NULL all the 'first_tb' fields in all PageDescs. */
 static void page_flush_tb_1(int level, void **lp)
 {
@@ -64,6 +109,7 @@ static void page_flush_tb_1(int level, void **lp)
         for (i = 0; i < V_L2_SIZE; ++i) {
             page_lock(&pd[i]);
             pd[i].first_tb = (uintptr_t)NULL;
+            invalidate_page_bitmap(pd + i);
             page_unlock(&pd[i]);
         }
     } else {
@@ -98,6 +144,7 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 
     CPU_FOREACH(cpu) {
         tcg_flush_jmp_cache(cpu);
+        tb_lookup_cache_flush(cpu->tb_jmp_cache);
     }
 
     qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
@@ -226,7 +273,11 @@ static inline void tb_jmp_unlink(TranslationBlock *dest)
     qemu_spin_unlock(&dest->jmp_lock);
 }
 
-static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
+/*
+ * Remove @tb from the jump caches of all cpus, and from their lookup
+ * caches, where @hash is the hash of @tb in the global table.
+ */
+static void tb_jmp_cache_inval_tb(TranslationBlock *tb, uint32_t hash)
 {
     CPUState *cpu;
 
@@ -234,6 +285,7 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
         /* A TB may be at any virtual address */
         CPU_FOREACH(cpu) {
             tcg_flush_jmp_cache(cpu);
+            tb_lookup_cache_remove(cpu->tb_jmp_cache, hash, tb);
         }
     } else {
         uint32_t h = tb_jmp_cache_hash_func(tb_pc(tb));
@@ -244,6 +296,7 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
             if (qatomic_read(&jc->array[h].tb) == tb) {
                 qatomic_set(&jc->array[h].tb, NULL);
             }
+            tb_lookup_cache_remove(jc, hash, tb);
         }
     }
 }
@@ -252,8 +305,11 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
  * In user-mode, call with mmap_lock held.
  * In !user-mode, if @rm_from_page_list is set, call with the TB's pages'
  * locks held.
+ * If @rm_from_jmp_cache is clear, the caller must flush the jump caches
+ * of all cpus before the TB can be freed.
  */
-static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
+static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list,
+                                  bool rm_from_jmp_cache)
 {
     PageDesc *p;
     uint32_t h;
@@ -279,15 +335,19 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     if (rm_from_page_list) {
         p = page_find(phys_pc >> TARGET_PAGE_BITS);
         tb_page_remove(p, tb);
+        invalidate_page_bitmap(p);
         phys_pc = tb_page_addr1(tb);
         if (phys_pc != -1) {
             p = page_find(phys_pc >> TARGET_PAGE_BITS);
             tb_page_remove(p, tb);
+            invalidate_page_bitmap(p);
         }
     }
 
     /* remove the TB from the hash list */
-    tb_jmp_cache_inval_tb(tb);
+    if (rm_from_jmp_cache) {
+        tb_jmp_cache_inval_tb(tb, h);
+    }
 
     /* suppress this TB from the two jump lists */
     tb_remove_from_jmp_list(tb, 0);
@@ -303,7 +363,7 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
 static void tb_phys_invalidate__locked(TranslationBlock *tb)
 {
     qemu_thread_jit_write();
-    do_tb_phys_invalidate(tb, true);
+    do_tb_phys_invalidate(tb, true, true);
     qemu_thread_jit_execute();
 }
 
@@ -380,10 +440,61 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
 {
     if (page_addr == -1 && tb_page_addr0(tb) != -1) {
         page_lock_tb(tb);
-        do_tb_phys_invalidate(tb, true);
+        do_tb_phys_invalidate(tb, true, true);
         page_unlock_tb(tb);
     } else {
-        do_tb_phys_invalidate(tb, false);
+        do_tb_phys_invalidate(tb, false, true);
+    }
+}
+
+static void tb_evict_tb(TranslationBlock *tb)
+{
+    if (tb_page_addr0(tb) != -1) {
+        page_lock_tb(tb);
+        do_tb_phys_invalidate(tb, true, false);
+        page_unlock_tb(tb);
+    } else {
+        do_tb_phys_invalidate(tb, false, false);
+    }
+}
+
+/* make room in the code buffer by dropping the oldest translations */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUState *other;
+    int n;
+
+    mmap_lock();
+    qemu_thread_jit_write();
+    n = tcg_region_evict(tb_evict_tb);
+    qemu_thread_jit_execute();
+    if (n > 0) {
+        /* The evicted TBs were left in the jump caches */
+        CPU_FOREACH(other) {
+            tcg_flush_jmp_cache(other);
+            tb_lookup_cache_flush(other->tb_jmp_cache);
+        }
+        qatomic_set(&tb_ctx.tb_evict_count, tb_ctx.tb_evict_count + n);
+    }
+    mmap_unlock();
+
+    if (n < 0) {
+        do_tb_flush(cpu, RUN_ON_CPU_HOST_INT(tb_ctx.tb_flush_count));
+    }
+}
+
+/*
+ * Called when the code buffer is full: evict its oldest regions, or
+ * flush it entirely if it cannot be done.
+ */
+void tb_evict(CPUState *cpu)
+{
+    if (tcg_enabled()) {
+        if (cpu_in_exclusive_context(cpu)) {
+            do_tb_evict(cpu, RUN_ON_CPU_NULL);
+        } else {
+            async_safe_run_on_cpu(cpu, do_tb_evict, RUN_ON_CPU_NULL);
+        }
     }
 }
 
@@ -402,6 +513,7 @@ static inline void tb_page_add(PageDesc *p, TranslationBlock *tb,
     assert_page_locked(p);
 
     tb->page_next[n] = p->first_tb;
+    invalidate_page_bitmap(p);
 #ifndef CONFIG_USER_ONLY
     page_already_protected = p->first_tb != (uintptr_t)NULL;
 #endif
@@ -638,6 +750,21 @@ void tb_invalidate_phys_page_fast(struct page_collection *pages,
     }
 
     assert_page_locked(p);
+    if (!p->code_bitmap &&
+        ++p->code_write_count >= SMC_BITMAP_USE_THRESHOLD) {
+        build_page_bitmap(p);
+    }
+    if (p->code_bitmap) {
+        unsigned long nr = start & ~TARGET_PAGE_MASK;
+
+        /*
+         * The bitmap is dropped whenever a TB is added to or removed from
+         * the page, so a miss means only data was written.
+         */
+        if (find_next_bit(p->code_bitmap, nr + len, nr) >= nr + len) {
+            return;
+        }
+    }
     tb_invalidate_phys_page_range__locked(pages, p, start, start + len,
                                           retaddr);
 }
@@ -37,6 +37,7 @@
 #include "hw/boards.h"
 #endif
 #include "internal.h"
+#include "tb-jmp-cache.h"
 
 struct TCGState {
     AccelState parent_obj;
@@ -44,6 +45,8 @@ struct TCGState {
     bool mttcg_enabled;
     int splitwx_enabled;
     unsigned long tb_size;
+    uint32_t vtlb_size;
+    uint32_t tb_lookup_cache_size;
 };
 typedef struct TCGState TCGState;
 
@@ -99,6 +102,10 @@ static void tcg_accel_instance_init(Object *obj)
     TCGState *s = TCG_STATE(obj);
 
     s->mttcg_enabled = default_mttcg_enabled();
+    s->tb_lookup_cache_size = TB_LOOKUP_CACHE_DEFAULT_SIZE;
+#ifdef CONFIG_SOFTMMU
+    s->vtlb_size = CPU_VTLB_DEFAULT_SIZE;
+#endif
 
     /* If debugging enabled, default "auto on", otherwise off. */
 #if defined(CONFIG_DEBUG_TCG) && !defined(CONFIG_USER_ONLY)
@@ -124,6 +131,10 @@ static int tcg_init_machine(MachineState *ms)
 
     page_init();
     tb_htable_init();
+    tb_lookup_cache_size = s->tb_lookup_cache_size;
+#ifdef CONFIG_SOFTMMU
+    tlb_vtlb_size = s->vtlb_size;
+#endif
     tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_cpus);
 
 #if defined(CONFIG_SOFTMMU)
@@ -196,6 +207,72 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_tb_lookup_cache_size(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->tb_lookup_cache_size;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_tb_lookup_cache_size(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    if (value && (!is_power_of_2(value) ||
+                  value < TB_LOOKUP_CACHE_WAYS ||
+                  value > TB_LOOKUP_CACHE_MAX_SIZE)) {
+        error_setg(errp, "tb-lookup-cache-size must be 0 or a power of 2 "
+                   "between %d and %d", TB_LOOKUP_CACHE_WAYS,
+                   TB_LOOKUP_CACHE_MAX_SIZE);
+        return;
+    }
+
+    s->tb_lookup_cache_size = value;
+}
+
+#ifdef CONFIG_SOFTMMU
+static void tcg_get_vtlb_size(Object *obj, Visitor *v,
+                              const char *name, void *opaque,
+                              Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->vtlb_size;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_vtlb_size(Object *obj, Visitor *v,
+                              const char *name, void *opaque,
+                              Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    if (!is_power_of_2(value) ||
+        value < CPU_VTLB_WAYS || value > CPU_VTLB_MAX_SIZE) {
+        error_setg(errp, "vtlb-size must be a power of 2 between %d and %d",
+                   CPU_VTLB_WAYS, CPU_VTLB_MAX_SIZE);
+        return;
+    }
+
+    s->vtlb_size = value;
+}
+#endif
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -241,6 +318,20 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "tb-lookup-cache-size", "int",
+        tcg_get_tb_lookup_cache_size, tcg_set_tb_lookup_cache_size,
+        NULL, NULL);
+    object_class_property_set_description(oc, "tb-lookup-cache-size",
+        "Number of entries of the per-vCPU translation block lookup cache");
+
+#ifdef CONFIG_SOFTMMU
+    object_class_property_add(oc, "vtlb-size", "int",
+        tcg_get_vtlb_size, tcg_set_vtlb_size,
+        NULL, NULL);
+    object_class_property_set_description(oc, "vtlb-size",
+        "Number of victim TLB entries per MMU mode");
+#endif
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
@@ -0,0 +1,859 @@
+/*
+ * block-cache driver
+ *
+ * Keeps recently used clusters of the child node in host memory, so that
+ * a hot working set does not have to be fetched again from a slow child
+ * (nbd, rbd, curl, ...) when the host page cache is bypassed.  Writes either
+ * go through to the child and update cached clusters (writethrough), or are
+ * kept in the cache until the next flush (writeback).
+ *
+ * In writeback mode the child is missing the dirty data, so the node is not
+ * a filter: bdrv_skip_filters() users like block jobs must not look past it.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+
+#include "qapi/error.h"
+#include "qapi/qapi-visit-block-core.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/madvise.h"
+#include "qemu/memalign.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
+#include "block/block_int.h"
+#include "block/reqlist.h"
+#include "trace.h"
+
+#define BLOCK_CACHE_OPT_CACHE_SIZE "cache-size"
+#define BLOCK_CACHE_OPT_CLUSTER_SIZE "cluster-size"
+#define BLOCK_CACHE_OPT_MODE "mode"
+
+#define BLOCK_CACHE_MAX_CLUSTER_SIZE (2 * MiB)
+
+typedef struct BlockCacheEntry {
+    /* Offset of the cached cluster, key in @map; -1 if the entry is free */
+    int64_t offset;
+    uint8_t *data;
+    /*
+     * Dirty entries hold data that the child has not seen yet.  They are on
+     * neither the @lru nor the @free list, so they are never evicted.
+     */
+    bool dirty;
+    QTAILQ_ENTRY(BlockCacheEntry) next;
+} BlockCacheEntry;
+
+typedef struct BlockCacheOpts {
+    uint64_t cache_size;
+    uint64_t cluster_size;
+    BlockCacheMode mode;
+} BlockCacheOpts;
+
+typedef struct BDRVBlockCacheState {
+    BlockCacheOpts opts;
+
+    size_t nb_entries;
+    BlockCacheEntry *entries;
+    uint8_t *buf;
+    size_t buf_size;
+
+    /*
+     * Requests lock the cluster-aligned range they work on in @reqs, so that
+     * overlapping requests are serialized and the cache never gets populated
+     * with data that is stale by the time it is inserted.
+     *
+     * @lock protects @reqs, @map, both lists, the entries' metadata and the
+     * statistics.  Entry data may be accessed without @lock by the owner of
+     * the range the entry belongs to.
+     */
+    CoMutex lock;
+    BlockReqList reqs;
+    GHashTable *map;
+    QTAILQ_HEAD(, BlockCacheEntry) lru; /* clean entries, least recent first */
+    QTAILQ_HEAD(, BlockCacheEntry) free;
+    uint64_t nb_cached;
+    uint64_t nb_dirty;
+
+    uint64_t read_hit_bytes;
+    uint64_t read_miss_bytes;
+    uint64_t evictions;
+    uint64_t writebacks;
+} BDRVBlockCacheState;
+
+static QemuOptsList runtime_opts = {
+    .name = "block-cache",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = BLOCK_CACHE_OPT_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "size of the cache, default 64M",
+        },
+        {
+            .name = BLOCK_CACHE_OPT_CLUSTER_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "cache granularity, default 64k",
+        },
+        {
+            .name = BLOCK_CACHE_OPT_MODE,
+            .type = QEMU_OPT_STRING,
+            .help = "write policy (writethrough, writeback)",
+        },
+        { /* end of list */ }
+    },
+};
+
+static bool block_cache_absorb_opts(BlockCacheOpts *dest, QDict *options,
+                                    BlockDriverState *child_bs, Error **errp)
+{
+    QemuOpts *opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    Error *local_err = NULL;
+    bool ret = false;
+
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        goto out;
+    }
+
+    dest->cache_size =
+        qemu_opt_get_size(opts, BLOCK_CACHE_OPT_CACHE_SIZE, 64 * MiB);
+    dest->cluster_size =
+        qemu_opt_get_size(opts, BLOCK_CACHE_OPT_CLUSTER_SIZE, 64 * KiB);
+    dest->mode = qapi_enum_parse(&BlockCacheMode_lookup,
+                                 qemu_opt_get(opts, BLOCK_CACHE_OPT_MODE),
+                                 BLOCK_CACHE_MODE_WRITETHROUGH, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        goto out;
+    }
+
+    if (!is_power_of_2(dest->cluster_size) ||
+        dest->cluster_size < BDRV_SECTOR_SIZE ||
+        dest->cluster_size > BLOCK_CACHE_MAX_CLUSTER_SIZE) {
+        error_setg(errp, "cluster-size of block-cache must be a power "
+                   "of two between %llu and %" PRIi64, BDRV_SECTOR_SIZE,
+                   BLOCK_CACHE_MAX_CLUSTER_SIZE);
+        goto out;
+    }
+
+    if (!QEMU_IS_ALIGNED(dest->cluster_size,
+                         child_bs->bl.request_alignment)) {
+        error_setg(errp, "cluster-size of block-cache is not aligned "
+                   "to underlying node request alignment (%" PRIu32 ")",
+                   child_bs->bl.request_alignment);
+        goto out;
+    }
+
+    if (dest->cache_size < dest->cluster_size ||
+        dest->cache_size / dest->cluster_size > INT_MAX) {
+        error_setg(errp, "cache-size of block-cache must hold between "
+                   "1 and %d clusters", INT_MAX);
+        goto out;
+    }
+
+    ret = true;
+out:
+    qemu_opts_del(opts);
+    return ret;
+}
+
+static int block_cache_open(BlockDriverState *bs, QDict *options, int flags,
+                            Error **errp)
+{
+    BDRVBlockCacheState *s = bs->opaque;
+    size_t i;
+    int ret;
+
+    ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (!block_cache_absorb_opts(&s->opts, options, bs->file->bs, errp)) {
+        return -EINVAL;
+    }
+
+    s->nb_entries = s->opts.cache_size / s->opts.cluster_size;
+    s->buf_size = s->nb_entries * s->opts.cluster_size;
+    s->buf = qemu_try_memalign(qemu_real_host_page_size(), s->buf_size);
+    if (!s->buf) {
+        error_setg(errp, "Could not allocate %zu bytes for block-cache",
+                   s->buf_size);
+        return -ENOMEM;
+    }
+    qemu_madvise(s->buf, s->buf_size, QEMU_MADV_HUGEPAGE);
+
+    qemu_co_mutex_init(&s->lock);
+    QLIST_INIT(&s->reqs);
+    QTAILQ_INIT(&s->lru);
+    QTAILQ_INIT(&s->free);
+    s->map = g_hash_table_new(g_int64_hash, g_int64_equal);
+    s->entries = g_new0(BlockCacheEntry, s->nb_entries);
+    for (i = 0; i < s->nb_entries; i++) {
+        s->entries[i].offset = -1;
+        s->entries[i].data = s->buf + i * s->opts.cluster_size;
+        QTAILQ_INSERT_TAIL(&s->free, &s->entries[i], next);
+    }
+
+    bs->supported_write_flags = BDRV_REQ_WRITE_UNCHANGED |
+        (BDRV_REQ_FUA & bs->file->bs->supported_write_flags);
+
+    bs->supported_zero_flags = BDRV_REQ_WRITE_UNCHANGED |
+        ((BDRV_REQ_FUA | BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK) &
+            bs->file->bs->supported_zero_flags);
+
+    return 0;
+}
+
+static void block_cache_close(BlockDriverState *bs)
+{
+    BDRVBlockCacheState *s = bs->opaque;
+
+    /* bdrv_close() flushes before calling us, so this is a failed flush */
+    if (s->nb_dirty) {
+        warn_report("block-cache: dropping %" PRIu64 " dirty clusters that "
+                    "could not be written back", s->nb_dirty);
+    }
+
+    g_hash_table_destroy(s->map);
+    g_free(s->entries);
+    qemu_vfree(s->buf);
+}
+
+/*
+ * The cache is allocated on open and dirty entries would have to be written
+ * back before the policy changes, so options cannot be changed on reopen.
+ */
+static int block_cache_reopen_prepare(BDRVReopenState *reopen_state,
+                                      BlockReopenQueue *queue, Error **errp)
+{
+    BDRVBlockCacheState *s = reopen_state->bs->opaque;
+    BlockCacheOpts opts;
+
+    if (!block_cache_absorb_opts(&opts, reopen_state->options,
+                                 reopen_state->bs->file->bs, errp)) {
+        return -EINVAL;
+    }
+
+    if (opts.cache_size != s->opts.cache_size ||
+        opts.cluster_size != s->opts.cluster_size ||
+        opts.mode != s->opts.mode) {
+        error_setg(errp, "Cannot change block-cache options on reopen");
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+static int64_t block_cache_getlength(BlockDriverState *bs)
+{
+    return bdrv_getlength(bs->file->bs);
+}
+
+/* Called with lock held */
+static BlockCacheEntry *block_cache_find(BDRVBlockCacheState *s,
+                                         int64_t offset)
+{
+    int64_t cluster = QEMU_ALIGN_DOWN(offset, s->opts.cluster_size);
+
+    return g_hash_table_lookup(s->map, &cluster);
+}
+
+/* Called with lock held */
+static void block_cache_touch(BDRVBlockCacheState *s, BlockCacheEntry *e)
+{
+    if (!e->dirty) {
+        QTAILQ_REMOVE(&s->lru, e, next);
+        QTAILQ_INSERT_TAIL(&s->lru, e, next);
+    }
+}
+
+/* Called with lock held */
+static void block_cache_set_dirty(BDRVBlockCacheState *s, BlockCacheEntry *e)
+{
+    if (!e->dirty) {
+        QTAILQ_REMOVE(&s->lru, e, next);
+        e->dirty = true;
+        s->nb_dirty++;
+    }
+}
+
+/* Called with lock held */
+static void block_cache_drop(BDRVBlockCacheState *s, BlockCacheEntry *e)
+{
+    if (e->dirty) {
+        e->dirty = false;
+        s->nb_dirty--;
+    } else {
+        QTAILQ_REMOVE(&s->lru, e, next);
+    }
+    g_hash_table_remove(s->map, &e->offset);
+    e->offset = -1;
+    s->nb_cached--;
+    QTAILQ_INSERT_HEAD(&s->free, e, next);
+}
+
+/*
+ * Get an entry for the cluster at @offset, evicting the least recently used
+ * clean entry if the cache is full.  Returns NULL if all entries are dirty.
+ * Called with lock held.
+ */
+static BlockCacheEntry *block_cache_alloc(BDRVBlockCacheState *s,
+                                          int64_t offset)
+{
+    BlockCacheEntry *e = QTAILQ_FIRST(&s->free);
+
+    if (e) {
+        QTAILQ_REMOVE(&s->free, e, next);
+    } else {
+        e = QTAILQ_FIRST(&s->lru);
+        if (!e) {
+            return NULL;
+        }
+        trace_block_cache_evict(s, e->offset);
+        QTAILQ_REMOVE(&s->lru, e, next);
+        g_hash_table_remove(s->map, &e->offset);
+        s->nb_cached--;
+        s->evictions++;
+    }
+
+    e->offset = offset;
+    g_hash_table_insert(s->map, &e->offset, e);
+    QTAILQ_INSERT_TAIL(&s->lru, e, next);
+    s->nb_cached++;
+
+    return e;
+}
+
+static void coroutine_fn block_cache_lock_range(BDRVBlockCacheState *s,
+                                                BlockReq *req,
+                                                int64_t start, int64_t end)
+{
+    QEMU_LOCK_GUARD(&s->lock);
+    reqlist_wait_all(&s->reqs, start, end - start, &s->lock);
+    reqlist_init_req(&s->reqs, req, start, end - start);
+}
+
+static void coroutine_fn block_cache_lock_request(BDRVBlockCacheState *s,
+                                                  BlockReq *req,
+                                                  int64_t offset,
+                                                  int64_t bytes)
+{
+    block_cache_lock_range(s, req,
+                           QEMU_ALIGN_DOWN(offset, s->opts.cluster_size),
+                           QEMU_ALIGN_UP(offset + bytes,
+                                         s->opts.cluster_size));
+}
+
+static void coroutine_fn block_cache_unlock_range(BDRVBlockCacheState *s,
+                                                  BlockReq *req)
+{
+    QEMU_LOCK_GUARD(&s->lock);
+    reqlist_remove_req(req);
+}
+
+/*
+ * Write a dirty entry back to the child.  The caller must own the range
+ * containing the entry.
+ */
+static int coroutine_fn block_cache_writeback_entry(BlockDriverState *bs,
+                                                    BlockCacheEntry *e)
+{
+    BDRVBlockCacheState *s = bs->opaque;
+    int ret;
+
+    assert(e->dirty);
+
+    trace_block_cache_writeback(s, e->offset);
+    ret = bdrv_co_pwrite(bs->file, e->offset, s->opts.cluster_size, e->data,
+                         0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    QEMU_LOCK_GUARD(&s->lock);
+    e->dirty = false;
+    s->nb_dirty--;
+    s->writebacks++;
+    QTAILQ_INSERT_TAIL(&s->lru, e, next);
+
+    return 0;
+}
+
+/* Write back all dirty entries that intersect [offset, offset + bytes) */
+static int coroutine_fn block_cache_writeback(BlockDriverState *bs,
+                                              int64_t offset, int64_t bytes)
+{
+    BDRVBlockCacheState *s = bs->opaque;
+    size_t i;
+    int ret;
+
+    for (i = 0; i < s->nb_entries && s->nb_dirty; i++) {
+        BlockCacheEntry *e = &s->entries[i];
+        int64_t cluster = e->offset;
+        BlockReq req;
+
+        if (!e->dirty || cluster + s->opts.cluster_size <= offset ||
+            cluster >= offset + bytes) {
+            continue;
+        }
+
+        block_cache_lock_range(s, &req, cluster,
+                               cluster + s->opts.cluster_size);
+        /* The entry may have been written back while we were waiting */
+        ret = e->dirty && e->offset == cluster ?
+            block_cache_writeback_entry(bs, e) : 0;
+        block_cache_unlock_range(s, &req);
+
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Drop all entries for clusters intersecting [offset, offset + bytes).
+ * Dirty entries only partly covered by the range are written back first.
+ * The caller must own the cluster-aligned range.
+ */
+static int coroutine_fn block_cache_invalidate(BlockDriverState *bs,
+                                               int64_t offset, int64_t bytes)
+{
+    BDRVBlockCacheState *s = bs->opaque;
+    int64_t cluster_size = s->opts.cluster_size;
+    size_t i;
+    int ret;
+
+    for (i = 0; i < s->nb_entries; i++) {
+        BlockCacheEntry *e = &s->entries[i];
+
+        if (e->offset < 0 || e->offset + cluster_size <= offset ||
+            e->offset >= offset + bytes) {
+            continue;
+        }
+
+        if (e->dirty &&
+            (e->offset < offset || e->offset + cluster_size > offset + bytes))
+        {
+            ret = block_cache_writeback_entry(bs, e);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+
+        WITH_QEMU_LOCK_GUARD(&s->lock) {
+            /* Clean entries may be reused by others while we yield */
+            if (e->offset >= 0 && e->offset + cluster_size > offset &&
+                e->offset < offset + bytes) {
+                block_cache_drop(s, e);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Copy cached data for [*pos, end) to @qiov, stopping at the first cluster
+ * that is not cached.  On return, *pos is where that cluster's part of the
+ * request starts (or @end), and *miss_end is the start of the next cached
+ * cluster after it (or @end).
+ * Called with lock held.
+ */
+static void block_cache_read_hits(BDRVBlockCacheState *s, int64_t *pos,
+                                  int64_t end, int64_t *miss_end,
+                                  QEMUIOVector *qiov, size_t qiov_offset)
+{
+    int64_t cluster_size = s->opts.cluster_size;
+    int64_t p = *pos;
+    BlockCacheEntry *e;
+
+    while (p < end && (e = block_cache_find(s, p))) {
+        int64_t cluster = QEMU_ALIGN_DOWN(p, cluster_size);
+        int64_t n = MIN(cluster + cluster_size, end) - p;
+
+        qemu_iovec_from_buf(qiov, qiov_offset + p, e->data + (p - cluster), n);
+        block_cache_touch(s, e);
+        s->read_hit_bytes += n;
+        p += n;
+    }
+    *pos = p;
+
+    while (p < end && !block_cache_find(s, p)) {
+        p = MIN(QEMU_ALIGN_DOWN(p, cluster_size) + cluster_size, end);
+    }
+    *miss_end = p;
+}
+
+/*
+ * Insert the clusters fully covered by [start, end), which were just read
+ * from the child into @qiov.  Called with lock held.
+ */
+static void block_cache_fill(BDRVBlockCacheState *s, int64_t start,
+                             int64_t end, QEMUIOVector *qiov,
+                             size_t qiov_offset)
+{
+    int64_t cluster_size = s->opts.cluster_size;
+    int64_t first = QEMU_ALIGN_UP(start, cluster_size);
+    int64_t last = QEMU_ALIGN_DOWN(end, cluster_size);
+    int64_t cluster;
+
+    /*
+     * Do not let a single large sequential read (e.g. a backup job reading
+     * the whole disk) wipe out the working set.
+     */
+    if (last - first > s->buf_size / 4) {
+        return;
+    }
+
+    for (cluster = first; cluster < last; cluster += cluster_size) {
+        BlockCacheEntry *e = block_cache_alloc(s, cluster);
+
+        if (!e) {
+            break;
+        }
+        qemu_iovec_to_buf(qiov, qiov_offset + cluster, e->data, cluster_size);
+    }
+}
+
+static int coroutine_fn
+block_cache_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                           QEMUIOVector *qiov, size_t qiov_offset,
+                           BdrvRequestFlags flags)
+{
+    BDRVBlockCacheState *s = bs->opaque;
+    int64_t pos = offset, end = offset + bytes;
+    /* Offsets into @qiov are computed by adding disk offsets to this */
+    size_t qoff = qiov_offset - offset;
+    BlockReq req;
+    int ret = 0;
+
+    block_cache_lock_request(s, &req, offset, bytes);
+
+    while (pos < end) {
+        int64_t miss_end;
+
+        WITH_QEMU_LOCK_GUARD(&s->lock) {
+            block_cache_read_hits(s, &pos, end, &miss_end, qiov, qoff);
+        }
+        if (pos == end) {
+            break;
+        }
+
+        ret = bdrv_co_preadv_part(bs->file, pos, miss_end - pos, qiov,
+                                  qoff + pos, flags);
+        if (ret < 0) {
+            break;
+        }
+
+        WITH_QEMU_LOCK_GUARD(&s->lock) {
+            s->read_miss_bytes += miss_end - pos;
+            block_cache_fill(s, pos, miss_end, qiov, qoff);
+        }
+        pos = miss_end;
+    }
+
+    block_cache_unlock_range(s, &req);
+    return ret;
+}
+
+/*
+ * Update cached clusters with the data just written to the child for
+ * [offset, offset + bytes).  Called with lock held.
+ */
+static void block_cache_update(BDRVBlockCacheState *s, int64_t offset,
+                               int64_t bytes, QEMUIOVector *qiov,
+                               size_t qiov_offset)
+{
+    int64_t cluster_size = s->opts.cluster_size;
+    int64_t pos = offset, end = offset + bytes;
+
+    while (pos < end) {
+        int64_t cluster = QEMU_ALIGN_DOWN(pos, cluster_size);
+        int64_t n = MIN(cluster + cluster_size, end) - pos;
+        BlockCacheEntry *e = block_cache_find(s, pos);
+
+        if (e) {
+            qemu_iovec_to_buf(qiov, qiov_offset + (pos - offset),
+                              e->data + (pos - cluster), n);
+            block_cache_touch(s, e);
+        }
+        pos += n;
+    }
+}
+
+/*
+ * Writeback mode: copy the data for [offset, offset + bytes) into dirty
+ * entries.  Cached clusters are updated in place and uncached clusters are
+ * allocated if the write covers them fully.  Stops at the first cluster that
+ * cannot be absorbed; *pnum is then set to the length of the following run
+ * of such clusters, which must be written to the child.
+ *
+ * Returns the number of bytes absorbed.  Called with lock held.
+ */
+static int64_t block_cache_absorb(BDRVBlockCacheState *s, int64_t offset,
+                                  int64_t bytes, QEMUIOVector *qiov,
+                                  size_t qiov_offset, int64_t *pnum)
+{
+    int64_t cluster_size = s->opts.cluster_size;
+    int64_t pos = offset, end = offset + bytes;
+    int64_t absorbed = -1;
+
+    while (pos < end) {
+        int64_t cluster = QEMU_ALIGN_DOWN(pos, cluster_size);
+        int64_t n = MIN(cluster + cluster_size, end) - pos;
+        BlockCacheEntry *e = block_cache_find(s, pos);
+        bool can_absorb = e || (n == cluster_size &&
+                                (!QTAILQ_EMPTY(&s->free) ||
+                                 !QTAILQ_EMPTY(&s->lru)));
+
+        if (absorbed >= 0) {
+            /* Collecting the run to write through */
+            if (can_absorb) {
+                break;
+            }
+        } else if (!can_absorb) {
+            absorbed = pos - offset;
+        } else {
+            if (!e) {
+                e = block_cache_alloc(s, cluster);
+            }
+            qemu_iovec_to_buf(qiov, qiov_offset + (pos - offset),
+                              e->data + (pos - cluster), n);
+            block_cache_set_dirty(s, e);
+        }
+        pos += n;
+    }
+
+    if (absorbed < 0) {
+        *pnum = 0;
+        return pos - offset;
+    }
+
+    *pnum = pos - offset - absorbed;
+    return absorbed;
+}
+
+static int coroutine_fn
+block_cache_co_pwritev_part(BlockDriverState *bs, int64_t offset,
+                            int64_t bytes, QEMUIOVector *qiov,
+                            size_t qiov_offset, BdrvRequestFlags flags)
+{
+    BDRVBlockCacheState *s = bs->opaque;
+    BlockReq req;
+    int ret = 0;
+
+    block_cache_lock_request(s, &req, offset, bytes);
+
+    if (s->opts.mode == BLOCK_CACHE_MODE_WRITETHROUGH ||
+        (flags & BDRV_REQ_FUA))
+    {
+        ret = bdrv_co_pwritev_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                   flags);
+        if (ret < 0) {
+            /*
+             * The child's content is undefined now, don't keep stale data.
+             * Failing to drop it is the worse error, so that one wins.
+             */
+            ret = block_cache_invalidate(bs, offset, bytes) ?: ret;
+        } else {
+            WITH_QEMU_LOCK_GUARD(&s->lock) {
+                block_cache_update(s, offset, bytes, qiov, qiov_offset);
+            }
+        }
+        goto out;
+    }
+
+    while (bytes) {
+        int64_t absorbed, num;
+
+        WITH_QEMU_LOCK_GUARD(&s->lock) {
+            absorbed = block_cache_absorb(s, offset, bytes, qiov, qiov_offset,
+                                          &num);
+        }
+        offset += absorbed;
+        qiov_offset += absorbed;
+        bytes -= absorbed;
+
+        if (num) {
+            ret = bdrv_co_pwritev_part(bs->file, offset, num, qiov,
+                                       qiov_offset, flags);
+            if (ret < 0) {
+                break;
+            }
+            offset += num;
+            qiov_offset += num;
+            bytes -= num;
+        }
+    }
+
+out:
+    block_cache_unlock_range(s, &req);
+    return ret;
+}
+
+static int coroutine_fn block_cache_co_pwrite_zeroes(BlockDriverState *bs,
+                                                     int64_t offset,
+                                                     int64_t bytes,
+                                                     BdrvRequestFlags flags)
+{
+    BDRVBlockCacheState *s = bs->opaque;
+    BlockReq req;
+    int ret;
+
+    block_cache_lock_request(s, &req, offset, bytes);
+    ret = block_cache_invalidate(bs, offset, bytes);
+    if (ret == 0) {
+        ret = bdrv_co_pwrite_zeroes(bs->file, offset, bytes, flags);
+    }
+    block_cache_unlock_range(s, &req);
+
+    return ret;
+}
+
+static int coroutine_fn block_cache_co_pdiscard(BlockDriverState *bs,
+                                                int64_t offset, int64_t bytes)
+{
+    BDRVBlockCacheState *s = bs->opaque;
+    BlockReq req;
+    int ret;
+
+    block_cache_lock_request(s, &req, offset, bytes);
+    ret = block_cache_invalidate(bs, offset, bytes);
+    if (ret == 0) {
+        ret = bdrv_co_pdiscard(bs->file, offset, bytes);
+    }
+    block_cache_unlock_range(s, &req);
+
+    return ret;
+}
+
+static int coroutine_fn block_cache_co_flush(BlockDriverState *bs)
+{
+    int ret = block_cache_writeback(bs, 0, INT64_MAX);
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    return bdrv_co_flush(bs->file->bs);
+}
+
+static int coroutine_fn
+block_cache_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
+                        PreallocMode prealloc, BdrvRequestFlags flags,
+                        Error **errp)
+{
+    BDRVBlockCacheState *s = bs->opaque;
+    BlockReq req;
+    size_t i;
+    int ret = 0;
+
+    block_cache_lock_range(s, &req, 0, INT64_MAX);
+    for (i = 0; i < s->nb_entries && s->nb_dirty; i++) {
+        if (s->entries[i].dirty) {
+            ret = block_cache_writeback_entry(bs, &s->entries[i]);
+            if (ret < 0) {
+                goto out;
+            }
+        }
+    }
+    ret = block_cache_invalidate(bs, 0, INT64_MAX);
+
+out:
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to write back block-cache");
+    } else {
+        ret = bdrv_co_truncate(bs->file, offset, exact, prealloc, flags,
+                               errp);
+    }
+    block_cache_unlock_range(s, &req);
+
+    return ret;
+}
+
+static int coroutine_fn block_cache_co_block_status(BlockDriverState *bs,
+                                                     bool want_zero,
+                                                     int64_t offset,
+                                                     int64_t bytes,
+                                                     int64_t *pnum,
+                                                     int64_t *map,
+                                                     BlockDriverState **file)
+{
+    /* The child's status is only accurate once it has seen our dirty data */
+    int ret = block_cache_writeback(bs, offset, bytes);
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    *pnum = bytes;
+    *map = offset;
+    *file = bs->file->bs;
+    return BDRV_BLOCK_RAW | BDRV_BLOCK_OFFSET_VALID;
+}
+
+static BlockStatsSpecific *block_cache_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+    BDRVBlockCacheState *s = bs->opaque;
+
+    stats->driver = BLOCKDEV_DRIVER_BLOCK_CACHE;
+    stats->u.block_cache = (BlockStatsSpecificBlockCache) {
+        .read_hit_bytes = s->read_hit_bytes,
+        .read_miss_bytes = s->read_miss_bytes,
+        .evictions = s->evictions,
+        .writebacks = s->writebacks,
+        .cached_bytes = s->nb_cached * s->opts.cluster_size,
+        .dirty_bytes = s->nb_dirty * s->opts.cluster_size,
+    };
+
+    return stats;
+}
+
+static void block_cache_child_perm(BlockDriverState *bs, BdrvChild *c,
+                                   BdrvChildRole role,
+                                   BlockReopenQueue *reopen_queue,
+                                   uint64_t perm, uint64_t shared,
+                                   uint64_t *nperm, uint64_t *nshared)
+{
+    bdrv_default_perms(bs, c, role, reopen_queue, perm, shared, nperm, nshared);
+
+    /* Writes that bypass us would leave stale data in the cache */
+    *nshared &= ~(BLK_PERM_WRITE | BLK_PERM_RESIZE);
+}
+
+BlockDriver bdrv_block_cache = {
+    .format_name = "block-cache",
+    .instance_size = sizeof(BDRVBlockCacheState),
+
+    .bdrv_open = block_cache_open,
+    .bdrv_close = block_cache_close,
+    .bdrv_getlength = block_cache_getlength,
+    .bdrv_reopen_prepare = block_cache_reopen_prepare,
+
+    .bdrv_co_preadv_part = block_cache_co_preadv_part,
+    .bdrv_co_pwritev_part = block_cache_co_pwritev_part,
+    .bdrv_co_pwrite_zeroes = block_cache_co_pwrite_zeroes,
+    .bdrv_co_pdiscard = block_cache_co_pdiscard,
+    .bdrv_co_flush = block_cache_co_flush,
+    .bdrv_co_truncate = block_cache_co_truncate,
+    .bdrv_co_block_status = block_cache_co_block_status,
+
+    .bdrv_get_specific_stats = block_cache_get_specific_stats,
+    .bdrv_child_perm = block_cache_child_perm,
+
+    .has_variable_length = true,
+};
+
+static void bdrv_block_cache_init(void)
+{
+    bdrv_register(&bdrv_block_cache);
+}
+
+block_init(bdrv_block_cache_init);
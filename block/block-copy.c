@@ -24,6 +24,7 @@
 #include "block/aio_task.h"
 #include "qemu/error-report.h"
 #include "qemu/memalign.h"
+#include "qemu/cutils.h"
 
 #define BLOCK_COPY_MAX_COPY_RANGE (16 * MiB)
 #define BLOCK_COPY_MAX_BUFFER (1 * MiB)
@@ -125,6 +126,11 @@ typedef struct BlockCopyState {
     int64_t max_transfer;
     uint64_t len;
     BdrvRequestFlags write_flags;
+    /*
+     * skip_identical: read the target before writing and skip the write
+     * when it already holds the same data; write zeroes for all-zero data.
+     */
+    bool skip_identical;
 
     /*
      * Fields whose state changes throughout the execution
@@ -278,11 +284,12 @@ static uint32_t block_copy_max_transfer(BdrvChild *source, BdrvChild *target)
 }
 
 void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
-                              bool compress)
+                              bool compress, bool skip_identical)
 {
     /* Keep BDRV_REQ_SERIALISING set (or not set) in block_copy_state_new() */
     s->write_flags = (s->write_flags & BDRV_REQ_SERIALISING) |
         (compress ? BDRV_REQ_WRITE_COMPRESSED : 0);
+    s->skip_identical = skip_identical;
 
     if (s->max_transfer < s->cluster_size) {
         /*
@@ -295,6 +302,9 @@ void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
     } else if (compress) {
         /* Compression supports only cluster-size writes and no copy-range. */
         s->method = COPY_READ_WRITE_CLUSTER;
+    } else if (skip_identical) {
+        /* Data must pass through our buffer to be compared against target */
+        s->method = COPY_READ_WRITE;
     } else {
         /*
          * If copy range enabled, start with COPY_RANGE_SMALL, until first
@@ -304,6 +314,26 @@ void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
     }
 }
 
+bool block_copy_check_skip_identical(BlockDriverState *source,
+                                     BlockDriverState *target, Error **errp)
+{
+    GLOBAL_STATE_CODE();
+
+    /*
+     * If reading the target falls through to the source, as it does for a
+     * fleecing image backed by the source, the target always looks
+     * identical and the old data would never be copied.
+     */
+    if (bdrv_chain_contains(target, bdrv_skip_filters(source))) {
+        error_setg(errp, "skip-identical cannot be used when target '%s' "
+                   "reads through to source '%s'",
+                   bdrv_get_node_name(target), bdrv_get_node_name(source));
+        return false;
+    }
+
+    return true;
+}
+
 static int64_t block_copy_calculate_cluster_size(BlockDriverState *target,
                                                  Error **errp)
 {
@@ -404,7 +434,7 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
                                     cluster_size),
     };
 
-    block_copy_set_copy_opts(s, false, false);
+    block_copy_set_copy_opts(s, false, false, false);
 
     ratelimit_init(&s->rate_limit);
     qemu_co_mutex_init(&s->lock);
@@ -452,6 +482,36 @@ static coroutine_fn int block_copy_task_run(AioTaskPool *pool,
     return 0;
 }
 
+/*
+ * block_copy_target_is_identical
+ *
+ * Check whether the target already holds @nbytes of @buf at @offset.
+ * Errors reading the target are not fatal: the data is simply written.
+ */
+static bool coroutine_fn block_copy_target_is_identical(BlockCopyState *s,
+                                                        int64_t offset,
+                                                        int64_t nbytes,
+                                                        void *buf)
+{
+    void *target_buf = qemu_try_blockalign(s->target->bs, nbytes);
+    bool identical = false;
+    int ret;
+
+    if (!target_buf) {
+        return false;
+    }
+
+    ret = bdrv_co_pread(s->target, offset, nbytes, target_buf, 0);
+    if (ret < 0) {
+        trace_block_copy_target_read_fail(s, offset, ret);
+    } else {
+        identical = !memcmp(buf, target_buf, nbytes);
+    }
+
+    qemu_vfree(target_buf);
+    return identical;
+}
+
 /*
  * block_copy_do_copy
  *
@@ -527,6 +587,25 @@ static int coroutine_fn block_copy_do_copy(BlockCopyState *s,
             goto out;
         }
 
+        if (s->skip_identical) {
+            if (buffer_is_zero(bounce_buffer, nbytes)) {
+                trace_block_copy_detect_zeroes(s, offset, nbytes);
+                ret = bdrv_co_pwrite_zeroes(s->target, offset, nbytes,
+                                            s->write_flags &
+                                            ~BDRV_REQ_WRITE_COMPRESSED);
+                if (ret < 0) {
+                    trace_block_copy_write_zeroes_fail(s, offset, ret);
+                    *error_is_read = false;
+                }
+                goto out;
+            }
+            if (block_copy_target_is_identical(s, offset, nbytes,
+                                               bounce_buffer)) {
+                trace_block_copy_skip_identical(s, offset, nbytes);
+                goto out;
+            }
+        }
+
         ret = bdrv_co_pwrite(s->target, offset, nbytes, bounce_buffer,
                              s->write_flags);
         if (ret < 0) {
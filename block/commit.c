@@ -25,9 +25,9 @@
 
 enum {
     /*
-     * Size of data buffer for populating the image file.  This should be large
-     * enough to process multiple clusters in a single call, so that populating
-     * contiguous regions of the image is efficient.
+     * Default size of data buffer for populating the image file.  This should
+     * be large enough to process multiple clusters in a single call, so that
+     * populating contiguous regions of the image is efficient.
      */
     COMMIT_BUFFER_SIZE = 512 * 1024, /* in bytes */
 };
@@ -43,6 +43,9 @@ typedef struct CommitBlockJob {
     bool base_read_only;
     bool chain_frozen;
     char *backing_file_str;
+    int max_workers;
+    int64_t max_chunk;
+    BlockJobChunks chunks;
 } CommitBlockJob;
 
 static int commit_prepare(Job *job)
@@ -113,6 +116,24 @@ static void commit_clean(Job *job)
     blk_unref(s->top);
 }
 
+static int coroutine_fn commit_chunk(BlockJobChunks *chunks, int64_t offset,
+                                     int64_t bytes, bool *error_in_source)
+{
+    CommitBlockJob *s = container_of(chunks, CommitBlockJob, chunks);
+    QEMU_AUTO_VFREE void *buf = blk_blockalign(s->top, bytes);
+    int ret;
+
+    ret = blk_co_pread(s->top, offset, bytes, buf, 0);
+    if (ret >= 0) {
+        ret = blk_co_pwrite(s->base, offset, bytes, buf, 0);
+        if (ret < 0) {
+            *error_in_source = false;
+        }
+    }
+
+    return ret;
+}
+
 static int coroutine_fn commit_run(Job *job, Error **errp)
 {
     CommitBlockJob *s = container_of(job, CommitBlockJob, common.job);
@@ -120,7 +141,6 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
     uint64_t delay_ns = 0;
     int ret = 0;
     int64_t n = 0; /* bytes */
-    QEMU_AUTO_VFREE void *buf = NULL;
     int64_t len, base_len;
 
     len = blk_getlength(s->top);
@@ -141,33 +161,45 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
         }
     }
 
-    buf = blk_blockalign(s->top, COMMIT_BUFFER_SIZE);
+    block_job_chunks_init(&s->chunks, &s->common, s->max_workers,
+                          commit_chunk);
 
-    for (offset = 0; offset < len; offset += n) {
-        bool copy;
+    for (offset = 0; ; offset += n) {
+        bool copy = false;
         bool error_in_source = true;
 
-        /* Note that even when no rate limit is applied we need to yield
-         * with no pending I/O here so that bdrv_drain_all() returns.
+        /* Wait for the last chunks, failed ones are handled below */
+        if (offset >= len && block_job_chunks_wait(&s->chunks) == 0) {
+            ret = 0;
+            break;
+        }
+
+        /*
+         * Yield even when no rate limit is applied, so that the job can be
+         * paused.  Chunks may still be in flight: they are requests on the
+         * nodes, so bdrv_drain_all() waits for them to complete.
          */
         job_sleep_ns(&s->common.job, delay_ns);
         if (job_is_cancelled(&s->common.job)) {
+            ret = 0;
             break;
         }
-        /* Copy if allocated above the base */
-        ret = bdrv_is_allocated_above(blk_bs(s->top), s->base_overlay, true,
-                                      offset, COMMIT_BUFFER_SIZE, &n);
-        copy = (ret > 0);
-        trace_commit_one_iteration(s, offset, n, ret);
-        if (copy) {
-            assert(n < SIZE_MAX);
-
-            ret = blk_co_pread(s->top, offset, n, buf, 0);
-            if (ret >= 0) {
-                ret = blk_co_pwrite(s->base, offset, n, buf, 0);
-                if (ret < 0) {
-                    error_in_source = false;
-                }
+
+        /*
+         * Chunks after a failed one that succeeded are copied again, which
+         * is harmless.
+         */
+        ret = block_job_chunks_rewind(&s->chunks, &offset, &n,
+                                      &error_in_source);
+        if (ret == 0) {
+            /* Copy if allocated above the base */
+            ret = bdrv_is_allocated_above(blk_bs(s->top), s->base_overlay,
+                                          true, offset, s->max_chunk, &n);
+            copy = (ret > 0);
+            trace_commit_one_iteration(s, offset, n, ret);
+            if (copy) {
+                assert(n < SIZE_MAX);
+                block_job_chunks_start(&s->chunks, offset, n);
             }
         }
         if (ret < 0) {
@@ -175,23 +207,25 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
                 block_job_error_action(&s->common, s->on_error,
                                        error_in_source, -ret);
             if (action == BLOCK_ERROR_ACTION_REPORT) {
-                return ret;
+                break;
             } else {
                 n = 0;
                 continue;
             }
         }
-        /* Publish progress */
-        job_progress_update(&s->common.job, n);
 
+        /* Publish progress, copied chunks do that on completion */
         if (copy) {
             delay_ns = block_job_ratelimit_get_delay(&s->common, n);
         } else {
+            job_progress_update(&s->common.job, n);
             delay_ns = 0;
         }
     }
 
-    return 0;
+    block_job_chunks_cleanup(&s->chunks);
+
+    return ret;
 }
 
 static const BlockJobDriver commit_job_driver = {
@@ -245,7 +279,8 @@ void commit_start(const char *job_id, BlockDriverState *bs,
                   BlockDriverState *base, BlockDriverState *top,
                   int creation_flags, int64_t speed,
                   BlockdevOnError on_error, const char *backing_file_str,
-                  const char *filter_node_name, Error **errp)
+                  const char *filter_node_name, const BlockJobPerf *perf,
+                  Error **errp)
 {
     CommitBlockJob *s;
     BlockDriverState *iter;
@@ -253,11 +288,18 @@ void commit_start(const char *job_id, BlockDriverState *bs,
     BlockDriverState *filtered_base;
     int64_t base_size, top_size;
     uint64_t base_perms, iter_shared_perms;
+    int max_workers = 1;
+    int64_t max_chunk = COMMIT_BUFFER_SIZE;
     int ret;
 
     GLOBAL_STATE_CODE();
 
     assert(top != bs);
+
+    if (!block_job_parse_perf(perf, &max_workers, &max_chunk, errp)) {
+        return;
+    }
+
     if (bdrv_skip_filters(top) == bdrv_skip_filters(base)) {
         error_setg(errp, "Invalid files for merge: top and base are the same");
         return;
@@ -392,6 +434,8 @@ void commit_start(const char *job_id, BlockDriverState *bs,
 
     s->backing_file_str = g_strdup(backing_file_str);
     s->on_error = on_error;
+    s->max_workers = max_workers;
+    s->max_chunk = max_chunk;
 
     trace_commit_start(bs, base, top, s);
     job_start(&s->common.job);
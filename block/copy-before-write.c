@@ -396,6 +396,7 @@ static BlockdevOptions *cbw_parse_options(QDict *options, Error **errp)
     qdict_extract_subqdict(options, NULL, "bitmap");
     qdict_del(options, "on-cbw-error");
     qdict_del(options, "cbw-timeout");
+    qdict_del(options, "skip-identical");
 
 out:
     visit_free(v);
@@ -451,11 +452,17 @@ static int cbw_open(BlockDriverState *bs, QDict *options, int flags,
             ((BDRV_REQ_FUA | BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK) &
              bs->file->bs->supported_zero_flags);
 
+    if (opts->skip_identical &&
+        !block_copy_check_skip_identical(bs->file->bs, s->target->bs, errp)) {
+        return -EINVAL;
+    }
+
     s->bcs = block_copy_state_new(bs->file, s->target, bitmap, errp);
     if (!s->bcs) {
         error_prepend(errp, "Cannot create block-copy-state: ");
         return -EINVAL;
     }
+    block_copy_set_copy_opts(s->bcs, false, false, opts->skip_identical);
 
     cluster_size = block_copy_cluster_size(s->bcs);
 
@@ -39,18 +39,59 @@ typedef struct VduseBlkReq {
     VduseVirtq *vq;
 } VduseBlkReq;
 
+/* Requests are counted from the AioContexts of all virtqueues */
 static void vduse_blk_inflight_inc(VduseBlkExport *vblk_exp)
 {
-    vblk_exp->inflight++;
+    qatomic_inc(&vblk_exp->inflight);
 }
 
 static void vduse_blk_inflight_dec(VduseBlkExport *vblk_exp)
 {
-    if (--vblk_exp->inflight == 0) {
+    if (qatomic_fetch_dec(&vblk_exp->inflight) == 1) {
         aio_wait_kick();
     }
 }
 
+static AioContext *vduse_blk_queue_ctx(VduseBlkExport *vblk_exp, int index)
+{
+    return virtio_blk_handler_queue_ctx(&vblk_exp->handler, index) ?:
+           vblk_exp->export.ctx;
+}
+
+static AioContext *vduse_blk_vq_ctx(VduseBlkExport *vblk_exp, VduseVirtq *vq)
+{
+    int i;
+
+    for (i = 0; i < vblk_exp->num_queues; i++) {
+        if (vduse_dev_get_queue(vblk_exp->dev, i) == vq) {
+            break;
+        }
+    }
+    return vduse_blk_queue_ctx(vblk_exp, i);
+}
+
+/*
+ * libvduse is not thread-safe, so the device handler excludes the
+ * virtqueues that are processed in IOThreads.
+ */
+static void vduse_blk_lock_queues(VduseBlkExport *vblk_exp)
+{
+    unsigned int i;
+
+    for (i = 0; i < vblk_exp->handler.num_iothreads; i++) {
+        aio_context_acquire(vblk_exp->handler.queue_ctx[i]);
+    }
+}
+
+static void vduse_blk_unlock_queues(VduseBlkExport *vblk_exp)
+{
+    unsigned int i;
+
+    for (i = vblk_exp->handler.num_iothreads; i-- > 0; ) {
+        aio_context_release(vblk_exp->handler.queue_ctx[i]);
+    }
+}
+
 static void vduse_blk_req_complete(VduseBlkReq *req, size_t in_len)
 {
     vduse_queue_push(req->vq, &req->elem, in_len);
@@ -77,10 +118,9 @@ static void coroutine_fn vduse_blk_virtio_process_req(void *opaque)
                                     out_iov, in_num, out_num);
     if (in_len < 0) {
         free(req);
-        return;
+    } else {
+        vduse_blk_req_complete(req, in_len);
     }
-
-    vduse_blk_req_complete(req, in_len);
     vduse_blk_inflight_dec(vblk_exp);
 }
 
@@ -109,6 +149,8 @@ static void on_vduse_vq_kick(void *opaque)
 {
     VduseVirtq *vq = opaque;
     VduseDev *dev = vduse_queue_get_dev(vq);
+    VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
+    AioContext *ctx = NULL;
     int fd = vduse_queue_get_fd(vq);
     eventfd_t kick_data;
 
@@ -117,14 +159,22 @@ static void on_vduse_vq_kick(void *opaque)
         return;
     }
 
+    /* Queues in IOThreads are protected by the AioContext lock */
+    if (vblk_exp->handler.num_iothreads) {
+        ctx = qemu_get_current_aio_context();
+        aio_context_acquire(ctx);
+    }
     vduse_blk_vq_handler(dev, vq);
+    if (ctx) {
+        aio_context_release(ctx);
+    }
 }
 
 static void vduse_blk_enable_queue(VduseDev *dev, VduseVirtq *vq)
 {
     VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
 
-    aio_set_fd_handler(vblk_exp->export.ctx, vduse_queue_get_fd(vq),
+    aio_set_fd_handler(vduse_blk_vq_ctx(vblk_exp, vq), vduse_queue_get_fd(vq),
                        true, on_vduse_vq_kick, NULL, NULL, NULL, vq);
     /* Make sure we don't miss any kick afer reconnecting */
     eventfd_write(vduse_queue_get_fd(vq), 1);
@@ -134,7 +184,7 @@ static void vduse_blk_disable_queue(VduseDev *dev, VduseVirtq *vq)
 {
     VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
 
-    aio_set_fd_handler(vblk_exp->export.ctx, vduse_queue_get_fd(vq),
+    aio_set_fd_handler(vduse_blk_vq_ctx(vblk_exp, vq), vduse_queue_get_fd(vq),
                        true, NULL, NULL, NULL, NULL, NULL);
 }
 
@@ -146,8 +196,11 @@ static const VduseOps vduse_blk_ops = {
 static void on_vduse_dev_kick(void *opaque)
 {
     VduseDev *dev = opaque;
+    VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
 
+    vduse_blk_lock_queues(vblk_exp);
     vduse_dev_handler(dev);
+    vduse_blk_unlock_queues(vblk_exp);
 }
 
 static void vduse_blk_attach_ctx(VduseBlkExport *vblk_exp, AioContext *ctx)
@@ -165,7 +218,7 @@ static void vduse_blk_attach_ctx(VduseBlkExport *vblk_exp, AioContext *ctx)
         if (fd < 0) {
             continue;
         }
-        aio_set_fd_handler(vblk_exp->export.ctx, fd, true,
+        aio_set_fd_handler(vduse_blk_queue_ctx(vblk_exp, i), fd, true,
                            on_vduse_vq_kick, NULL, NULL, NULL, vq);
     }
 }
@@ -181,13 +234,13 @@ static void vduse_blk_detach_ctx(VduseBlkExport *vblk_exp)
         if (fd < 0) {
             continue;
         }
-        aio_set_fd_handler(vblk_exp->export.ctx, fd,
+        aio_set_fd_handler(vduse_blk_queue_ctx(vblk_exp, i), fd,
                            true, NULL, NULL, NULL, NULL, NULL);
     }
     aio_set_fd_handler(vblk_exp->export.ctx, vduse_dev_get_fd(vblk_exp->dev),
                        true, NULL, NULL, NULL, NULL, NULL);
 
-    AIO_WAIT_WHILE(vblk_exp->export.ctx, vblk_exp->inflight > 0);
+    AIO_WAIT_WHILE(vblk_exp->export.ctx, qatomic_read(&vblk_exp->inflight) > 0);
 }
 
 
@@ -269,6 +322,11 @@ static int vduse_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
                                         vblk_opts->serial : "");
     vblk_exp->handler.logical_block_size = logical_block_size;
     vblk_exp->handler.writable = opts->writable;
+    if (!virtio_blk_handler_set_iothreads(&vblk_exp->handler,
+                                          vblk_opts->queue_iothreads, errp)) {
+        ret = -EINVAL;
+        goto err_dev;
+    }
 
     config.capacity =
             cpu_to_le64(blk_getlength(exp->blk) >> VIRTIO_BLK_SECTOR_BITS);
@@ -336,6 +394,7 @@ err:
     vduse_dev_destroy(vblk_exp->dev);
     g_free(vblk_exp->recon_file);
 err_dev:
+    virtio_blk_handler_release_iothreads(&vblk_exp->handler);
     g_free(vblk_exp->handler.serial);
     return ret;
 }
@@ -353,6 +412,7 @@ static void vduse_blk_exp_delete(BlockExport *exp)
         unlink(vblk_exp->recon_file);
     }
     g_free(vblk_exp->recon_file);
+    virtio_blk_handler_release_iothreads(&vblk_exp->handler);
     g_free(vblk_exp->handler.serial);
 }
 
@@ -285,6 +285,11 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
     vexp->handler.serial = g_strdup("vhost_user_blk");
     vexp->handler.logical_block_size = logical_block_size;
     vexp->handler.writable = opts->writable;
+    if (!virtio_blk_handler_set_iothreads(&vexp->handler,
+                                          vu_opts->queue_iothreads, errp)) {
+        g_free(vexp->handler.serial);
+        return -EINVAL;
+    }
 
     vu_blk_initialize_config(blk_bs(exp->blk), &vexp->blkcfg,
                              logical_block_size, num_queues);
@@ -296,9 +301,13 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
                                  num_queues, &vu_blk_iface, errp)) {
         blk_remove_aio_context_notifier(exp->blk, blk_aio_attached,
                                         blk_aio_detach, vexp);
+        virtio_blk_handler_release_iothreads(&vexp->handler);
         g_free(vexp->handler.serial);
         return -EADDRNOTAVAIL;
     }
+    vhost_user_server_set_queue_aio_contexts(&vexp->vu_server,
+                                             vexp->handler.queue_ctx,
+                                             vexp->handler.num_iothreads);
 
     return 0;
 }
@@ -309,6 +318,7 @@ static void vu_blk_exp_delete(BlockExport *exp)
 
     blk_remove_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
                                     vexp);
+    virtio_blk_handler_release_iothreads(&vexp->handler);
     g_free(vexp->handler.serial);
 }
 
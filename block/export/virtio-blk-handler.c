@@ -14,6 +14,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/error-report.h"
+#include "qapi/error.h"
 #include "virtio-blk-handler.h"
 
 #include "standard-headers/linux/virtio_blk.h"
@@ -128,11 +129,10 @@ virtio_blk_discard_write_zeroes(VirtioBlkHandler *handler, struct iovec *iov,
     return VIRTIO_BLK_S_IOERR;
 }
 
-int coroutine_fn virtio_blk_process_req(VirtioBlkHandler *handler,
-                                        struct iovec *in_iov,
-                                        struct iovec *out_iov,
-                                        unsigned int in_num,
-                                        unsigned int out_num)
+static int coroutine_fn
+virtio_blk_do_process_req(VirtioBlkHandler *handler, struct iovec *in_iov,
+                          struct iovec *out_iov, unsigned int in_num,
+                          unsigned int out_num)
 {
     BlockBackend *blk = handler->blk;
     struct virtio_blk_inhdr *in;
@@ -238,3 +238,94 @@ int coroutine_fn virtio_blk_process_req(VirtioBlkHandler *handler,
 
     return in_len;
 }
+
+/*
+ * Requests may come from virtqueues that are processed in other IOThreads
+ * than the one of the BlockBackend, see virtio_blk_handler_queue_ctx().
+ * The I/O is always submitted from the AioContext of the BlockBackend and
+ * the coroutine then goes back to the virtqueue's AioContext, so that the
+ * caller completes the request there.
+ *
+ * While the coroutine moves between AioContexts, the request is counted as
+ * in flight so that drain, and thus an AioContext change of the
+ * BlockBackend, waits for it.  The count is dropped for the I/O itself,
+ * because requests queued by blk_wait_while_drained() must not hold up the
+ * drain that queued them.
+ */
+int coroutine_fn virtio_blk_process_req(VirtioBlkHandler *handler,
+                                        struct iovec *in_iov,
+                                        struct iovec *out_iov,
+                                        unsigned int in_num,
+                                        unsigned int out_num)
+{
+    BlockBackend *blk = handler->blk;
+    AioContext *queue_ctx = qemu_get_current_aio_context();
+    int in_len;
+
+    blk_inc_in_flight(blk);
+    aio_co_reschedule_self(blk_get_aio_context(blk));
+    blk_dec_in_flight(blk);
+
+    in_len = virtio_blk_do_process_req(handler, in_iov, out_iov,
+                                       in_num, out_num);
+
+    blk_inc_in_flight(blk);
+    aio_co_reschedule_self(queue_ctx);
+    blk_dec_in_flight(blk);
+
+    return in_len;
+}
+
+bool virtio_blk_handler_set_iothreads(VirtioBlkHandler *handler,
+                                      strList *ids, Error **errp)
+{
+    unsigned int n = 0;
+    strList *e;
+
+    for (e = ids; e; e = e->next) {
+        n++;
+    }
+    if (!n) {
+        return true;
+    }
+
+    handler->iothreads = g_new0(IOThread *, n);
+    handler->queue_ctx = g_new0(AioContext *, n);
+    for (e = ids; e; e = e->next) {
+        IOThread *iothread = iothread_by_id(e->value);
+
+        if (!iothread) {
+            error_setg(errp, "iothread \"%s\" not found", e->value);
+            virtio_blk_handler_release_iothreads(handler);
+            return false;
+        }
+        object_ref(OBJECT(iothread));
+        handler->iothreads[handler->num_iothreads] = iothread;
+        handler->queue_ctx[handler->num_iothreads++] =
+            iothread_get_aio_context(iothread);
+    }
+    return true;
+}
+
+void virtio_blk_handler_release_iothreads(VirtioBlkHandler *handler)
+{
+    unsigned int i;
+
+    for (i = 0; i < handler->num_iothreads; i++) {
+        object_unref(OBJECT(handler->iothreads[i]));
+    }
+    g_free(handler->iothreads);
+    g_free(handler->queue_ctx);
+    handler->iothreads = NULL;
+    handler->queue_ctx = NULL;
+    handler->num_iothreads = 0;
+}
+
+AioContext *virtio_blk_handler_queue_ctx(VirtioBlkHandler *handler,
+                                         unsigned int index)
+{
+    if (!handler->num_iothreads) {
+        return NULL;
+    }
+    return handler->queue_ctx[index % handler->num_iothreads];
+}
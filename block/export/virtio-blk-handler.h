@@ -14,6 +14,8 @@
 #define VIRTIO_BLK_HANDLER_H
 
 #include "sysemu/block-backend.h"
+#include "qapi/qapi-builtin-types.h"
+#include "sysemu/iothread.h"
 
 #define VIRTIO_BLK_SECTOR_BITS 9
 #define VIRTIO_BLK_SECTOR_SIZE (1ULL << VIRTIO_BLK_SECTOR_BITS)
@@ -26,6 +28,10 @@ typedef struct {
     char *serial;
     uint32_t logical_block_size;
     bool writable;
+    /* IOThreads that process the virtqueues, see queue-iothreads */
+    IOThread **iothreads;
+    AioContext **queue_ctx;
+    unsigned int num_iothreads;
 } VirtioBlkHandler;
 
 int coroutine_fn virtio_blk_process_req(VirtioBlkHandler *handler,
@@ -34,4 +40,17 @@ int coroutine_fn virtio_blk_process_req(VirtioBlkHandler *handler,
                                         unsigned int in_num,
                                         unsigned int out_num);
 
+/*
+ * Look up the IOThreads in @ids.  Virtqueue i is then processed in
+ * IOThread i % N, or in the AioContext of the BlockBackend if @ids is
+ * empty.
+ */
+bool virtio_blk_handler_set_iothreads(VirtioBlkHandler *handler,
+                                      strList *ids, Error **errp);
+void virtio_blk_handler_release_iothreads(VirtioBlkHandler *handler);
+
+/* Returns NULL if the virtqueue is processed with the BlockBackend */
+AioContext *virtio_blk_handler_queue_ctx(VirtioBlkHandler *handler,
+                                         unsigned int index);
+
 #endif /* VIRTIO_BLK_HANDLER_H */
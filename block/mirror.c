@@ -14,6 +14,7 @@
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
 #include "qemu/coroutine.h"
+#include "qemu/units.h"
 #include "qemu/range.h"
 #include "trace.h"
 #include "block/blockjob_int.h"
@@ -26,6 +27,7 @@
 #include "qemu/memalign.h"
 
 #define MAX_IN_FLIGHT 16
+#define MAX_IN_FLIGHT_ADAPTIVE 64
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
 
@@ -74,6 +76,8 @@ typedef struct MirrorBlockJob {
     uint64_t last_pause_ns;
     unsigned long *in_flight_bitmap;
     unsigned in_flight;
+    /* Limit for in_flight; only changes at run time in adaptive mode */
+    unsigned max_in_flight;
     int64_t bytes_in_flight;
     QTAILQ_HEAD(, MirrorOp) ops_in_flight;
     int ret;
@@ -85,6 +89,19 @@ typedef struct MirrorBlockJob {
     int64_t active_write_bytes_in_flight;
     bool prepared;
     bool in_drain;
+
+    /*
+     * Adaptive mode: copy operations completed in the current sampling
+     * window, the lowest recent cost (latency per KiB) and the throughput
+     * of the previous window.
+     */
+    bool adaptive;
+    int64_t window_start_ns;
+    int64_t window_latency_ns;
+    uint64_t window_bytes;
+    unsigned window_ops;
+    int64_t min_cost;
+    uint64_t last_throughput;
 } MirrorBlockJob;
 
 typedef struct MirrorBDSOpaque {
@@ -106,6 +123,8 @@ struct MirrorOp {
     bool is_pseudo_op;
     bool is_active_write;
     bool is_in_flight;
+    /* When a background copy was submitted, for adaptive mode */
+    int64_t start_ns;
     CoQueue waiting_requests;
     Coroutine *co;
     MirrorOp *waiting_for_op;
@@ -185,6 +204,64 @@ static void coroutine_fn mirror_wait_on_conflicts(MirrorOp *self,
     }
 }
 
+/*
+ * Adaptive mode: once about max_in_flight copies have completed, compare
+ * the throughput of this window with the previous one and grow or shrink
+ * the in-flight limit AIMD-style.  The latency per KiB tells whether the
+ * target is merely slow to respond (worth more parallelism, and larger
+ * requests amortize the round trip) or is queueing requests internally
+ * (more parallelism only adds latency).  Since the request size is
+ * derived from buf_size / max_in_flight, shrinking the limit also makes
+ * requests larger.
+ */
+static void mirror_adapt(MirrorBlockJob *s, MirrorOp *op)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    uint64_t throughput;
+    int64_t elapsed, cost;
+
+    if (s->window_ops == 0 || op->start_ns < s->window_start_ns) {
+        s->window_start_ns = op->start_ns;
+    }
+    s->window_latency_ns += now - op->start_ns;
+    s->window_bytes += op->bytes;
+    s->window_ops++;
+
+    elapsed = now - s->window_start_ns;
+    if (s->window_ops < s->max_in_flight || elapsed <= 0) {
+        return;
+    }
+
+    /* In bytes per millisecond */
+    throughput = s->window_bytes * SCALE_MS / elapsed;
+    cost = s->window_latency_ns * KiB / s->window_bytes;
+
+    /*
+     * The reference cost follows a new minimum at once, but otherwise
+     * creeps up by an eighth of the difference per window.  A single fast
+     * window, or a target that has become slower for good, must not keep
+     * halving the limit for the rest of the job.
+     */
+    if (!s->min_cost || cost < s->min_cost) {
+        s->min_cost = cost;
+    } else {
+        s->min_cost += (cost - s->min_cost) / 8;
+    }
+
+    if (cost > 2 * s->min_cost &&
+        throughput < s->last_throughput + s->last_throughput / 16) {
+        s->max_in_flight = MAX(s->max_in_flight / 2, 1);
+    } else if (s->max_in_flight < MAX_IN_FLIGHT_ADAPTIVE) {
+        s->max_in_flight++;
+    }
+    trace_mirror_adapt(s, throughput, cost, s->max_in_flight);
+
+    s->last_throughput = throughput;
+    s->window_latency_ns = 0;
+    s->window_bytes = 0;
+    s->window_ops = 0;
+}
+
 static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
 {
     MirrorBlockJob *s = op->s;
@@ -212,6 +289,9 @@ static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
         if (s->cow_bitmap) {
             bitmap_set(s->cow_bitmap, chunk_num, nb_chunks);
         }
+        if (s->adaptive && op->start_ns) {
+            mirror_adapt(s, op);
+        }
         if (!s->initial_zeroing_ongoing) {
             job_progress_update(&s->common.job, op->bytes);
         }
@@ -387,6 +467,9 @@ static void coroutine_fn mirror_co_read(void *opaque)
     s->in_flight++;
     s->bytes_in_flight += op->bytes;
     op->is_in_flight = true;
+    if (s->adaptive && !s->initial_zeroing_ongoing) {
+        op->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    }
     trace_mirror_one_iteration(s, op->offset, op->bytes);
 
     ret = bdrv_co_preadv(s->mirror_top_bs->backing, op->offset, op->bytes,
@@ -478,7 +561,7 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int max_io_bytes = MAX(s->buf_size / s->max_in_flight, MAX_IO_BYTES);
 
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
     offset = bdrv_dirty_iter_next(s->dbi);
@@ -582,7 +665,7 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= s->max_in_flight) {
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
             mirror_wait_for_free_in_flight_slot(s);
         }
@@ -835,7 +918,7 @@ static int coroutine_fn mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= s->max_in_flight) {
                 trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
                                    s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -1021,7 +1104,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         }
         if (delta < BLOCK_JOB_SLICE_TIME &&
             iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= s->max_in_flight || s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -1630,7 +1713,7 @@ static BlockJob *mirror_start_job(
                              bool is_none_mode, BlockDriverState *base,
                              bool auto_complete, const char *filter_node_name,
                              bool is_mirror, MirrorCopyMode copy_mode,
-                             Error **errp)
+                             bool adaptive, Error **errp)
 {
     MirrorBlockJob *s;
     MirrorBDSOpaque *bs_opaque;
@@ -1778,6 +1861,8 @@ static BlockJob *mirror_start_job(
     s->backing_mode = backing_mode;
     s->zero_target = zero_target;
     s->copy_mode = copy_mode;
+    s->adaptive = adaptive;
+    s->max_in_flight = MAX_IN_FLIGHT;
     s->base = base;
     s->base_overlay = bdrv_find_overlay(bs, base);
     s->granularity = granularity;
@@ -1894,7 +1979,7 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   bool unmap, const char *filter_node_name,
-                  MirrorCopyMode copy_mode, Error **errp)
+                  MirrorCopyMode copy_mode, bool adaptive, Error **errp)
 {
     bool is_none_mode;
     BlockDriverState *base;
@@ -1913,7 +1998,7 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                      speed, granularity, buf_size, backing_mode, zero_target,
                      on_source_error, on_target_error, unmap, NULL, NULL,
                      &mirror_job_driver, is_none_mode, base, false,
-                     filter_node_name, true, copy_mode, errp);
+                     filter_node_name, true, copy_mode, adaptive, errp);
 }
 
 BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
@@ -1942,7 +2027,7 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
                      on_error, on_error, true, cb, opaque,
                      &commit_active_job_driver, false, base, auto_complete,
                      filter_node_name, false, MIRROR_COPY_MODE_BACKGROUND,
-                     errp);
+                     false, errp);
     if (!job) {
         goto error_restore_flags;
     }
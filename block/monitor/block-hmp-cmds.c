@@ -510,7 +510,7 @@ void hmp_block_stream(Monitor *mon, const QDict *qdict)
                      false, NULL, false, NULL,
                      qdict_haskey(qdict, "speed"), speed, true,
                      BLOCKDEV_ON_ERROR_REPORT, false, NULL, false, false, false,
-                     false, &error);
+                     false, false, NULL, &error);
 
     hmp_handle_error(mon, error);
 }
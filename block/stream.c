@@ -24,7 +24,7 @@
 
 enum {
     /*
-     * Maximum chunk size to feed to copy-on-read.  This should be
+     * Default maximum chunk size to feed to copy-on-read.  This should be
      * large enough to process multiple clusters in a single call, so
      * that populating contiguous regions of the image is efficient.
      */
@@ -41,6 +41,9 @@ typedef struct StreamBlockJob {
     BlockdevOnError on_error;
     char *backing_file_str;
     bool bs_read_only;
+    int max_workers;
+    int64_t max_chunk;
+    BlockJobChunks chunks;
 } StreamBlockJob;
 
 static int coroutine_fn stream_populate(BlockBackend *blk,
@@ -51,6 +54,14 @@ static int coroutine_fn stream_populate(BlockBackend *blk,
     return blk_co_preadv(blk, offset, bytes, NULL, BDRV_REQ_PREFETCH);
 }
 
+static int coroutine_fn stream_chunk(BlockJobChunks *chunks, int64_t offset,
+                                     int64_t bytes, bool *error_in_source)
+{
+    StreamBlockJob *s = container_of(chunks, StreamBlockJob, chunks);
+
+    return stream_populate(s->blk, offset, bytes);
+}
+
 static int stream_prepare(Job *job)
 {
     StreamBlockJob *s = container_of(job, StreamBlockJob, common.job);
@@ -141,39 +152,57 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
     }
     job_progress_set_remaining(&s->common.job, len);
 
-    for ( ; offset < len; offset += n) {
-        bool copy;
+    block_job_chunks_init(&s->chunks, &s->common, s->max_workers,
+                          stream_chunk);
+
+    for ( ; ; offset += n) {
+        bool copy = false;
         int ret;
 
-        /* Note that even when no rate limit is applied we need to yield
-         * with no pending I/O here so that bdrv_drain_all() returns.
+        /* Wait for the last chunks, failed ones are handled below */
+        if (offset >= len && block_job_chunks_wait(&s->chunks) == 0) {
+            break;
+        }
+
+        /*
+         * Yield even when no rate limit is applied, so that the job can be
+         * paused.  Chunks may still be in flight: they are requests on the
+         * nodes, so bdrv_drain_all() waits for them to complete.
          */
         job_sleep_ns(&s->common.job, delay_ns);
         if (job_is_cancelled(&s->common.job)) {
             break;
         }
 
-        copy = false;
-
-        ret = bdrv_is_allocated(unfiltered_bs, offset, STREAM_CHUNK, &n);
-        if (ret == 1) {
-            /* Allocated in the top, no need to copy.  */
-        } else if (ret >= 0) {
-            /* Copy if allocated in the intermediate images.  Limit to the
-             * known-unallocated area [offset, offset+n*BDRV_SECTOR_SIZE).  */
-            ret = bdrv_is_allocated_above(bdrv_cow_bs(unfiltered_bs),
-                                          s->base_overlay, true,
-                                          offset, n, &n);
-            /* Finish early if end of backing file has been reached */
-            if (ret == 0 && n == 0) {
-                n = len - offset;
+        /*
+         * Chunks after a failed one that succeeded are scanned again, they
+         * are allocated in the top image now.
+         */
+        ret = block_job_chunks_rewind(&s->chunks, &offset, &n, NULL);
+        if (ret == 0) {
+            ret = bdrv_is_allocated(unfiltered_bs, offset, s->max_chunk, &n);
+            if (ret == 1) {
+                /* Allocated in the top, no need to copy.  */
+            } else if (ret >= 0) {
+                /*
+                 * Copy if allocated in the intermediate images.  Limit to
+                 * the known-unallocated area [offset, offset + n).
+                 */
+                ret = bdrv_is_allocated_above(bdrv_cow_bs(unfiltered_bs),
+                                              s->base_overlay, true,
+                                              offset, n, &n);
+                /* Finish early if end of backing file has been reached */
+                if (ret == 0 && n == 0) {
+                    n = len - offset;
+                }
+
+                copy = (ret > 0);
+            }
+            trace_stream_one_iteration(s, offset, n, ret);
+            if (copy) {
+                block_job_chunks_start(&s->chunks, offset, n);
+                ret = 0;
             }
-
-            copy = (ret > 0);
-        }
-        trace_stream_one_iteration(s, offset, n, ret);
-        if (copy) {
-            ret = stream_populate(s->blk, offset, n);
         }
         if (ret < 0) {
             BlockErrorAction action =
@@ -190,15 +219,17 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
             }
         }
 
-        /* Publish progress */
-        job_progress_update(&s->common.job, n);
+        /* Publish progress, copied chunks do that on completion */
         if (copy) {
             delay_ns = block_job_ratelimit_get_delay(&s->common, n);
         } else {
+            job_progress_update(&s->common.job, n);
             delay_ns = 0;
         }
     }
 
+    block_job_chunks_cleanup(&s->chunks);
+
     /* Do not remove the backing file if an error was there but ignored. */
     return error;
 }
@@ -221,6 +252,7 @@ void stream_start(const char *job_id, BlockDriverState *bs,
                   int creation_flags, int64_t speed,
                   BlockdevOnError on_error,
                   const char *filter_node_name,
+                  const BlockJobPerf *perf,
                   Error **errp)
 {
     StreamBlockJob *s = NULL;
@@ -230,6 +262,8 @@ void stream_start(const char *job_id, BlockDriverState *bs,
     BlockDriverState *base_overlay;
     BlockDriverState *cor_filter_bs = NULL;
     BlockDriverState *above_base;
+    int max_workers = 1;
+    int64_t max_chunk = STREAM_CHUNK;
     QDict *opts;
     int ret;
 
@@ -238,6 +272,10 @@ void stream_start(const char *job_id, BlockDriverState *bs,
     assert(!(base && bottom));
     assert(!(backing_file_str && bottom));
 
+    if (!block_job_parse_perf(perf, &max_workers, &max_chunk, errp)) {
+        return;
+    }
+
     if (bottom) {
         /*
          * New simple interface. The code is written in terms of old interface
@@ -364,6 +402,8 @@ void stream_start(const char *job_id, BlockDriverState *bs,
     s->cor_filter_bs = cor_filter_bs;
     s->target_bs = bs;
     s->bs_read_only = bs_read_only;
+    s->max_workers = max_workers;
+    s->max_chunk = max_chunk;
 
     s->on_error = on_error;
     trace_stream_start(bs, base, s);
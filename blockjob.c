@@ -24,6 +24,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/units.h"
 #include "block/block.h"
 #include "block/blockjob_int.h"
 #include "block/block_int.h"
@@ -325,6 +326,163 @@ int64_t block_job_ratelimit_get_delay(BlockJob *job, uint64_t n)
     return ratelimit_calculate_delay(&job->limit, n);
 }
 
+/*
+ * Each worker may allocate a buffer of the chunk size, so use the same
+ * bounds as block-copy: its largest chunk and its number of workers.
+ */
+#define BLOCK_JOB_MAX_CHUNK (16 * MiB)
+#define BLOCK_JOB_MAX_WORKERS 64
+
+bool block_job_parse_perf(const BlockJobPerf *perf, int *max_workers,
+                          int64_t *max_chunk, Error **errp)
+{
+    GLOBAL_STATE_CODE();
+
+    if (!perf) {
+        return true;
+    }
+
+    if (perf->has_max_workers) {
+        if (perf->max_workers < 1 ||
+            perf->max_workers > BLOCK_JOB_MAX_WORKERS) {
+            error_setg(errp, "max-workers must be between 1 and %d",
+                       BLOCK_JOB_MAX_WORKERS);
+            return false;
+        }
+        *max_workers = perf->max_workers;
+    }
+
+    if (perf->has_max_chunk) {
+        if (perf->max_chunk < 1 || perf->max_chunk > BLOCK_JOB_MAX_CHUNK) {
+            error_setg(errp, "max-chunk must be between 1 and %" PRIi64,
+                       BLOCK_JOB_MAX_CHUNK);
+            return false;
+        }
+        *max_chunk = perf->max_chunk;
+    }
+
+    return true;
+}
+
+typedef struct BlockJobChunkTask {
+    AioTask task;
+    BlockJobChunks *chunks;
+    int64_t offset;
+    int64_t bytes;
+} BlockJobChunkTask;
+
+static coroutine_fn int block_job_chunk_task_entry(AioTask *task)
+{
+    BlockJobChunkTask *t = container_of(task, BlockJobChunkTask, task);
+    BlockJobChunks *chunks = t->chunks;
+    bool error_in_source = true;
+    int ret;
+
+    ret = chunks->func(chunks, t->offset, t->bytes, &error_in_source);
+    if (ret < 0) {
+        if (!chunks->ret || t->offset < chunks->error_offset) {
+            chunks->ret = ret;
+            chunks->error_in_source = error_in_source;
+            chunks->error_offset = t->offset;
+            chunks->error_bytes = t->bytes;
+        }
+        chunks->failed_bytes += t->bytes;
+    } else {
+        job_progress_update(&chunks->job->job, t->bytes);
+    }
+
+    return ret;
+}
+
+void block_job_chunks_init(BlockJobChunks *chunks, BlockJob *job,
+                           int max_workers, BlockJobChunkFunc *func)
+{
+    *chunks = (BlockJobChunks) {
+        .job = job,
+        .func = func,
+        .max_workers = max_workers,
+        .pool = aio_task_pool_new(max_workers),
+    };
+}
+
+void coroutine_fn block_job_chunks_start(BlockJobChunks *chunks,
+                                         int64_t offset, int64_t bytes)
+{
+    BlockJobChunkTask *t;
+
+    /*
+     * Like a sequential job, do not go on after a failed chunk.  The chunk
+     * is copied again after block_job_chunks_rewind(), so it counts like a
+     * failed one.
+     */
+    aio_task_pool_wait_slot(chunks->pool);
+    if (aio_task_pool_status(chunks->pool) < 0) {
+        chunks->failed_bytes += bytes;
+        return;
+    }
+
+    t = g_new(BlockJobChunkTask, 1);
+    *t = (BlockJobChunkTask) {
+        .task.func = block_job_chunk_task_entry,
+        .chunks = chunks,
+        .offset = offset,
+        .bytes = bytes,
+    };
+    aio_task_pool_start_task(chunks->pool, &t->task);
+
+    /*
+     * With a single worker, a failed chunk is seen before the job looks
+     * at the next offset, which keeps the progress and errors of a job
+     * without x-perf what they were.
+     */
+    if (chunks->max_workers == 1) {
+        aio_task_pool_wait_all(chunks->pool);
+    }
+}
+
+int coroutine_fn block_job_chunks_wait(BlockJobChunks *chunks)
+{
+    aio_task_pool_wait_all(chunks->pool);
+    return aio_task_pool_status(chunks->pool);
+}
+
+int coroutine_fn block_job_chunks_rewind(BlockJobChunks *chunks,
+                                         int64_t *offset, int64_t *bytes,
+                                         bool *error_in_source)
+{
+    int ret;
+
+    if (aio_task_pool_status(chunks->pool) == 0) {
+        return 0;
+    }
+
+    /* Chunks still running may fail at a lower offset */
+    aio_task_pool_wait_all(chunks->pool);
+    aio_task_pool_free(chunks->pool);
+    chunks->pool = aio_task_pool_new(chunks->max_workers);
+
+    job_progress_increase_remaining(&chunks->job->job,
+                                    *offset - chunks->error_offset -
+                                    chunks->failed_bytes);
+    *offset = chunks->error_offset;
+    *bytes = chunks->error_bytes;
+    if (error_in_source) {
+        *error_in_source = chunks->error_in_source;
+    }
+
+    ret = chunks->ret;
+    chunks->ret = 0;
+    chunks->failed_bytes = 0;
+    return ret;
+}
+
+void coroutine_fn block_job_chunks_cleanup(BlockJobChunks *chunks)
+{
+    aio_task_pool_wait_all(chunks->pool);
+    aio_task_pool_free(chunks->pool);
+    chunks->pool = NULL;
+}
+
 BlockJobInfo *block_job_query_locked(BlockJob *job, Error **errp)
 {
     BlockJobInfo *info;
@@ -0,0 +1,428 @@
+/*
+ * vhost-user-net loopback back-end
+ *
+ * A software-only virtio-net device that reflects the packets sent by
+ * the guest back to it, discards them, or generates packets for the
+ * guest.  It exercises the vhost-user datapath without any real network
+ * and reports its packet rate, so that changes to the virtqueue code can
+ * be measured.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+
+#include <glib-unix.h>
+
+#include "qemu/iov.h"
+#include "qemu/bswap.h"
+#include "qemu/sockets.h"
+#include "libvhost-user-glib.h"
+#include "standard-headers/linux/virtio_net.h"
+#include "qapi/error.h"
+
+enum {
+    VHOST_USER_NET_RX_QUEUE = 0,
+    VHOST_USER_NET_TX_QUEUE = 1,
+    VHOST_USER_NET_MAX_QUEUES = 2,
+};
+
+#define VUN_ETH_ALEN            6
+#define VUN_ETH_HLEN            14
+#define VUN_ETH_ZLEN            60
+#define VUN_MAX_FRAME_SIZE      65535
+
+/* IEEE 802 local experimental EtherType, used for generated frames */
+#define VUN_ETH_P_EXPERIMENTAL  0x88b5
+
+typedef enum VuNetMode {
+    VUN_MODE_REFLECT,
+    VUN_MODE_SINK,
+    VUN_MODE_GENERATE,
+} VuNetMode;
+
+typedef struct VuNetStats {
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t dropped;
+    uint64_t notifications;
+} VuNetStats;
+
+typedef struct VuNet {
+    VugDev dev;
+    GMainLoop *loop;
+    VuNetMode mode;
+    size_t hdr_len;
+    unsigned batch;
+    size_t frame_size;
+    uint64_t seq;
+    /* rx is what the guest receives, tx what it sends */
+    VuNetStats rx, tx;
+    VuNetStats last_rx, last_tx;
+    int64_t start, last_stats;
+    uint8_t buf[VUN_MAX_FRAME_SIZE];
+} VuNet;
+
+static void vun_panic_cb(VuDev *dev, const char *buf)
+{
+    VuNet *vn = container_of(dev, VuNet, dev.parent);
+
+    if (buf) {
+        g_warning("vu_panic: %s", buf);
+    }
+
+    g_main_loop_quit(vn->loop);
+}
+
+/*
+ * Copy one frame to the next receive buffer of the guest.  Returns false
+ * if the guest has not posted a buffer large enough for it.
+ */
+static bool vun_receive(VuNet *vn, const uint8_t *buf, size_t size)
+{
+    VuDev *dev = &vn->dev.parent;
+    VuVirtq *vq = vu_get_queue(dev, VHOST_USER_NET_RX_QUEUE);
+    struct virtio_net_hdr_mrg_rxbuf hdr = {
+        .num_buffers = cpu_to_le16(1),
+    };
+    VuVirtqElement *elem;
+
+    elem = vu_queue_pop(dev, vq, sizeof(VuVirtqElement));
+    if (!elem) {
+        return false;
+    }
+
+    if (iov_size(elem->in_sg, elem->in_num) < vn->hdr_len + size) {
+        g_warning("receive buffer too small for a %zu byte frame", size);
+        vu_queue_unpop(dev, vq, elem, 0);
+        free(elem);
+        return false;
+    }
+
+    iov_from_buf(elem->in_sg, elem->in_num, 0, &hdr, vn->hdr_len);
+    iov_from_buf(elem->in_sg, elem->in_num, vn->hdr_len, buf, size);
+    vu_queue_push(dev, vq, elem, vn->hdr_len + size);
+    free(elem);
+
+    vn->rx.packets++;
+    vn->rx.bytes += size;
+    return true;
+}
+
+static void vun_notify(VuNet *vn, int qidx)
+{
+    VuDev *dev = &vn->dev.parent;
+
+    vu_queue_notify(dev, vu_get_queue(dev, qidx));
+    if (qidx == VHOST_USER_NET_RX_QUEUE) {
+        vn->rx.notifications++;
+    } else {
+        vn->tx.notifications++;
+    }
+}
+
+static void vun_reflect(VuNet *vn, VuVirtqElement *elem, size_t size)
+{
+    uint8_t mac[VUN_ETH_ALEN];
+
+    size = MIN(size, sizeof(vn->buf));
+    iov_to_buf(elem->out_sg, elem->out_num, vn->hdr_len, vn->buf, size);
+
+    if (size >= VUN_ETH_HLEN) {
+        memcpy(mac, vn->buf, VUN_ETH_ALEN);
+        memcpy(vn->buf, vn->buf + VUN_ETH_ALEN, VUN_ETH_ALEN);
+        memcpy(vn->buf + VUN_ETH_ALEN, mac, VUN_ETH_ALEN);
+    }
+
+    if (!vun_receive(vn, vn->buf, size)) {
+        vn->rx.dropped++;
+    }
+}
+
+static void vun_handle_tx(VuDev *dev, int qidx)
+{
+    VuNet *vn = container_of(dev, VuNet, dev.parent);
+    VuVirtq *vq = vu_get_queue(dev, qidx);
+    uint64_t received;
+    unsigned n;
+
+    do {
+        received = vn->rx.packets;
+
+        for (n = 0; n < vn->batch; n++) {
+            VuVirtqElement *elem;
+            size_t size;
+
+            elem = vu_queue_pop(dev, vq, sizeof(VuVirtqElement));
+            if (!elem) {
+                break;
+            }
+
+            size = iov_size(elem->out_sg, elem->out_num);
+            if (size < vn->hdr_len) {
+                g_warning("transmit buffer shorter than the vnet header");
+                vn->tx.dropped++;
+            } else {
+                size -= vn->hdr_len;
+                vn->tx.packets++;
+                vn->tx.bytes += size;
+                if (vn->mode == VUN_MODE_REFLECT) {
+                    vun_reflect(vn, elem, size);
+                }
+            }
+
+            vu_queue_push(dev, vq, elem, 0);
+            free(elem);
+        }
+
+        /* Notify once per batch, not once per packet */
+        if (n) {
+            vun_notify(vn, qidx);
+        }
+        if (vn->rx.packets != received) {
+            vun_notify(vn, VHOST_USER_NET_RX_QUEUE);
+        }
+    } while (n == vn->batch);
+}
+
+static void vun_generate(VuNet *vn)
+{
+    static const uint8_t src[VUN_ETH_ALEN] = { 0x02, 0, 0, 0, 0, 0x01 };
+
+    memset(vn->buf, 0xff, VUN_ETH_ALEN);
+    memcpy(vn->buf + VUN_ETH_ALEN, src, VUN_ETH_ALEN);
+    stw_be_p(vn->buf + 2 * VUN_ETH_ALEN, VUN_ETH_P_EXPERIMENTAL);
+    stq_be_p(vn->buf + VUN_ETH_HLEN, vn->seq);
+}
+
+static void vun_handle_rx(VuDev *dev, int qidx)
+{
+    VuNet *vn = container_of(dev, VuNet, dev.parent);
+    unsigned n;
+
+    /* In reflect mode, receive buffers are consumed by vun_handle_tx */
+    if (vn->mode != VUN_MODE_GENERATE) {
+        return;
+    }
+
+    do {
+        for (n = 0; n < vn->batch; n++) {
+            vun_generate(vn);
+            if (!vun_receive(vn, vn->buf, vn->frame_size)) {
+                break;
+            }
+            vn->seq++;
+        }
+
+        if (n) {
+            vun_notify(vn, qidx);
+        }
+    } while (n == vn->batch);
+}
+
+static void vun_queue_set_started(VuDev *dev, int qidx, bool started)
+{
+    VuVirtq *vq = vu_get_queue(dev, qidx);
+    vu_queue_handler_cb handler;
+
+    if (qidx == VHOST_USER_NET_RX_QUEUE) {
+        handler = vun_handle_rx;
+    } else if (qidx == VHOST_USER_NET_TX_QUEUE) {
+        handler = vun_handle_tx;
+    } else {
+        return;
+    }
+
+    vu_set_queue_handler(dev, vq, started ? handler : NULL);
+
+    /* The driver may have made buffers available before the kick fd */
+    if (started) {
+        handler(dev, qidx);
+    }
+}
+
+static uint64_t vun_get_features(VuDev *dev)
+{
+    return 1ull << VIRTIO_F_VERSION_1 |
+           1ull << VIRTIO_NET_F_MRG_RXBUF;
+}
+
+static void vun_set_features(VuDev *dev, uint64_t features)
+{
+    VuNet *vn = container_of(dev, VuNet, dev.parent);
+
+    if (features & (1ull << VIRTIO_F_VERSION_1 |
+                    1ull << VIRTIO_NET_F_MRG_RXBUF)) {
+        vn->hdr_len = sizeof(struct virtio_net_hdr_mrg_rxbuf);
+    } else {
+        vn->hdr_len = sizeof(struct virtio_net_hdr);
+    }
+}
+
+static const VuDevIface vun_iface = {
+    .get_features = vun_get_features,
+    .set_features = vun_set_features,
+    .queue_set_started = vun_queue_set_started,
+};
+
+static void vun_print_stats(const char *prefix, const VuNetStats *cur,
+                            const VuNetStats *last, double secs)
+{
+    uint64_t packets = cur->packets - last->packets;
+    uint64_t bytes = cur->bytes - last->bytes;
+    uint64_t notifications = cur->notifications - last->notifications;
+
+    g_print("%s: %" PRIu64 " packets, %.0f pps, %.1f Mbps, "
+            "%.1f packets per notification, %" PRIu64 " dropped\n",
+            prefix, packets, packets / secs, bytes * 8 / secs / 1e6,
+            notifications ? (double)packets / notifications : 0.0,
+            cur->dropped - last->dropped);
+}
+
+static void vun_report(VuNet *vn)
+{
+    int64_t now = g_get_monotonic_time();
+    double secs = MAX(now - vn->last_stats, 1) / (double)G_USEC_PER_SEC;
+
+    vun_print_stats("rx", &vn->rx, &vn->last_rx, secs);
+    vun_print_stats("tx", &vn->tx, &vn->last_tx, secs);
+
+    vn->last_rx = vn->rx;
+    vn->last_tx = vn->tx;
+    vn->last_stats = now;
+}
+
+static gboolean vun_stats_timeout(gpointer opaque)
+{
+    vun_report(opaque);
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean vun_quit(gpointer opaque)
+{
+    VuNet *vn = opaque;
+
+    g_main_loop_quit(vn->loop);
+    return G_SOURCE_REMOVE;
+}
+
+static int opt_fdnum = -1;
+static char *opt_socket_path;
+static char *opt_mode;
+static int opt_size = 64;
+static int opt_batch = 32;
+static int opt_stats_interval;
+static gboolean opt_print_caps;
+
+static GOptionEntry entries[] = {
+    { "print-capabilities", 'c', 0, G_OPTION_ARG_NONE, &opt_print_caps,
+      "Print capabilities", NULL },
+    { "fd", 'f', 0, G_OPTION_ARG_INT, &opt_fdnum,
+      "Use inherited fd socket", "FDNUM" },
+    { "socket-path", 's', 0, G_OPTION_ARG_FILENAME, &opt_socket_path,
+      "Use UNIX socket path", "PATH" },
+    { "mode", 'm', 0, G_OPTION_ARG_STRING, &opt_mode,
+      "Traffic mode: reflect (default), sink or generate", "MODE" },
+    { "size", 'S', 0, G_OPTION_ARG_INT, &opt_size,
+      "Size of the generated frames in bytes (default: 64)", "SIZE" },
+    { "batch", 'b', 0, G_OPTION_ARG_INT, &opt_batch,
+      "Buffers processed per notification (default: 32)", "COUNT" },
+    { "stats-interval", 'i', 0, G_OPTION_ARG_INT, &opt_stats_interval,
+      "Print statistics every SECONDS (default: only at exit)", "SECONDS" },
+    { NULL, }
+};
+
+int main(int argc, char *argv[])
+{
+    GError *error = NULL;
+    GOptionContext *context;
+    int lsock = -1, csock;
+    VuNet vn = {
+        .mode = VUN_MODE_REFLECT,
+        .hdr_len = sizeof(struct virtio_net_hdr_mrg_rxbuf),
+    };
+
+    context = g_option_context_new(NULL);
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("Option parsing failed: %s\n", error->message);
+        exit(EXIT_FAILURE);
+    }
+    if (opt_print_caps) {
+        g_print("{\n");
+        g_print("  \"type\": \"net\"\n");
+        g_print("}\n");
+        exit(EXIT_SUCCESS);
+    }
+
+    if (!opt_mode || g_str_equal(opt_mode, "reflect")) {
+        vn.mode = VUN_MODE_REFLECT;
+    } else if (g_str_equal(opt_mode, "sink")) {
+        vn.mode = VUN_MODE_SINK;
+    } else if (g_str_equal(opt_mode, "generate")) {
+        vn.mode = VUN_MODE_GENERATE;
+    } else {
+        g_printerr("Invalid mode '%s'\n", opt_mode);
+        exit(EXIT_FAILURE);
+    }
+    if (opt_size < VUN_ETH_ZLEN || opt_size > VUN_MAX_FRAME_SIZE) {
+        g_printerr("Frame size must be between %d and %d\n",
+                   VUN_ETH_ZLEN, VUN_MAX_FRAME_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    if (opt_batch < 1) {
+        g_printerr("Batch size must be at least 1\n");
+        exit(EXIT_FAILURE);
+    }
+    vn.frame_size = opt_size;
+    vn.batch = opt_batch;
+
+    if (opt_socket_path) {
+        lsock = unix_listen(opt_socket_path, &error_fatal);
+    } else if (opt_fdnum < 0) {
+        g_print("%s\n", g_option_context_get_help(context, true, NULL));
+        exit(EXIT_FAILURE);
+    } else {
+        lsock = opt_fdnum;
+    }
+
+    csock = accept(lsock, NULL, NULL);
+    if (csock < 0) {
+        g_printerr("Accept error %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    vn.loop = g_main_loop_new(NULL, FALSE);
+    if (!vug_init(&vn.dev, VHOST_USER_NET_MAX_QUEUES, csock,
+                  vun_panic_cb, &vun_iface)) {
+        g_printerr("Failed to initialize libvhost-user-glib\n");
+        exit(EXIT_FAILURE);
+    }
+
+    g_unix_signal_add(SIGINT, vun_quit, &vn);
+    g_unix_signal_add(SIGTERM, vun_quit, &vn);
+    if (opt_stats_interval > 0) {
+        g_timeout_add_seconds(opt_stats_interval, vun_stats_timeout, &vn);
+    }
+
+    vn.start = vn.last_stats = g_get_monotonic_time();
+    g_main_loop_run(vn.loop);
+
+    /* Print totals for the whole run */
+    vn.last_rx = (VuNetStats) {};
+    vn.last_tx = (VuNetStats) {};
+    vn.last_stats = vn.start;
+    vun_report(&vn);
+
+    g_main_loop_unref(vn.loop);
+    g_option_context_free(context);
+    vug_deinit(&vn.dev);
+    close(csock);
+    close(lsock);
+    g_free(opt_socket_path);
+    g_free(opt_mode);
+
+    return 0;
+}
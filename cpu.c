@@ -146,12 +146,15 @@ void cpu_exec_realizefn(CPUState *cpu, Error **errp)
     /* Wait until cpu initialization complete before exposing cpu. */
     cpu_list_add(cpu);
 
-    /* Plugin initialization must wait until cpu_index assigned. */
+#ifdef CONFIG_USER_ONLY
+    /*
+     * Plugin initialization must wait until cpu_index assigned.  System
+     * emulation does it in qemu_init_vcpu(), once the vCPU has a thread.
+     */
     if (tcg_enabled()) {
         qemu_plugin_vcpu_init_hook(cpu);
     }
 
-#ifdef CONFIG_USER_ONLY
     assert(qdev_get_vmsd(DEVICE(cpu)) == NULL ||
            qdev_get_vmsd(DEVICE(cpu))->unmigratable);
 #else
@@ -0,0 +1,35 @@
+/*
+ * eBPF packet classifier stub file
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "ebpf/ebpf_filter.h"
+
+void ebpf_filter_init(struct EBPFFilterContext *ctx)
+{
+    if (ctx != NULL) {
+        ctx->program_fd = -1;
+    }
+}
+
+bool ebpf_filter_is_loaded(struct EBPFFilterContext *ctx)
+{
+    return false;
+}
+
+bool ebpf_filter_load(struct EBPFFilterContext *ctx,
+                      const NetFilterMatch *match,
+                      NetFilterDirection direction, Error **errp)
+{
+    error_setg(errp, "eBPF support is not available in this build");
+    return false;
+}
+
+void ebpf_filter_unload(struct EBPFFilterContext *ctx)
+{
+
+}
@@ -0,0 +1,350 @@
+/*
+ * eBPF packet classifier for network filters
+ *
+ * The criteria of a filter are compiled into a socket filter program,
+ * so that the kernel can classify the packets of a vhost netdev and only
+ * hand the matching ones to QEMU.  The program reads the packet with the
+ * BPF_ABS and BPF_IND loads, which stop the program and drop the packet
+ * when they go past its end.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_packet.h>
+
+#include "net/eth.h"
+#include "ebpf/ebpf_filter.h"
+#include "trace.h"
+
+/* Returned by the program to keep the whole packet */
+#define EBPF_FILTER_ACCEPT  0xffffffff
+
+/* Value of the VLAN id register for untagged frames */
+#define EBPF_FILTER_NO_VLAN 0x10000
+
+#define EBPF_FILTER_LOG_SIZE 4096
+
+/*
+ * Register usage: R6 holds the context, as the packet loads require,
+ * R7 the offset of the IP header, then of the TCP/UDP header, and R8 the
+ * VLAN id.  R0 receives the loaded values and R1 holds 32-bit constants.
+ */
+
+typedef enum {
+    EBPF_FILTER_LABEL_ACCEPT,
+    EBPF_FILTER_LABEL_DROP,
+    EBPF_FILTER_LABEL_HW_VLAN,
+    EBPF_FILTER_LABEL_NO_VLAN,
+    EBPF_FILTER_LABEL_L3,
+    EBPF_FILTER_LABEL_L4,
+    EBPF_FILTER_LABEL__MAX,
+} EBPFFilterLabel;
+
+typedef struct EBPFFilterFixup {
+    unsigned int insn;
+    EBPFFilterLabel label;
+} EBPFFilterFixup;
+
+typedef struct EBPFFilterProg {
+    GArray *insns;
+    GArray *fixups;
+    unsigned int labels[EBPF_FILTER_LABEL__MAX];
+    bool used[EBPF_FILTER_LABEL__MAX];
+} EBPFFilterProg;
+
+static void emit(EBPFFilterProg *p, uint8_t code, uint8_t dst, uint8_t src,
+                 int16_t off, int32_t imm)
+{
+    struct bpf_insn insn = {
+        .code = code,
+        .dst_reg = dst,
+        .src_reg = src,
+        .off = off,
+        .imm = imm,
+    };
+
+    g_array_append_val(p->insns, insn);
+}
+
+static void emit_jump(EBPFFilterProg *p, uint8_t code, uint8_t dst,
+                      uint8_t src, int32_t imm, EBPFFilterLabel label)
+{
+    EBPFFilterFixup fixup = {
+        .insn = p->insns->len,
+        .label = label,
+    };
+
+    g_array_append_val(p->fixups, fixup);
+    p->used[label] = true;
+    emit(p, BPF_JMP | code, dst, src, 0, imm);
+}
+
+static void bind_label(EBPFFilterProg *p, EBPFFilterLabel label)
+{
+    p->labels[label] = p->insns->len;
+}
+
+/* Load @size bytes at @off from the start of the frame into R0 */
+static void emit_load_abs(EBPFFilterProg *p, uint8_t size, int32_t off)
+{
+    emit(p, BPF_LD | BPF_ABS | size, 0, 0, 0, off);
+}
+
+/* Load @size bytes at @off from the header pointed to by R7 into R0 */
+static void emit_load_ind(EBPFFilterProg *p, uint8_t size, int32_t off)
+{
+    emit(p, BPF_LD | BPF_IND | size, 0, BPF_REG_7, 0, off);
+}
+
+/* Drop the packet unless R0 is @value, which may not fit a signed imm */
+static void emit_drop_unless(EBPFFilterProg *p, uint32_t value)
+{
+    if (value <= INT32_MAX) {
+        emit_jump(p, BPF_JNE | BPF_K, BPF_REG_0, 0, value,
+                  EBPF_FILTER_LABEL_DROP);
+    } else {
+        emit(p, BPF_ALU | BPF_MOV | BPF_K, BPF_REG_1, 0, 0, value);
+        emit_jump(p, BPF_JNE | BPF_X, BPF_REG_0, BPF_REG_1, 0,
+                  EBPF_FILTER_LABEL_DROP);
+    }
+}
+
+static void emit_match_mac(EBPFFilterProg *p, int32_t off, const uint8_t *mac)
+{
+    emit_load_abs(p, BPF_W, off);
+    emit_drop_unless(p, ldl_be_p(mac));
+    emit_load_abs(p, BPF_H, off + 4);
+    emit_drop_unless(p, lduw_be_p(mac + 4));
+}
+
+static void emit_match_addr(EBPFFilterProg *p, int32_t off,
+                            uint32_t addr, uint32_t mask)
+{
+    if (!mask) {
+        return;
+    }
+
+    emit_load_ind(p, BPF_W, off);
+    emit(p, BPF_ALU | BPF_AND | BPF_K, BPF_REG_0, 0, 0, mask);
+    emit_drop_unless(p, addr & mask);
+}
+
+/*
+ * Set R7 to the offset of the IP header, R8 to the VLAN id and R0 to the
+ * EtherType.  The tag of received frames has been moved to the metadata
+ * by the time a socket sees them; transmitted frames still carry it.
+ */
+static void emit_parse_l2(EBPFFilterProg *p)
+{
+    emit(p, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_0, BPF_REG_6,
+         offsetof(struct __sk_buff, vlan_present), 0);
+    emit_jump(p, BPF_JNE | BPF_K, BPF_REG_0, 0, 0, EBPF_FILTER_LABEL_HW_VLAN);
+    emit_load_abs(p, BPF_H, 12);
+    emit_jump(p, BPF_JNE | BPF_K, BPF_REG_0, 0, ETH_P_VLAN,
+              EBPF_FILTER_LABEL_NO_VLAN);
+
+    /* Tag in the frame */
+    emit_load_abs(p, BPF_H, 14);
+    emit(p, BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_0, 0, 0, 0xfff);
+    emit(p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_8, BPF_REG_0, 0, 0);
+    emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_7, 0, 0, ETH_HLEN + 4);
+    emit_load_abs(p, BPF_H, 16);
+    emit_jump(p, BPF_JA, 0, 0, 0, EBPF_FILTER_LABEL_L3);
+
+    /* Tag in the metadata */
+    bind_label(p, EBPF_FILTER_LABEL_HW_VLAN);
+    emit(p, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_8, BPF_REG_6,
+         offsetof(struct __sk_buff, vlan_tci), 0);
+    emit(p, BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_8, 0, 0, 0xfff);
+    emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_7, 0, 0, ETH_HLEN);
+    emit_load_abs(p, BPF_H, 12);
+    emit_jump(p, BPF_JA, 0, 0, 0, EBPF_FILTER_LABEL_L3);
+
+    /* Untagged, R0 already holds the EtherType */
+    bind_label(p, EBPF_FILTER_LABEL_NO_VLAN);
+    emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_8, 0, 0, EBPF_FILTER_NO_VLAN);
+    emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_7, 0, 0, ETH_HLEN);
+
+    bind_label(p, EBPF_FILTER_LABEL_L3);
+}
+
+static void emit_match_ip(EBPFFilterProg *p, const NetFilterMatch *m)
+{
+    bool ports = m->has_src_port || m->has_dst_port;
+
+    emit_drop_unless(p, ETH_P_IP);
+
+    emit_load_ind(p, BPF_B, 9);
+    if (m->has_proto) {
+        /* Ports only make sense for TCP and UDP, see netfilter_complete */
+        assert(!ports || m->proto == IP_PROTO_TCP ||
+               m->proto == IP_PROTO_UDP);
+        emit_drop_unless(p, m->proto);
+    } else if (ports) {
+        emit_jump(p, BPF_JEQ | BPF_K, BPF_REG_0, 0, IP_PROTO_TCP,
+                  EBPF_FILTER_LABEL_L4);
+        emit_drop_unless(p, IP_PROTO_UDP);
+    }
+    bind_label(p, EBPF_FILTER_LABEL_L4);
+
+    emit_match_addr(p, 12, m->src_addr, m->src_mask);
+    emit_match_addr(p, 16, m->dst_addr, m->dst_mask);
+
+    if (!ports) {
+        return;
+    }
+
+    /* Only the first fragment has the ports */
+    emit_load_ind(p, BPF_H, 6);
+    emit(p, BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_0, 0, 0, IP_OFFMASK);
+    emit_drop_unless(p, 0);
+
+    /* Skip the IP header */
+    emit_load_ind(p, BPF_B, 0);
+    emit(p, BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_0, 0, 0, 0xf);
+    emit(p, BPF_ALU64 | BPF_LSH | BPF_K, BPF_REG_0, 0, 0, 2);
+    emit(p, BPF_ALU64 | BPF_ADD | BPF_X, BPF_REG_7, BPF_REG_0, 0, 0);
+
+    if (m->has_src_port) {
+        emit_load_ind(p, BPF_H, 0);
+        emit_drop_unless(p, m->src_port);
+    }
+    if (m->has_dst_port) {
+        emit_load_ind(p, BPF_H, 2);
+        emit_drop_unless(p, m->dst_port);
+    }
+}
+
+static void ebpf_filter_compile(EBPFFilterProg *p, const NetFilterMatch *m,
+                                NetFilterDirection direction)
+{
+    EBPFFilterFixup *fixup;
+    unsigned int i;
+
+    emit(p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0);
+
+    /*
+     * The host sends the packets for the guest (tx, sent by the netdev)
+     * out of the tap device; the packets of the guest (rx, sent to the
+     * netdev) are received by it.
+     */
+    if (direction != NET_FILTER_DIRECTION_ALL) {
+        emit(p, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_0, BPF_REG_6,
+             offsetof(struct __sk_buff, pkt_type), 0);
+        emit_jump(p, (direction == NET_FILTER_DIRECTION_TX ? BPF_JNE : BPF_JEQ)
+                  | BPF_K, BPF_REG_0, 0, PACKET_OUTGOING,
+                  EBPF_FILTER_LABEL_DROP);
+    }
+
+    if (m->has_dst_mac) {
+        emit_match_mac(p, 0, m->dst_mac);
+    }
+    if (m->has_src_mac) {
+        emit_match_mac(p, ETH_ALEN, m->src_mac);
+    }
+
+    if (m->has_vlan || netfilter_match_has_ip(m)) {
+        emit_parse_l2(p);
+        if (m->has_vlan) {
+            emit_jump(p, BPF_JNE | BPF_K, BPF_REG_8, 0, m->vlan,
+                      EBPF_FILTER_LABEL_DROP);
+        }
+        if (netfilter_match_has_ip(m)) {
+            emit_match_ip(p, m);
+        }
+    }
+
+    bind_label(p, EBPF_FILTER_LABEL_ACCEPT);
+    emit(p, BPF_ALU | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, EBPF_FILTER_ACCEPT);
+    emit(p, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+    /* The verifier rejects unreachable instructions */
+    if (p->used[EBPF_FILTER_LABEL_DROP]) {
+        bind_label(p, EBPF_FILTER_LABEL_DROP);
+        emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, 0);
+        emit(p, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+    }
+
+    for (i = 0; i < p->fixups->len; i++) {
+        fixup = &g_array_index(p->fixups, EBPFFilterFixup, i);
+        g_array_index(p->insns, struct bpf_insn, fixup->insn).off =
+            p->labels[fixup->label] - fixup->insn - 1;
+    }
+}
+
+static int ebpf_filter_prog_load(EBPFFilterProg *p, char *log,
+                                 size_t log_size)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+    attr.insns = (uintptr_t)p->insns->data;
+    attr.insn_cnt = p->insns->len;
+    attr.license = (uintptr_t)"GPL";
+    if (log) {
+        attr.log_buf = (uintptr_t)log;
+        attr.log_size = log_size;
+        attr.log_level = 1;
+    }
+
+    return syscall(__NR_bpf, BPF_PROG_LOAD, &attr, sizeof(attr));
+}
+
+void ebpf_filter_init(struct EBPFFilterContext *ctx)
+{
+    if (ctx != NULL) {
+        ctx->program_fd = -1;
+    }
+}
+
+bool ebpf_filter_is_loaded(struct EBPFFilterContext *ctx)
+{
+    return ctx != NULL && ctx->program_fd >= 0;
+}
+
+bool ebpf_filter_load(struct EBPFFilterContext *ctx,
+                      const NetFilterMatch *match,
+                      NetFilterDirection direction, Error **errp)
+{
+    EBPFFilterProg p = {
+        .insns = g_array_new(false, false, sizeof(struct bpf_insn)),
+        .fixups = g_array_new(false, false, sizeof(EBPFFilterFixup)),
+    };
+    g_autofree char *log = NULL;
+    int fd;
+
+    ebpf_filter_compile(&p, match, direction);
+
+    fd = ebpf_filter_prog_load(&p, NULL, 0);
+    if (fd < 0) {
+        error_setg_errno(errp, errno, "can not load eBPF filter program");
+
+        /* Load it again to get the reason from the verifier */
+        log = g_malloc0(EBPF_FILTER_LOG_SIZE);
+        ebpf_filter_prog_load(&p, log, EBPF_FILTER_LOG_SIZE);
+        trace_ebpf_error("eBPF filter", log);
+    }
+
+    g_array_free(p.insns, true);
+    g_array_free(p.fixups, true);
+
+    ctx->program_fd = fd;
+    return fd >= 0;
+}
+
+void ebpf_filter_unload(struct EBPFFilterContext *ctx)
+{
+    if (!ebpf_filter_is_loaded(ctx)) {
+        return;
+    }
+
+    close(ctx->program_fd);
+    ctx->program_fd = -1;
+}
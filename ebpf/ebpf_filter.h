@@ -0,0 +1,35 @@
+/*
+ * eBPF packet classifier for network filters
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_EBPF_FILTER_H
+#define QEMU_EBPF_FILTER_H
+
+#include "net/filter.h"
+
+struct EBPFFilterContext {
+    int program_fd;
+};
+
+void ebpf_filter_init(struct EBPFFilterContext *ctx);
+
+bool ebpf_filter_is_loaded(struct EBPFFilterContext *ctx);
+
+/*
+ * Compile @match into a socket filter program that accepts the packets
+ * that @match selects and drops all the others.  The direction is that
+ * of the filter: NET_FILTER_DIRECTION_RX accepts only packets that the
+ * guest sends, which the tap device receives, NET_FILTER_DIRECTION_TX
+ * only packets that the host sends towards the guest, which go out of
+ * the tap device (PACKET_OUTGOING).
+ */
+bool ebpf_filter_load(struct EBPFFilterContext *ctx,
+                      const NetFilterMatch *match,
+                      NetFilterDirection direction, Error **errp);
+
+void ebpf_filter_unload(struct EBPFFilterContext *ctx);
+
+#endif /* QEMU_EBPF_FILTER_H */
@@ -401,6 +401,61 @@ float64_gen2(float64 xa, float64 xb, float_status *s,
     return soft(ua.s, ub.s, s);
 }
 
+/*
+ * Rounding to an integral value is exact, so unlike arithmetic it does not
+ * need the host rounding mode to match the guest's: each guest rounding
+ * mode maps onto a libm function that ignores the current host mode, except
+ * for nearest-even, for which (like can_use_fpu) we rely on the host FPU
+ * being left in its default mode.  The caller computes the inexact flag by
+ * comparing the result against the input.
+ */
+static inline bool hard_round_to_int(double *r, double a, FloatRoundMode rmode)
+{
+    switch (rmode) {
+    case float_round_nearest_even:
+        *r = rint(a);
+        return true;
+    case float_round_ties_away:
+        *r = round(a);
+        return true;
+    case float_round_to_zero:
+        *r = trunc(a);
+        return true;
+    case float_round_down:
+        *r = floor(a);
+        return true;
+    case float_round_up:
+        *r = ceil(a);
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Float to integer conversion of a zero or normal input whose rounded value
+ * is in [@min, @max_plus_1).  Anything else, including the conversions that
+ * saturate and raise invalid, is left to soft-fp.  Every float32 converts
+ * exactly to double, so both formats share this helper.
+ */
+static inline bool hard_to_int(int64_t *ret, double a, FloatRoundMode rmode,
+                               int scale, double min, double max_plus_1,
+                               float_status *s)
+{
+    double r;
+
+    if (QEMU_NO_HARDFLOAT || unlikely(scale != 0) ||
+        !hard_round_to_int(&r, a, rmode) ||
+        !(r >= min && r < max_plus_1)) {
+        return false;
+    }
+    if (r != a) {
+        float_raise(float_flag_inexact, s);
+    }
+    *ret = r >= 0x1p63 ? (int64_t)(uint64_t)r : (int64_t)r;
+    return true;
+}
+
 /*
  * Classify a floating point number. Everything above float_class_qnan
  * is a NaN so cls >= float_class_qnan is any NaN.
@@ -2808,6 +2863,16 @@ float16 float64_to_float16(float64 a, bool ieee, float_status *s)
 float32 float64_to_float32(float64 a, float_status *s)
 {
     FloatParts64 p;
+    union_float64 ua;
+    union_float32 ur;
+
+    ua.s = a;
+    if (can_use_fpu(s) && float64_is_zero_or_normal(a)) {
+        ur.h = ua.h;
+        if (likely(!f32_is_inf(ur) && (fabsf(ur.h) > FLT_MIN || ua.h == 0))) {
+            return ur.s;
+        }
+    }
 
     float64_unpack_canonical(&p, a, s);
     parts_float_to_float(&p, s);
@@ -2973,6 +3038,18 @@ float16 float16_round_to_int(float16 a, float_status *s)
 float32 float32_round_to_int(float32 a, float_status *s)
 {
     FloatParts64 p;
+    union_float32 ua;
+    double r;
+
+    ua.s = a;
+    if (!QEMU_NO_HARDFLOAT && float32_is_zero_or_normal(a) &&
+        hard_round_to_int(&r, ua.h, s->float_rounding_mode)) {
+        if (r != ua.h) {
+            float_raise(float_flag_inexact, s);
+        }
+        ua.h = r;
+        return ua.s;
+    }
 
     float32_unpack_canonical(&p, a, s);
     parts_round_to_int(&p, s->float_rounding_mode, 0, s, &float32_params);
@@ -2982,6 +3059,18 @@ float32 float32_round_to_int(float32 a, float_status *s)
 float64 float64_round_to_int(float64 a, float_status *s)
 {
     FloatParts64 p;
+    union_float64 ua;
+    double r;
+
+    ua.s = a;
+    if (!QEMU_NO_HARDFLOAT && float64_is_zero_or_normal(a) &&
+        hard_round_to_int(&r, ua.h, s->float_rounding_mode)) {
+        if (r != ua.h) {
+            float_raise(float_flag_inexact, s);
+        }
+        ua.h = r;
+        return ua.s;
+    }
 
     float64_unpack_canonical(&p, a, s);
     parts_round_to_int(&p, s->float_rounding_mode, 0, s, &float64_params);
@@ -3072,6 +3161,14 @@ int32_t float32_to_int32_scalbn(float32 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
     FloatParts64 p;
+    union_float32 ua;
+    int64_t r;
+
+    ua.s = a;
+    if (float32_is_zero_or_normal(a) &&
+        hard_to_int(&r, ua.h, rmode, scale, -0x1p31, 0x1p31, s)) {
+        return r;
+    }
 
     float32_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT32_MIN, INT32_MAX, s);
@@ -3081,6 +3178,14 @@ int64_t float32_to_int64_scalbn(float32 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
     FloatParts64 p;
+    union_float32 ua;
+    int64_t r;
+
+    ua.s = a;
+    if (float32_is_zero_or_normal(a) &&
+        hard_to_int(&r, ua.h, rmode, scale, -0x1p63, 0x1p63, s)) {
+        return r;
+    }
 
     float32_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT64_MIN, INT64_MAX, s);
@@ -3099,6 +3204,14 @@ int32_t float64_to_int32_scalbn(float64 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
     FloatParts64 p;
+    union_float64 ua;
+    int64_t r;
+
+    ua.s = a;
+    if (float64_is_zero_or_normal(a) &&
+        hard_to_int(&r, ua.h, rmode, scale, -0x1p31, 0x1p31, s)) {
+        return r;
+    }
 
     float64_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT32_MIN, INT32_MAX, s);
@@ -3108,6 +3221,14 @@ int64_t float64_to_int64_scalbn(float64 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
     FloatParts64 p;
+    union_float64 ua;
+    int64_t r;
+
+    ua.s = a;
+    if (float64_is_zero_or_normal(a) &&
+        hard_to_int(&r, ua.h, rmode, scale, -0x1p63, 0x1p63, s)) {
+        return r;
+    }
 
     float64_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT64_MIN, INT64_MAX, s);
@@ -3462,6 +3583,14 @@ uint32_t float32_to_uint32_scalbn(float32 a, FloatRoundMode rmode, int scale,
                                   float_status *s)
 {
     FloatParts64 p;
+    union_float32 ua;
+    int64_t r;
+
+    ua.s = a;
+    if (float32_is_zero_or_normal(a) &&
+        hard_to_int(&r, ua.h, rmode, scale, 0, 0x1p32, s)) {
+        return r;
+    }
 
     float32_unpack_canonical(&p, a, s);
     return parts_float_to_uint(&p, rmode, scale, UINT32_MAX, s);
@@ -3471,6 +3600,14 @@ uint64_t float32_to_uint64_scalbn(float32 a, FloatRoundMode rmode, int scale,
                                   float_status *s)
 {
     FloatParts64 p;
+    union_float32 ua;
+    int64_t r;
+
+    ua.s = a;
+    if (float32_is_zero_or_normal(a) &&
+        hard_to_int(&r, ua.h, rmode, scale, 0, 0x1p64, s)) {
+        return r;
+    }
 
     float32_unpack_canonical(&p, a, s);
     return parts_float_to_uint(&p, rmode, scale, UINT64_MAX, s);
@@ -3489,6 +3626,14 @@ uint32_t float64_to_uint32_scalbn(float64 a, FloatRoundMode rmode, int scale,
                                   float_status *s)
 {
     FloatParts64 p;
+    union_float64 ua;
+    int64_t r;
+
+    ua.s = a;
+    if (float64_is_zero_or_normal(a) &&
+        hard_to_int(&r, ua.h, rmode, scale, 0, 0x1p32, s)) {
+        return r;
+    }
 
     float64_unpack_canonical(&p, a, s);
     return parts_float_to_uint(&p, rmode, scale, UINT32_MAX, s);
@@ -3498,6 +3643,14 @@ uint64_t float64_to_uint64_scalbn(float64 a, FloatRoundMode rmode, int scale,
                                   float_status *s)
 {
     FloatParts64 p;
+    union_float64 ua;
+    int64_t r;
+
+    ua.s = a;
+    if (float64_is_zero_or_normal(a) &&
+        hard_to_int(&r, ua.h, rmode, scale, 0, 0x1p64, s)) {
+        return r;
+    }
 
     float64_unpack_canonical(&p, a, s);
     return parts_float_to_uint(&p, rmode, scale, UINT64_MAX, s);
@@ -4183,7 +4336,8 @@ static bfloat16 bfloat16_minmax(bfloat16 a, bfloat16 b,
     return bfloat16_round_pack_canonical(pr, s);
 }
 
-static float32 float32_minmax(float32 a, float32 b, float_status *s, int flags)
+static float32 QEMU_SOFTFLOAT_ATTR
+soft_float32_minmax(float32 a, float32 b, float_status *s, int flags)
 {
     FloatParts64 pa, pb, *pr;
 
@@ -4194,7 +4348,37 @@ static float32 float32_minmax(float32 a, float32 b, float_status *s, int flags)
     return float32_round_pack_canonical(pr, s);
 }
 
-static float64 float64_minmax(float64 a, float64 b, float_status *s, int flags)
+static float32 float32_minmax(float32 a, float32 b, float_status *s, int flags)
+{
+    union_float32 ua, ub;
+    bool ismin = flags & minmax_ismin;
+
+    ua.s = a;
+    ub.s = b;
+
+    /*
+     * Without NaNs, infinities or denormals there are no flags to raise and
+     * no canonicalization to do: the result is one of the inputs.
+     */
+    if (QEMU_NO_HARDFLOAT || unlikely(!f32_is_zon2(ua, ub))) {
+        return soft_float32_minmax(a, b, s, flags);
+    }
+    if (flags & minmax_ismag) {
+        float fa = fabsf(ua.h), fb = fabsf(ub.h);
+
+        if (fa != fb) {
+            return (fa < fb) == ismin ? a : b;
+        }
+    }
+    if (unlikely(ua.h == ub.h)) {
+        /* Only zeroes of different sign compare equal but differ. */
+        return float32_is_neg(a) == ismin ? a : b;
+    }
+    return (ua.h < ub.h) == ismin ? a : b;
+}
+
+static float64 QEMU_SOFTFLOAT_ATTR
+soft_float64_minmax(float64 a, float64 b, float_status *s, int flags)
 {
     FloatParts64 pa, pb, *pr;
 
@@ -4205,6 +4389,35 @@ static float64 float64_minmax(float64 a, float64 b, float_status *s, int flags)
     return float64_round_pack_canonical(pr, s);
 }
 
+static float64 float64_minmax(float64 a, float64 b, float_status *s, int flags)
+{
+    union_float64 ua, ub;
+    bool ismin = flags & minmax_ismin;
+
+    ua.s = a;
+    ub.s = b;
+
+    /*
+     * Without NaNs, infinities or denormals there are no flags to raise and
+     * no canonicalization to do: the result is one of the inputs.
+     */
+    if (QEMU_NO_HARDFLOAT || unlikely(!f64_is_zon2(ua, ub))) {
+        return soft_float64_minmax(a, b, s, flags);
+    }
+    if (flags & minmax_ismag) {
+        double fa = fabs(ua.h), fb = fabs(ub.h);
+
+        if (fa != fb) {
+            return (fa < fb) == ismin ? a : b;
+        }
+    }
+    if (unlikely(ua.h == ub.h)) {
+        /* Only zeroes of different sign compare equal but differ. */
+        return float64_is_neg(a) == ismin ? a : b;
+    }
+    return (ua.h < ub.h) == ismin ? a : b;
+}
+
 static float128 float128_minmax(float128 a, float128 b,
                                 float_status *s, int flags)
 {
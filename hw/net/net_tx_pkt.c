@@ -403,6 +403,27 @@ bool net_tx_pkt_add_raw_fragment(struct NetTxPkt *pkt, hwaddr pa,
     }
 }
 
+bool net_tx_pkt_add_raw_fragment_host(struct NetTxPkt *pkt, void *base,
+    size_t len)
+{
+    struct iovec *ventry;
+    assert(pkt && !pkt->pci_dev);
+
+    if (pkt->raw_frags >= pkt->max_raw_frags) {
+        return false;
+    }
+
+    if (!len) {
+        return true;
+    }
+
+    ventry = &pkt->raw[pkt->raw_frags];
+    ventry->iov_base = base;
+    ventry->iov_len = len;
+    pkt->raw_frags++;
+    return true;
+}
+
 bool net_tx_pkt_has_fragments(struct NetTxPkt *pkt)
 {
     return pkt->raw_frags > 0;
@@ -450,7 +471,8 @@ void net_tx_pkt_reset(struct NetTxPkt *pkt)
     pkt->payload_len = 0;
     pkt->payload_frags = 0;
 
-    if (pkt->max_raw_frags > 0) {
+    /* fragments added without a PCI device were not mapped here */
+    if (pkt->max_raw_frags > 0 && pkt->pci_dev) {
         assert(pkt->raw);
         for (i = 0; i < pkt->raw_frags; i++) {
             assert(pkt->raw[i].iov_base);
@@ -511,6 +533,7 @@ enum {
 };
 
 #define NET_MAX_FRAG_SG_LIST (64)
+#define NET_TX_PKT_MAX_TCP_HDR_LEN (60)
 
 static size_t net_tx_pkt_fetch_fragment(struct NetTxPkt *pkt,
     int *src_idx, size_t *src_offset, struct iovec *dst, int *dst_idx)
@@ -608,15 +631,151 @@ static bool net_tx_pkt_do_sw_fragmentation(struct NetTxPkt *pkt,
     return true;
 }
 
-bool net_tx_pkt_send(struct NetTxPkt *pkt, NetClientState *nc)
+/* Gather the next @len bytes of payload into @dst */
+static int net_tx_pkt_fetch_segment(struct NetTxPkt *pkt,
+    int *src_idx, size_t *src_offset, struct iovec *dst, int dst_max,
+    size_t len)
 {
-    assert(pkt);
+    struct iovec *src = pkt->vec;
+    int dst_idx = 0;
 
-    if (!pkt->has_virt_hdr &&
-        pkt->virt_hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
-        net_tx_pkt_do_sw_csum(pkt);
+    while (len) {
+        if (dst_idx == dst_max ||
+            *src_idx == pkt->payload_frags + NET_TX_PKT_PL_START_FRAG) {
+            return -1;
+        }
+
+        dst[dst_idx].iov_base = src[*src_idx].iov_base + *src_offset;
+        dst[dst_idx].iov_len = MIN(src[*src_idx].iov_len - *src_offset, len);
+
+        *src_offset += dst[dst_idx].iov_len;
+        len -= dst[dst_idx].iov_len;
+
+        if (*src_offset == src[*src_idx].iov_len) {
+            *src_offset = 0;
+            (*src_idx)++;
+        }
+
+        dst_idx++;
     }
 
+    return dst_idx;
+}
+
+/*
+ * Split a TSO packet into TCP segments of at most gso_size bytes of
+ * payload, the same way a NIC would: every segment gets the headers of
+ * the original packet with updated lengths, sequence number, IP
+ * identification and checksums.  FIN and PSH are only kept on the last
+ * segment, CWR only on the first.
+ */
+static bool net_tx_pkt_do_sw_segmentation(struct NetTxPkt *pkt,
+    NetClientState *nc)
+{
+    struct iovec seg[NET_MAX_FRAG_SG_LIST];
+    struct iovec *data = &seg[NET_TX_PKT_FRAGMENT_HEADER_NUM + 1];
+    int data_max = NET_MAX_FRAG_SG_LIST - NET_TX_PKT_FRAGMENT_HEADER_NUM - 1;
+    uint8_t l4_hdr[NET_TX_PKT_MAX_TCP_HDR_LEN];
+    struct tcp_hdr *tcp = (struct tcp_hdr *)l4_hdr;
+    void *l3_iov_base = pkt->vec[NET_TX_PKT_L3HDR_FRAG].iov_base;
+    size_t l3_iov_len = pkt->vec[NET_TX_PKT_L3HDR_FRAG].iov_len;
+    uint16_t l3_proto = eth_get_l3_proto(&pkt->vec[NET_TX_PKT_L2HDR_FRAG], 1,
+        pkt->vec[NET_TX_PKT_L2HDR_FRAG].iov_len);
+    int src_idx = NET_TX_PKT_PL_START_FRAG;
+    size_t src_offset = 0;
+    size_t l4_hdr_len, data_len, offset, len;
+    uint16_t gso_size = pkt->virt_hdr.gso_size;
+    uint16_t ip_id = 0;
+    uint32_t seq, csum_cntr, cso;
+    uint8_t flags;
+    int n;
+
+    if (!gso_size || pkt->payload_len < sizeof(struct tcp_hdr)) {
+        return false;
+    }
+
+    iov_to_buf(&pkt->vec[NET_TX_PKT_PL_START_FRAG], pkt->payload_frags,
+               0, l4_hdr, sizeof(struct tcp_hdr));
+    l4_hdr_len = tcp->th_off * sizeof(uint32_t);
+    if (l4_hdr_len < sizeof(struct tcp_hdr) || l4_hdr_len > pkt->payload_len) {
+        return false;
+    }
+    iov_to_buf(&pkt->vec[NET_TX_PKT_PL_START_FRAG], pkt->payload_frags,
+               0, l4_hdr, l4_hdr_len);
+
+    /* skip the TCP header in the payload */
+    if (net_tx_pkt_fetch_segment(pkt, &src_idx, &src_offset, seg,
+                                 NET_MAX_FRAG_SG_LIST, l4_hdr_len) < 0) {
+        return false;
+    }
+
+    seg[NET_TX_PKT_FRAGMENT_L2_HDR_POS] = pkt->vec[NET_TX_PKT_L2HDR_FRAG];
+    seg[NET_TX_PKT_FRAGMENT_L3_HDR_POS] = pkt->vec[NET_TX_PKT_L3HDR_FRAG];
+    seg[NET_TX_PKT_FRAGMENT_HEADER_NUM].iov_base = l4_hdr;
+    seg[NET_TX_PKT_FRAGMENT_HEADER_NUM].iov_len = l4_hdr_len;
+
+    if (l3_proto == ETH_P_IP) {
+        ip_id = be16_to_cpu(((struct ip_header *)l3_iov_base)->ip_id);
+    }
+    seq = be32_to_cpu(tcp->th_seq);
+    flags = tcp->th_flags;
+    data_len = pkt->payload_len - l4_hdr_len;
+
+    offset = 0;
+    do {
+        len = MIN(gso_size, data_len - offset);
+        n = net_tx_pkt_fetch_segment(pkt, &src_idx, &src_offset,
+                                     data, data_max, len);
+        if (n < 0) {
+            return false;
+        }
+
+        tcp->th_seq = cpu_to_be32(seq + offset);
+        tcp->th_flags = flags;
+        if (offset + len < data_len) {
+            tcp->th_flags &= ~(TH_FIN | TH_PUSH);
+        }
+        if (offset) {
+            tcp->th_flags &= ~TH_CWR;
+        }
+        tcp->th_sum = 0;
+
+        if (l3_proto == ETH_P_IP) {
+            struct ip_header *ip = l3_iov_base;
+
+            ip->ip_len = cpu_to_be16(l3_iov_len + l4_hdr_len + len);
+            ip->ip_id = cpu_to_be16(ip_id++);
+            eth_fix_ip4_checksum(l3_iov_base, l3_iov_len);
+            csum_cntr = eth_calc_ip4_pseudo_hdr_csum(l3_iov_base,
+                                                     l4_hdr_len + len, &cso);
+        } else {
+            struct ip6_header *ip6 = l3_iov_base;
+
+            ip6->ip6_plen = cpu_to_be16(l3_iov_len - sizeof(*ip6) +
+                                        l4_hdr_len + len);
+            csum_cntr = eth_calc_ip6_pseudo_hdr_csum(l3_iov_base,
+                                                     l4_hdr_len + len,
+                                                     IP_PROTO_TCP, &cso);
+        }
+
+        csum_cntr += net_checksum_add(l4_hdr_len, l4_hdr);
+        csum_cntr += net_checksum_add_iov(data, n, 0, len, 0);
+        tcp->th_sum = cpu_to_be16(net_checksum_finish_nozero(csum_cntr));
+
+        net_tx_pkt_sendv(pkt, nc, seg, NET_TX_PKT_FRAGMENT_HEADER_NUM + 1 + n);
+
+        offset += len;
+    } while (offset < data_len);
+
+    return true;
+}
+
+bool net_tx_pkt_send(struct NetTxPkt *pkt, NetClientState *nc)
+{
+    uint8_t gso_type;
+
+    assert(pkt);
+
     /*
      * Since underlying infrastructure does not support IP datagrams longer
      * than 64K we should drop such packets and don't even try to send
@@ -629,6 +788,19 @@ bool net_tx_pkt_send(struct NetTxPkt *pkt, NetClientState *nc)
         }
     }
 
+    /* each segment gets its own checksum */
+    gso_type = pkt->virt_hdr.gso_type & ~VIRTIO_NET_HDR_GSO_ECN;
+    if (!pkt->has_virt_hdr && pkt->l4proto == IP_PROTO_TCP &&
+        (gso_type == VIRTIO_NET_HDR_GSO_TCPV4 ||
+         gso_type == VIRTIO_NET_HDR_GSO_TCPV6)) {
+        return net_tx_pkt_do_sw_segmentation(pkt, nc);
+    }
+
+    if (!pkt->has_virt_hdr &&
+        pkt->virt_hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+        net_tx_pkt_do_sw_csum(pkt);
+    }
+
     if (pkt->has_virt_hdr ||
         pkt->virt_hdr.gso_type == VIRTIO_NET_HDR_GSO_NONE) {
         net_tx_pkt_fix_ip6_payload_len(pkt);
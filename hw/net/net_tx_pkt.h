@@ -100,6 +100,18 @@ net_tx_pkt_setup_vlan_header(struct NetTxPkt *pkt, uint16_t vlan)
 bool net_tx_pkt_add_raw_fragment(struct NetTxPkt *pkt, hwaddr pa,
     size_t len);
 
+/**
+ * populate data fragment that is already mapped into pkt context.
+ * Only valid for packets initialized without a PCI device.
+ *
+ * @pkt:            packet
+ * @base:           host address of fragment
+ * @len:            length of fragment
+ *
+ */
+bool net_tx_pkt_add_raw_fragment_host(struct NetTxPkt *pkt, void *base,
+    size_t len);
+
 /**
  * Fix ip header fields and calculate IP header and pseudo header checksums.
  *
@@ -151,7 +163,8 @@ void net_tx_pkt_dump(struct NetTxPkt *pkt);
 void net_tx_pkt_reset(struct NetTxPkt *pkt);
 
 /**
- * Send packet to qemu. handles sw offloads if vhdr is not supported.
+ * Send packet to qemu. handles sw offloads if vhdr is not supported:
+ * TSO packets are split into TCP segments, UFO packets into IP fragments.
  *
  * @pkt:            packet
  * @nc:             NetClientState
@@ -16,10 +16,12 @@
 #include "qemu/iov.h"
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
+#include "block/aio-wait.h"
 #include "qemu/module.h"
 #include "hw/virtio/virtio.h"
 #include "net/net.h"
 #include "net/checksum.h"
+#include "net/gro.h"
 #include "net/tap.h"
 #include "qemu/error-report.h"
 #include "qemu/timer.h"
@@ -44,7 +46,9 @@
 #include "monitor/qdev.h"
 #include "hw/pci/pci.h"
 #include "net_rx_pkt.h"
+#include "net_tx_pkt.h"
 #include "hw/virtio/vhost.h"
+#include "sysemu/kvm.h"
 #include "sysemu/qtest.h"
 
 #define VIRTIO_NET_VM_VERSION    11
@@ -369,14 +373,66 @@ static void virtio_net_vnet_endian_status(VirtIONet *n, uint8_t status)
     }
 }
 
-static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
+/*
+ * With the "iothreads" property each queue pair, together with the fd
+ * handlers of its peer, runs in an IOThread.  Code running in the main
+ * loop must hold the queue's AioContext lock while it touches the queue.
+ */
+static void virtio_net_queue_acquire(VirtIONetQueue *q)
 {
-    unsigned int dropped = virtqueue_drop_all(vq);
-    if (dropped) {
+    if (q->ctx) {
+        aio_context_acquire(q->ctx);
+    }
+}
+
+static void virtio_net_queue_release(VirtIONetQueue *q)
+{
+    if (q->ctx) {
+        aio_context_release(q->ctx);
+    }
+}
+
+static void virtio_net_acquire_iothreads(VirtIONet *n)
+{
+    int i;
+
+    if (n->dataplane_started) {
+        for (i = 0; i < n->num_iothreads; i++) {
+            aio_context_acquire(iothread_get_aio_context(n->iothreads[i]));
+        }
+    }
+}
+
+static void virtio_net_release_iothreads(VirtIONet *n)
+{
+    int i;
+
+    if (n->dataplane_started) {
+        for (i = n->num_iothreads - 1; i >= 0; i--) {
+            aio_context_release(iothread_get_aio_context(n->iothreads[i]));
+        }
+    }
+}
+
+static void virtio_net_queue_notify(VirtIONetQueue *q, VirtQueue *vq)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(q->n);
+
+    if (q->ctx) {
+        virtio_notify_irqfd(vdev, vq);
+    } else {
         virtio_notify(vdev, vq);
     }
 }
 
+static void virtio_net_drop_tx_queue_data(VirtIONetQueue *q)
+{
+    unsigned int dropped = virtqueue_drop_all(q->tx_vq);
+    if (dropped) {
+        virtio_net_queue_notify(q, q->tx_vq);
+    }
+}
+
 static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -392,6 +448,7 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
         bool queue_started;
         q = &n->vqs[i];
 
+        virtio_net_queue_acquire(q);
         if ((!n->multiqueue && i != 0) || i >= n->curr_queue_pairs) {
             queue_status = 0;
         } else {
@@ -405,6 +462,7 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
         }
 
         if (!q->tx_waiting) {
+            virtio_net_queue_release(q);
             continue;
         }
 
@@ -428,9 +486,10 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
                  * and disabled notification */
                 q->tx_waiting = 0;
                 virtio_queue_set_notification(q->tx_vq, 1);
-                virtio_net_drop_tx_queue_data(vdev, q->tx_vq);
+                virtio_net_drop_tx_queue_data(q);
             }
         }
+        virtio_net_queue_release(q);
     }
 }
 
@@ -567,7 +626,9 @@ static void virtio_net_queue_reset(VirtIODevice *vdev, uint32_t queue_index)
         vhost_net_virtqueue_reset(vdev, nc, queue_index);
     }
 
+    virtio_net_queue_acquire(&n->vqs[vq2q(queue_index)]);
     flush_or_purge_queued_packets(nc);
+    virtio_net_queue_release(&n->vqs[vq2q(queue_index)]);
 }
 
 static void virtio_net_queue_enable(VirtIODevice *vdev, uint32_t queue_index)
@@ -656,6 +717,17 @@ static int peer_has_ufo(VirtIONet *n)
     return n->has_ufo;
 }
 
+/*
+ * Checksum and TCP segmentation offloads are either passed to the peer
+ * in the vnet header, or done by virtio-net itself: TSO packets from the
+ * guest are segmented in software and TCP segments for the guest are
+ * coalesced by GRO.
+ */
+static bool virtio_net_has_offloads(VirtIONet *n)
+{
+    return peer_has_vnet_hdr(n) || n->sw_offload;
+}
+
 static void virtio_net_set_mrg_rx_bufs(VirtIONet *n, int mergeable_rx_bufs,
                                        int version_1, int hash_report)
 {
@@ -782,7 +854,7 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
 
     virtio_add_feature(&features, VIRTIO_NET_F_MAC);
 
-    if (!peer_has_vnet_hdr(n)) {
+    if (!virtio_net_has_offloads(n)) {
         virtio_clear_feature(&features, VIRTIO_NET_F_CSUM);
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO4);
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO6);
@@ -792,7 +864,9 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_TSO4);
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_TSO6);
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_ECN);
+    }
 
+    if (!peer_has_vnet_hdr(n)) {
         virtio_clear_feature(&features, VIRTIO_NET_F_HASH_REPORT);
     }
 
@@ -801,6 +875,11 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_UFO);
     }
 
+    if (n->num_iothreads && !ebpf_rss_is_loaded(&n->ebpf_rss)) {
+        /* See virtio_net_iothreads_realize() */
+        virtio_clear_feature(&features, VIRTIO_NET_F_RSS);
+    }
+
     if (!get_vhost_net(nc->peer)) {
         virtio_add_feature(&features, VIRTIO_F_RING_RESET);
         return features;
@@ -968,7 +1047,7 @@ static void virtio_net_set_features(VirtIODevice *vdev, uint64_t features)
         virtio_has_feature(features, VIRTIO_NET_F_GUEST_TSO6);
     n->rss_data.redirect = virtio_has_feature(features, VIRTIO_NET_F_RSS);
 
-    if (n->has_vnet_hdr) {
+    if (virtio_net_has_offloads(n)) {
         n->curr_guest_offloads =
             virtio_net_guest_offloads_by_features(features);
         virtio_net_apply_guest_offloads(n);
@@ -1057,7 +1136,7 @@ static int virtio_net_handle_offloads(VirtIONet *n, uint8_t cmd,
 
         offloads = virtio_ldq_p(vdev, &offloads);
 
-        if (!n->has_vnet_hdr) {
+        if (!virtio_net_has_offloads(n)) {
             return VIRTIO_NET_ERR;
         }
 
@@ -1536,6 +1615,7 @@ size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
 
 static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
 {
+    VirtIONet *n = VIRTIO_NET(vdev);
     VirtQueueElement *elem;
 
     for (;;) {
@@ -1545,8 +1625,11 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
             break;
         }
 
+        /* Commands change the state used by the receive path */
+        virtio_net_acquire_iothreads(n);
         written = virtio_net_handle_ctrl_iov(vdev, elem->in_sg, elem->in_num,
                                              elem->out_sg, elem->out_num);
+        virtio_net_release_iothreads(n);
         if (written > 0) {
             virtqueue_push(vq, elem, written);
             virtio_notify(vdev, vq);
@@ -1565,8 +1648,11 @@ static void virtio_net_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     int queue_index = vq2q(virtio_get_queue_index(vq));
+    VirtIONetQueue *q = &n->vqs[queue_index];
 
+    virtio_net_queue_acquire(q);
     qemu_flush_queued_packets(qemu_get_subqueue(n->nic, queue_index));
+    virtio_net_queue_release(q);
 }
 
 static bool virtio_net_can_receive(NetClientState *nc)
@@ -1591,6 +1677,22 @@ static bool virtio_net_can_receive(NetClientState *nc)
     return true;
 }
 
+/*
+ * Publish the buffers filled since the last flush.  Inside a burst of
+ * received packets this happens only once, at the end of the burst,
+ * which the netdevs signal outside of an RCU read-side critical section.
+ */
+static void virtio_net_rx_flush(VirtIONetQueue *q)
+{
+    RCU_READ_LOCK_GUARD();
+
+    if (q->rx_pending) {
+        virtqueue_flush(q->rx_vq, q->rx_pending);
+        q->rx_pending = 0;
+        virtio_net_queue_notify(q, q->rx_vq);
+    }
+}
+
 static int virtio_net_has_buffers(VirtIONetQueue *q, int bufsize)
 {
     VirtIONet *n = q->n;
@@ -1636,21 +1738,28 @@ static void virtio_net_hdr_swap(VirtIODevice *vdev, struct virtio_net_hdr *hdr)
  * we should provide a mechanism to disable it to avoid polluting the host
  * cache.
  */
-static void work_around_broken_dhclient(struct virtio_net_hdr *hdr,
-                                        uint8_t *buf, size_t size)
+static bool is_broken_dhclient_packet(const struct virtio_net_hdr *hdr,
+                                      const uint8_t *buf, size_t size)
 {
-    if ((hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) && /* missing csum */
+    return (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) && /* missing csum */
         (size > 27 && size < 1500) && /* normal sized MTU */
         (buf[12] == 0x08 && buf[13] == 0x00) && /* ethertype == IPv4 */
         (buf[23] == 17) && /* ip.protocol == UDP */
-        (buf[34] == 0 && buf[35] == 67)) { /* udp.srcport == bootps */
+        (buf[34] == 0 && buf[35] == 67); /* udp.srcport == bootps */
+}
+
+static void work_around_broken_dhclient(struct virtio_net_hdr *hdr,
+                                        uint8_t *buf, size_t size)
+{
+    if (is_broken_dhclient_packet(hdr, buf, size)) {
         net_checksum_calculate(buf, size, CSUM_UDP);
         hdr->flags &= ~VIRTIO_NET_HDR_F_NEEDS_CSUM;
     }
 }
 
 static void receive_header(VirtIONet *n, const struct iovec *iov, int iov_cnt,
-                           const void *buf, size_t size)
+                           const void *buf, size_t size,
+                           const struct virtio_net_hdr *sw_hdr)
 {
     if (n->has_vnet_hdr) {
         /* FIXME this cast is evil */
@@ -1662,6 +1771,12 @@ static void receive_header(VirtIONet *n, const struct iovec *iov, int iov_cnt,
             virtio_net_hdr_swap(VIRTIO_DEVICE(n), wbuf);
         }
         iov_from_buf(iov, iov_cnt, 0, buf, sizeof(struct virtio_net_hdr));
+    } else if (sw_hdr) {
+        /* built by GRO, in host byte order */
+        struct virtio_net_hdr hdr = *sw_hdr;
+
+        virtio_net_hdr_swap(VIRTIO_DEVICE(n), &hdr);
+        iov_from_buf(iov, iov_cnt, 0, &hdr, sizeof hdr);
     } else {
         struct virtio_net_hdr hdr = {
             .flags = 0,
@@ -1772,8 +1887,9 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
                                   size_t size)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
     unsigned int index = nc->queue_index, new_index = index;
-    struct NetRxPkt *pkt = n->rx_pkt;
+    struct NetRxPkt *pkt;
     uint8_t net_hash_type;
     uint32_t hash;
     bool isip4, isip6, isudp, istcp;
@@ -1789,6 +1905,12 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
         VIRTIO_NET_HASH_REPORT_UDPv6_EX
     };
 
+    /* Per queue pair, as queue pairs may run in different IOThreads */
+    if (!q->rx_pkt) {
+        net_rx_pkt_init(&q->rx_pkt, false);
+    }
+    pkt = q->rx_pkt;
+
     net_rx_pkt_set_protocols(pkt, buf + n->host_hdr_len,
                              size - n->host_hdr_len);
     net_rx_pkt_get_protocols(pkt, &isip4, &isip6, &isudp, &istcp);
@@ -1822,7 +1944,8 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
 }
 
 static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
-                                      size_t size, bool no_rss)
+                                      size_t size, bool no_rss,
+                                      const struct virtio_net_hdr *sw_hdr)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
@@ -1841,9 +1964,14 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
 
     if (!no_rss && n->rss_data.enabled && n->rss_data.enabled_software_rss) {
         int index = virtio_net_process_rss(nc, buf, size);
-        if (index >= 0) {
+        /*
+         * Only steer within the current AioContext.  This is only relevant
+         * with iothreads, when attaching the eBPF program failed at runtime
+         * or when hash reporting forces software RSS.
+         */
+        if (index >= 0 && n->vqs[index].ctx == q->ctx) {
             NetClientState *nc2 = qemu_get_subqueue(n->nic, index);
-            return virtio_net_receive_rcu(nc2, buf, size, true);
+            return virtio_net_receive_rcu(nc2, buf, size, true, sw_hdr);
         }
     }
 
@@ -1904,7 +2032,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                                     sizeof(mhdr.num_buffers));
             }
 
-            receive_header(n, sg, elem->in_num, buf, size);
+            receive_header(n, sg, elem->in_num, buf, size, sw_hdr);
             if (n->rss_data.populate_hash) {
                 offset = sizeof(mhdr);
                 iov_from_buf(sg, elem->in_num, offset,
@@ -1946,12 +2074,14 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
 
     for (j = 0; j < i; j++) {
         /* signal other side */
-        virtqueue_fill(q->rx_vq, elems[j], lens[j], j);
+        virtqueue_fill(q->rx_vq, elems[j], lens[j], q->rx_pending + j);
         g_free(elems[j]);
     }
 
-    virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    q->rx_pending += i;
+    if (!q->rx_burst) {
+        virtio_net_rx_flush(q);
+    }
 
     return size;
 
@@ -1969,7 +2099,190 @@ static ssize_t virtio_net_do_receive(NetClientState *nc, const uint8_t *buf,
 {
     RCU_READ_LOCK_GUARD();
 
-    return virtio_net_receive_rcu(nc, buf, size, false);
+    return virtio_net_receive_rcu(nc, buf, size, false, NULL);
+}
+
+/* Give elems[first] to elems[num - 1] back, in the reverse order of popping */
+static void virtio_net_rx_unpop(VirtIONetQueue *q, VirtQueueElement **elems,
+                                unsigned first, unsigned num)
+{
+    while (num-- > first) {
+        virtqueue_unpop(q->rx_vq, elems[num], 0);
+        g_free(elems[num]);
+    }
+}
+
+/*
+ * Let the peer read the next packet straight into the guest's receive
+ * buffers.  The peer writes the vnet header itself, so this requires the
+ * host and guest headers to be the same, and the packet must not need
+ * RSS or RSC, which look at its contents before picking the buffers.
+ * The size of the packet is only known after the read, so enough buffers
+ * are popped for the largest packet that a peer reads (NET_BUFSIZE) and
+ * the unused ones are given back afterwards.
+ */
+static ssize_t virtio_net_receive_direct(NetClientState *nc, NetReadIOV *read,
+                                         void *opaque)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    VirtQueueElement *elems[VIRTQUEUE_MAX_SIZE];
+    size_t lens[VIRTQUEUE_MAX_SIZE];
+    struct iovec sg[VIRTQUEUE_MAX_SIZE];
+    /* vnet header and enough of the frame for receive_filter() & co. */
+    uint8_t head[sizeof(struct virtio_net_hdr_mrg_rxbuf) + 36] = { };
+    struct virtio_net_hdr hdr;
+    size_t hdr_len = n->host_hdr_len;
+    size_t capacity = 0, offset;
+    unsigned num = 0, used, iovcnt = 0;
+    uint16_t num_buffers;
+    ssize_t size;
+
+    RCU_READ_LOCK_GUARD();
+
+    if (!virtio_net_can_receive(nc) || !n->has_vnet_hdr ||
+        n->host_hdr_len != n->guest_hdr_len || n->rss_data.populate_hash ||
+        (n->rss_data.enabled && n->rss_data.enabled_software_rss) ||
+        n->rsc4_enabled || n->rsc6_enabled) {
+        return -ENOTSUP;
+    }
+
+    /*
+     * Without mergeable buffers, guests only post buffers that are large
+     * enough for any packet if they can receive GSO packets.
+     */
+    if (!n->mergeable_rx_bufs &&
+        !(n->curr_guest_offloads & ((1ULL << VIRTIO_NET_F_GUEST_TSO4) |
+                                    (1ULL << VIRTIO_NET_F_GUEST_TSO6) |
+                                    (1ULL << VIRTIO_NET_F_GUEST_UFO)))) {
+        return -ENOTSUP;
+    }
+
+    while (capacity < NET_BUFSIZE && num < ARRAY_SIZE(elems) &&
+           (n->mergeable_rx_bufs || !num)) {
+        VirtQueueElement *elem;
+
+        elem = virtqueue_pop(q->rx_vq, sizeof(VirtQueueElement));
+        if (!elem) {
+            break;
+        }
+        if (!elem->in_num || iovcnt + elem->in_num > ARRAY_SIZE(sg)) {
+            /* Leave it to the copy path, and its error handling */
+            virtqueue_unpop(q->rx_vq, elem, 0);
+            g_free(elem);
+            break;
+        }
+
+        memcpy(&sg[iovcnt], elem->in_sg, elem->in_num * sizeof(sg[0]));
+        iovcnt += elem->in_num;
+        capacity += iov_size(elem->in_sg, elem->in_num);
+        elems[num++] = elem;
+    }
+
+    if (capacity < NET_BUFSIZE) {
+        virtio_net_rx_unpop(q, elems, 0, num);
+        return -ENOTSUP;
+    }
+    virtio_queue_set_notification(q->rx_vq, 0);
+
+    /*
+     * The buffers hold NET_BUFSIZE bytes, as much as the copy path reads,
+     * so a packet is cut short exactly where it would be there.
+     */
+    size = read(opaque, sg, iovcnt);
+    if (size <= 0) {
+        virtio_net_rx_unpop(q, elems, 0, num);
+        return MAX(size, 0);
+    }
+
+    iov_to_buf(sg, iovcnt, 0, head, MIN(size, sizeof(head)));
+    if (!receive_filter(n, head, size)) {
+        virtio_net_rx_unpop(q, elems, 0, num);
+        return size;
+    }
+
+    memcpy(&hdr, head, sizeof(hdr));
+    if (is_broken_dhclient_packet(&hdr, head + hdr_len, size - hdr_len)) {
+        g_autofree uint8_t *buf = g_malloc(size);
+
+        iov_to_buf(sg, iovcnt, 0, buf, size);
+        work_around_broken_dhclient((struct virtio_net_hdr *)buf,
+                                    buf + hdr_len, size - hdr_len);
+        iov_from_buf(sg, iovcnt, 0, buf, size);
+        memcpy(&hdr, buf, sizeof(hdr));
+    }
+    if (n->needs_vnet_hdr_swap) {
+        virtio_net_hdr_swap(vdev, &hdr);
+        iov_from_buf(sg, iovcnt, 0, &hdr, sizeof(hdr));
+    }
+
+    offset = 0;
+    for (used = 0; offset < size; used++) {
+        lens[used] = MIN(iov_size(elems[used]->in_sg, elems[used]->in_num),
+                         size - offset);
+        offset += lens[used];
+    }
+
+    if (n->mergeable_rx_bufs) {
+        virtio_stw_p(vdev, &num_buffers, used);
+        iov_from_buf(elems[0]->in_sg, elems[0]->in_num,
+                     offsetof(struct virtio_net_hdr_mrg_rxbuf, num_buffers),
+                     &num_buffers, sizeof(num_buffers));
+    }
+
+    virtio_net_rx_unpop(q, elems, used, num);
+    for (num = 0; num < used; num++) {
+        virtqueue_fill(q->rx_vq, elems[num], lens[num], q->rx_pending + num);
+        g_free(elems[num]);
+    }
+
+    q->rx_pending += used;
+    if (!q->rx_burst) {
+        virtio_net_rx_flush(q);
+    }
+
+    return size;
+}
+
+static void virtio_net_gro_output(void *opaque,
+                                  const struct virtio_net_hdr *hdr,
+                                  const uint8_t *buf, size_t size)
+{
+    VirtIONetQueue *q = opaque;
+    int queue_index = vq2q(virtio_get_queue_index(q->rx_vq));
+
+    RCU_READ_LOCK_GUARD();
+
+    virtio_net_receive_rcu(qemu_get_subqueue(q->n->nic, queue_index),
+                           buf, size, false, hdr);
+}
+
+/*
+ * Coalesce the TCP segments received in a burst from a peer without vnet
+ * header support.  Only packets that are sure to fit in the receive queue
+ * are taken by GRO, so that nothing is dropped when they are flushed at
+ * the end of the burst.
+ */
+static bool virtio_net_gro_receive(NetClientState *nc, const uint8_t *buf,
+                                   size_t size)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    size_t needed;
+
+    if (!q->rx_gro || !virtio_net_can_receive(nc)) {
+        return false;
+    }
+
+    needed = net_gro_pending(q->gro) + size +
+             (NET_GRO_MAX_FLOWS + 1) * n->guest_hdr_len;
+    if (!virtio_net_has_buffers(q, needed)) {
+        net_gro_flush(q->gro);
+        return false;
+    }
+
+    return net_gro_receive(q->gro, buf, size);
 }
 
 static void virtio_net_rsc_extract_unit4(VirtioNetRscChain *chain,
@@ -2571,6 +2884,8 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf,
     VirtIONet *n = qemu_get_nic_opaque(nc);
     if ((n->rsc4_enabled || n->rsc6_enabled)) {
         return virtio_net_rsc_receive(nc, buf, size);
+    } else if (virtio_net_gro_receive(nc, buf, size)) {
+        return size;
     } else {
         return virtio_net_do_receive(nc, buf, size);
     }
@@ -2582,13 +2897,12 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
-    VirtIODevice *vdev = VIRTIO_DEVICE(n);
     int ret;
 
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
-    virtio_notify(vdev, q->tx_vq);
+    virtio_net_queue_notify(q, q->tx_vq);
 
-    g_free(q->async_tx.elem);
+    virtqueue_element_free(q->tx_vq, q->async_tx.elem);
     q->async_tx.elem = NULL;
 
     virtio_queue_set_notification(q->tx_vq, 1);
@@ -2611,13 +2925,135 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+
+/* Maximum number of TX elements popped from the virtqueue at a time */
+#define VIRTIO_NET_TX_BATCH 32
+
+/*
+ * Do the checksum and segmentation offloads requested by the guest when
+ * the peer has no vnet header support.  Returns false if there is nothing
+ * to do, i.e. if the packet can be sent as is.
+ */
+static bool virtio_net_tx_sw_offload(VirtIONetQueue *q, NetClientState *nc,
+                                     const struct iovec *out_sg,
+                                     unsigned int out_num)
+{
+    VirtIONet *n = q->n;
+    struct virtio_net_hdr hdr;
+    size_t offset = n->guest_hdr_len;
+    unsigned int i;
+
+    if (iov_to_buf(out_sg, out_num, 0, &hdr, sizeof(hdr)) < sizeof(hdr)) {
+        return false;
+    }
+    virtio_net_hdr_swap(VIRTIO_DEVICE(n), &hdr);
+    if (!(hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) &&
+        hdr.gso_type == VIRTIO_NET_HDR_GSO_NONE) {
+        return false;
+    }
+
+    if (!q->tx_pkt) {
+        net_tx_pkt_init(&q->tx_pkt, NULL, VIRTQUEUE_MAX_SIZE, false);
+    }
+    net_tx_pkt_reset(q->tx_pkt);
+
+    for (i = 0; i < out_num; i++) {
+        if (offset >= out_sg[i].iov_len) {
+            offset -= out_sg[i].iov_len;
+            continue;
+        }
+        net_tx_pkt_add_raw_fragment_host(q->tx_pkt,
+                                         out_sg[i].iov_base + offset,
+                                         out_sg[i].iov_len - offset);
+        offset = 0;
+    }
+
+    /* Packets that cannot be parsed are dropped */
+    if (net_tx_pkt_parse(q->tx_pkt)) {
+        *net_tx_pkt_get_vhdr(q->tx_pkt) = hdr;
+        net_tx_pkt_send(q->tx_pkt, nc);
+    }
+    return true;
+}
+
+/*
+ * Send the packet in @elem.  Returns 0 if @elem can be given back to the
+ * guest, -EBUSY if the packet was queued and virtio_net_tx_complete() will
+ * be called for it, or -EINVAL if the device is broken.
+ */
+static int virtio_net_tx_packet(VirtIONetQueue *q, VirtQueueElement *elem)
+{
+    VirtIONet *n = q->n;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    ssize_t ret;
+    unsigned int out_num;
+    struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
+    struct virtio_net_hdr_mrg_rxbuf mhdr;
+
+    out_num = elem->out_num;
+    out_sg = elem->out_sg;
+    if (out_num < 1) {
+        virtio_error(vdev, "virtio-net header not in first element");
+        return -EINVAL;
+    }
+
+    if (!n->has_vnet_hdr && n->sw_offload &&
+        virtio_net_tx_sw_offload(q, qemu_get_subqueue(n->nic, queue_index),
+                                 out_sg, out_num)) {
+        return 0;
+    }
+
+    if (n->has_vnet_hdr) {
+        if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
+            n->guest_hdr_len) {
+            virtio_error(vdev, "virtio-net header incorrect");
+            return -EINVAL;
+        }
+        if (n->needs_vnet_hdr_swap) {
+            virtio_net_hdr_swap(vdev, (void *) &mhdr);
+            sg2[0].iov_base = &mhdr;
+            sg2[0].iov_len = n->guest_hdr_len;
+            out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1,
+                               out_sg, out_num,
+                               n->guest_hdr_len, -1);
+            if (out_num == VIRTQUEUE_MAX_SIZE) {
+                /* drop */
+                return 0;
+            }
+            out_num += 1;
+            out_sg = sg2;
+        }
+    }
+    /*
+     * If host wants to see the guest header as is, we can
+     * pass it on unchanged. Otherwise, copy just the parts
+     * that host is interested in.
+     */
+    assert(n->host_hdr_len <= n->guest_hdr_len);
+    if (n->host_hdr_len != n->guest_hdr_len) {
+        unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
+                                   out_sg, out_num,
+                                   0, n->host_hdr_len);
+        sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
+                         out_sg, out_num,
+                         n->guest_hdr_len, -1);
+        out_num = sg_num;
+        out_sg = sg;
+    }
+
+    ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
+                                  out_sg, out_num, virtio_net_tx_complete);
+    return ret == 0 ? -EBUSY : 0;
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
-    VirtQueueElement *elem;
+    VirtQueueElement *elems[VIRTIO_NET_TX_BATCH];
     int32_t num_packets = 0;
-    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
         return num_packets;
     }
@@ -2627,80 +3063,50 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         return num_packets;
     }
 
-    for (;;) {
-        ssize_t ret;
-        unsigned int out_num;
-        struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
-        struct virtio_net_hdr_mrg_rxbuf mhdr;
+    while (num_packets < n->tx_burst) {
+        unsigned int i, sent, popped;
+        int ret = 0;
 
-        elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
-        if (!elem) {
+        popped = virtqueue_pop_batch(q->tx_vq, sizeof(VirtQueueElement),
+                                     (void **)elems,
+                                     MIN(n->tx_burst - num_packets,
+                                         VIRTIO_NET_TX_BATCH));
+        if (!popped) {
             break;
         }
 
-        out_num = elem->out_num;
-        out_sg = elem->out_sg;
-        if (out_num < 1) {
-            virtio_error(vdev, "virtio-net header not in first element");
-            virtqueue_detach_element(q->tx_vq, elem, 0);
-            g_free(elem);
-            return -EINVAL;
+        for (sent = 0; sent < popped; sent++) {
+            ret = virtio_net_tx_packet(q, elems[sent]);
+            if (ret) {
+                break;
+            }
         }
 
-        if (n->has_vnet_hdr) {
-            if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
-                n->guest_hdr_len) {
-                virtio_error(vdev, "virtio-net header incorrect");
-                virtqueue_detach_element(q->tx_vq, elem, 0);
-                g_free(elem);
-                return -EINVAL;
-            }
-            if (n->needs_vnet_hdr_swap) {
-                virtio_net_hdr_swap(vdev, (void *) &mhdr);
-                sg2[0].iov_base = &mhdr;
-                sg2[0].iov_len = n->guest_hdr_len;
-                out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1,
-                                   out_sg, out_num,
-                                   n->guest_hdr_len, -1);
-                if (out_num == VIRTQUEUE_MAX_SIZE) {
-                    goto drop;
-                }
-                out_num += 1;
-                out_sg = sg2;
+        /* Complete everything that was sent with a single used index update */
+        if (sent) {
+            virtqueue_push_batch(q->tx_vq, elems, NULL, sent);
+            virtio_net_queue_notify(q, q->tx_vq);
+            for (i = 0; i < sent; i++) {
+                virtqueue_element_free(q->tx_vq, elems[i]);
             }
+            num_packets += sent;
         }
-        /*
-         * If host wants to see the guest header as is, we can
-         * pass it on unchanged. Otherwise, copy just the parts
-         * that host is interested in.
-         */
-        assert(n->host_hdr_len <= n->guest_hdr_len);
-        if (n->host_hdr_len != n->guest_hdr_len) {
-            unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
-                                       out_sg, out_num,
-                                       0, n->host_hdr_len);
-            sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
-                             out_sg, out_num,
-                             n->guest_hdr_len, -1);
-            out_num = sg_num;
-            out_sg = sg;
-        }
-
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
-        if (ret == 0) {
+
+        if (ret == -EBUSY) {
+            /* Give back the rest of the batch, most recent first */
+            for (i = popped - 1; i > sent; i--) {
+                virtqueue_unpop(q->tx_vq, elems[i], 0);
+                virtqueue_element_free(q->tx_vq, elems[i]);
+            }
             virtio_queue_set_notification(q->tx_vq, 0);
-            q->async_tx.elem = elem;
+            q->async_tx.elem = elems[sent];
             return -EBUSY;
-        }
-
-drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
-
-        if (++num_packets >= n->tx_burst) {
-            break;
+        } else if (ret) {
+            for (i = sent; i < popped; i++) {
+                virtqueue_detach_element(q->tx_vq, elems[i], 0);
+                virtqueue_element_free(q->tx_vq, elems[i]);
+            }
+            return ret;
         }
     }
     return num_packets;
@@ -2714,7 +3120,7 @@ static void virtio_net_handle_tx_timer(VirtIODevice *vdev, VirtQueue *vq)
     VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
 
     if (unlikely((n->status & VIRTIO_NET_S_LINK_UP) == 0)) {
-        virtio_net_drop_tx_queue_data(vdev, vq);
+        virtio_net_drop_tx_queue_data(q);
         return;
     }
 
@@ -2742,21 +3148,24 @@ static void virtio_net_handle_tx_bh(VirtIODevice *vdev, VirtQueue *vq)
     VirtIONet *n = VIRTIO_NET(vdev);
     VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
 
+    virtio_net_queue_acquire(q);
     if (unlikely((n->status & VIRTIO_NET_S_LINK_UP) == 0)) {
-        virtio_net_drop_tx_queue_data(vdev, vq);
-        return;
+        virtio_net_drop_tx_queue_data(q);
+        goto out;
     }
 
     if (unlikely(q->tx_waiting)) {
-        return;
+        goto out;
     }
     q->tx_waiting = 1;
     /* This happens when device was stopped but VCPU wasn't. */
     if (!vdev->vm_running) {
-        return;
+        goto out;
     }
     virtio_queue_set_notification(vq, 0);
     qemu_bh_schedule(q->tx_bh);
+out:
+    virtio_net_queue_release(q);
 }
 
 static void virtio_net_tx_timer(void *opaque)
@@ -2809,9 +3218,8 @@ static void virtio_net_tx_timer(void *opaque)
     }
 }
 
-static void virtio_net_tx_bh(void *opaque)
+static void virtio_net_do_tx_bh(VirtIONetQueue *q)
 {
-    VirtIONetQueue *q = opaque;
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     int32_t ret;
@@ -2858,6 +3266,36 @@ static void virtio_net_tx_bh(void *opaque)
     }
 }
 
+static void virtio_net_tx_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+
+    virtio_net_queue_acquire(q);
+    virtio_net_do_tx_bh(q);
+    virtio_net_queue_release(q);
+}
+
+/*
+ * Move the queue pair and its peer to @ctx, or back to the main loop if
+ * @ctx is NULL.  Runs in the thread that currently owns the queue.
+ */
+static void virtio_net_queue_set_ctx(VirtIONetQueue *q, AioContext *ctx)
+{
+    VirtIONet *n = q->n;
+    NetClientState *nc = qemu_get_subqueue(n->nic, q - n->vqs);
+
+    qemu_bh_delete(q->tx_bh);
+    q->tx_bh = ctx ? aio_bh_new(ctx, virtio_net_tx_bh, q)
+                   : qemu_bh_new(virtio_net_tx_bh, q);
+    q->ctx = ctx;
+    if (nc->peer) {
+        qemu_set_net_aio_context(nc->peer, ctx);
+    }
+    if (q->tx_waiting) {
+        qemu_bh_schedule(q->tx_bh);
+    }
+}
+
 static void virtio_net_add_queue(VirtIONet *n, int index)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -2901,6 +3339,15 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
     }
     q->tx_waiting = 0;
     virtio_del_queue(vdev, index * 2 + 1);
+
+    net_gro_free(q->gro);
+    q->gro = NULL;
+    net_tx_pkt_uninit(q->tx_pkt);
+    q->tx_pkt = NULL;
+    if (q->rx_pkt) {
+        net_rx_pkt_uninit(q->rx_pkt);
+        q->rx_pkt = NULL;
+    }
 }
 
 static void virtio_net_change_num_queue_pairs(VirtIONet *n, int new_max_queue_pairs)
@@ -3287,11 +3734,55 @@ static const VMStateDescription vmstate_virtio_net_device = {
     }
 };
 
+static void virtio_net_receive_burst_begin(NetClientState *nc)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    uint64_t offloads = n->curr_guest_offloads;
+    bool tso4 = offloads & (1ULL << VIRTIO_NET_F_GUEST_TSO4);
+    bool tso6 = offloads & (1ULL << VIRTIO_NET_F_GUEST_TSO6);
+
+    if (q->rx_burst++) {
+        return;
+    }
+
+    /*
+     * GRO needs mergeable buffers to know in advance whether the guest
+     * can take the coalesced packets, and would defeat software RSS.
+     */
+    if (!n->has_vnet_hdr && n->sw_offload && n->mergeable_rx_bufs &&
+        !n->rss_data.enabled &&
+        (offloads & (1ULL << VIRTIO_NET_F_GUEST_CSUM)) && (tso4 || tso6)) {
+        if (!q->gro) {
+            q->gro = net_gro_new(virtio_net_gro_output, q);
+        }
+        net_gro_set_offloads(q->gro, tso4, tso6);
+        q->rx_gro = true;
+    }
+}
+
+static void virtio_net_receive_burst_end(NetClientState *nc)
+{
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+
+    assert(q->rx_burst);
+    if (!--q->rx_burst) {
+        if (q->rx_gro) {
+            net_gro_flush(q->gro);
+            q->rx_gro = false;
+        }
+        virtio_net_rx_flush(q);
+    }
+}
+
 static NetClientInfo net_virtio_info = {
     .type = NET_CLIENT_DRIVER_NIC,
     .size = sizeof(NICState),
     .can_receive = virtio_net_can_receive,
     .receive = virtio_net_receive,
+    .receive_burst_begin = virtio_net_receive_burst_begin,
+    .receive_burst_end = virtio_net_receive_burst_end,
+    .receive_direct = virtio_net_receive_direct,
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
     .announce = virtio_net_announce,
@@ -3301,7 +3792,10 @@ static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     NetClientState *nc;
-    assert(n->vhost_started);
+    if (!n->vhost_started) {
+        /* See virtio_net_dataplane_start() */
+        return false;
+    }
     if (!virtio_vdev_has_feature(vdev, VIRTIO_NET_F_MQ) && idx == 2) {
         /* Must guard against invalid features and bogus queue index
          * from being set by malicious guest, or penetrated through
@@ -3324,7 +3818,10 @@ static void virtio_net_guest_notifier_mask(VirtIODevice *vdev, int idx,
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     NetClientState *nc;
-    assert(n->vhost_started);
+    if (!n->vhost_started) {
+        /* See virtio_net_dataplane_start() */
+        return;
+    }
     if (!virtio_vdev_has_feature(vdev, VIRTIO_NET_F_MQ) && idx == 2) {
         /* Must guard against invalid features and bogus queue index
          * from being set by malicious guest, or penetrated through
@@ -3506,6 +4003,256 @@ static bool failover_hide_primary_device(DeviceListener *listener,
     return qatomic_read(&n->failover_primary_hidden);
 }
 
+static IOThread *virtio_net_queue_iothread(VirtIONet *n, int queue_pair)
+{
+    return n->iothreads[queue_pair % n->num_iothreads];
+}
+
+/* Context: QEMU global mutex held */
+static int virtio_net_dataplane_start(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int nvqs = virtio_get_num_queues(vdev);
+    int queue_pairs = (nvqs - 1) / 2;
+    int vq_init_count = 0;
+    int i, r;
+
+    if (!n->num_iothreads) {
+        return virtio_device_start_ioeventfd_impl(vdev);
+    }
+
+    /*
+     * Without vhost nothing in the device can mask the guest notifiers.
+     * With irqfds, let virtio-pci attach and detach them as the guest
+     * masks the vectors, as for vhost-user; otherwise the interrupts go
+     * through the MSI-X emulation, which masks them itself.
+     */
+    vdev->use_guest_notifier_mask = !kvm_msi_via_irqfd_enabled();
+
+    /* Set up guest notifier (irq) */
+    r = k->set_guest_notifiers(qbus->parent, nvqs, true);
+    if (r != 0) {
+        error_report("virtio-net: Failed to set guest notifiers (%d), "
+                     "ensure -accel kvm is set.", r);
+        vdev->use_guest_notifier_mask = true;
+        return r;
+    }
+
+    /*
+     * Batch all the host notifiers in a single transaction to avoid
+     * quadratic time complexity in address_space_update_ioeventfds().
+     */
+    memory_region_transaction_begin();
+
+    for (i = 0; i < nvqs; i++) {
+        r = virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, true);
+        if (r != 0) {
+            goto fail_host_notifiers;
+        }
+        vq_init_count++;
+    }
+
+    memory_region_transaction_commit();
+
+    n->dataplane_started = true;
+
+    for (i = 0; i < queue_pairs; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+        AioContext *ctx =
+            iothread_get_aio_context(virtio_net_queue_iothread(n, i));
+
+        aio_context_acquire(ctx);
+        virtio_net_queue_set_ctx(q, ctx);
+        virtio_queue_aio_attach_host_notifier(q->rx_vq, ctx);
+        virtio_queue_aio_attach_host_notifier(q->tx_vq, ctx);
+        aio_context_release(ctx);
+    }
+
+    /* The control queue stays in the main loop */
+    event_notifier_set_handler(virtio_queue_get_host_notifier(n->ctrl_vq),
+                               virtio_queue_host_notifier_read);
+
+    /* Kick right away to begin processing requests already in vring */
+    for (i = 0; i < nvqs; i++) {
+        event_notifier_set(virtio_queue_get_host_notifier(
+                               virtio_get_queue(vdev, i)));
+    }
+    return 0;
+
+fail_host_notifiers:
+    for (i = 0; i < vq_init_count; i++) {
+        virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+    }
+
+    /*
+     * The transaction expects the ioeventfds to be open when it
+     * commits. Do it now, before the cleanup loop.
+     */
+    memory_region_transaction_commit();
+
+    for (i = 0; i < vq_init_count; i++) {
+        virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
+    }
+    k->set_guest_notifiers(qbus->parent, nvqs, false);
+    vdev->use_guest_notifier_mask = true;
+    return r;
+}
+
+/* Context: in IOThread */
+static void virtio_net_dataplane_stop_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+
+    virtio_queue_aio_detach_host_notifier(q->rx_vq, q->ctx);
+    virtio_queue_aio_detach_host_notifier(q->tx_vq, q->ctx);
+    virtio_net_queue_set_ctx(q, NULL);
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_net_dataplane_stop(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int nvqs = virtio_get_num_queues(vdev);
+    int queue_pairs = (nvqs - 1) / 2;
+    int i;
+
+    if (!n->num_iothreads) {
+        virtio_device_stop_ioeventfd_impl(vdev);
+        return;
+    }
+
+    if (!n->dataplane_started) {
+        return;
+    }
+
+    event_notifier_set_handler(virtio_queue_get_host_notifier(n->ctrl_vq),
+                               NULL);
+
+    for (i = 0; i < queue_pairs; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+        AioContext *ctx = q->ctx;
+
+        aio_context_acquire(ctx);
+        aio_wait_bh_oneshot(ctx, virtio_net_dataplane_stop_bh, q);
+        aio_context_release(ctx);
+    }
+    n->dataplane_started = false;
+
+    /*
+     * Batch all the host notifiers in a single transaction to avoid
+     * quadratic time complexity in address_space_update_ioeventfds().
+     */
+    memory_region_transaction_begin();
+
+    for (i = 0; i < nvqs; i++) {
+        virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+    }
+
+    /*
+     * The transaction expects the ioeventfds to be open when it
+     * commits. Do it now, before the cleanup loop.
+     */
+    memory_region_transaction_commit();
+
+    for (i = 0; i < nvqs; i++) {
+        virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
+    }
+
+    /* Clean up guest notifier (irq) */
+    k->set_guest_notifiers(qbus->parent, nvqs, false);
+    vdev->use_guest_notifier_mask = true;
+}
+
+static bool virtio_net_iothreads_realize(VirtIONet *n, Error **errp)
+{
+    int i;
+
+    if (!n->num_iothreads) {
+        return true;
+    }
+
+    if (n->net_conf.tx && !strcmp(n->net_conf.tx, "timer")) {
+        error_setg(errp, "iothreads require tx=bh");
+        return false;
+    }
+    if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSC_EXT)) {
+        error_setg(errp, "iothreads are not compatible with guest_rsc_ext");
+        return false;
+    }
+    for (i = 0; i < n->nic_conf.peers.queues; i++) {
+        NetClientState *peer = n->nic_conf.peers.ncs[i];
+
+        if (get_vhost_net(peer)) {
+            error_setg(errp, "iothreads are not compatible with vhost");
+            return false;
+        }
+        if (!qemu_has_net_aio_context(peer)) {
+            error_setg(errp, "netdev '%s' cannot run in an IOThread",
+                       peer->name);
+            return false;
+        }
+        /*
+         * Filters run timers and nested event loops of their own in the
+         * main loop, without the AioContext lock of the queue.
+         */
+        if (!QTAILQ_EMPTY(&peer->filters)) {
+            error_setg(errp, "iothreads are not compatible with the net "
+                       "filters of netdev '%s'", peer->name);
+            return false;
+        }
+        /*
+         * Software RSS would hand packets to queue pairs owned by other
+         * IOThreads, so steering has to happen in the netdev with eBPF.
+         */
+        if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSS) &&
+            !peer->info->set_steering_ebpf) {
+            error_setg(errp, "rss=on with iothreads requires eBPF steering "
+                       "support in netdev '%s'", peer->name);
+            return false;
+        }
+    }
+
+    n->iothreads = g_new0(IOThread *, n->num_iothreads);
+    for (i = 0; i < n->num_iothreads; i++) {
+        IOThread *iothread = iothread_by_id(n->iothread_ids[i]);
+
+        if (!iothread) {
+            error_setg(errp, "IOThread '%s' not found",
+                       n->iothread_ids[i] ? n->iothread_ids[i] : "");
+            goto fail;
+        }
+        object_ref(OBJECT(iothread));
+        n->iothreads[i] = iothread;
+    }
+    return true;
+
+fail:
+    while (--i >= 0) {
+        object_unref(OBJECT(n->iothreads[i]));
+    }
+    g_free(n->iothreads);
+    n->iothreads = NULL;
+    return false;
+}
+
+static void virtio_net_iothreads_unrealize(VirtIONet *n)
+{
+    int i;
+
+    if (!n->iothreads) {
+        return;
+    }
+    for (i = 0; i < n->num_iothreads; i++) {
+        object_unref(OBJECT(n->iothreads[i]));
+    }
+    g_free(n->iothreads);
+    n->iothreads = NULL;
+}
+
 static void virtio_net_device_realize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
@@ -3600,6 +4347,12 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         virtio_cleanup(vdev);
         return;
     }
+
+    if (!virtio_net_iothreads_realize(n, errp)) {
+        virtio_cleanup(vdev);
+        return;
+    }
+
     n->vqs = g_new0(VirtIONetQueue, n->max_queue_pairs);
     n->curr_queue_pairs = 1;
     n->tx_timeout = n->net_conf.txtimer;
@@ -3641,6 +4394,7 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
 
     for (i = 0; i < n->max_queue_pairs; i++) {
         n->nic->ncs[i].do_not_pad = true;
+        n->nic->ncs[i].in_iothread = n->num_iothreads > 0;
     }
 
     peer_test_vnet_hdr(n);
@@ -3676,8 +4430,6 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
     QTAILQ_INIT(&n->rsc_chains);
     n->qdev = dev;
 
-    net_rx_pkt_init(&n->rx_pkt, false);
-
     if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSS)) {
         virtio_net_load_ebpf(n);
     }
@@ -3723,7 +4475,7 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     qemu_del_nic(n->nic);
     virtio_net_rsc_cleanup(n);
     g_free(n->rss_data.indirections_table);
-    net_rx_pkt_uninit(n->rx_pkt);
+    virtio_net_iothreads_unrealize(n);
     virtio_cleanup(vdev);
 }
 
@@ -3860,6 +4612,7 @@ static Property virtio_net_properties[] = {
     DEFINE_PROP_INT32("speed", VirtIONet, net_conf.speed, SPEED_UNKNOWN),
     DEFINE_PROP_STRING("duplex", VirtIONet, net_conf.duplex_str),
     DEFINE_PROP_BOOL("failover", VirtIONet, failover, false),
+    DEFINE_PROP_BOOL("sw-offload", VirtIONet, sw_offload, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -3889,6 +4642,8 @@ static void virtio_net_class_init(ObjectClass *klass, void *data)
     vdc->vmsd = &vmstate_virtio_net_device;
     vdc->primary_unplug_pending = primary_unplug_pending;
     vdc->get_vhost = virtio_net_get_vhost;
+    vdc->start_ioeventfd = virtio_net_dataplane_start;
+    vdc->stop_ioeventfd = virtio_net_dataplane_stop;
 }
 
 static const TypeInfo virtio_net_info = {
@@ -99,7 +99,7 @@ static void virtio_scsi_free_req(VirtIOSCSIReq *req)
 {
     qemu_iovec_destroy(&req->resp_iov);
     qemu_sglist_destroy(&req->qsgl);
-    g_free(req);
+    virtqueue_element_free(req->vq, req);
 }
 
 static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
@@ -224,6 +224,23 @@ static VirtIOSCSIReq *virtio_scsi_pop_req(VirtIOSCSI *s, VirtQueue *vq)
     return req;
 }
 
+/* Maximum number of command requests popped from a virtqueue at a time */
+#define VIRTIO_SCSI_POP_BATCH 16
+
+static unsigned int virtio_scsi_pop_reqs(VirtIOSCSI *s, VirtQueue *vq,
+                                         VirtIOSCSIReq **reqs)
+{
+    VirtIOSCSICommon *vs = (VirtIOSCSICommon *)s;
+    unsigned int i, num;
+
+    num = virtqueue_pop_batch(vq, sizeof(VirtIOSCSIReq) + vs->cdb_size,
+                              (void **)reqs, VIRTIO_SCSI_POP_BATCH);
+    for (i = 0; i < num; i++) {
+        virtio_scsi_init_req(s, vq, reqs[i]);
+    }
+    return num;
+}
+
 static void virtio_scsi_save_request(QEMUFile *f, SCSIRequest *sreq)
 {
     VirtIOSCSIReq *req = sreq->hba_private;
@@ -725,7 +742,9 @@ static void virtio_scsi_handle_cmd_req_submit(VirtIOSCSI *s, VirtIOSCSIReq *req)
 
 static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
 {
+    VirtIOSCSIReq *batch[VIRTIO_SCSI_POP_BATCH];
     VirtIOSCSIReq *req, *next;
+    unsigned int i, num;
     int ret = 0;
     bool suppress_notifications = virtio_queue_get_notification(vq);
 
@@ -736,19 +755,27 @@ static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_scsi_pop_req(s, vq))) {
-            ret = virtio_scsi_handle_cmd_req_prepare(s, req);
-            if (!ret) {
-                QTAILQ_INSERT_TAIL(&reqs, req, next);
-            } else if (ret == -EINVAL) {
-                /* The device is broken and shouldn't process any request */
-                while (!QTAILQ_EMPTY(&reqs)) {
-                    req = QTAILQ_FIRST(&reqs);
-                    QTAILQ_REMOVE(&reqs, req, next);
-                    blk_io_unplug(req->sreq->dev->conf.blk);
-                    scsi_req_unref(req->sreq);
-                    virtqueue_detach_element(req->vq, &req->elem, 0);
-                    virtio_scsi_free_req(req);
+        while ((num = virtio_scsi_pop_reqs(s, vq, batch))) {
+            for (i = 0; i < num; i++) {
+                req = batch[i];
+                ret = virtio_scsi_handle_cmd_req_prepare(s, req);
+                if (!ret) {
+                    QTAILQ_INSERT_TAIL(&reqs, req, next);
+                } else if (ret == -EINVAL) {
+                    /* The device is broken and shouldn't process any request */
+                    while (!QTAILQ_EMPTY(&reqs)) {
+                        req = QTAILQ_FIRST(&reqs);
+                        QTAILQ_REMOVE(&reqs, req, next);
+                        blk_io_unplug(req->sreq->dev->conf.blk);
+                        scsi_req_unref(req->sreq);
+                        virtqueue_detach_element(req->vq, &req->elem, 0);
+                        virtio_scsi_free_req(req);
+                    }
+                    /* nor the rest of the batch */
+                    while (++i < num) {
+                        virtqueue_detach_element(vq, &batch[i]->elem, 0);
+                        virtio_scsi_free_req(batch[i]);
+                    }
                 }
             }
         }
@@ -15,6 +15,7 @@
 #include "qemu/main-loop.h"
 #include "qemu/log.h"
 #include "qemu/memalign.h"
+#include "qemu/timer.h"
 #include "linux-headers/linux/vhost.h"
 
 /**
@@ -34,6 +35,7 @@ bool vhost_svq_valid_features(uint64_t features, Error **errp)
         switch (b) {
         case VIRTIO_F_ANY_LAYOUT:
         case VIRTIO_RING_F_EVENT_IDX:
+        case VIRTIO_F_RING_PACKED:
             continue;
 
         case VIRTIO_F_ACCESS_PLATFORM:
@@ -68,7 +70,7 @@ bool vhost_svq_valid_features(uint64_t features, Error **errp)
  */
 static uint16_t vhost_svq_available_slots(const VhostShadowVirtqueue *svq)
 {
-    return svq->vring.num - (svq->shadow_avail_idx - svq->shadow_used_idx);
+    return svq->num_free;
 }
 
 /**
@@ -165,10 +167,10 @@ static bool vhost_svq_vring_write_descs(VhostShadowVirtqueue *svq, hwaddr *sg,
         descs[i].len = cpu_to_le32(iovec[n].iov_len);
 
         last = i;
-        i = cpu_to_le16(svq->desc_next[i]);
+        i = svq->desc_next[i];
     }
 
-    svq->free_head = le16_to_cpu(svq->desc_next[last]);
+    svq->free_head = svq->desc_next[last];
     return true;
 }
 
@@ -204,36 +206,152 @@ static bool vhost_svq_add_split(VhostShadowVirtqueue *svq,
 
     /*
      * Put the entry in the available array (but don't update avail->idx until
-     * they do sync).
+     * the device is kicked).
      */
     avail_idx = svq->shadow_avail_idx & (svq->vring.num - 1);
     avail->ring[avail_idx] = cpu_to_le16(*head);
     svq->shadow_avail_idx++;
+    svq->num_added++;
+    svq->num_free -= out_num + in_num;
 
-    /* Update the avail index after write the descriptor */
-    smp_wmb();
-    avail->idx = cpu_to_le16(svq->shadow_avail_idx);
+    return true;
+}
+
+/**
+ * Write a chain of descriptors to the SVQ packed vring
+ *
+ * The flags of the first descriptor are written last, so the device never
+ * sees a partially written chain.  Descriptors are given a single buffer
+ * id, taken from the free list.
+ */
+static bool vhost_svq_add_packed(VhostShadowVirtqueue *svq,
+                                 const struct iovec *out_sg, size_t out_num,
+                                 const struct iovec *in_sg, size_t in_num,
+                                 unsigned *head)
+{
+    struct vring_packed_desc *descs = svq->vring_packed.desc;
+    size_t num = out_num + in_num;
+    uint16_t id = svq->free_head;
+    uint16_t i = svq->shadow_avail_idx;
+    uint16_t head_idx = i, head_flags = 0;
+    bool wrap_counter = svq->avail_wrap_counter;
+    g_autofree hwaddr *sgs = g_new(hwaddr, num);
+    bool ok;
+
+    /* We need some descriptors here */
+    if (unlikely(!num)) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "Guest provided element with no descriptors");
+        return false;
+    }
 
+    ok = vhost_svq_translate_addr(svq, sgs, out_sg, out_num);
+    if (unlikely(!ok)) {
+        return false;
+    }
+
+    ok = vhost_svq_translate_addr(svq, sgs + out_num, in_sg, in_num);
+    if (unlikely(!ok)) {
+        return false;
+    }
+
+    for (size_t n = 0; n < num; n++) {
+        const struct iovec *iov = n < out_num ? &out_sg[n]
+                                              : &in_sg[n - out_num];
+        uint16_t flags = wrap_counter ? BIT(VRING_PACKED_DESC_F_AVAIL)
+                                      : BIT(VRING_PACKED_DESC_F_USED);
+
+        if (n >= out_num) {
+            flags |= VRING_DESC_F_WRITE;
+        }
+        if (n + 1 < num) {
+            flags |= VRING_DESC_F_NEXT;
+        }
+
+        descs[i].addr = cpu_to_le64(sgs[n]);
+        descs[i].len = cpu_to_le32(iov->iov_len);
+        descs[i].id = cpu_to_le16(id);
+        if (n == 0) {
+            head_flags = flags;
+        } else {
+            descs[i].flags = cpu_to_le16(flags);
+        }
+
+        if (++i == svq->vring_packed.num) {
+            i = 0;
+            wrap_counter = !wrap_counter;
+        }
+    }
+
+    /* Expose the chain to the device after writing the other descriptors */
+    smp_wmb();
+    descs[head_idx].flags = cpu_to_le16(head_flags);
+
+    svq->shadow_avail_idx = i;
+    svq->avail_wrap_counter = wrap_counter;
+    svq->num_free -= num;
+    svq->num_added += num;
+    svq->free_head = svq->desc_next[id];
+    *head = id;
     return true;
 }
 
+static bool vhost_svq_packed_needs_kick(const VhostShadowVirtqueue *svq)
+{
+    const struct vring_packed_desc_event *event = svq->vring_packed.device;
+    uint16_t flags = le16_to_cpu(qatomic_read(&event->flags));
+    uint16_t off_wrap, event_idx;
+
+    if (flags != VRING_PACKED_EVENT_FLAG_DESC) {
+        return flags != VRING_PACKED_EVENT_FLAG_DISABLE;
+    }
+
+    off_wrap = le16_to_cpu(qatomic_read(&event->off_wrap));
+    event_idx = off_wrap & ~BIT(VRING_PACKED_EVENT_F_WRAP_CTR);
+    if ((off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) !=
+        svq->avail_wrap_counter) {
+        event_idx -= svq->vring_packed.num;
+    }
+
+    return vring_need_event(event_idx, svq->shadow_avail_idx,
+                            svq->shadow_avail_idx - svq->num_added);
+}
+
+/**
+ * Expose the entries added since the last kick to the device, and kick it if
+ * it wants to be notified of them.
+ */
 static void vhost_svq_kick(VhostShadowVirtqueue *svq)
 {
     bool needs_kick;
 
+    if (!svq->num_added) {
+        return;
+    }
+
+    if (!svq->is_packed) {
+        /* Update the avail index after write the descriptor */
+        smp_wmb();
+        svq->vring.avail->idx = cpu_to_le16(svq->shadow_avail_idx);
+    }
+
     /*
      * We need to expose the available array entries before checking the used
      * flags
      */
     smp_mb();
 
-    if (virtio_vdev_has_feature(svq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    if (svq->is_packed) {
+        needs_kick = vhost_svq_packed_needs_kick(svq);
+    } else if (virtio_vdev_has_feature(svq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
         uint16_t avail_event = *(uint16_t *)(&svq->vring.used->ring[svq->vring.num]);
-        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx, svq->shadow_avail_idx - 1);
+        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx,
+                                      svq->shadow_avail_idx - svq->num_added);
     } else {
         needs_kick = !(svq->vring.used->flags & VRING_USED_F_NO_NOTIFY);
     }
 
+    svq->num_added = 0;
     if (!needs_kick) {
         return;
     }
@@ -241,14 +359,14 @@ static void vhost_svq_kick(VhostShadowVirtqueue *svq)
     event_notifier_set(&svq->hdev_kick);
 }
 
-/**
- * Add an element to a SVQ.
- *
- * Return -EINVAL if element is invalid, -ENOSPC if dev queue is full
+/*
+ * Add an element to a SVQ without exposing it to the device, see
+ * vhost_svq_add().
  */
-int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
-                  size_t out_num, const struct iovec *in_sg, size_t in_num,
-                  VirtQueueElement *elem)
+static int vhost_svq_add_nokick(VhostShadowVirtqueue *svq,
+                                const struct iovec *out_sg, size_t out_num,
+                                const struct iovec *in_sg, size_t in_num,
+                                VirtQueueElement *elem)
 {
     unsigned qemu_head;
     unsigned ndescs = in_num + out_num;
@@ -258,23 +376,115 @@ int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
         return -ENOSPC;
     }
 
-    ok = vhost_svq_add_split(svq, out_sg, out_num, in_sg, in_num, &qemu_head);
+    if (svq->is_packed) {
+        ok = vhost_svq_add_packed(svq, out_sg, out_num, in_sg, in_num,
+                                  &qemu_head);
+    } else {
+        ok = vhost_svq_add_split(svq, out_sg, out_num, in_sg, in_num,
+                                 &qemu_head);
+    }
     if (unlikely(!ok)) {
         return -EINVAL;
     }
 
     svq->desc_state[qemu_head].elem = elem;
     svq->desc_state[qemu_head].ndescs = ndescs;
-    vhost_svq_kick(svq);
     return 0;
 }
 
-/* Convenience wrapper to add a guest's element to SVQ */
+/**
+ * Add an element to a SVQ.
+ *
+ * Return -EINVAL if element is invalid, -ENOSPC if dev queue is full
+ */
+int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
+                  size_t out_num, const struct iovec *in_sg, size_t in_num,
+                  VirtQueueElement *elem)
+{
+    int r = vhost_svq_add_nokick(svq, out_sg, out_num, in_sg, in_num, elem);
+
+    if (likely(r == 0)) {
+        vhost_svq_kick(svq);
+    }
+    return r;
+}
+
+/*
+ * Convenience wrapper to add a guest's element to SVQ.  The device is kicked
+ * once all the available guest's elements have been added.
+ */
 static int vhost_svq_add_element(VhostShadowVirtqueue *svq,
                                  VirtQueueElement *elem)
 {
-    return vhost_svq_add(svq, elem->out_sg, elem->out_num, elem->in_sg,
-                         elem->in_num, elem);
+    return vhost_svq_add_nokick(svq, elem->out_sg, elem->out_num, elem->in_sg,
+                                elem->in_num, elem);
+}
+
+static void vhost_svq_start_polling(VhostShadowVirtqueue *svq);
+
+/**
+ * Forward the guest's available buffers to the device until the guest
+ * vring is empty or SVQ is full, and kick the device once for all of them.
+ *
+ * @svq: Shadow VirtQueue
+ * @forwarded: Number of buffers forwarded
+ *
+ * Returns false if SVQ is full or the guest buffers are broken.
+ */
+static bool vhost_svq_forward_avail(VhostShadowVirtqueue *svq,
+                                    unsigned *forwarded)
+{
+    bool ok = true;
+    unsigned n = 0;
+
+    while (true) {
+        g_autofree VirtQueueElement *elem = NULL;
+        int r;
+
+        if (svq->next_guest_avail_elem) {
+            elem = g_steal_pointer(&svq->next_guest_avail_elem);
+        } else {
+            elem = virtqueue_pop(svq->vq, sizeof(*elem));
+        }
+
+        if (!elem) {
+            break;
+        }
+
+        if (svq->ops) {
+            r = svq->ops->avail_handler(svq, elem, svq->ops_opaque);
+        } else {
+            r = vhost_svq_add_element(svq, elem);
+        }
+        if (unlikely(r != 0)) {
+            if (r == -ENOSPC) {
+                /*
+                 * This condition is possible since a contiguous buffer in
+                 * GPA does not imply a contiguous buffer in qemu's VA
+                 * scatter-gather segments. If that happens, the buffer
+                 * exposed to the device needs to be a chain of descriptors
+                 * at this moment.
+                 *
+                 * SVQ cannot hold more available buffers if we are here:
+                 * queue the current guest descriptor and ignore kicks
+                 * until some elements are used.
+                 */
+                svq->next_guest_avail_elem = g_steal_pointer(&elem);
+            }
+
+            /* VQ is full or broken */
+            ok = false;
+            break;
+        }
+        /* elem belongs to SVQ or external caller now */
+        elem = NULL;
+        n++;
+    }
+
+    /* Expose all the buffers added above with a single kick */
+    vhost_svq_kick(svq);
+    *forwarded = n;
+    return ok;
 }
 
 /**
@@ -292,53 +502,24 @@ static int vhost_svq_add_element(VhostShadowVirtqueue *svq,
  */
 static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
 {
+    unsigned forwarded;
+
     /* Clear event notifier */
     event_notifier_test_and_clear(&svq->svq_kick);
 
+    if (svq->poll_ns) {
+        vhost_svq_start_polling(svq);
+        vhost_svq_forward_avail(svq, &forwarded);
+        return;
+    }
+
     /* Forward to the device as many available buffers as possible */
     do {
         virtio_queue_set_notification(svq->vq, false);
 
-        while (true) {
-            g_autofree VirtQueueElement *elem = NULL;
-            int r;
-
-            if (svq->next_guest_avail_elem) {
-                elem = g_steal_pointer(&svq->next_guest_avail_elem);
-            } else {
-                elem = virtqueue_pop(svq->vq, sizeof(*elem));
-            }
-
-            if (!elem) {
-                break;
-            }
-
-            if (svq->ops) {
-                r = svq->ops->avail_handler(svq, elem, svq->ops_opaque);
-            } else {
-                r = vhost_svq_add_element(svq, elem);
-            }
-            if (unlikely(r != 0)) {
-                if (r == -ENOSPC) {
-                    /*
-                     * This condition is possible since a contiguous buffer in
-                     * GPA does not imply a contiguous buffer in qemu's VA
-                     * scatter-gather segments. If that happens, the buffer
-                     * exposed to the device needs to be a chain of descriptors
-                     * at this moment.
-                     *
-                     * SVQ cannot hold more available buffers if we are here:
-                     * queue the current guest descriptor and ignore kicks
-                     * until some elements are used.
-                     */
-                    svq->next_guest_avail_elem = g_steal_pointer(&elem);
-                }
-
-                /* VQ is full or broken, just return and ignore kicks */
-                return;
-            }
-            /* elem belongs to SVQ or external caller now */
-            elem = NULL;
+        if (!vhost_svq_forward_avail(svq, &forwarded)) {
+            /* VQ is full or broken, just return and ignore kicks */
+            return;
         }
 
         virtio_queue_set_notification(svq->vq, true);
@@ -357,9 +538,25 @@ static void vhost_handle_guest_kick_notifier(EventNotifier *n)
     vhost_handle_guest_kick(svq);
 }
 
+static bool vhost_svq_more_used_packed(const VhostShadowVirtqueue *svq)
+{
+    const struct vring_packed_desc *desc =
+        &svq->vring_packed.desc[svq->last_used_idx];
+    uint16_t flags = le16_to_cpu(qatomic_read(&desc->flags));
+    bool avail = flags & BIT(VRING_PACKED_DESC_F_AVAIL);
+    bool used = flags & BIT(VRING_PACKED_DESC_F_USED);
+
+    return avail == used && used == svq->used_wrap_counter;
+}
+
 static bool vhost_svq_more_used(VhostShadowVirtqueue *svq)
 {
     uint16_t *used_idx = &svq->vring.used->idx;
+
+    if (svq->is_packed) {
+        return vhost_svq_more_used_packed(svq);
+    }
+
     if (svq->last_used_idx != svq->shadow_used_idx) {
         return true;
     }
@@ -380,7 +577,19 @@ static bool vhost_svq_more_used(VhostShadowVirtqueue *svq)
  */
 static bool vhost_svq_enable_notification(VhostShadowVirtqueue *svq)
 {
-    if (virtio_vdev_has_feature(svq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    if (svq->is_packed) {
+        struct vring_packed_desc_event *event = svq->vring_packed.driver;
+
+        if (virtio_vdev_has_feature(svq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+            event->off_wrap = cpu_to_le16(svq->last_used_idx |
+                (svq->used_wrap_counter << VRING_PACKED_EVENT_F_WRAP_CTR));
+            /* Make sure off_wrap is written before flags */
+            smp_wmb();
+            event->flags = cpu_to_le16(VRING_PACKED_EVENT_FLAG_DESC);
+        } else {
+            event->flags = cpu_to_le16(VRING_PACKED_EVENT_FLAG_ENABLE);
+        }
+    } else if (virtio_vdev_has_feature(svq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
         uint16_t *used_event = (uint16_t *)&svq->vring.avail->ring[svq->vring.num];
         *used_event = svq->shadow_used_idx;
     } else {
@@ -394,6 +603,12 @@ static bool vhost_svq_enable_notification(VhostShadowVirtqueue *svq)
 
 static void vhost_svq_disable_notification(VhostShadowVirtqueue *svq)
 {
+    if (svq->is_packed) {
+        svq->vring_packed.driver->flags =
+            cpu_to_le16(VRING_PACKED_EVENT_FLAG_DISABLE);
+        return;
+    }
+
     /*
      * No need to disable notification in the event idx case, since used event
      * index is already an index too far away.
@@ -407,12 +622,51 @@ static uint16_t vhost_svq_last_desc_of_chain(const VhostShadowVirtqueue *svq,
                                              uint16_t num, uint16_t i)
 {
     for (uint16_t j = 0; j < (num - 1); ++j) {
-        i = le16_to_cpu(svq->desc_next[i]);
+        i = svq->desc_next[i];
     }
 
     return i;
 }
 
+static VirtQueueElement *vhost_svq_get_buf_packed(VhostShadowVirtqueue *svq,
+                                                  uint32_t *len)
+{
+    const struct vring_packed_desc *desc =
+        &svq->vring_packed.desc[svq->last_used_idx];
+    uint16_t id, num;
+
+    /* Only read the descriptor after it has been exposed by dev */
+    smp_rmb();
+    id = le16_to_cpu(desc->id);
+    if (unlikely(id >= svq->vring_packed.num)) {
+        qemu_log_mask(LOG_GUEST_ERROR, "Device %s says index %u is used",
+                      svq->vdev->name, id);
+        return NULL;
+    }
+
+    num = svq->desc_state[id].ndescs;
+    if (unlikely(!num)) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+            "Device %s says index %u is used, but it was not available",
+            svq->vdev->name, id);
+        return NULL;
+    }
+
+    /* The device writes a single used descriptor for the whole chain */
+    svq->desc_state[id].ndescs = 0;
+    svq->num_free += num;
+    svq->last_used_idx += num;
+    if (svq->last_used_idx >= svq->vring_packed.num) {
+        svq->last_used_idx -= svq->vring_packed.num;
+        svq->used_wrap_counter = !svq->used_wrap_counter;
+    }
+    svq->desc_next[id] = svq->free_head;
+    svq->free_head = id;
+
+    *len = le32_to_cpu(desc->len);
+    return g_steal_pointer(&svq->desc_state[id].elem);
+}
+
 static VirtQueueElement *vhost_svq_get_buf(VhostShadowVirtqueue *svq,
                                            uint32_t *len)
 {
@@ -424,6 +678,10 @@ static VirtQueueElement *vhost_svq_get_buf(VhostShadowVirtqueue *svq,
         return NULL;
     }
 
+    if (svq->is_packed) {
+        return vhost_svq_get_buf_packed(svq, len);
+    }
+
     /* Only get used array entries after they have been exposed by dev */
     smp_rmb();
     last_used = svq->last_used_idx & (svq->vring.num - 1);
@@ -449,6 +707,7 @@ static VirtQueueElement *vhost_svq_get_buf(VhostShadowVirtqueue *svq,
     last_used_chain = vhost_svq_last_desc_of_chain(svq, num, used_elem.id);
     svq->desc_next[last_used_chain] = svq->free_head;
     svq->free_head = used_elem.id;
+    svq->num_free += num;
 
     *len = used_elem.len;
     return g_steal_pointer(&svq->desc_state[used_elem.id].elem);
@@ -470,47 +729,131 @@ void vhost_svq_push_elem(VhostShadowVirtqueue *svq,
     }
 }
 
-static void vhost_svq_flush(VhostShadowVirtqueue *svq,
-                            bool check_for_avail_queue)
+/**
+ * Forward the device's used buffers to the guest, updating the guest's used
+ * index and notifying the guest once for all of them.
+ *
+ * @svq: Shadow VirtQueue
+ * @check_for_avail_queue: Forward pending available buffers too
+ *
+ * Returns the number of buffers forwarded, or -1 if the device is broken.
+ */
+static int vhost_svq_forward_used(VhostShadowVirtqueue *svq,
+                                  bool check_for_avail_queue)
 {
     VirtQueue *vq = svq->vq;
+    unsigned i = 0;
 
-    /* Forward as many used buffers as possible. */
-    do {
-        unsigned i = 0;
-
-        vhost_svq_disable_notification(svq);
-        while (true) {
-            uint32_t len;
-            g_autofree VirtQueueElement *elem = vhost_svq_get_buf(svq, &len);
-            if (!elem) {
-                break;
-            }
+    while (true) {
+        uint32_t len;
+        g_autofree VirtQueueElement *elem = vhost_svq_get_buf(svq, &len);
+        if (!elem) {
+            break;
+        }
 
-            if (unlikely(i >= svq->vring.num)) {
-                qemu_log_mask(LOG_GUEST_ERROR,
-                         "More than %u used buffers obtained in a %u size SVQ",
-                         i, svq->vring.num);
-                virtqueue_fill(vq, elem, len, i);
-                virtqueue_flush(vq, i);
-                return;
-            }
-            virtqueue_fill(vq, elem, len, i++);
+        if (unlikely(i >= svq->vring.num)) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                     "More than %u used buffers obtained in a %u size SVQ",
+                     i, svq->vring.num);
+            virtqueue_fill(vq, elem, len, i);
+            virtqueue_flush(vq, i);
+            return -1;
         }
+        virtqueue_fill(vq, elem, len, i++);
+    }
 
-        virtqueue_flush(vq, i);
+    virtqueue_flush(vq, i);
+    if (i && virtio_queue_should_notify(vq)) {
         event_notifier_set(&svq->svq_call);
+    }
 
-        if (check_for_avail_queue && svq->next_guest_avail_elem) {
-            /*
-             * Avail ring was full when vhost_svq_flush was called, so it's a
-             * good moment to make more descriptors available if possible.
-             */
-            vhost_handle_guest_kick(svq);
+    if (check_for_avail_queue && svq->next_guest_avail_elem) {
+        /*
+         * Avail ring was full when vhost_svq_flush was called, so it's a
+         * good moment to make more descriptors available if possible.
+         */
+        vhost_handle_guest_kick(svq);
+    }
+
+    return i;
+}
+
+static void vhost_svq_flush(VhostShadowVirtqueue *svq,
+                            bool check_for_avail_queue)
+{
+    /* Forward as many used buffers as possible. */
+    do {
+        vhost_svq_disable_notification(svq);
+        if (vhost_svq_forward_used(svq, check_for_avail_queue) < 0) {
+            return;
         }
     } while (!vhost_svq_enable_notification(svq));
 }
 
+/**
+ * Stop busy polling, and go back to guest kicks and device calls.
+ *
+ * Polling starts again if buffers were made available or used before the
+ * notifications were enabled.
+ */
+static void vhost_svq_stop_polling(VhostShadowVirtqueue *svq)
+{
+    svq->polling = false;
+
+    /* If SVQ is full, keep ignoring kicks until some elements are used */
+    if (!svq->next_guest_avail_elem) {
+        virtio_queue_set_notification(svq->vq, true);
+    }
+
+    if (!vhost_svq_enable_notification(svq) ||
+        (!svq->next_guest_avail_elem && !virtio_queue_empty(svq->vq))) {
+        vhost_svq_start_polling(svq);
+    }
+}
+
+/**
+ * Busy poll the guest and device vrings.
+ *
+ * @opaque: Shadow VirtQueue
+ *
+ * Guest kicks and device calls are disabled while polling, and this bottom
+ * half forwards the buffers in both directions instead.  It keeps
+ * rescheduling itself until no buffer was forwarded for poll_ns.
+ */
+static void vhost_svq_poll_bh(void *opaque)
+{
+    VhostShadowVirtqueue *svq = opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    unsigned forwarded;
+    bool progress;
+
+    progress = vhost_svq_forward_used(svq, false) > 0;
+    vhost_svq_forward_avail(svq, &forwarded);
+    progress |= forwarded > 0;
+
+    if (progress) {
+        svq->poll_last_progress = now;
+    } else if (now - svq->poll_last_progress >= svq->poll_ns) {
+        vhost_svq_stop_polling(svq);
+        return;
+    }
+
+    qemu_bh_schedule(svq->poll_bh);
+}
+
+static void vhost_svq_start_polling(VhostShadowVirtqueue *svq)
+{
+    if (svq->polling) {
+        return;
+    }
+
+    svq->polling = true;
+    svq->poll_last_progress = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    virtio_queue_set_notification(svq->vq, false);
+    vhost_svq_disable_notification(svq);
+    qemu_bh_schedule(svq->poll_bh);
+}
+
 /**
  * Poll the SVQ for one device used buffer.
  *
@@ -551,6 +894,13 @@ static void vhost_svq_handle_call(EventNotifier *n)
     VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
                                              hdev_call);
     event_notifier_test_and_clear(n);
+
+    if (svq->poll_ns) {
+        vhost_svq_start_polling(svq);
+        vhost_svq_forward_used(svq, true);
+        return;
+    }
+
     vhost_svq_flush(svq, true);
 }
 
@@ -581,6 +931,9 @@ void vhost_svq_set_svq_call_fd(VhostShadowVirtqueue *svq, int call_fd)
  * Get the shadow vq vring address.
  * @svq: Shadow virtqueue
  * @addr: Destination to store address
+ *
+ * For packed vrings, the avail and used addresses are the ones of the driver
+ * and device event suppression structures.
  */
 void vhost_svq_get_vring_addr(const VhostShadowVirtqueue *svq,
                               struct vhost_vring_addr *addr)
@@ -590,19 +943,44 @@ void vhost_svq_get_vring_addr(const VhostShadowVirtqueue *svq,
     addr->used_user_addr = (uint64_t)(uintptr_t)svq->vring.used;
 }
 
+static size_t vhost_svq_desc_size(const VhostShadowVirtqueue *svq)
+{
+    if (svq->is_packed) {
+        return sizeof(struct vring_packed_desc) * svq->vring_packed.num;
+    }
+
+    return sizeof(vring_desc_t) * svq->vring.num;
+}
+
+/*
+ * In packed vrings, the device writes the used descriptors in the driver
+ * area, so it must be mapped writable.
+ */
 size_t vhost_svq_driver_area_size(const VhostShadowVirtqueue *svq)
 {
-    size_t desc_size = sizeof(vring_desc_t) * svq->vring.num;
-    size_t avail_size = offsetof(vring_avail_t, ring[svq->vring.num]) +
+    size_t desc_size = vhost_svq_desc_size(svq);
+    size_t avail_size;
+
+    if (svq->is_packed) {
+        avail_size = sizeof(struct vring_packed_desc_event);
+    } else {
+        avail_size = offsetof(vring_avail_t, ring[svq->vring.num]) +
                                                               sizeof(uint16_t);
+    }
 
     return ROUND_UP(desc_size + avail_size, qemu_real_host_page_size());
 }
 
 size_t vhost_svq_device_area_size(const VhostShadowVirtqueue *svq)
 {
-    size_t used_size = offsetof(vring_used_t, ring[svq->vring.num]) +
+    size_t used_size;
+
+    if (svq->is_packed) {
+        used_size = sizeof(struct vring_packed_desc_event);
+    } else {
+        used_size = offsetof(vring_used_t, ring[svq->vring.num]) +
                                                               sizeof(uint16_t);
+    }
     return ROUND_UP(used_size, qemu_real_host_page_size());
 }
 
@@ -650,16 +1028,24 @@ void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
 
     svq->next_guest_avail_elem = NULL;
     svq->shadow_avail_idx = 0;
+    svq->num_added = 0;
+    svq->free_head = 0;
     svq->shadow_used_idx = 0;
     svq->last_used_idx = 0;
+    svq->avail_wrap_counter = true;
+    svq->used_wrap_counter = true;
+    svq->polling = false;
     svq->vdev = vdev;
     svq->vq = vq;
+    svq->is_packed = virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED);
 
     svq->vring.num = virtio_queue_get_num(vdev, virtio_get_queue_index(vq));
+    svq->num_free = svq->vring.num;
     driver_size = vhost_svq_driver_area_size(svq);
     device_size = vhost_svq_device_area_size(svq);
     svq->vring.desc = qemu_memalign(qemu_real_host_page_size(), driver_size);
-    desc_size = sizeof(vring_desc_t) * svq->vring.num;
+    desc_size = vhost_svq_desc_size(svq);
+    /* For packed vrings, this is the driver event suppression area */
     svq->vring.avail = (void *)((char *)svq->vring.desc + desc_size);
     memset(svq->vring.desc, 0, driver_size);
     svq->vring.used = qemu_memalign(qemu_real_host_page_size(), device_size);
@@ -667,7 +1053,7 @@ void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
     svq->desc_state = g_new0(SVQDescState, svq->vring.num);
     svq->desc_next = g_new0(uint16_t, svq->vring.num);
     for (unsigned i = 0; i < svq->vring.num - 1; i++) {
-        svq->desc_next[i] = cpu_to_le16(i + 1);
+        svq->desc_next[i] = i + 1;
     }
 }
 
@@ -684,6 +1070,9 @@ void vhost_svq_stop(VhostShadowVirtqueue *svq)
         return;
     }
 
+    qemu_bh_cancel(svq->poll_bh);
+    svq->polling = false;
+
     /* Send all pending used descriptors to guest */
     vhost_svq_flush(svq, false);
 
@@ -741,6 +1130,7 @@ VhostShadowVirtqueue *vhost_svq_new(VhostIOVATree *iova_tree,
 
     event_notifier_init_fd(&svq->svq_kick, VHOST_FILE_UNBIND);
     event_notifier_set_handler(&svq->hdev_call, vhost_svq_handle_call);
+    svq->poll_bh = qemu_bh_new(vhost_svq_poll_bh, svq);
     svq->iova_tree = iova_tree;
     svq->ops = ops;
     svq->ops_opaque = ops_opaque;
@@ -762,6 +1152,7 @@ void vhost_svq_free(gpointer pvq)
 {
     VhostShadowVirtqueue *vq = pvq;
     vhost_svq_stop(vq);
+    qemu_bh_delete(vq->poll_bh);
     event_notifier_cleanup(&vq->hdev_kick);
     event_notifier_set_handler(&vq->hdev_call, NULL);
     event_notifier_cleanup(&vq->hdev_call);
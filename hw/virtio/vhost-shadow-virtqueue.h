@@ -48,8 +48,21 @@ typedef struct VhostShadowVirtqueueOps {
 
 /* Shadow virtqueue to relay notifications */
 typedef struct VhostShadowVirtqueue {
-    /* Shadow vring */
-    struct vring vring;
+    union {
+        /* Shadow vring, if the device uses split virtqueues */
+        struct vring vring;
+
+        /* Shadow vring, if the device uses packed virtqueues */
+        struct {
+            unsigned int num;
+            struct vring_packed_desc *desc;
+            struct vring_packed_desc_event *driver;
+            struct vring_packed_desc_event *device;
+        } vring_packed;
+    };
+
+    /* VIRTIO_F_RING_PACKED was negotiated */
+    bool is_packed;
 
     /* Shadow kick notifier, sent to vhost */
     EventNotifier hdev_kick;
@@ -86,7 +99,8 @@ typedef struct VhostShadowVirtqueue {
 
     /*
      * Backup next field for each descriptor so we can recover securely, not
-     * needing to trust the device access.
+     * needing to trust the device access.  Host byte order: for split
+     * vrings it is converted when written to the descriptors.
      */
     uint16_t *desc_next;
 
@@ -96,17 +110,48 @@ typedef struct VhostShadowVirtqueue {
     /* Caller callbacks opaque */
     void *ops_opaque;
 
-    /* Next head to expose to the device */
+    /*
+     * Next head to expose to the device.  In packed vrings, next descriptor
+     * to write.
+     */
     uint16_t shadow_avail_idx;
 
-    /* Next free descriptor */
+    /* Entries made available since the device was last kicked */
+    uint16_t num_added;
+
+    /*
+     * Next free descriptor.  In packed vrings, next free buffer id, the
+     * descriptors themselves are always used in ring order.
+     */
     uint16_t free_head;
 
     /* Last seen used idx */
     uint16_t shadow_used_idx;
 
-    /* Next head to consume from the device */
+    /*
+     * Next head to consume from the device.  In packed vrings, next
+     * descriptor to read.
+     */
     uint16_t last_used_idx;
+
+    /* Free descriptors */
+    uint16_t num_free;
+
+    /* Packed vrings: wrap counters */
+    bool avail_wrap_counter;
+    bool used_wrap_counter;
+
+    /*
+     * Time in ns to keep polling the guest and device vrings after the last
+     * buffer was forwarded, instead of waiting for their notifications.
+     * Zero disables polling.
+     */
+    int64_t poll_ns;
+
+    /* Polling state */
+    QEMUBH *poll_bh;
+    bool polling;
+    int64_t poll_last_progress;
 } VhostShadowVirtqueue;
 
 bool vhost_svq_valid_features(uint64_t features, Error **errp);
@@ -436,6 +436,7 @@ static int vhost_vdpa_init_svq(struct vhost_dev *hdev, struct vhost_vdpa *v,
             error_setg(errp, "Cannot create svq %u", n);
             return -1;
         }
+        svq->poll_ns = v->shadow_vq_poll_ns;
         g_ptr_array_add(shadow_vqs, g_steal_pointer(&svq));
     }
 
@@ -977,7 +978,8 @@ static bool vhost_vdpa_svq_map_rings(struct vhost_dev *dev,
     driver_region = (DMAMap) {
         .translated_addr = svq_addr.desc_user_addr,
         .size = driver_size - 1,
-        .perm = IOMMU_RO,
+        /* The device writes used descriptors in packed vrings */
+        .perm = svq->is_packed ? IOMMU_RW : IOMMU_RO,
     };
     ok = vhost_vdpa_svq_map_ring(v, &driver_region, errp);
     if (unlikely(!ok)) {
@@ -1013,6 +1015,11 @@ static bool vhost_vdpa_svq_setup(struct vhost_dev *dev,
     };
     int r;
 
+    if (virtio_vdev_has_feature(dev->vdev, VIRTIO_F_RING_PACKED)) {
+        /* Avail and used indexes start at 0, with both wrap counters set */
+        s.num = BIT(15) | BIT(31);
+    }
+
     r = vhost_vdpa_set_dev_vring_base(dev, &s);
     if (unlikely(r)) {
         error_setg_errno(errp, -r, "Cannot set vring base");
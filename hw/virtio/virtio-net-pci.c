@@ -43,6 +43,14 @@ static Property virtio_net_properties[] = {
                     VIRTIO_PCI_FLAG_USE_IOEVENTFD_BIT, true),
     DEFINE_PROP_UINT32("vectors", VirtIOPCIProxy, nvectors,
                        DEV_NVECTORS_UNSPECIFIED),
+    /*
+     * The elements of an array property are only created when its length
+     * is set, so they cannot be aliased from the device like its other
+     * properties.  Only virtio-pci has the ioeventfds to run the queues in
+     * IOThreads anyway.
+     */
+    DEFINE_PROP_ARRAY("iothreads", VirtIONetPCI, vdev.num_iothreads,
+                      vdev.iothread_ids, qdev_prop_string, char *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -90,6 +98,14 @@ static void virtio_net_pci_instance_init(Object *obj)
                               "bootindex");
 }
 
+static void virtio_net_pci_instance_finalize(Object *obj)
+{
+    VirtIONetPCI *dev = VIRTIO_NET_PCI(obj);
+
+    /* The strings went away with the array element properties */
+    g_free(dev->vdev.iothread_ids);
+}
+
 static const VirtioPCIDeviceTypeInfo virtio_net_pci_info = {
     .base_name             = TYPE_VIRTIO_NET_PCI,
     .generic_name          = "virtio-net-pci",
@@ -97,6 +113,7 @@ static const VirtioPCIDeviceTypeInfo virtio_net_pci_info = {
     .non_transitional_name = "virtio-net-pci-non-transitional",
     .instance_size = sizeof(VirtIONetPCI),
     .instance_init = virtio_net_pci_instance_init,
+    .instance_finalize = virtio_net_pci_instance_finalize,
     .class_init    = virtio_net_pci_class_init,
 };
 
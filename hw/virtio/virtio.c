@@ -562,6 +562,11 @@ struct VirtQueue
     EventNotifier host_notifier;
     bool host_notifier_enabled;
     QLIST_ENTRY(VirtQueue) node;
+
+    /* Freed elements kept for reuse, see virtqueue_element_free() */
+    void *elem_pool;
+    unsigned int elem_pool_len;
+    size_t elem_pool_sz;
 };
 
 const char *virtio_device_names[] = {
@@ -1405,6 +1410,31 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+/* virtqueue_push_batch:
+ * @vq: The #VirtQueue
+ * @elems: The elements to return to the guest
+ * @lens: number of bytes written to each element, or NULL if none
+ * @count: number of elements in @elems
+ *
+ * Same as calling virtqueue_push() for each element, except that the used
+ * index is only written once, after all elements have been filled in.
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *lens, unsigned int count)
+{
+    unsigned int i;
+
+    if (!count) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < count; i++) {
+        virtqueue_fill(vq, elems[i], lens ? lens[i] : 0, i);
+    }
+    virtqueue_flush(vq, count);
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1871,21 +1901,57 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+/*
+ * Elements with up to VIRTQUEUE_POOL_SG buffers are allocated with room for
+ * that many, so that they can be recycled by virtqueue_element_free().  At
+ * most VIRTQUEUE_POOL_MAX free elements are kept for each queue.
+ */
+#define VIRTQUEUE_POOL_SG   8
+#define VIRTQUEUE_POOL_MAX  64
+
+static size_t virtqueue_elem_in_addr_ofs(size_t sz)
+{
+    return QEMU_ALIGN_UP(sz, __alignof__(hwaddr));
+}
+
+static void *virtqueue_alloc_element(VirtQueue *vq, size_t sz,
+                                     unsigned out_num, unsigned in_num)
 {
     VirtQueueElement *elem;
-    size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
+    size_t in_addr_ofs = virtqueue_elem_in_addr_ofs(sz);
     size_t out_addr_ofs = in_addr_ofs + in_num * sizeof(elem->in_addr[0]);
     size_t out_addr_end = out_addr_ofs + out_num * sizeof(elem->out_addr[0]);
     size_t in_sg_ofs = QEMU_ALIGN_UP(out_addr_end, __alignof__(elem->in_sg[0]));
     size_t out_sg_ofs = in_sg_ofs + in_num * sizeof(elem->in_sg[0]);
     size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
+    bool pooled = false;
 
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
+    if (vq && out_num + in_num <= VIRTQUEUE_POOL_SG) {
+        if (!vq->elem_pool_sz) {
+            vq->elem_pool_sz = sz;
+        }
+        pooled = vq->elem_pool_sz == sz;
+    }
+
+    if (pooled && vq->elem_pool) {
+        elem = vq->elem_pool;
+        vq->elem_pool = *(void **)elem;
+        vq->elem_pool_len--;
+    } else if (pooled) {
+        size_t pool_addr_end = in_addr_ofs +
+                               VIRTQUEUE_POOL_SG * sizeof(elem->in_addr[0]);
+
+        elem = g_malloc(QEMU_ALIGN_UP(pool_addr_end,
+                                      __alignof__(elem->in_sg[0])) +
+                        VIRTQUEUE_POOL_SG * sizeof(elem->in_sg[0]));
+    } else {
+        elem = g_malloc(out_sg_end);
+    }
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
     elem->out_num = out_num;
     elem->in_num = in_num;
+    elem->pooled = pooled;
     elem->in_addr = (void *)elem + in_addr_ofs;
     elem->out_addr = (void *)elem + out_addr_ofs;
     elem->in_sg = (void *)elem + in_sg_ofs;
@@ -1893,10 +1959,69 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/* virtqueue_element_free:
+ * @vq: The #VirtQueue that @elem was popped from
+ * @elem: The element, or NULL
+ *
+ * Free an element returned by virtqueue_pop() or virtqueue_pop_batch().
+ * Small elements are put back in a pool, so that the next pop from @vq
+ * does not have to allocate memory.  Elements can also be freed with
+ * g_free(), but they are then not reused.
+ */
+void virtqueue_element_free(VirtQueue *vq, void *elem)
 {
-    unsigned int i, head, max;
-    VRingMemoryRegionCaches *caches;
+    VirtQueueElement *e = elem;
+
+    if (e && e->pooled && vq->vring.num &&
+        vq->elem_pool_len < VIRTQUEUE_POOL_MAX &&
+        (void *)e->in_addr == elem +
+                              virtqueue_elem_in_addr_ofs(vq->elem_pool_sz)) {
+        *(void **)elem = vq->elem_pool;
+        vq->elem_pool = elem;
+        vq->elem_pool_len++;
+    } else {
+        g_free(elem);
+    }
+}
+
+static void virtqueue_elem_pool_drain(VirtQueue *vq)
+{
+    while (vq->elem_pool) {
+        void *elem = vq->elem_pool;
+
+        vq->elem_pool = *(void **)elem;
+        g_free(elem);
+    }
+    vq->elem_pool_len = 0;
+    vq->elem_pool_sz = 0;
+}
+
+/* Called within rcu_read_lock().  */
+static VRingMemoryRegionCaches *virtqueue_split_desc_caches(VirtQueue *vq)
+{
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+
+    if (!caches) {
+        virtio_error(vq->vdev, "Region caches not initialized");
+        return NULL;
+    }
+
+    if (caches->desc.len < vq->vring.num * sizeof(VRingDesc)) {
+        virtio_error(vq->vdev, "Cannot map descriptor ring");
+        return NULL;
+    }
+    return caches;
+}
+
+/*
+ * Map the descriptor chain starting at @head into a new element.
+ * Called within rcu_read_lock().
+ */
+static void *virtqueue_split_pop_head(VirtQueue *vq, size_t sz,
+                                      VRingMemoryRegionCaches *caches,
+                                      unsigned int head)
+{
+    unsigned int i, max;
     MemoryRegionCache indirect_desc_cache = MEMORY_REGION_CACHE_INVALID;
     MemoryRegionCache *desc_cache;
     int64_t len;
@@ -1908,45 +2033,12 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     VRingDesc desc;
     int rc;
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_empty_rcu(vq)) {
-        goto done;
-    }
-    /* Needed after virtio_queue_empty(), see comment in
-     * virtqueue_num_heads(). */
-    smp_rmb();
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
     max = vq->vring.num;
-
-    if (vq->inuse >= vq->vring.num) {
-        virtio_error(vdev, "Virtqueue size exceeded");
-        goto done;
-    }
-
-    if (!virtqueue_get_head(vq, vq->last_avail_idx++, &head)) {
-        goto done;
-    }
-
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
-        vring_set_avail_event(vq, vq->last_avail_idx);
-    }
-
     i = head;
 
-    caches = vring_get_region_caches(vq);
-    if (!caches) {
-        virtio_error(vdev, "Region caches not initialized");
-        goto done;
-    }
-
-    if (caches->desc.len < max * sizeof(VRingDesc)) {
-        virtio_error(vdev, "Cannot map descriptor ring");
-        goto done;
-    }
-
     desc_cache = &caches->desc;
     vring_split_desc_read(vdev, &desc, desc_cache, i);
     if (desc.flags & VRING_DESC_F_INDIRECT) {
@@ -2005,7 +2097,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq, sz, out_num, in_num);
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -2030,6 +2122,123 @@ err_undo_map:
     goto done;
 }
 
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+{
+    unsigned int head;
+    VRingMemoryRegionCaches *caches;
+    VirtIODevice *vdev = vq->vdev;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_empty_rcu(vq)) {
+        return NULL;
+    }
+    /* Needed after virtio_queue_empty(), see comment in
+     * virtqueue_num_heads(). */
+    smp_rmb();
+
+    if (vq->inuse >= vq->vring.num) {
+        virtio_error(vdev, "Virtqueue size exceeded");
+        return NULL;
+    }
+
+    if (!virtqueue_get_head(vq, vq->last_avail_idx++, &head)) {
+        return NULL;
+    }
+
+    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+
+    caches = virtqueue_split_desc_caches(vq);
+    if (!caches) {
+        return NULL;
+    }
+
+    return virtqueue_split_pop_head(vq, sz, caches, head);
+}
+
+/* Number of avail ring entries read ahead by virtqueue_split_pop_batch() */
+#define VIRTQUEUE_POP_PREFETCH 16
+
+static unsigned int virtqueue_split_pop_batch(VirtQueue *vq, size_t sz,
+                                              void **elems, unsigned int max)
+{
+    unsigned int heads[VIRTQUEUE_POP_PREFETCH];
+    VRingMemoryRegionCaches *caches;
+    VirtIODevice *vdev = vq->vdev;
+    unsigned int n = 0, avail;
+    int num_heads;
+
+    RCU_READ_LOCK_GUARD();
+    if (unlikely(!vq->vring.avail)) {
+        return 0;
+    }
+
+    /*
+     * Only read the avail index if the last value read does not already
+     * cover the whole batch.  Either way, a single barrier orders it
+     * against all the descriptor reads below.
+     */
+    avail = (uint16_t)(vq->shadow_avail_idx - vq->last_avail_idx);
+    if (avail < max) {
+        num_heads = virtqueue_num_heads(vq, vq->last_avail_idx);
+        if (num_heads <= 0) {
+            return 0;
+        }
+        avail = num_heads;
+    } else {
+        /* Descriptor reads must not bypass the earlier avail index read */
+        smp_rmb();
+    }
+    avail = MIN(avail, max);
+
+    if (vq->inuse >= vq->vring.num) {
+        virtio_error(vdev, "Virtqueue size exceeded");
+        return 0;
+    }
+    avail = MIN(avail, vq->vring.num - vq->inuse);
+
+    caches = virtqueue_split_desc_caches(vq);
+    if (!caches) {
+        return 0;
+    }
+
+    while (n < avail) {
+        unsigned int i, chunk = MIN(avail - n, VIRTQUEUE_POP_PREFETCH);
+
+        /*
+         * Read the heads for the whole chunk from the avail ring and
+         * start loading their descriptors, before walking the chains.
+         */
+        for (i = 0; i < chunk; i++) {
+            if (!virtqueue_get_head(vq, vq->last_avail_idx + i, &heads[i])) {
+                chunk = i;
+                avail = n + i;
+                break;
+            }
+            if (caches->desc.ptr) {
+                __builtin_prefetch(caches->desc.ptr +
+                                   heads[i] * sizeof(VRingDesc));
+            }
+        }
+
+        for (i = 0; i < chunk; i++) {
+            vq->last_avail_idx++;
+            elems[n] = virtqueue_split_pop_head(vq, sz, caches, heads[i]);
+            if (!elems[n]) {
+                avail = n;
+                break;
+            }
+            n++;
+        }
+    }
+
+    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return n;
+}
+
 static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 {
     unsigned int i, max;
@@ -2131,7 +2340,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     } while (rc == VIRTQUEUE_READ_DESC_MORE);
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq, sz, out_num, in_num);
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -2178,6 +2387,39 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 }
 
+/* virtqueue_pop_batch:
+ * @vq: The #VirtQueue
+ * @sz: The size of each element, as for virtqueue_pop()
+ * @elems: Array that receives the elements
+ * @max: Maximum number of elements to pop
+ *
+ * Pop up to @max elements, as if virtqueue_pop() was called in a loop.  On
+ * split rings, the avail index is read at most once and the avail event is
+ * only updated after the last element, and the descriptors are prefetched.
+ * Elements with few buffers are allocated from a pool in @vq, and should be
+ * freed with virtqueue_element_free().
+ *
+ * Returns: the number of elements stored in @elems.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    unsigned int n = 0;
+
+    if (virtio_device_disabled(vq->vdev)) {
+        return 0;
+    }
+
+    if (!virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        return virtqueue_split_pop_batch(vq, sz, elems, max);
+    }
+
+    while (n < max && (elems[n] = virtqueue_packed_pop(vq, sz))) {
+        n++;
+    }
+    return n;
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -2313,7 +2555,7 @@ void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz)
     assert(ARRAY_SIZE(data.in_addr) >= data.in_num);
     assert(ARRAY_SIZE(data.out_addr) >= data.out_num);
 
-    elem = virtqueue_alloc_element(sz, data.out_num, data.in_num);
+    elem = virtqueue_alloc_element(NULL, sz, data.out_num, data.in_num);
     elem->index = data.index;
 
     for (i = 0; i < elem->in_num; i++) {
@@ -2924,6 +3166,7 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    virtqueue_elem_pool_drain(vq);
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -3025,6 +3268,18 @@ static bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
     }
 }
 
+/*
+ * For code that signals the guest through its own event notifier, such as
+ * vhost shadow virtqueues: check whether the guest wants an interrupt for the
+ * buffers used since the last one.
+ */
+bool virtio_queue_should_notify(VirtQueue *vq)
+{
+    RCU_READ_LOCK_GUARD();
+
+    return virtio_should_notify(vq->vdev, vq);
+}
+
 void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
 {
     WITH_RCU_READ_LOCK_GUARD() {
@@ -4220,6 +4475,7 @@ static void virtio_device_free_virtqueues(VirtIODevice *vdev)
         if (vdev->vq[i].vring.num == 0) {
             break;
         }
+        virtqueue_elem_pool_drain(&vdev->vq[i]);
         virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
     }
     g_free(vdev->vq);
@@ -4244,7 +4500,7 @@ static Property virtio_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
 
-static int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int i, n, r, err;
@@ -4314,7 +4570,7 @@ int virtio_device_start_ioeventfd(VirtIODevice *vdev)
     return virtio_bus_start_ioeventfd(vbus);
 }
 
-static void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int n, r;
@@ -28,9 +28,21 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
                                      const BdrvDirtyBitmap *bitmap,
                                      Error **errp);
 
-/* Function should be called prior any actual copy request */
+/*
+ * Function should be called prior any actual copy request
+ *
+ * @skip_identical makes block-copy compare the data against the target and
+ * skip writes that would not change it, and write zeroes for zeroed data.
+ */
 void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
-                              bool compress);
+                              bool compress, bool skip_identical);
+
+/*
+ * Check that @target can be compared against to skip identical writes,
+ * i.e. that reading it does not fall through to @source.
+ */
+bool block_copy_check_skip_identical(BlockDriverState *source,
+                                     BlockDriverState *target, Error **errp);
 void block_copy_set_progress_meter(BlockCopyState *s, ProgressMeter *pm);
 
 void block_copy_state_free(BlockCopyState *s);
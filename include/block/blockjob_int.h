@@ -28,6 +28,7 @@
 
 #include "block/blockjob.h"
 #include "block/block.h"
+#include "block/aio_task.h"
 
 /**
  * BlockJobDriver:
@@ -119,6 +120,20 @@ void block_job_free(Job *job);
  */
 void block_job_user_resume(Job *job);
 
+/**
+ * block_job_parse_perf:
+ * @perf: Performance options given by the user, or %NULL.
+ * @max_workers: Number of chunks copied in parallel, the default on input.
+ * @max_chunk: Maximum length of a chunk in bytes, the default on input.
+ * @errp: Error object.
+ *
+ * Check the options in @perf and store them in @max_workers and @max_chunk
+ * for block_job_chunks_init().  Return false and set @errp if they are out
+ * of range.
+ */
+bool block_job_parse_perf(const BlockJobPerf *perf, int *max_workers,
+                          int64_t *max_chunk, Error **errp);
+
 /*
  * I/O API functions. These functions are thread-safe.
  *
@@ -147,4 +162,96 @@ int64_t block_job_ratelimit_get_delay(BlockJob *job, uint64_t n);
 BlockErrorAction block_job_error_action(BlockJob *job, BlockdevOnError on_err,
                                         int is_read, int error);
 
+typedef struct BlockJobChunks BlockJobChunks;
+
+/*
+ * Copy @bytes at @offset.  On failure, set *@error_in_source to false if
+ * the error was not in the source of the copy.
+ */
+typedef int coroutine_fn BlockJobChunkFunc(BlockJobChunks *chunks,
+                                           int64_t offset, int64_t bytes,
+                                           bool *error_in_source);
+
+/**
+ * BlockJobChunks:
+ *
+ * Chunks of a job that copies its data in order, from the first offset to
+ * the last one, running up to @max_workers of them in parallel.  When some
+ * of them fail, the job goes back to the first failed one.
+ */
+struct BlockJobChunks {
+    BlockJob *job;
+    BlockJobChunkFunc *func;
+    int max_workers;
+    AioTaskPool *pool;
+
+    /*
+     * First (lowest offset) failed chunk, and total length of the chunks
+     * that failed or were not started since the last
+     * block_job_chunks_rewind()
+     */
+    int ret;
+    bool error_in_source;
+    int64_t error_offset;
+    int64_t error_bytes;
+    int64_t failed_bytes;
+};
+
+/**
+ * block_job_chunks_init:
+ * @chunks: The chunks to set up, usually part of the job's state.
+ * @job: The job the chunks belong to.
+ * @max_workers: Number of chunks copied in parallel.
+ * @func: Copies one chunk.
+ *
+ * Set up @chunks at the start of the job's run() callback.  The progress of
+ * the chunks is published when they complete successfully.
+ */
+void block_job_chunks_init(BlockJobChunks *chunks, BlockJob *job,
+                           int max_workers, BlockJobChunkFunc *func);
+
+/**
+ * block_job_chunks_start:
+ *
+ * Start copying @bytes at @offset, waiting for a free worker first.  If a
+ * chunk has failed by then, do nothing: the caller finds out with
+ * block_job_chunks_rewind() and copies the chunk again later.  With a
+ * single worker, also wait for the chunk to complete.
+ */
+void coroutine_fn block_job_chunks_start(BlockJobChunks *chunks,
+                                         int64_t offset, int64_t bytes);
+
+/**
+ * block_job_chunks_wait:
+ *
+ * Wait for all chunks to complete.  Return 0 if none failed since the last
+ * block_job_chunks_rewind(), or a negative errno.
+ */
+int coroutine_fn block_job_chunks_wait(BlockJobChunks *chunks);
+
+/**
+ * block_job_chunks_rewind:
+ * @offset: The offset the job got to; on return, where to continue from.
+ * @bytes: On return, the length of the failed chunk.
+ * @error_in_source: On return, whether the error was in the source.  May
+ *                   be %NULL.
+ *
+ * If a chunk failed, wait for the others and go back to the first failed
+ * one.  The progress of the chunks after it that were counted already is
+ * added back to the remaining work, as they are visited again.  Return the
+ * error of the failed chunk, which the caller must handle, or 0 without
+ * waiting or changing anything if no chunk failed.
+ */
+int coroutine_fn block_job_chunks_rewind(BlockJobChunks *chunks,
+                                         int64_t *offset, int64_t *bytes,
+                                         bool *error_in_source);
+
+/**
+ * block_job_chunks_cleanup:
+ *
+ * Wait for all chunks to complete and free @chunks' resources, at the end
+ * of the job's run() callback.
+ */
+void coroutine_fn block_job_chunks_cleanup(BlockJobChunks *chunks);
+
 #endif
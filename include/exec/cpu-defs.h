@@ -79,9 +79,6 @@ typedef uint64_t target_ulong;
 
 #if !defined(CONFIG_USER_ONLY) && defined(CONFIG_TCG)
 
-/* use a fully associative victim tlb of 8 entries */
-#define CPU_VTLB_SIZE 8
-
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
 #else
@@ -91,6 +88,16 @@ typedef uint64_t target_ulong;
 #define CPU_TLB_DYN_MIN_BITS 6
 #define CPU_TLB_DYN_DEFAULT_BITS 8
 
+/*
+ * The victim tlb is set-associative, with CPU_VTLB_WAYS entries per set.
+ * Sets are selected by the low bits of the page number, like the main tlb,
+ * so that an entry swapped between the two always lands in the same set.
+ * This limits the number of sets to the smallest main tlb size.
+ */
+#define CPU_VTLB_WAYS 8
+#define CPU_VTLB_DEFAULT_SIZE 64
+#define CPU_VTLB_MAX_SIZE (CPU_VTLB_WAYS << CPU_TLB_DYN_MIN_BITS)
+
 # if HOST_LONG_BITS == 32
 /* Make sure we do not require a double-word shift for the TLB load */
 #  define CPU_TLB_DYN_MAX_BITS (32 - TARGET_PAGE_BITS)
@@ -195,11 +202,13 @@ typedef struct CPUTLBDesc {
     /* maximum number of entries observed in the window */
     size_t window_max_entries;
     size_t n_used_entries;
-    /* The next index to use in the tlb victim table.  */
+    /* The next way to use in the tlb victim table.  */
     size_t vindex;
+    /* Contains the number of sets in the tlb victim table, minus one.  */
+    size_t vset_mask;
     /* The tlb victim table, in two parts.  */
-    CPUTLBEntry vtable[CPU_VTLB_SIZE];
-    CPUTLBEntryFull vfulltlb[CPU_VTLB_SIZE];
+    CPUTLBEntry *vtable;
+    CPUTLBEntryFull *vfulltlb;
     CPUTLBEntryFull *fulltlb;
 } CPUTLBDesc;
 
@@ -214,6 +223,23 @@ typedef struct CPUTLBDescFast {
     CPUTLBEntry *table;
 } CPUTLBDescFast QEMU_ALIGNED(2 * sizeof(void *));
 
+/*
+ * A flush of the pages in [addr, addr + len) from the mmu_idx in idxmap,
+ * where only the low @bits of each address are significant.
+ */
+typedef struct CPUTLBFlushRange {
+    target_ulong addr;
+    target_ulong len;
+    uint16_t idxmap;
+    uint16_t bits;
+} CPUTLBFlushRange;
+
+/*
+ * Number of disjoint ranges that can wait to be flushed on a vCPU before
+ * further ones are turned into full flushes of their mmu_idx.
+ */
+#define CPU_TLB_PENDING_RANGES 16
+
 /*
  * Data elements that are shared between all MMU modes.
  */
@@ -226,6 +252,17 @@ typedef struct CPUTLBCommon {
      * Protected by tlb_c.lock.
      */
     uint16_t dirty;
+    /*
+     * Flushes requested by other vCPUs and not performed yet: a full
+     * flush of the mmu_idx in pending_idxmap, plus pending_n_ranges
+     * range flushes.  A single work item, queued when pending_queued
+     * becomes true, performs all of them.
+     * Protected by tlb_c.lock.
+     */
+    bool pending_queued;
+    uint16_t pending_idxmap;
+    unsigned int pending_n_ranges;
+    CPUTLBFlushRange pending[CPU_TLB_PENDING_RANGES];
     /*
      * Statistics.  These are not lock protected, but are read and
      * written atomically.  This allows the monitor to print a snapshot
@@ -234,6 +271,14 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    /*
+     * Flushes requested by other vCPUs, and how many of them were
+     * merged into already queued work.  Written under tlb_c.lock.
+     */
+    size_t remote_flush_count;
+    size_t coalesced_flush_count;
+    size_t vtlb_hit_count;
+    size_t vtlb_miss_count;
 } CPUTLBCommon;
 
 /*
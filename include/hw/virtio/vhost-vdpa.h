@@ -38,6 +38,8 @@ typedef struct vhost_vdpa {
     GPtrArray *shadow_vqs;
     const VhostShadowVirtqueueOps *shadow_vq_ops;
     void *shadow_vq_ops_opaque;
+    /* Busy polling time of the shadow virtqueues, see VhostShadowVirtqueue */
+    int64_t shadow_vq_poll_ns;
     struct vhost_dev *dev;
     VhostVDPAHostNotifier notifier[VIRTIO_QUEUE_MAX];
 } VhostVDPA;
@@ -20,6 +20,7 @@
 #include "net/announce.h"
 #include "qemu/option_int.h"
 #include "qom/object.h"
+#include "sysemu/iothread.h"
 
 #include "ebpf/ebpf_rss.h"
 
@@ -155,6 +156,18 @@ typedef struct VirtIONetQueue {
         VirtQueueElement *elem;
     } async_tx;
     struct VirtIONet *n;
+    /* IOThread context running this queue pair, NULL for the main loop */
+    AioContext *ctx;
+    /* nesting depth of receive bursts, see qemu_net_burst_begin() */
+    unsigned int rx_burst;
+    /* RX buffers filled but not yet flushed to the used ring */
+    unsigned int rx_pending;
+    /* software offloads, see the sw-offload property */
+    struct NetGRO *gro;
+    bool rx_gro;
+    struct NetTxPkt *tx_pkt;
+    /* parsed headers for software RSS and hash reports */
+    struct NetRxPkt *rx_pkt;
 } VirtIONetQueue;
 
 struct VirtIONet {
@@ -209,6 +222,8 @@ struct VirtIONet {
     AnnounceTimer announce_timer;
     bool needs_vnet_hdr_swap;
     bool mtu_bypass_backend;
+    /* offer offloads even if the peer has no vnet header support */
+    bool sw_offload;
     /* primary failover device is hidden*/
     bool failover_primary_hidden;
     bool failover;
@@ -217,8 +232,12 @@ struct VirtIONet {
     bool primary_opts_from_json;
     Notifier migration_state;
     VirtioNetRssData rss_data;
-    struct NetRxPkt *rx_pkt;
     struct EBPFRSSContext ebpf_rss;
+    /* from virtio-net-pci, queue pair i runs in iothreads[i % num_iothreads] */
+    uint32_t num_iothreads;
+    char **iothread_ids;
+    IOThread **iothreads;
+    bool dataplane_started;
 };
 
 size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
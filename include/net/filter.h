@@ -17,6 +17,31 @@
 #define TYPE_NETFILTER "netfilter"
 OBJECT_DECLARE_TYPE(NetFilterState, NetFilterClass, NETFILTER)
 
+/*
+ * Packets that a filter applies to; other packets go past it as if it
+ * were not there.  All the criteria that are set must match.  Addresses,
+ * protocol and ports only match IPv4 packets; addresses and masks are in
+ * host byte order, and a zero mask matches any address.
+ */
+typedef struct NetFilterMatch {
+    bool has_dst_mac;
+    bool has_src_mac;
+    bool has_vlan;
+    bool has_proto;
+    bool has_src_port;
+    bool has_dst_port;
+    uint8_t dst_mac[6];
+    uint8_t src_mac[6];
+    uint16_t vlan;
+    uint8_t proto;
+    uint32_t src_addr;
+    uint32_t src_mask;
+    uint32_t dst_addr;
+    uint32_t dst_mask;
+    uint16_t src_port;
+    uint16_t dst_port;
+} NetFilterMatch;
+
 typedef void (FilterSetup) (NetFilterState *nf, Error **errp);
 typedef void (FilterCleanup) (NetFilterState *nf);
 /*
@@ -43,6 +68,12 @@ struct NetFilterClass {
     FilterCleanup *cleanup;
     FilterStatusChanged *status_changed;
     FilterHandleEvent *handle_event;
+    /*
+     * Called after setup when the packets of the netdev go through vhost
+     * and never reach receive_iov.  Filters without it cannot be attached
+     * to such netdevs.
+     */
+    FilterSetup *setup_offload;
     /* mandatory */
     FilterReceiveIOV *receive_iov;
 };
@@ -59,6 +90,7 @@ struct NetFilterState {
     bool on;
     char *position;
     bool insert_before_flag;
+    NetFilterMatch match;
     QTAILQ_ENTRY(NetFilterState) next;
 };
 
@@ -77,6 +109,16 @@ ssize_t qemu_netfilter_pass_to_next(NetClientState *sender,
                                     int iovcnt,
                                     void *opaque);
 
+/* Whether @match has criteria for the IPv4 header or the TCP/UDP ports */
+static inline bool netfilter_match_has_ip(const NetFilterMatch *match)
+{
+    return match->has_proto || match->src_mask || match->dst_mask ||
+           match->has_src_port || match->has_dst_port;
+}
+
+bool netfilter_match(const NetFilterMatch *match,
+                     const uint8_t *buf, size_t size);
+
 void colo_notify_filters_event(int event, Error **errp);
 
 #endif /* QEMU_NET_FILTER_H */
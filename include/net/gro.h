@@ -0,0 +1,54 @@
+/*
+ * Generic receive offload
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_NET_GRO_H
+#define QEMU_NET_GRO_H
+
+#include "standard-headers/linux/virtio_net.h"
+
+/* Maximum number of flows held at the same time */
+#define NET_GRO_MAX_FLOWS 8
+
+typedef struct NetGRO NetGRO;
+
+/*
+ * Called by the engine for each packet it releases.  @hdr is in host
+ * byte order and describes @buf the way a vnet header would: coalesced
+ * packets have a GSO type, and the checksums of all packets released by
+ * the engine have been verified.
+ */
+typedef void (NetGROOutput)(void *opaque, const struct virtio_net_hdr *hdr,
+                            const uint8_t *buf, size_t size);
+
+NetGRO *net_gro_new(NetGROOutput *output, void *opaque);
+void net_gro_free(NetGRO *gro);
+
+/* Select which kinds of TCP packets are coalesced; none by default.  */
+void net_gro_set_offloads(NetGRO *gro, bool tcp4, bool tcp6);
+
+/**
+ * net_gro_receive:
+ * @gro: the engine
+ * @buf: an Ethernet frame
+ * @size: length of @buf
+ *
+ * Try to coalesce @buf with the TCP segments received before it.
+ *
+ * Returns: true if the packet was taken over by the engine, which will
+ * release it later through the output callback.  If false is returned,
+ * the caller must deliver the packet itself; the engine has already
+ * released any data that must precede it.
+ */
+bool net_gro_receive(NetGRO *gro, const uint8_t *buf, size_t size);
+
+/* Release all packets held by the engine.  */
+void net_gro_flush(NetGRO *gro);
+
+/* Number of bytes held by the engine.  */
+size_t net_gro_pending(NetGRO *gro);
+
+#endif /* QEMU_NET_GRO_H */
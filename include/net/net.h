@@ -65,7 +65,12 @@ typedef struct SocketReadState SocketReadState;
 typedef void (SocketReadStateFinalize)(SocketReadState *rs);
 typedef void (NetAnnounce)(NetClientState *);
 typedef bool (SetSteeringEBPF)(NetClientState *, int);
+typedef int (OpenMirrorSocket)(NetClientState *, int);
 typedef bool (NetCheckPeerType)(NetClientState *, ObjectClass *, Error **);
+typedef void (SetAioContext)(NetClientState *, AioContext *);
+typedef void (NetReceiveBurst)(NetClientState *);
+typedef ssize_t (NetReadIOV)(void *, const struct iovec *, int);
+typedef ssize_t (NetReceiveDirect)(NetClientState *, NetReadIOV *, void *);
 
 typedef struct NetClientInfo {
     NetClientDriver type;
@@ -91,7 +96,12 @@ typedef struct NetClientInfo {
     SetVnetBE *set_vnet_be;
     NetAnnounce *announce;
     SetSteeringEBPF *set_steering_ebpf;
+    OpenMirrorSocket *open_mirror_socket;
     NetCheckPeerType *check_peer_type;
+    SetAioContext *set_aio_context;
+    NetReceiveBurst *receive_burst_begin;
+    NetReceiveBurst *receive_burst_end;
+    NetReceiveDirect *receive_direct;
 } NetClientInfo;
 
 struct NetClientState {
@@ -112,6 +122,7 @@ struct NetClientState {
     bool is_netdev;
     bool do_not_pad; /* do not pad to the minimum ethernet frame length */
     bool is_datapath;
+    bool in_iothread; /* NIC runs its peer's handlers in an IOThread */
     QTAILQ_HEAD(, NetFilterState) filters;
 };
 
@@ -176,6 +187,10 @@ ssize_t qemu_send_packet_async(NetClientState *nc, const uint8_t *buf,
                                int size, NetPacketSent *sent_cb);
 void qemu_purge_queued_packets(NetClientState *nc);
 void qemu_flush_queued_packets(NetClientState *nc);
+void qemu_net_burst_begin(NetClientState *nc);
+void qemu_net_burst_end(NetClientState *nc);
+ssize_t qemu_receive_direct(NetClientState *nc, NetReadIOV *read,
+                            void *opaque);
 void qemu_flush_or_purge_queued_packets(NetClientState *nc, bool purge);
 void qemu_set_info_str(NetClientState *nc,
                        const char *fmt, ...) G_GNUC_PRINTF(2, 3);
@@ -189,6 +204,8 @@ void qemu_set_offload(NetClientState *nc, int csum, int tso4, int tso6,
 void qemu_set_vnet_hdr_len(NetClientState *nc, int len);
 int qemu_set_vnet_le(NetClientState *nc, bool is_le);
 int qemu_set_vnet_be(NetClientState *nc, bool is_be);
+bool qemu_has_net_aio_context(NetClientState *nc);
+void qemu_set_net_aio_context(NetClientState *nc, AioContext *ctx);
 void qemu_macaddr_default_if_unset(MACAddr *macaddr);
 int qemu_show_nic_models(const char *arg, const char *const *models);
 void qemu_check_nic_model(NICInfo *nd, const char *model);
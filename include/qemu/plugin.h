@@ -88,9 +88,20 @@ enum plugin_dyn_cb_type {
 enum plugin_dyn_cb_subtype {
     PLUGIN_CB_REGULAR,
     PLUGIN_CB_INLINE,
+    PLUGIN_CB_COND,
     PLUGIN_N_CB_SUBTYPES,
 };
 
+/*
+ * A scoreboard holds one entry per vCPU. Its storage is reallocated
+ * (and the code cache flushed) when a vCPU with a higher index appears,
+ * since translated code embeds the address of the entries.
+ */
+struct qemu_plugin_scoreboard {
+    GArray *data;
+    QLIST_ENTRY(qemu_plugin_scoreboard) entry;
+};
+
 /*
  * A dynamic callback has an insertion point that is determined at run-time.
  * Usually the insertion point is somewhere in the code cache; think for
@@ -106,8 +117,15 @@ struct qemu_plugin_dyn_cb {
     union {
         struct {
             enum qemu_plugin_op op;
+            /* if @entry.score is NULL, the op applies to @userp */
+            qemu_plugin_u64 entry;
             uint64_t imm;
         } inline_insn;
+        struct {
+            enum qemu_plugin_cond cond;
+            qemu_plugin_u64 entry;
+            uint64_t imm;
+        } cond;
     };
 };
 
@@ -23,6 +23,7 @@
 typedef struct VuFdWatch {
     VuDev *vu_dev;
     int fd; /*kick fd*/
+    AioContext *ctx; /* NULL if the fd is handled in VuServer->ctx */
     void *pvt;
     vu_watch_cb cb;
     QTAILQ_ENTRY(VuFdWatch) next;
@@ -32,7 +33,8 @@ typedef struct VuFdWatch {
  * VuServer:
  * A vhost-user server instance with user-defined VuDevIface callbacks.
  * Vhost-user device backends can be implemented using VuServer. VuDevIface
- * callbacks and virtqueue kicks run in the given AioContext.
+ * callbacks and virtqueue kicks run in the given AioContext, unless
+ * vhost_user_server_set_queue_aio_contexts() moves the virtqueues elsewhere.
  */
 typedef struct {
     QIONetListener *listener;
@@ -41,9 +43,16 @@ typedef struct {
     int max_queues;
     const VuDevIface *vu_iface;
 
-    /* Protected by ctx lock */
+    /* Virtqueue i is processed in queue_ctx[i % num_queue_ctx], if set */
+    AioContext **queue_ctx;
+    unsigned int num_queue_ctx;
+    bool queues_locked;
+
+    /* Accessed atomically, taken by requests in any queue AioContext */
     unsigned int refcount;
     bool wait_idle;
+
+    /* Protected by ctx lock */
     VuDev vu_dev;
     QIOChannel *ioc; /* The I/O channel with the client */
     QIOChannelSocket *sioc; /* The underlying data channel with the client */
@@ -61,6 +70,10 @@ bool vhost_user_server_start(VuServer *server,
 
 void vhost_user_server_stop(VuServer *server);
 
+void vhost_user_server_set_queue_aio_contexts(VuServer *server,
+                                              AioContext **queue_ctx,
+                                              unsigned int num_queue_ctx);
+
 void vhost_user_server_ref(VuServer *server);
 void vhost_user_server_unref(VuServer *server);
 
@@ -213,6 +213,29 @@ DEF(qemu_st8_i32, 0, TLADDR_ARGS + 1, 1,
     TCG_OPF_CALL_CLOBBER | TCG_OPF_SIDE_EFFECTS |
     IMPL(TCG_TARGET_HAS_qemu_st8_i32))
 
+/*
+ * Atomic read-modify-write of guest memory, returning the old value.
+ * The MemOpIdx never has MO_SIGN or a byte swap.
+ */
+DEF(qemu_cmpxchg_i32, 1, TLADDR_ARGS + 2, 1,
+    TCG_OPF_CALL_CLOBBER | TCG_OPF_SIDE_EFFECTS |
+    IMPL(TCG_TARGET_HAS_qemu_atomic))
+DEF(qemu_xchg_i32, 1, TLADDR_ARGS + 1, 1,
+    TCG_OPF_CALL_CLOBBER | TCG_OPF_SIDE_EFFECTS |
+    IMPL(TCG_TARGET_HAS_qemu_atomic))
+DEF(qemu_fetch_add_i32, 1, TLADDR_ARGS + 1, 1,
+    TCG_OPF_CALL_CLOBBER | TCG_OPF_SIDE_EFFECTS |
+    IMPL(TCG_TARGET_HAS_qemu_atomic))
+DEF(qemu_cmpxchg_i64, 1, TLADDR_ARGS + 2, 1,
+    TCG_OPF_CALL_CLOBBER | TCG_OPF_SIDE_EFFECTS | IMPL64 |
+    IMPL(TCG_TARGET_HAS_qemu_atomic))
+DEF(qemu_xchg_i64, 1, TLADDR_ARGS + 1, 1,
+    TCG_OPF_CALL_CLOBBER | TCG_OPF_SIDE_EFFECTS | IMPL64 |
+    IMPL(TCG_TARGET_HAS_qemu_atomic))
+DEF(qemu_fetch_add_i64, 1, TLADDR_ARGS + 1, 1,
+    TCG_OPF_CALL_CLOBBER | TCG_OPF_SIDE_EFFECTS | IMPL64 |
+    IMPL(TCG_TARGET_HAS_qemu_atomic))
+
 /* Host vector support.  */
 
 #define IMPLVEC  TCG_OPF_VECTOR | IMPL(TCG_TARGET_MAYBE_vec)
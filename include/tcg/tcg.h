@@ -176,7 +176,8 @@ typedef uint64_t TCGRegSet;
 
 #if !defined(TCG_TARGET_HAS_v64) \
     && !defined(TCG_TARGET_HAS_v128) \
-    && !defined(TCG_TARGET_HAS_v256)
+    && !defined(TCG_TARGET_HAS_v256) \
+    && !defined(TCG_TARGET_HAS_v512)
 #define TCG_TARGET_MAYBE_vec            0
 #define TCG_TARGET_HAS_abs_vec          0
 #define TCG_TARGET_HAS_neg_vec          0
@@ -209,6 +210,17 @@ typedef uint64_t TCGRegSet;
 #ifndef TCG_TARGET_HAS_v256
 #define TCG_TARGET_HAS_v256             0
 #endif
+#ifndef TCG_TARGET_HAS_v512
+#define TCG_TARGET_HAS_v512             0
+#endif
+
+/*
+ * Backends that can do the TLB lookup for qemu_cmpxchg, qemu_xchg and
+ * qemu_fetch_add inline, calling the cpu_atomic_*_mmu helpers on a miss.
+ */
+#ifndef TCG_TARGET_HAS_qemu_atomic
+#define TCG_TARGET_HAS_qemu_atomic      0
+#endif
 
 #ifndef TARGET_INSN_START_EXTRA_WORDS
 # define TARGET_INSN_START_WORDS 1
@@ -263,10 +275,22 @@ struct TCGLabel {
     unsigned has_value : 1;
     unsigned id : 14;
     unsigned refs : 16;
+    /*
+     * Set by liveness_pass_1 if the label is the target of a backward
+     * branch, for which the register allocator has no state to merge.
+     */
+    bool backward;
     union {
         uintptr_t value;
         const tcg_insn_unit *value_ptr;
     } u;
+    /* Liveness state of the globals on entry to the label.  */
+    uint8_t *la_state;
+    /*
+     * For each host register, the global that all forward branches
+     * seen so far keep in it, or NULL.
+     */
+    struct TCGTemp **reg_state;
     QSIMPLEQ_HEAD(, TCGRelocation) relocs;
     QSIMPLEQ_ENTRY(TCGLabel) next;
 };
@@ -293,6 +317,7 @@ typedef enum TCGType {
     TCG_TYPE_V64,
     TCG_TYPE_V128,
     TCG_TYPE_V256,
+    TCG_TYPE_V512,
 
     TCG_TYPE_COUNT, /* number of different types */
 
@@ -606,6 +631,9 @@ struct TCGContext {
 
     /* descriptor of the instruction being translated */
     struct qemu_plugin_insn *plugin_insn;
+
+    /* if non-NULL, tcg_emit_op inserts new ops before this one */
+    TCGOp *emit_before_op;
 #endif
 
     GHashTable *const_table[TCG_TYPE_COUNT];
@@ -806,6 +834,7 @@ void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
+int tcg_region_evict(void (*evict_tb)(TranslationBlock *tb));
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
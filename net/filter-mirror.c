@@ -21,6 +21,7 @@
 #include "qemu/iov.h"
 #include "qemu/sockets.h"
 #include "block/aio-wait.h"
+#include "ebpf/ebpf_filter.h"
 
 #define TYPE_FILTER_MIRROR "filter-mirror"
 typedef struct MirrorState MirrorState;
@@ -41,6 +42,9 @@ struct MirrorState {
     CharBackend chr_out;
     SocketReadState rs;
     bool vnet_hdr;
+    /* Packet socket fed by the eBPF classifier when the netdev is vhost */
+    int mirror_fd;
+    uint8_t *mirror_buf;
 };
 
 typedef struct FilterSendCo {
@@ -235,6 +239,14 @@ static void filter_mirror_cleanup(NetFilterState *nf)
 {
     MirrorState *s = FILTER_MIRROR(nf);
 
+    if (s->mirror_fd >= 0) {
+        qemu_set_fd_handler(s->mirror_fd, NULL, NULL, NULL);
+        close(s->mirror_fd);
+        s->mirror_fd = -1;
+    }
+    g_free(s->mirror_buf);
+    s->mirror_buf = NULL;
+
     qemu_chr_fe_deinit(&s->chr_out, false);
 }
 
@@ -267,6 +279,72 @@ static void filter_mirror_setup(NetFilterState *nf, Error **errp)
     qemu_chr_fe_init(&s->chr_out, chr, errp);
 }
 
+/*
+ * With vhost the packets never reach the filter chain, so read the ones
+ * selected by the classifier from the packet socket.  The kernel hands
+ * them over without a virtio-net header; send a zeroed one so that
+ * consumers see the same layout as for the userspace datapath.
+ */
+static void filter_mirror_offload_read(void *opaque)
+{
+    MirrorState *s = opaque;
+    NetFilterState *nf = NETFILTER(s);
+    size_t hdr_len = nf->netdev->vnet_hdr_len;
+    struct iovec iov;
+    ssize_t len;
+    int ret;
+
+    for (;;) {
+        len = recv(s->mirror_fd, s->mirror_buf + hdr_len,
+                   NET_BUFSIZE - hdr_len, 0);
+        if (len <= 0) {
+            break;
+        }
+        if (!nf->on) {
+            continue;
+        }
+
+        memset(s->mirror_buf, 0, hdr_len);
+        iov.iov_base = s->mirror_buf;
+        iov.iov_len = hdr_len + len;
+        ret = filter_send(s, &iov, 1);
+        if (ret < 0) {
+            error_report("filter mirror send failed(%s)", strerror(-ret));
+        }
+    }
+}
+
+static void filter_mirror_setup_offload(NetFilterState *nf, Error **errp)
+{
+    MirrorState *s = FILTER_MIRROR(nf);
+    struct EBPFFilterContext ctx;
+    int fd;
+
+    if (!nf->netdev->info->open_mirror_socket) {
+        error_setg(errp, "Vhost is not supported by filter-mirror on "
+                   "netdev '%s'", nf->netdev->name);
+        return;
+    }
+
+    ebpf_filter_init(&ctx);
+    if (!ebpf_filter_load(&ctx, &nf->match, nf->direction, errp)) {
+        return;
+    }
+
+    /* The socket holds its own reference to the program */
+    fd = nf->netdev->info->open_mirror_socket(nf->netdev, ctx.program_fd);
+    ebpf_filter_unload(&ctx);
+    if (fd < 0) {
+        error_setg_errno(errp, -fd, "filter-mirror: could not open a packet "
+                         "socket on netdev '%s'", nf->netdev->name);
+        return;
+    }
+
+    s->mirror_fd = fd;
+    s->mirror_buf = g_malloc(NET_BUFSIZE);
+    qemu_set_fd_handler(s->mirror_fd, filter_mirror_offload_read, NULL, s);
+}
+
 static void redirector_rs_finalize(SocketReadState *rs)
 {
     MirrorState *s = container_of(rs, MirrorState, rs);
@@ -421,6 +499,7 @@ static void filter_mirror_class_init(ObjectClass *oc, void *data)
                                    filter_mirror_set_vnet_hdr);
 
     nfc->setup = filter_mirror_setup;
+    nfc->setup_offload = filter_mirror_setup_offload;
     nfc->cleanup = filter_mirror_cleanup;
     nfc->receive_iov = filter_mirror_receive_iov;
 }
@@ -447,6 +526,7 @@ static void filter_mirror_init(Object *obj)
     MirrorState *s = FILTER_MIRROR(obj);
 
     s->vnet_hdr = false;
+    s->mirror_fd = -1;
 }
 
 static void filter_redirector_init(Object *obj)
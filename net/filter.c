@@ -9,8 +9,11 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "qapi/qmp/qerror.h"
+#include "qapi/visitor.h"
+#include "qemu/cutils.h"
 #include "qemu/error-report.h"
 
+#include "net/eth.h"
 #include "net/filter.h"
 #include "net/net.h"
 #include "net/vhost_net.h"
@@ -19,12 +22,112 @@
 #include "qemu/module.h"
 #include "net/colo.h"
 #include "migration/colo.h"
+#include "util.h"
 
 static inline bool qemu_can_skip_netfilter(NetFilterState *nf)
 {
     return !nf->on;
 }
 
+static bool netfilter_match_is_set(const NetFilterMatch *match)
+{
+    return match->has_dst_mac || match->has_src_mac || match->has_vlan ||
+           netfilter_match_has_ip(match);
+}
+
+/*
+ * Keep in sync with ebpf/ebpf_filter.c, which implements the same
+ * criteria for netdevs whose packets do not go through QEMU.
+ */
+bool netfilter_match(const NetFilterMatch *match,
+                     const uint8_t *buf, size_t size)
+{
+    const struct ip_header *ip;
+    size_t l3 = ETH_HLEN, l4;
+    uint16_t ethertype;
+    int vlan = -1;
+
+    if (size < ETH_HLEN) {
+        return false;
+    }
+    if (match->has_dst_mac && memcmp(buf, match->dst_mac, ETH_ALEN)) {
+        return false;
+    }
+    if (match->has_src_mac &&
+        memcmp(buf + ETH_ALEN, match->src_mac, ETH_ALEN)) {
+        return false;
+    }
+
+    ethertype = lduw_be_p(buf + 12);
+    if (ethertype == ETH_P_VLAN) {
+        if (size < ETH_HLEN + 4) {
+            return false;
+        }
+        vlan = lduw_be_p(buf + 14) & 0xfff;
+        ethertype = lduw_be_p(buf + 16);
+        l3 += 4;
+    }
+    if (match->has_vlan && vlan != match->vlan) {
+        return false;
+    }
+
+    if (!netfilter_match_has_ip(match)) {
+        return true;
+    }
+    if (ethertype != ETH_P_IP || size < l3 + sizeof(*ip)) {
+        return false;
+    }
+
+    ip = (const struct ip_header *)(buf + l3);
+    if (match->has_proto && ip->ip_p != match->proto) {
+        return false;
+    }
+    if ((ldl_be_p(&ip->ip_src) & match->src_mask) !=
+        (match->src_addr & match->src_mask)) {
+        return false;
+    }
+    if ((ldl_be_p(&ip->ip_dst) & match->dst_mask) !=
+        (match->dst_addr & match->dst_mask)) {
+        return false;
+    }
+
+    if (!match->has_src_port && !match->has_dst_port) {
+        return true;
+    }
+    if ((ip->ip_p != IP_PROTO_TCP && ip->ip_p != IP_PROTO_UDP) ||
+        (lduw_be_p(&ip->ip_off) & IP_OFFMASK)) {
+        return false;
+    }
+    l4 = l3 + IP_HDR_GET_LEN(ip);
+    if (size < l4 + 4) {
+        return false;
+    }
+    if (match->has_src_port && lduw_be_p(buf + l4) != match->src_port) {
+        return false;
+    }
+    if (match->has_dst_port && lduw_be_p(buf + l4 + 2) != match->dst_port) {
+        return false;
+    }
+
+    return true;
+}
+
+static bool netfilter_receive_match(NetFilterState *nf,
+                                    const struct iovec *iov, int iovcnt)
+{
+    /* Ethernet and VLAN headers, IPv4 header with options, ports */
+    uint8_t buf[ETH_HLEN + 4 + 60 + 4];
+    size_t size;
+
+    if (!netfilter_match_is_set(&nf->match)) {
+        return true;
+    }
+
+    size = iov_to_buf(iov, iovcnt, nf->netdev->vnet_hdr_len,
+                      buf, sizeof(buf));
+    return netfilter_match(&nf->match, buf, size);
+}
+
 ssize_t qemu_netfilter_receive(NetFilterState *nf,
                                NetFilterDirection direction,
                                NetClientState *sender,
@@ -36,8 +139,9 @@ ssize_t qemu_netfilter_receive(NetFilterState *nf,
     if (qemu_can_skip_netfilter(nf)) {
         return 0;
     }
-    if (nf->direction == direction ||
-        nf->direction == NET_FILTER_DIRECTION_ALL) {
+    if ((nf->direction == direction ||
+         nf->direction == NET_FILTER_DIRECTION_ALL) &&
+        netfilter_receive_match(nf, iov, iovcnt)) {
         return NETFILTER_GET_CLASS(OBJECT(nf))->receive_iov(
                                    nf, sender, flags, iov, iovcnt, sent_cb);
     }
@@ -205,6 +309,235 @@ static void netfilter_set_insert(Object *obj, const char *str, Error **errp)
     nf->insert_before_flag = !strcmp(str, "before");
 }
 
+/* The program of offloaded filters is built when they are attached */
+static bool netfilter_check_match_settable(NetFilterState *nf,
+                                           const char *name, Error **errp)
+{
+    if (nf->netdev) {
+        error_setg(errp, "Property '%s' can not be changed once the filter "
+                   "is attached", name);
+        return false;
+    }
+    return true;
+}
+
+static char *netfilter_format_mac(bool has_mac, const uint8_t *mac)
+{
+    if (!has_mac) {
+        return g_strdup("");
+    }
+    return g_strdup_printf("%02x:%02x:%02x:%02x:%02x:%02x",
+                           mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+static bool netfilter_parse_mac(NetFilterState *nf, const char *name,
+                                const char *str, bool *has_mac, uint8_t *mac,
+                                Error **errp)
+{
+    if (!netfilter_check_match_settable(nf, name, errp)) {
+        return false;
+    }
+    if (net_parse_macaddr(mac, str) < 0) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, name, "a MAC address");
+        return false;
+    }
+    *has_mac = true;
+    return true;
+}
+
+static char *netfilter_get_match_dst_mac(Object *obj, Error **errp)
+{
+    NetFilterState *nf = NETFILTER(obj);
+
+    return netfilter_format_mac(nf->match.has_dst_mac, nf->match.dst_mac);
+}
+
+static void netfilter_set_match_dst_mac(Object *obj, const char *str,
+                                        Error **errp)
+{
+    NetFilterState *nf = NETFILTER(obj);
+
+    netfilter_parse_mac(nf, "match-dst-mac", str, &nf->match.has_dst_mac,
+                        nf->match.dst_mac, errp);
+}
+
+static char *netfilter_get_match_src_mac(Object *obj, Error **errp)
+{
+    NetFilterState *nf = NETFILTER(obj);
+
+    return netfilter_format_mac(nf->match.has_src_mac, nf->match.src_mac);
+}
+
+static void netfilter_set_match_src_mac(Object *obj, const char *str,
+                                        Error **errp)
+{
+    NetFilterState *nf = NETFILTER(obj);
+
+    netfilter_parse_mac(nf, "match-src-mac", str, &nf->match.has_src_mac,
+                        nf->match.src_mac, errp);
+}
+
+static char *netfilter_get_match_proto(Object *obj, Error **errp)
+{
+    NetFilterState *nf = NETFILTER(obj);
+
+    if (!nf->match.has_proto) {
+        return g_strdup("");
+    }
+
+    switch (nf->match.proto) {
+    case IP_PROTO_TCP:
+        return g_strdup("tcp");
+    case IP_PROTO_UDP:
+        return g_strdup("udp");
+    case IPPROTO_ICMP:
+        return g_strdup("icmp");
+    default:
+        return g_strdup_printf("%u", nf->match.proto);
+    }
+}
+
+static void netfilter_set_match_proto(Object *obj, const char *str,
+                                      Error **errp)
+{
+    NetFilterState *nf = NETFILTER(obj);
+    unsigned int proto;
+
+    if (!netfilter_check_match_settable(nf, "match-proto", errp)) {
+        return;
+    }
+
+    if (!strcmp(str, "tcp")) {
+        proto = IP_PROTO_TCP;
+    } else if (!strcmp(str, "udp")) {
+        proto = IP_PROTO_UDP;
+    } else if (!strcmp(str, "icmp")) {
+        proto = IPPROTO_ICMP;
+    } else if (qemu_strtoui(str, NULL, 0, &proto) < 0 || proto > UINT8_MAX) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "match-proto",
+                   "'tcp', 'udp', 'icmp' or an IP protocol number");
+        return;
+    }
+
+    nf->match.has_proto = true;
+    nf->match.proto = proto;
+}
+
+static char *netfilter_format_addr(uint32_t addr, uint32_t mask)
+{
+    if (!mask) {
+        return g_strdup("");
+    }
+    return g_strdup_printf("%u.%u.%u.%u/%d", addr >> 24, (addr >> 16) & 0xff,
+                           (addr >> 8) & 0xff, addr & 0xff, ctpop32(mask));
+}
+
+/* Parse an IPv4 address with an optional prefix length */
+static void netfilter_parse_addr(NetFilterState *nf, const char *name,
+                                 const char *str, uint32_t *addr,
+                                 uint32_t *mask, Error **errp)
+{
+    g_autofree char *host = g_strdup(str);
+    char *prefix = strchr(host, '/');
+    unsigned int len = 32;
+    struct in_addr in;
+
+    if (!netfilter_check_match_settable(nf, name, errp)) {
+        return;
+    }
+
+    if (prefix) {
+        *prefix++ = '\0';
+    }
+    if (inet_pton(AF_INET, host, &in) != 1 ||
+        (prefix && (qemu_strtoui(prefix, NULL, 10, &len) < 0 ||
+                    len < 1 || len > 32))) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, name,
+                   "an IPv4 address with an optional prefix length");
+        return;
+    }
+
+    *mask = UINT32_MAX << (32 - len);
+    *addr = ntohl(in.s_addr) & *mask;
+}
+
+static char *netfilter_get_match_src(Object *obj, Error **errp)
+{
+    NetFilterState *nf = NETFILTER(obj);
+
+    return netfilter_format_addr(nf->match.src_addr, nf->match.src_mask);
+}
+
+static void netfilter_set_match_src(Object *obj, const char *str,
+                                    Error **errp)
+{
+    NetFilterState *nf = NETFILTER(obj);
+
+    netfilter_parse_addr(nf, "match-src", str, &nf->match.src_addr,
+                         &nf->match.src_mask, errp);
+}
+
+static char *netfilter_get_match_dst(Object *obj, Error **errp)
+{
+    NetFilterState *nf = NETFILTER(obj);
+
+    return netfilter_format_addr(nf->match.dst_addr, nf->match.dst_mask);
+}
+
+static void netfilter_set_match_dst(Object *obj, const char *str,
+                                    Error **errp)
+{
+    NetFilterState *nf = NETFILTER(obj);
+
+    netfilter_parse_addr(nf, "match-dst", str, &nf->match.dst_addr,
+                         &nf->match.dst_mask, errp);
+}
+
+static void netfilter_get_match_u16(Object *obj, Visitor *v, const char *name,
+                                    void *opaque, Error **errp)
+{
+    NetFilterState *nf = NETFILTER(obj);
+    uint16_t value;
+
+    if (!strcmp(name, "match-vlan")) {
+        value = nf->match.vlan;
+    } else if (!strcmp(name, "match-sport")) {
+        value = nf->match.src_port;
+    } else {
+        value = nf->match.dst_port;
+    }
+
+    visit_type_uint16(v, name, &value, errp);
+}
+
+static void netfilter_set_match_u16(Object *obj, Visitor *v, const char *name,
+                                    void *opaque, Error **errp)
+{
+    NetFilterState *nf = NETFILTER(obj);
+    uint16_t value;
+
+    if (!netfilter_check_match_settable(nf, name, errp) ||
+        !visit_type_uint16(v, name, &value, errp)) {
+        return;
+    }
+
+    if (!strcmp(name, "match-vlan")) {
+        if (value > 4095) {
+            error_setg(errp, QERR_INVALID_PARAMETER_VALUE, name,
+                       "a VLAN id between 0 and 4095");
+            return;
+        }
+        nf->match.has_vlan = true;
+        nf->match.vlan = value;
+    } else if (!strcmp(name, "match-sport")) {
+        nf->match.has_src_port = true;
+        nf->match.src_port = value;
+    } else {
+        nf->match.has_dst_port = true;
+        nf->match.dst_port = value;
+    }
+}
+
 static void netfilter_init(Object *obj)
 {
     NetFilterState *nf = NETFILTER(obj);
@@ -240,11 +573,25 @@ static void netfilter_complete(UserCreatable *uc, Error **errp)
         return;
     }
 
-    if (get_vhost_net(ncs[0])) {
+    if (get_vhost_net(ncs[0]) && !nfc->setup_offload) {
         error_setg(errp, "Vhost is not supported");
         return;
     }
 
+    if (ncs[0]->peer && ncs[0]->peer->in_iothread) {
+        error_setg(errp, "netdev '%s' is used by a NIC with iothreads",
+                   nf->netdev_id);
+        return;
+    }
+
+    if ((nf->match.has_src_port || nf->match.has_dst_port) &&
+        nf->match.has_proto && nf->match.proto != IP_PROTO_TCP &&
+        nf->match.proto != IP_PROTO_UDP) {
+        error_setg(errp, "'match-sport' and 'match-dport' need "
+                   "'match-proto' to be tcp or udp");
+        return;
+    }
+
     if (strcmp(nf->position, "head") && strcmp(nf->position, "tail")) {
         Object *container;
         Object *obj;
@@ -290,6 +637,14 @@ static void netfilter_complete(UserCreatable *uc, Error **errp)
         }
     }
 
+    if (get_vhost_net(nf->netdev)) {
+        nfc->setup_offload(nf, &local_err);
+        if (local_err) {
+            error_propagate(errp, local_err);
+            return;
+        }
+    }
+
     if (position) {
         if (nf->insert_before_flag) {
             QTAILQ_INSERT_BEFORE(position, nf, next);
@@ -349,6 +704,30 @@ static void netfilter_class_init(ObjectClass *oc, void *data)
                                   netfilter_get_position, netfilter_set_position);
     object_class_property_add_str(oc, "insert",
                                   netfilter_get_insert, netfilter_set_insert);
+    object_class_property_add_str(oc, "match-dst-mac",
+                                  netfilter_get_match_dst_mac,
+                                  netfilter_set_match_dst_mac);
+    object_class_property_add_str(oc, "match-src-mac",
+                                  netfilter_get_match_src_mac,
+                                  netfilter_set_match_src_mac);
+    object_class_property_add(oc, "match-vlan", "uint16",
+                              netfilter_get_match_u16,
+                              netfilter_set_match_u16, NULL, NULL);
+    object_class_property_add_str(oc, "match-proto",
+                                  netfilter_get_match_proto,
+                                  netfilter_set_match_proto);
+    object_class_property_add_str(oc, "match-src",
+                                  netfilter_get_match_src,
+                                  netfilter_set_match_src);
+    object_class_property_add_str(oc, "match-dst",
+                                  netfilter_get_match_dst,
+                                  netfilter_set_match_dst);
+    object_class_property_add(oc, "match-sport", "uint16",
+                              netfilter_get_match_u16,
+                              netfilter_set_match_u16, NULL, NULL);
+    object_class_property_add(oc, "match-dport", "uint16",
+                              netfilter_get_match_u16,
+                              netfilter_set_match_u16, NULL, NULL);
 
     ucc->complete = netfilter_complete;
     nfc->handle_event = default_handle_event;
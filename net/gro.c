@@ -0,0 +1,427 @@
+/*
+ * Generic receive offload
+ *
+ * Consecutive segments of a TCP connection are merged into a single large
+ * packet, which is then described to the receiver by a vnet header with
+ * a GSO type.  This lets NICs whose guests accept TSO packets receive
+ * them even from backends that only handle MTU-sized frames, e.g. the
+ * socket, stream and user network backends.
+ *
+ * Coalescing is limited to plain Ethernet frames carrying TCP over IPv4
+ * without options or IPv6 without extension headers, and to segments
+ * that only have the ACK and PSH flags set.  As in Linux, the segments
+ * of a flow must have identical headers except for the sequence number,
+ * the window and the IP length, checksum and identification fields.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "net/gro.h"
+#include "net/eth.h"
+#include "net/checksum.h"
+
+/* Largest packet that fits the 16-bit IP length fields */
+#define NET_GRO_MAX_SIZE    (ETH_HLEN + ETH_MAX_IP_DGRAM_LEN)
+
+#define IP4_HDR_LEN         sizeof(struct ip_header)
+#define IP6_HDR_LEN         sizeof(struct ip6_header)
+#define TCP_HDR_LEN         sizeof(struct tcp_header)
+
+#define IP4_OFF(field)      offsetof(struct ip_header, field)
+#define IP6_PLEN_OFF        offsetof(struct ip6_header, ip6_plen)
+#define IP6_NXT_OFF         offsetof(struct ip6_header, ip6_nxt)
+#define IP6_HLIM_OFF        offsetof(struct ip6_header, \
+                                     ip6_ctlun.ip6_un1.ip6_un1_hlim)
+#define TCP_FLAGS_OFF       offsetof(struct tcp_hdr, th_flags)
+
+typedef struct NetGROFlow {
+    uint8_t *buf;
+    size_t size;            /* 0 if the flow is not in use */
+    size_t l4_off;          /* offset of the TCP header */
+    size_t hdr_len;         /* length of all headers */
+    bool ipv6;
+    uint16_t mss;           /* payload length of the first segment */
+    unsigned int segs;
+    uint32_t next_seq;
+    uint32_t csum;          /* partial checksum of the payload */
+} NetGROFlow;
+
+struct NetGRO {
+    NetGROOutput *output;
+    void *opaque;
+    bool tcp4;
+    bool tcp6;
+    size_t pending;
+    unsigned int evict;
+    NetGROFlow flows[NET_GRO_MAX_FLOWS];
+};
+
+typedef struct NetGROPacket {
+    const uint8_t *buf;
+    size_t size;            /* without Ethernet padding */
+    size_t l4_off;
+    size_t hdr_len;
+    size_t payload_len;
+    bool ipv6;
+    uint32_t csum;          /* partial checksum of the payload */
+} NetGROPacket;
+
+enum {
+    NET_GRO_PASS,           /* not TCP */
+    NET_GRO_FLUSH,          /* TCP, but cannot be coalesced */
+    NET_GRO_MERGE,
+};
+
+/* Unlike TCP_HEADER_FLAGS(), this includes ECE and CWR */
+static uint8_t net_gro_tcp_flags(const uint8_t *tcp)
+{
+    return tcp[TCP_FLAGS_OFF];
+}
+
+static uint32_t net_gro_csum_fold(uint32_t sum)
+{
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (sum & 0xffff) + (sum >> 16);
+}
+
+/* Checksum of the TCP pseudo header, @l3 points to the IP header */
+static uint32_t net_gro_pseudo_csum(uint8_t *l3, bool ipv6, size_t tcp_len)
+{
+    uint32_t sum;
+
+    if (ipv6) {
+        sum = net_checksum_add(2 * sizeof(struct in6_address),
+                               l3 + offsetof(struct ip6_header, ip6_src));
+    } else {
+        sum = net_checksum_add(2 * sizeof(uint32_t),
+                               l3 + IP4_OFF(ip_src));
+    }
+    return sum + IP_PROTO_TCP + tcp_len;
+}
+
+static int net_gro_parse(NetGRO *gro, NetGROPacket *pkt,
+                         const uint8_t *buf, size_t size)
+{
+    /* net_checksum_add() does not take a const pointer */
+    uint8_t *l3 = (uint8_t *)buf + ETH_HLEN;
+    uint8_t *tcp;
+    size_t l3_len, tcp_len;
+    uint32_t sum;
+    bool enabled;
+
+    if (size < ETH_HLEN + IP4_HDR_LEN + TCP_HDR_LEN) {
+        return NET_GRO_PASS;
+    }
+
+    switch (lduw_be_p(&PKT_GET_ETH_HDR(buf)->h_proto)) {
+    case ETH_P_IP:
+        if (l3[IP4_OFF(ip_ver_len)] != 0x45 ||
+            l3[IP4_OFF(ip_p)] != IP_PROTO_TCP ||
+            (lduw_be_p(l3 + IP4_OFF(ip_off)) & (IP_MF | IP_OFFMASK))) {
+            return NET_GRO_PASS;
+        }
+        l3_len = lduw_be_p(l3 + IP4_OFF(ip_len));
+        if (l3_len < IP4_HDR_LEN + TCP_HDR_LEN || l3_len > size - ETH_HLEN ||
+            net_raw_checksum(l3, IP4_HDR_LEN)) {
+            return NET_GRO_PASS;
+        }
+        pkt->ipv6 = false;
+        pkt->l4_off = ETH_HLEN + IP4_HDR_LEN;
+        enabled = gro->tcp4;
+        break;
+    case ETH_P_IPV6:
+        if (size < ETH_HLEN + IP6_HDR_LEN + TCP_HDR_LEN ||
+            (l3[0] >> 4) != IP_HEADER_VERSION_6 ||
+            l3[IP6_NXT_OFF] != IP_PROTO_TCP) {
+            return NET_GRO_PASS;
+        }
+        l3_len = IP6_HDR_LEN + lduw_be_p(l3 + IP6_PLEN_OFF);
+        if (l3_len < IP6_HDR_LEN + TCP_HDR_LEN || l3_len > size - ETH_HLEN) {
+            return NET_GRO_PASS;
+        }
+        pkt->ipv6 = true;
+        pkt->l4_off = ETH_HLEN + IP6_HDR_LEN;
+        enabled = gro->tcp6;
+        break;
+    default:
+        return NET_GRO_PASS;
+    }
+
+    pkt->buf = buf;
+    pkt->size = ETH_HLEN + l3_len;
+    tcp = (uint8_t *)buf + pkt->l4_off;
+    tcp_len = pkt->size - pkt->l4_off;
+    pkt->hdr_len = pkt->l4_off +
+        ((tcp[offsetof(tcp_header, th_offset_flags)] >> 4) << 2);
+    if (pkt->hdr_len < pkt->l4_off + TCP_HDR_LEN || pkt->hdr_len > pkt->size) {
+        return NET_GRO_PASS;
+    }
+    pkt->payload_len = pkt->size - pkt->hdr_len;
+
+    if (!enabled || !pkt->payload_len ||
+        (net_gro_tcp_flags(tcp) & ~TH_PUSH) != TH_ACK) {
+        return NET_GRO_FLUSH;
+    }
+
+    /*
+     * The receiver will be told that the checksum is valid, so check it.
+     * The payload is summed separately so that the sum can be reused
+     * when the segment is merged.
+     */
+    pkt->csum = net_gro_csum_fold(net_checksum_add(pkt->payload_len,
+                                                   tcp + pkt->hdr_len -
+                                                   pkt->l4_off));
+    sum = net_checksum_add(pkt->hdr_len - pkt->l4_off, tcp) + pkt->csum +
+          net_gro_pseudo_csum(l3, pkt->ipv6, tcp_len);
+    if (net_checksum_finish(sum)) {
+        return NET_GRO_FLUSH;
+    }
+
+    return NET_GRO_MERGE;
+}
+
+/* Does @pkt belong to the same connection as @flow?  */
+static bool net_gro_flow_match(NetGROFlow *flow, NetGROPacket *pkt)
+{
+    const uint8_t *l3 = pkt->buf + ETH_HLEN;
+    const uint8_t *flow_l3 = flow->buf + ETH_HLEN;
+
+    if (flow->ipv6 != pkt->ipv6 ||
+        memcmp(flow->buf + flow->l4_off, pkt->buf + pkt->l4_off,
+               2 * sizeof(uint16_t))) {
+        return false;
+    }
+    if (pkt->ipv6) {
+        return !memcmp(flow_l3 + offsetof(struct ip6_header, ip6_src),
+                       l3 + offsetof(struct ip6_header, ip6_src),
+                       2 * sizeof(struct in6_address));
+    } else {
+        return !memcmp(flow_l3 + IP4_OFF(ip_src),
+                       l3 + IP4_OFF(ip_src),
+                       2 * sizeof(uint32_t));
+    }
+}
+
+/* Can @pkt be appended to @flow, which belongs to the same connection?  */
+static bool net_gro_flow_can_merge(NetGROFlow *flow, NetGROPacket *pkt)
+{
+    const uint8_t *l3 = pkt->buf + ETH_HLEN;
+    const uint8_t *flow_l3 = flow->buf + ETH_HLEN;
+    const uint8_t *tcp = pkt->buf + pkt->l4_off;
+    const uint8_t *flow_tcp = flow->buf + flow->l4_off;
+
+    if (flow->hdr_len != pkt->hdr_len ||
+        flow->size + pkt->payload_len > NET_GRO_MAX_SIZE ||
+        pkt->payload_len > flow->mss ||
+        ldl_be_p(tcp + offsetof(tcp_header, th_seq)) != flow->next_seq ||
+        memcmp(flow->buf, pkt->buf, ETH_HLEN)) {
+        return false;
+    }
+
+    if (pkt->ipv6) {
+        /* version, traffic class, flow label; hop limit */
+        if (memcmp(flow_l3, l3, 4) ||
+            flow_l3[IP6_HLIM_OFF] != l3[IP6_HLIM_OFF]) {
+            return false;
+        }
+    } else {
+        if (flow_l3[IP4_OFF(ip_tos)] != l3[IP4_OFF(ip_tos)] ||
+            flow_l3[IP4_OFF(ip_ttl)] != l3[IP4_OFF(ip_ttl)] ||
+            lduw_be_p(flow_l3 + IP4_OFF(ip_off)) !=
+            lduw_be_p(l3 + IP4_OFF(ip_off))) {
+            return false;
+        }
+    }
+
+    /* acknowledgment number and options, including timestamps */
+    return ldl_be_p(flow_tcp + offsetof(tcp_header, th_ack)) ==
+           ldl_be_p(tcp + offsetof(tcp_header, th_ack)) &&
+           !memcmp(flow_tcp + TCP_HDR_LEN, tcp + TCP_HDR_LEN,
+                   pkt->hdr_len - pkt->l4_off - TCP_HDR_LEN);
+}
+
+static void net_gro_flow_start(NetGRO *gro, NetGROFlow *flow,
+                               NetGROPacket *pkt)
+{
+    if (!flow->buf) {
+        flow->buf = g_malloc(NET_GRO_MAX_SIZE);
+    }
+    memcpy(flow->buf, pkt->buf, pkt->size);
+    flow->size = pkt->size;
+    flow->l4_off = pkt->l4_off;
+    flow->hdr_len = pkt->hdr_len;
+    flow->ipv6 = pkt->ipv6;
+    flow->mss = pkt->payload_len;
+    flow->segs = 1;
+    flow->next_seq = ldl_be_p(pkt->buf + pkt->l4_off +
+                              offsetof(tcp_header, th_seq)) +
+                     pkt->payload_len;
+    flow->csum = pkt->csum;
+    gro->pending += flow->size;
+}
+
+static void net_gro_flow_merge(NetGRO *gro, NetGROFlow *flow,
+                               NetGROPacket *pkt)
+{
+    const uint8_t *tcp = pkt->buf + pkt->l4_off;
+    uint8_t *flow_tcp = flow->buf + flow->l4_off;
+    uint32_t csum = pkt->csum;
+
+    memcpy(flow->buf + flow->size, pkt->buf + pkt->hdr_len, pkt->payload_len);
+
+    /* A 16-bit sum at an odd offset has its bytes swapped */
+    if ((flow->size - flow->hdr_len) & 1) {
+        csum = bswap16(csum);
+    }
+    flow->csum = net_gro_csum_fold(flow->csum + csum);
+
+    /* The window and the PSH flag of the last segment are kept */
+    memcpy(flow_tcp + offsetof(tcp_header, th_win),
+           tcp + offsetof(tcp_header, th_win), sizeof(uint16_t));
+    flow_tcp[TCP_FLAGS_OFF] |= net_gro_tcp_flags(tcp);
+
+    flow->size += pkt->payload_len;
+    flow->segs++;
+    flow->next_seq += pkt->payload_len;
+    gro->pending += pkt->payload_len;
+}
+
+static void net_gro_flow_flush(NetGRO *gro, NetGROFlow *flow)
+{
+    struct virtio_net_hdr hdr = {
+        .flags = VIRTIO_NET_HDR_F_DATA_VALID,
+        .gso_type = VIRTIO_NET_HDR_GSO_NONE,
+    };
+    uint8_t *l3 = flow->buf + ETH_HLEN;
+    uint8_t *tcp = flow->buf + flow->l4_off;
+    size_t size = flow->size;
+    size_t tcp_len = size - flow->l4_off;
+    uint32_t sum;
+
+    if (flow->segs > 1) {
+        if (flow->ipv6) {
+            stw_be_p(l3 + IP6_PLEN_OFF, size - ETH_HLEN - IP6_HDR_LEN);
+            hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
+        } else {
+            stw_be_p(l3 + IP4_OFF(ip_len), size - ETH_HLEN);
+            stw_be_p(l3 + IP4_OFF(ip_sum), 0);
+            stw_be_p(l3 + IP4_OFF(ip_sum),
+                     net_raw_checksum(l3, IP4_HDR_LEN));
+            hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+        }
+
+        stw_be_p(tcp + offsetof(tcp_header, th_sum), 0);
+        sum = net_checksum_add(flow->hdr_len - flow->l4_off, tcp) +
+              flow->csum + net_gro_pseudo_csum(l3, flow->ipv6, tcp_len);
+        stw_be_p(tcp + offsetof(tcp_header, th_sum), net_checksum_finish(sum));
+
+        hdr.hdr_len = flow->hdr_len;
+        hdr.gso_size = flow->mss;
+    }
+
+    gro->pending -= size;
+    flow->size = 0;
+    gro->output(gro->opaque, &hdr, flow->buf, size);
+}
+
+bool net_gro_receive(NetGRO *gro, const uint8_t *buf, size_t size)
+{
+    NetGROPacket pkt;
+    NetGROFlow *flow = NULL;
+    int action;
+    int i;
+
+    action = net_gro_parse(gro, &pkt, buf, size);
+    if (action == NET_GRO_PASS) {
+        return false;
+    }
+
+    for (i = 0; i < NET_GRO_MAX_FLOWS; i++) {
+        if (gro->flows[i].size && net_gro_flow_match(&gro->flows[i], &pkt)) {
+            flow = &gro->flows[i];
+            break;
+        }
+    }
+
+    if (flow && action == NET_GRO_MERGE &&
+        net_gro_flow_can_merge(flow, &pkt)) {
+        net_gro_flow_merge(gro, flow, &pkt);
+        /* A short segment or PSH ends the flow */
+        if (pkt.payload_len < flow->mss ||
+            (net_gro_tcp_flags(buf + pkt.l4_off) & TH_PUSH)) {
+            net_gro_flow_flush(gro, flow);
+        }
+        return true;
+    }
+
+    if (flow) {
+        net_gro_flow_flush(gro, flow);
+    }
+    if (action != NET_GRO_MERGE ||
+        (net_gro_tcp_flags(buf + pkt.l4_off) & TH_PUSH)) {
+        return false;
+    }
+
+    if (!flow) {
+        for (i = 0; i < NET_GRO_MAX_FLOWS; i++) {
+            if (!gro->flows[i].size) {
+                flow = &gro->flows[i];
+                break;
+            }
+        }
+    }
+    if (!flow) {
+        flow = &gro->flows[gro->evict];
+        gro->evict = (gro->evict + 1) % NET_GRO_MAX_FLOWS;
+        net_gro_flow_flush(gro, flow);
+    }
+
+    net_gro_flow_start(gro, flow, &pkt);
+    return true;
+}
+
+void net_gro_flush(NetGRO *gro)
+{
+    int i;
+
+    for (i = 0; i < NET_GRO_MAX_FLOWS && gro->pending; i++) {
+        if (gro->flows[i].size) {
+            net_gro_flow_flush(gro, &gro->flows[i]);
+        }
+    }
+}
+
+size_t net_gro_pending(NetGRO *gro)
+{
+    return gro->pending;
+}
+
+void net_gro_set_offloads(NetGRO *gro, bool tcp4, bool tcp6)
+{
+    gro->tcp4 = tcp4;
+    gro->tcp6 = tcp6;
+}
+
+NetGRO *net_gro_new(NetGROOutput *output, void *opaque)
+{
+    NetGRO *gro = g_new0(NetGRO, 1);
+
+    gro->output = output;
+    gro->opaque = opaque;
+    return gro;
+}
+
+void net_gro_free(NetGRO *gro)
+{
+    int i;
+
+    if (!gro) {
+        return;
+    }
+    for (i = 0; i < NET_GRO_MAX_FLOWS; i++) {
+        g_free(gro->flows[i].buf);
+    }
+    g_free(gro);
+}
@@ -568,6 +568,26 @@ int qemu_set_vnet_be(NetClientState *nc, bool is_be)
 #endif
 }
 
+bool qemu_has_net_aio_context(NetClientState *nc)
+{
+    return nc && nc->info->set_aio_context;
+}
+
+/*
+ * Poll the backend of @nc from @ctx instead of the main loop, or from the
+ * main loop again if @ctx is NULL.  The backend takes the AioContext lock
+ * of @ctx while it processes packets, so the code that runs in the main
+ * loop must take it too before it touches the queues of @nc or its peer.
+ */
+void qemu_set_net_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    if (!qemu_has_net_aio_context(nc)) {
+        return;
+    }
+
+    nc->info->set_aio_context(nc, ctx);
+}
+
 int qemu_can_receive_packet(NetClientState *nc)
 {
     if (nc->receive_disabled) {
@@ -651,8 +671,24 @@ void qemu_purge_queued_packets(NetClientState *nc)
     qemu_net_queue_purge(nc->peer->incoming_queue, nc);
 }
 
+static void qemu_net_receive_burst_begin(NetClientState *nc)
+{
+    if (nc && nc->info->receive_burst_begin) {
+        nc->info->receive_burst_begin(nc);
+    }
+}
+
+static void qemu_net_receive_burst_end(NetClientState *nc)
+{
+    if (nc && nc->info->receive_burst_end) {
+        nc->info->receive_burst_end(nc);
+    }
+}
+
 void qemu_flush_or_purge_queued_packets(NetClientState *nc, bool purge)
 {
+    bool ret;
+
     nc->receive_disabled = 0;
 
     if (nc->peer && nc->peer->info->type == NET_CLIENT_DRIVER_HUBPORT) {
@@ -660,7 +696,10 @@ void qemu_flush_or_purge_queued_packets(NetClientState *nc, bool purge)
             qemu_notify_event();
         }
     }
-    if (qemu_net_queue_flush(nc->incoming_queue)) {
+    qemu_net_receive_burst_begin(nc);
+    ret = qemu_net_queue_flush(nc->incoming_queue);
+    qemu_net_receive_burst_end(nc);
+    if (ret) {
         /* We emptied the queue successfully, signal to the IO thread to repoll
          * the file descriptor (for tap, for example).
          */
@@ -676,6 +715,45 @@ void qemu_flush_queued_packets(NetClientState *nc)
     qemu_flush_or_purge_queued_packets(nc, false);
 }
 
+/*
+ * Bracket a series of qemu_send_packet*() calls on @nc.  The peer may
+ * then defer per-packet work, such as signalling the guest, until
+ * qemu_net_burst_end().  Bursts may nest, but must not span a return
+ * to the main loop.
+ */
+void qemu_net_burst_begin(NetClientState *nc)
+{
+    qemu_net_receive_burst_begin(nc->peer);
+}
+
+void qemu_net_burst_end(NetClientState *nc)
+{
+    qemu_net_receive_burst_end(nc->peer);
+}
+
+/*
+ * Let the peer of @nc read the next packet with @read straight into its
+ * own buffers, e.g. the guest's receive descriptors, instead of having
+ * @nc read it into a bounce buffer and send it.  Returns the size of the
+ * packet, 0 if @read found nothing to read, or -ENOTSUP if the packet
+ * must be read and sent with qemu_send_packet_async() instead.  That is
+ * the case whenever a filter or a queued packet could see it first.
+ */
+ssize_t qemu_receive_direct(NetClientState *nc, NetReadIOV *read,
+                            void *opaque)
+{
+    NetClientState *peer = nc->peer;
+
+    if (nc->link_down || !peer || !peer->info->receive_direct ||
+        peer->receive_disabled ||
+        !QTAILQ_EMPTY(&nc->filters) || !QTAILQ_EMPTY(&peer->filters) ||
+        !qemu_net_queue_empty(peer->incoming_queue)) {
+        return -ENOTSUP;
+    }
+
+    return peer->info->receive_direct(peer, read, opaque);
+}
+
 static ssize_t qemu_send_packet_async_with_flags(NetClientState *sender,
                                                  unsigned flags,
                                                  const uint8_t *buf, int size,
@@ -1030,6 +1108,9 @@ static int (* const net_client_init_fun[NET_CLIENT_DRIVER__MAX])(
 #ifdef CONFIG_NETMAP
         [NET_CLIENT_DRIVER_NETMAP]    = net_init_netmap,
 #endif
+#ifdef CONFIG_AF_XDP
+        [NET_CLIENT_DRIVER_AF_XDP]    = net_init_af_xdp,
+#endif
 #ifdef CONFIG_NET_BRIDGE
         [NET_CLIENT_DRIVER_BRIDGE]    = net_init_bridge,
 #endif
@@ -1134,6 +1215,9 @@ void show_netdevs(void)
 #ifdef CONFIG_NETMAP
         "netmap",
 #endif
+#ifdef CONFIG_AF_XDP
+        "af-xdp",
+#endif
 #ifdef CONFIG_POSIX
         "vhost-user",
 #endif
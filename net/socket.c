@@ -32,6 +32,7 @@
 #include "qemu/sockets.h"
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
+#include "block/aio-wait.h"
 
 typedef struct NetSocketState {
     NetClientState nc;
@@ -43,17 +44,46 @@ typedef struct NetSocketState {
     IOHandler *send_fn;           /* differs between SOCK_STREAM/SOCK_DGRAM */
     bool read_poll;               /* waiting to receive data? */
     bool write_poll;              /* waiting to transmit data? */
+    AioContext *ctx;              /* polls fd, NULL for the main loop */
 } NetSocketState;
 
 static void net_socket_accept(void *opaque);
 static void net_socket_writable(void *opaque);
+static void net_socket_aio_read(void *opaque);
+static void net_socket_aio_writable(void *opaque);
 
 static void net_socket_update_fd_handler(NetSocketState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll ? s->send_fn : NULL,
-                        s->write_poll ? net_socket_writable : NULL,
-                        s);
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, s->fd, false,
+                           s->read_poll ? net_socket_aio_read : NULL,
+                           s->write_poll ? net_socket_aio_writable : NULL,
+                           NULL, NULL, s);
+    } else {
+        qemu_set_fd_handler(s->fd,
+                            s->read_poll ? s->send_fn : NULL,
+                            s->write_poll ? net_socket_writable : NULL,
+                            s);
+    }
+}
+
+/*
+ * The listening socket and connection setup always stay in the main
+ * loop; these protect the data path against the context that polls
+ * the connected socket.
+ */
+static void net_socket_lock(NetSocketState *s)
+{
+    if (s->ctx) {
+        aio_context_acquire(s->ctx);
+    }
+}
+
+static void net_socket_unlock(NetSocketState *s)
+{
+    if (s->ctx) {
+        aio_context_release(s->ctx);
+    }
 }
 
 static void net_socket_read_poll(NetSocketState *s, bool enable)
@@ -185,7 +215,10 @@ static void net_socket_send(void *opaque)
     }
     buf = buf1;
 
+    /* A single read can contain several packets */
+    qemu_net_burst_begin(&s->nc);
     ret = net_fill_rstate(&s->rs, buf, size);
+    qemu_net_burst_end(&s->nc);
 
     if (ret == -1) {
         goto eoc;
@@ -305,9 +338,64 @@ fail:
     return -1;
 }
 
+static void net_socket_aio_read(void *opaque)
+{
+    NetSocketState *s = opaque;
+    AioContext *ctx = s->ctx;
+
+    aio_context_acquire(ctx);
+    s->send_fn(s);
+    aio_context_release(ctx);
+}
+
+static void net_socket_aio_writable(void *opaque)
+{
+    NetSocketState *s = opaque;
+    AioContext *ctx = s->ctx;
+
+    aio_context_acquire(ctx);
+    net_socket_writable(s);
+    aio_context_release(ctx);
+}
+
+static void net_socket_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
+
+    if (s->fd != -1) {
+        if (s->ctx) {
+            aio_set_fd_handler(s->ctx, s->fd, false,
+                               NULL, NULL, NULL, NULL, NULL);
+        } else if (s->send_fn) {
+            qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+        }
+    }
+    s->ctx = ctx;
+    if (s->fd != -1 && s->send_fn) {
+        net_socket_update_fd_handler(s);
+    }
+}
+
+static void net_socket_detach_aio_context_bh(void *opaque)
+{
+    NetSocketState *s = opaque;
+
+    net_socket_set_aio_context(&s->nc, NULL);
+}
+
 static void net_socket_cleanup(NetClientState *nc)
 {
     NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
+
+    /* Make sure that the data path is not running in another thread */
+    if (s->ctx) {
+        AioContext *ctx = s->ctx;
+
+        aio_context_acquire(ctx);
+        aio_wait_bh_oneshot(ctx, net_socket_detach_aio_context_bh, s);
+        aio_context_release(ctx);
+    }
+
     if (s->fd != -1) {
         net_socket_read_poll(s, false);
         net_socket_write_poll(s, false);
@@ -326,6 +414,7 @@ static NetClientInfo net_dgram_socket_info = {
     .size = sizeof(NetSocketState),
     .receive = net_socket_receive_dgram,
     .cleanup = net_socket_cleanup,
+    .set_aio_context = net_socket_set_aio_context,
 };
 
 static NetSocketState *net_socket_fd_init_dgram(NetClientState *peer,
@@ -408,8 +497,15 @@ err:
 static void net_socket_connect(void *opaque)
 {
     NetSocketState *s = opaque;
+
+    net_socket_lock(s);
+    if (s->ctx) {
+        /* stop waiting for the connection in the main loop */
+        qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    }
     s->send_fn = net_socket_send;
     net_socket_read_poll(s, true);
+    net_socket_unlock(s);
 }
 
 static NetClientInfo net_socket_info = {
@@ -417,6 +513,7 @@ static NetClientInfo net_socket_info = {
     .size = sizeof(NetSocketState),
     .receive = net_socket_receive,
     .cleanup = net_socket_cleanup,
+    .set_aio_context = net_socket_set_aio_context,
 };
 
 static NetSocketState *net_socket_fd_init_stream(NetClientState *peer,
@@ -493,9 +590,11 @@ static void net_socket_accept(void *opaque)
         }
     }
 
+    net_socket_lock(s);
     s->fd = fd;
     s->nc.link_down = false;
     net_socket_connect(s);
+    net_socket_unlock(s);
     qemu_set_info_str(&s->nc, "socket: connection from %s:%d",
                       inet_ntoa(saddr.sin_addr), ntohs(saddr.sin_port));
 }
@@ -175,7 +175,9 @@ static gboolean net_stream_send(QIOChannel *ioc,
     }
     buf = buf1;
 
+    qemu_net_burst_begin(&s->nc);
     ret = net_fill_rstate(&s->rs, (const uint8_t *)buf, size);
+    qemu_net_burst_end(&s->nc);
 
     if (ret == -1) {
         goto eoc;
@@ -29,6 +29,8 @@
 #include "net/tap.h"
 
 #include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
 #include <sys/ioctl.h>
 
 #include "qapi/error.h"
@@ -329,3 +331,42 @@ int tap_fd_set_steering_ebpf(int fd, int prog_fd)
 
     return 0;
 }
+
+/*
+ * Open a packet socket on the interface behind @fd that only receives
+ * what the socket filter @prog_fd accepts.  The filter is attached
+ * before the socket is bound, so no other packet is ever queued on it.
+ */
+int tap_fd_open_mirror_socket(int fd, int prog_fd)
+{
+    struct sockaddr_ll sll = {
+        .sll_family = AF_PACKET,
+        .sll_protocol = htons(ETH_P_ALL),
+    };
+    char ifname[IFNAMSIZ];
+    int sock, ret;
+
+    if (tap_fd_get_ifname(fd, ifname)) {
+        return -EINVAL;
+    }
+
+    sll.sll_ifindex = if_nametoindex(ifname);
+    if (!sll.sll_ifindex) {
+        return -errno;
+    }
+
+    sock = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (sock < 0) {
+        return -errno;
+    }
+
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_BPF,
+                   &prog_fd, sizeof(prog_fd)) < 0 ||
+        bind(sock, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+        ret = -errno;
+        close(sock);
+        return ret;
+    }
+
+    return sock;
+}
@@ -42,6 +42,7 @@
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/sockets.h"
+#include "block/aio-wait.h"
 
 #include "net/tap.h"
 
@@ -60,7 +61,11 @@ typedef struct TAPState {
     bool enabled;
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
+    /* read packets straight into the buffers of the peer if it can */
+    bool rx_direct;
     Notifier exit;
+    /* the fd is polled by this context, or by the main loop if NULL */
+    AioContext *ctx;
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
@@ -69,12 +74,25 @@ static void launch_script(const char *setup_script, const char *ifname,
 static void tap_send(void *opaque);
 static void tap_writable(void *opaque);
 
+static void tap_aio_send(void *opaque);
+static void tap_aio_writable(void *opaque);
+
 static void tap_update_fd_handler(TAPState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll && s->enabled ? tap_send : NULL,
-                        s->write_poll && s->enabled ? tap_writable : NULL,
-                        s);
+    bool can_read = s->read_poll && s->enabled;
+    bool can_write = s->write_poll && s->enabled;
+
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, s->fd, false,
+                           can_read ? tap_aio_send : NULL,
+                           can_write ? tap_aio_writable : NULL,
+                           NULL, NULL, s);
+    } else {
+        qemu_set_fd_handler(s->fd,
+                            can_read ? tap_send : NULL,
+                            can_write ? tap_writable : NULL,
+                            s);
+    }
 }
 
 static void tap_read_poll(TAPState *s, bool enable)
@@ -175,45 +193,83 @@ ssize_t tap_read_packet(int tapfd, uint8_t *buf, int maxlen)
 }
 #endif
 
+static ssize_t tap_read_iov(void *opaque, const struct iovec *iov, int iovcnt)
+{
+    TAPState *s = opaque;
+
+    return readv(s->fd, iov, iovcnt);
+}
+
+/*
+ * The peer takes the packet exactly as read from the tap, so the vnet
+ * header must be one that it asked for and the frame must not need
+ * padding.
+ */
+static bool tap_can_read_direct(TAPState *s)
+{
+    return s->rx_direct &&
+           (s->using_vnet_hdr || !s->host_vnet_hdr_len) &&
+           !net_peer_needs_padding(&s->nc);
+}
+
 static void tap_send_completed(NetClientState *nc, ssize_t len)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
     tap_read_poll(s, true);
 }
 
+/*
+ * Read one packet into s->buf and send it to the peer.  Returns the
+ * result of the send, or of the read if there was nothing to send.
+ */
+static int tap_send_one(TAPState *s)
+{
+    uint8_t *buf = s->buf;
+    uint8_t min_pkt[ETH_ZLEN];
+    size_t min_pktsz = sizeof(min_pkt);
+    int size;
+
+    size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
+    if (size <= 0) {
+        return size;
+    }
+
+    if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+        buf  += s->host_vnet_hdr_len;
+        size -= s->host_vnet_hdr_len;
+    }
+
+    if (net_peer_needs_padding(&s->nc)) {
+        if (eth_pad_short_frame(min_pkt, &min_pktsz, buf, size)) {
+            buf = min_pkt;
+            size = min_pktsz;
+        }
+    }
+
+    size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
+    if (size == 0) {
+        tap_read_poll(s, false);
+    }
+    return size;
+}
+
 static void tap_send(void *opaque)
 {
     TAPState *s = opaque;
     int size;
     int packets = 0;
 
+    /* Let the peer signal the guest once for all the packets read here */
+    qemu_net_burst_begin(&s->nc);
     while (true) {
-        uint8_t *buf = s->buf;
-        uint8_t min_pkt[ETH_ZLEN];
-        size_t min_pktsz = sizeof(min_pkt);
-
-        size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
-        if (size <= 0) {
-            break;
+        size = -ENOTSUP;
+        if (tap_can_read_direct(s)) {
+            size = qemu_receive_direct(&s->nc, tap_read_iov, s);
         }
-
-        if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
-            buf  += s->host_vnet_hdr_len;
-            size -= s->host_vnet_hdr_len;
+        if (size == -ENOTSUP) {
+            size = tap_send_one(s);
         }
-
-        if (net_peer_needs_padding(&s->nc)) {
-            if (eth_pad_short_frame(min_pkt, &min_pktsz, buf, size)) {
-                buf = min_pkt;
-                size = min_pktsz;
-            }
-        }
-
-        size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
-        if (size == 0) {
-            tap_read_poll(s, false);
-            break;
-        } else if (size < 0) {
+        if (size <= 0) {
             break;
         }
 
@@ -228,6 +284,50 @@ static void tap_send(void *opaque)
             break;
         }
     }
+    qemu_net_burst_end(&s->nc);
+}
+
+/* fd handlers used when the tap is polled by an AioContext */
+static void tap_aio_send(void *opaque)
+{
+    TAPState *s = opaque;
+    AioContext *ctx = s->ctx;
+
+    aio_context_acquire(ctx);
+    tap_send(s);
+    aio_context_release(ctx);
+}
+
+static void tap_aio_writable(void *opaque)
+{
+    TAPState *s = opaque;
+    AioContext *ctx = s->ctx;
+
+    aio_context_acquire(ctx);
+    tap_writable(s);
+    aio_context_release(ctx);
+}
+
+static void tap_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    assert(nc->info->type == NET_CLIENT_DRIVER_TAP);
+
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, s->fd, false, NULL, NULL, NULL, NULL, NULL);
+    } else {
+        qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    }
+    s->ctx = ctx;
+    tap_update_fd_handler(s);
+}
+
+static void tap_detach_aio_context_bh(void *opaque)
+{
+    TAPState *s = opaque;
+
+    tap_set_aio_context(&s->nc, NULL);
 }
 
 static bool tap_has_ufo(NetClientState *nc)
@@ -328,6 +428,15 @@ static void tap_cleanup(NetClientState *nc)
         s->vhost_net = NULL;
     }
 
+    /* Make sure that tap_send() is not running in another thread */
+    if (s->ctx) {
+        AioContext *ctx = s->ctx;
+
+        aio_context_acquire(ctx);
+        aio_wait_bh_oneshot(ctx, tap_detach_aio_context_bh, s);
+        aio_context_release(ctx);
+    }
+
     qemu_purge_queued_packets(nc);
 
     tap_exit_notify(&s->exit, NULL);
@@ -354,6 +463,14 @@ static bool tap_set_steering_ebpf(NetClientState *nc, int prog_fd)
     return tap_fd_set_steering_ebpf(s->fd, prog_fd) == 0;
 }
 
+static int tap_open_mirror_socket(NetClientState *nc, int prog_fd)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+    assert(nc->info->type == NET_CLIENT_DRIVER_TAP);
+
+    return tap_fd_open_mirror_socket(s->fd, prog_fd);
+}
+
 int tap_get_fd(NetClientState *nc)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -380,6 +497,8 @@ static NetClientInfo net_tap_info = {
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
     .set_steering_ebpf = tap_set_steering_ebpf,
+    .open_mirror_socket = tap_open_mirror_socket,
+    .set_aio_context = tap_set_aio_context,
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
@@ -682,6 +801,8 @@ static void net_init_tap_one(const NetdevTapOptions *tap, NetClientState *peer,
     TAPState *s = net_tap_fd_init(peer, model, name, fd, vnet_hdr);
     int vhostfd;
 
+    s->rx_direct = tap->has_rx_direct && tap->rx_direct;
+
     tap_set_sndbuf(s->fd, tap, &err);
     if (err) {
         error_propagate(errp, err);
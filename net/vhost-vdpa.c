@@ -532,6 +532,7 @@ static NetClientState *net_vhost_vdpa_init(NetClientState *peer,
                                            int nvqs,
                                            bool is_datapath,
                                            bool svq,
+                                           int64_t svq_poll_ns,
                                            VhostIOVATree *iova_tree)
 {
     NetClientState *nc = NULL;
@@ -552,7 +553,9 @@ static NetClientState *net_vhost_vdpa_init(NetClientState *peer,
     s->vhost_vdpa.index = queue_pair_index;
     s->vhost_vdpa.shadow_vqs_enabled = svq;
     s->vhost_vdpa.iova_tree = iova_tree;
-    if (!is_datapath) {
+    if (is_datapath) {
+        s->vhost_vdpa.shadow_vq_poll_ns = svq_poll_ns;
+    } else {
         s->cvq_cmd_out_buffer = qemu_memalign(qemu_real_host_page_size(),
                                             vhost_vdpa_net_cvq_cmd_page_len());
         memset(s->cvq_cmd_out_buffer, 0, vhost_vdpa_net_cvq_cmd_page_len());
@@ -632,6 +635,7 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
     g_autoptr(VhostIOVATree) iova_tree = NULL;
     NetClientState *nc;
     int queue_pairs, r, i = 0, has_cvq = 0;
+    int64_t svq_poll_ns = 0;
 
     assert(netdev->type == NET_CLIENT_DRIVER_VHOST_VDPA);
     opts = &netdev->u.vhost_vdpa;
@@ -673,6 +677,18 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
         return queue_pairs;
     }
 
+    if (opts->has_x_svq_poll_ns) {
+        if (!opts->x_svq) {
+            error_setg(errp, "vhost-vdpa: x-svq-poll-ns requires x-svq=on");
+            return -1;
+        }
+        if (opts->x_svq_poll_ns > INT64_MAX) {
+            error_setg(errp, "vhost-vdpa: x-svq-poll-ns is too large");
+            return -1;
+        }
+        svq_poll_ns = opts->x_svq_poll_ns;
+    }
+
     if (opts->x_svq) {
         struct vhost_vdpa_iova_range iova_range;
 
@@ -697,7 +713,7 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
     for (i = 0; i < queue_pairs; i++) {
         ncs[i] = net_vhost_vdpa_init(peer, TYPE_VHOST_VDPA, name,
                                      vdpa_device_fd, i, 2, true, opts->x_svq,
-                                     iova_tree);
+                                     svq_poll_ns, iova_tree);
         if (!ncs[i])
             goto err;
     }
@@ -705,7 +721,7 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
     if (has_cvq) {
         nc = net_vhost_vdpa_init(peer, TYPE_VHOST_VDPA, name,
                                  vdpa_device_fd, i, 1, false,
-                                 opts->x_svq, iova_tree);
+                                 opts->x_svq, 0, iova_tree);
         if (!nc)
             goto err;
     }
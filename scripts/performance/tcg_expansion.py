@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+
+#  Print how many host instructions TCG generates per guest instruction.
+#
+#  The guest program is run with "-d in_asm,out_asm" and the two
+#  disassembly listings of each translation block are compared.  With
+#  --dynamic, the blocks are also weighted by how often they execute
+#  (this adds "-d exec,nochain" and is therefore much slower).  Accesses
+#  to the CPU state through the env register are counted separately, as
+#  they are mostly spills and reloads of guest registers.
+#
+#  QEMU must have been built with a disassembler for both the guest and
+#  the host, e.g. with capstone.
+#
+#  Syntax:
+#  tcg_expansion.py [-h] [-s SYMBOL] [-d] [-e ENV] -- \
+#                   <qemu executable> [<qemu executable options>] \
+#                   <target executable> [<target executable options>]
+#
+#  [-h] - Print the script arguments help message.
+#  [-s] - Only count blocks whose symbol matches this regex.
+#  [-d] - Weight blocks by their execution count.
+#  [-e] - Regex for host instructions that access the CPU state.
+#
+#  Example of usage:
+#  tcg_expansion.py -s '^bench_' -- qemu-aarch64 tests/tcg/aarch64/branchy
+#
+#  This program is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+import argparse
+import os
+import platform
+import re
+import subprocess
+import sys
+import tempfile
+
+# How TCG_AREG0 shows up in the host disassembly.
+ENV_REGS = {
+    'x86_64': r'\(%rbp\)',
+    'aarch64': r'\[x19\b',
+}
+
+INSN_RE = re.compile(r'^0x([0-9a-f]+):')
+TRACE_RE = re.compile(r'^Trace \d+: (0x)?([0-9a-f]+) \[')
+
+
+class Block:
+    def __init__(self, symbol):
+        self.symbol = symbol
+        self.ptr = None
+        self.guest = 0
+        self.host = 0
+        self.slow = 0
+        self.env = 0
+
+
+def parse_log(path, env_re):
+    """
+    Parse a QEMU log with in_asm, out_asm and optionally exec output.
+
+    Returns:
+    (list, dict): translation blocks, and execution count by host address
+    """
+    blocks = []
+    execs = {}
+    block = None
+    mode = None
+
+    with open(path, 'r', errors='replace') as log:
+        for line in log:
+            line = line.rstrip('\n')
+            trace = TRACE_RE.match(line)
+            if trace:
+                ptr = int(trace.group(2), 16)
+                execs[ptr] = execs.get(ptr, 0) + 1
+            elif line.startswith('IN:'):
+                block = Block(line[3:].strip())
+                blocks.append(block)
+                mode = 'in'
+            elif line.startswith('OUT:'):
+                mode = 'out' if block else None
+            elif not line:
+                mode = None
+            elif mode == 'out' and line.startswith('  -- tb slow paths'):
+                mode = 'slow'
+            elif mode in ('out', 'slow') and line.startswith('  data:'):
+                mode = None
+            else:
+                insn = INSN_RE.match(line)
+                if not insn or not mode:
+                    continue
+                if mode == 'in':
+                    block.guest += 1
+                    continue
+                if block.ptr is None:
+                    block.ptr = int(insn.group(1), 16)
+                if mode == 'slow':
+                    block.slow += 1
+                else:
+                    block.host += 1
+                    if env_re and env_re.search(line):
+                        block.env += 1
+    return blocks, execs
+
+
+def main():
+    # Parse the command line arguments
+    parser = argparse.ArgumentParser(
+        usage='tcg_expansion.py [-h] [-s SYMBOL] [-d] [-e ENV] -- '
+        '<qemu executable> [<qemu executable options>] '
+        '<target executable> [<target executable options>]')
+
+    parser.add_argument('-s', '--symbol', type=str,
+                        help='only count blocks whose symbol matches')
+    parser.add_argument('-d', '--dynamic', action='store_true',
+                        help='weight blocks by their execution count')
+    parser.add_argument('-e', '--env', type=str,
+                        default=ENV_REGS.get(platform.machine()),
+                        help='regex for host accesses to the CPU state')
+    parser.add_argument('command', type=str, nargs='+', help=argparse.SUPPRESS)
+
+    args = parser.parse_args()
+
+    symbol_re = re.compile(args.symbol) if args.symbol else None
+    env_re = re.compile(args.env) if args.env else None
+    log_items = 'in_asm,out_asm'
+    if args.dynamic:
+        log_items += ',exec,nochain'
+
+    # Save the log in a temporary directory
+    with tempfile.TemporaryDirectory() as tmpdirname:
+        log_path = os.path.join(tmpdirname, 'qemu.log')
+        command = ([args.command[0], '-d', log_items, '-D', log_path]
+                   + args.command[1:])
+        qemu = subprocess.run(command, stdout=subprocess.DEVNULL,
+                              stderr=subprocess.PIPE)
+        if qemu.returncode:
+            sys.exit(qemu.stderr.decode('utf-8'))
+
+        blocks, execs = parse_log(log_path, env_re)
+
+    n_blocks = guest = host = slow = env = 0
+    for block in blocks:
+        if symbol_re and not symbol_re.search(block.symbol):
+            continue
+        weight = execs.get(block.ptr, 0) if args.dynamic else 1
+        n_blocks += 1
+        guest += weight * block.guest
+        host += weight * block.host
+        slow += weight * block.slow
+        env += weight * block.env
+
+    if not guest:
+        sys.exit("No guest instructions found ... Exiting.")
+
+    kind = 'Executed' if args.dynamic else 'Translated'
+    print('{:<32}{:>16}'.format('Translation blocks:', n_blocks))
+    print('{:<32}{:>16}'.format(kind + ' guest insns:', format(guest, ',')))
+    print('{:<32}{:>16}'.format(kind + ' host insns:', format(host, ',')))
+    print('{:<32}{:>16.3f}'.format('Host insns per guest insn:',
+                                   host / guest))
+    if not args.dynamic:
+        print('{:<32}{:>16}'.format('Slow path host insns:',
+                                    format(slow, ',')))
+    if env_re:
+        print('{:<32}{:>16.3f}'.format('CPU state accesses per guest insn:',
+                                       env / guest))
+
+
+if __name__ == "__main__":
+    main()
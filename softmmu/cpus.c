@@ -41,6 +41,7 @@
 #include "sysemu/replay.h"
 #include "sysemu/runstate.h"
 #include "sysemu/cpu-timers.h"
+#include "sysemu/tcg.h"
 #include "sysemu/whpx.h"
 #include "hw/boards.h"
 #include "hw/hw.h"
@@ -649,6 +650,11 @@ void qemu_init_vcpu(CPUState *cpu)
     while (!cpu->created) {
         qemu_cond_wait(&qemu_cpu_cond, &qemu_global_mutex);
     }
+
+    /* Plugins queue work on the vCPU, which kicks its thread. */
+    if (tcg_enabled()) {
+        qemu_plugin_vcpu_init_hook(cpu);
+    }
 }
 
 void cpu_stop_current(void)
@@ -38,6 +38,7 @@ C_O1_I2(r, 0, re)
 C_O1_I2(r, 0, reZ)
 C_O1_I2(r, 0, ri)
 C_O1_I2(r, 0, rI)
+C_O1_I2(L, L, 0)
 C_O1_I2(r, L, L)
 C_O1_I2(r, r, re)
 C_O1_I2(r, r, ri)
@@ -45,6 +46,7 @@ C_O1_I2(r, r, rI)
 C_O1_I2(x, x, x)
 C_N1_I2(r, r, r)
 C_N1_I2(r, r, rW)
+C_O1_I3(a, L, 0, L)
 C_O1_I3(x, 0, x, x)
 C_O1_I3(x, x, x, x)
 C_O1_I4(r, r, re, r, 0)
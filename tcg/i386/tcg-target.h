@@ -182,10 +182,15 @@ extern bool have_movbe;
 #define TCG_TARGET_HAS_qemu_st8_i32     1
 #endif
 
+#if TCG_TARGET_REG_BITS == 64 && defined(CONFIG_SOFTMMU)
+#define TCG_TARGET_HAS_qemu_atomic      1
+#endif
+
 /* We do not support older SSE systems, only beginning with AVX1.  */
 #define TCG_TARGET_HAS_v64              have_avx1
 #define TCG_TARGET_HAS_v128             have_avx1
 #define TCG_TARGET_HAS_v256             have_avx2
+#define TCG_TARGET_HAS_v512             have_avx512bw
 
 #define TCG_TARGET_HAS_andc_vec         1
 #define TCG_TARGET_HAS_orc_vec          have_avx512vl
@@ -253,6 +253,7 @@ static bool tcg_opt_gen_mov(OptContext *ctx, TCGOp *op, TCGArg dst, TCGArg src)
     case TCG_TYPE_V64:
     case TCG_TYPE_V128:
     case TCG_TYPE_V256:
+    case TCG_TYPE_V512:
         /* TCGOP_VECL and TCGOP_VECE remain unchanged.  */
         new_op = INDEX_op_mov_vec;
         break;
@@ -816,6 +817,7 @@ static bool fold_to_not(OptContext *ctx, TCGOp *op, int idx)
     case TCG_TYPE_V64:
     case TCG_TYPE_V128:
     case TCG_TYPE_V256:
+    case TCG_TYPE_V512:
         not_op = INDEX_op_not_vec;
         have_not = TCG_TARGET_HAS_not_vec;
         break;
@@ -1939,6 +1941,7 @@ static bool fold_sub_to_neg(OptContext *ctx, TCGOp *op)
     case TCG_TYPE_V64:
     case TCG_TYPE_V128:
     case TCG_TYPE_V256:
+    case TCG_TYPE_V512:
         neg_op = INDEX_op_neg_vec;
         have_neg = (TCG_TARGET_HAS_neg_vec &&
                     tcg_can_emit_vec_op(neg_op, ctx->type, TCGOP_VECE(op)) > 0);
@@ -2190,6 +2193,9 @@ void tcg_optimize(TCGContext *s)
             break;
         case INDEX_op_qemu_ld_i32:
         case INDEX_op_qemu_ld_i64:
+        CASE_OP_32_64(qemu_cmpxchg):
+        CASE_OP_32_64(qemu_xchg):
+        CASE_OP_32_64(qemu_fetch_add):
             done = fold_qemu_ld(&ctx, op);
             break;
         case INDEX_op_qemu_st_i32:
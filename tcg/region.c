@@ -40,11 +40,20 @@ struct tcg_region_tree {
     /* padding to avoid false sharing is computed at run-time */
 };
 
+struct tcg_region_use {
+    uint64_t gen; /* region.gen at allocation time; 0 if not in use */
+    size_t size_full; /* contribution to region.agg_size_full */
+};
+
 /*
  * We divide code_gen_buffer into equally-sized "regions" that TCG threads
  * dynamically allocate from as demand dictates. Given appropriate region
  * sizing, this minimizes flushes even when some TCG threads generate a lot
  * more code than others.
+ *
+ * Once all regions have been handed out, the oldest regions are evicted
+ * (see tcg_region_evict) and put on a free list, so that running out of
+ * space does not have to throw away all the translated code.
  */
 struct tcg_region_state {
     QemuMutex lock;
@@ -60,6 +69,10 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    uint64_t gen; /* number of region allocations so far */
+    size_t n_free; /* number of evicted regions in .free */
+    size_t *free; /* evicted regions, ready to be reused */
+    struct tcg_region_use *use; /* per-region state, .n entries */
 };
 
 static struct tcg_region_state region;
@@ -167,10 +180,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+/* Return the index of the region containing @p, a pointer into the rw buffer */
+static size_t tcg_region_index(const void *p)
 {
-    size_t region_idx;
+    ptrdiff_t offset;
 
+    if (p < region.start_aligned) {
+        return 0;
+    }
+    offset = p - region.start_aligned;
+    if (offset > region.stride * (region.n - 1)) {
+        return region.n - 1;
+    }
+    return offset / region.stride;
+}
+
+static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+{
     /*
      * Like tcg_splitwx_to_rw, with no assert.  The pc may come from
      * a signal handler over which the caller has no control.
@@ -181,19 +207,7 @@ static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
             return NULL;
         }
     }
-
-    if (p < region.start_aligned) {
-        region_idx = 0;
-    } else {
-        ptrdiff_t offset = p - region.start_aligned;
-
-        if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
-        }
-    }
-    return region_trees + region_idx * tree_size;
+    return region_trees + tcg_region_index(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -335,11 +349,18 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    size_t curr_region;
+
+    if (region.n_free) {
+        curr_region = region.free[--region.n_free];
+    } else if (region.current < region.n) {
+        curr_region = region.current++;
+    } else {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    tcg_region_assign(s, curr_region);
+    region.use[curr_region].gen = ++region.gen;
+    region.use[curr_region].size_full = 0;
     return false;
 }
 
@@ -350,13 +371,15 @@ static bool tcg_region_alloc__locked(TCGContext *s)
 bool tcg_region_alloc(TCGContext *s)
 {
     bool err;
-    /* read the region size now; alloc__locked will overwrite it on success */
-    size_t size_full = s->code_gen_buffer_size;
+    /* read the region now; alloc__locked will overwrite it on success */
+    size_t full_region = tcg_region_index(s->code_gen_buffer);
+    size_t size_full = s->code_gen_buffer_size - TCG_HIGHWATER;
 
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
-        region.agg_size_full += size_full - TCG_HIGHWATER;
+        region.use[full_region].size_full = size_full;
+        region.agg_size_full += size_full;
     }
     qemu_mutex_unlock(&region.lock);
     return err;
@@ -388,6 +411,8 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.n_free = 0;
+    memset(region.use, 0, region.n * sizeof(region.use[0]));
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -398,6 +423,116 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+static int tcg_region_gen_cmp(const void *ap, const void *bp)
+{
+    uint64_t a = region.use[*(const size_t *)ap].gen;
+    uint64_t b = region.use[*(const size_t *)bp].gen;
+
+    return a < b ? -1 : a > b;
+}
+
+/*
+ * Fill @victims with the oldest full regions, up to a quarter of the
+ * buffer, and return how many were chosen.  Regions that TCG contexts
+ * are still translating into are never chosen.
+ */
+static size_t tcg_region_pick_victims__locked(size_t *victims)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    size_t n_victims = 0;
+    size_t i;
+
+    for (i = 0; i < region.n; i++) {
+        if (region.use[i].gen) {
+            victims[n_victims++] = i;
+        }
+    }
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+        size_t curr_region = tcg_region_index(s->code_gen_buffer);
+        size_t j;
+
+        for (j = 0; j < n_victims; j++) {
+            if (victims[j] == curr_region) {
+                victims[j] = victims[--n_victims];
+                break;
+            }
+        }
+    }
+
+    qsort(victims, n_victims, sizeof(victims[0]), tcg_region_gen_cmp);
+    return MIN(n_victims, MAX(region.n / 4, 1));
+}
+
+static gboolean tcg_region_tree_collect(gpointer key, gpointer value,
+                                        gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return FALSE;
+}
+
+/*
+ * Make room in a full code_gen_buffer by evicting its oldest regions.
+ * @evict_tb is called on every TB of the evicted regions; it must unlink
+ * the TB from anything that may reach it, since the memory of both the
+ * TB and its code is reused as soon as this function returns.
+ *
+ * Returns the number of regions evicted, which is 0 if there were free
+ * regions already (e.g. because another thread got here first), or -1
+ * if no region can be evicted and the whole buffer must be flushed.
+ *
+ * Call from a safe-work context.
+ */
+int tcg_region_evict(void (*evict_tb)(TranslationBlock *tb))
+{
+    g_autofree size_t *victims = g_new(size_t, region.n);
+    g_autoptr(GPtrArray) tbs = g_ptr_array_new();
+    size_t n_victims, i, j;
+
+    qemu_mutex_lock(&region.lock);
+    if (region.n_free || region.current < region.n) {
+        qemu_mutex_unlock(&region.lock);
+        return 0;
+    }
+    n_victims = tcg_region_pick_victims__locked(victims);
+    qemu_mutex_unlock(&region.lock);
+
+    if (n_victims == 0) {
+        return -1;
+    }
+
+    for (i = 0; i < n_victims; i++) {
+        struct tcg_region_tree *rt = region_trees + victims[i] * tree_size;
+
+        qemu_mutex_lock(&rt->lock);
+        g_tree_foreach(rt->tree, tcg_region_tree_collect, tbs);
+        qemu_mutex_unlock(&rt->lock);
+
+        for (j = 0; j < tbs->len; j++) {
+            evict_tb(g_ptr_array_index(tbs, j));
+        }
+        g_ptr_array_set_size(tbs, 0);
+
+        qemu_mutex_lock(&rt->lock);
+        /* Increment the refcount first so that destroy acts as a reset */
+        g_tree_ref(rt->tree);
+        g_tree_destroy(rt->tree);
+        qemu_mutex_unlock(&rt->lock);
+    }
+
+    qemu_mutex_lock(&region.lock);
+    for (i = 0; i < n_victims; i++) {
+        struct tcg_region_use *use = &region.use[victims[i]];
+
+        region.agg_size_full -= use->size_full;
+        use->size_full = 0;
+        use->gen = 0;
+        region.free[region.n_free++] = victims[i];
+    }
+    qemu_mutex_unlock(&region.lock);
+    return n_victims;
+}
+
 static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
 {
 #ifdef CONFIG_USER_ONLY
@@ -411,9 +546,13 @@ static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
      * being of reasonable size. If that's not possible we make do by evenly
      * dividing the code_gen_buffer among the vCPUs.
      */
-    /* Use a single region if all we have is one vCPU thread */
+    /*
+     * With a single vCPU thread, still split the buffer in a few regions
+     * so that filling it up evicts the oldest code instead of all of it.
+     */
     if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
-        return 1;
+        n_regions = tb_size / (2 * MiB);
+        return MAX(MIN(n_regions, 8), 1);
     }
 
     /*
@@ -786,6 +925,8 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
 
     /* init the region struct */
     qemu_mutex_init(&region.lock);
+    region.free = g_new(size_t, region.n);
+    region.use = g_new0(struct tcg_region_use, region.n);
 
     /*
      * Set guard pages in the rw buffer, as that's the one into which
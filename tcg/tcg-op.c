@@ -3131,6 +3131,34 @@ typedef void (*gen_atomic_op_i64)(TCGv_i64, TCGv_env, TCGv,
 # define WITH_ATOMIC64(X)
 #endif
 
+/*
+ * Whether the backend can emit the atomic operation inline, with its own
+ * call to the cpu_atomic_*_mmu helpers on a TLB miss.  Byte-swapped
+ * accesses are left to the out-of-line helpers, and so are instrumented
+ * ones, for which the helpers provide the plugin memory callbacks.
+ */
+static bool tcg_atomic_inline(MemOp memop)
+{
+    if (!TCG_TARGET_HAS_qemu_atomic || (memop & MO_BSWAP)) {
+        return false;
+    }
+#ifdef CONFIG_PLUGIN
+    if (tcg_ctx->plugin_insn != NULL) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+static inline TCGArg tcg_atomic_addr_arg(TCGv addr)
+{
+#if TARGET_LONG_BITS == 32
+    return tcgv_i32_arg(addr);
+#else
+    return tcgv_i64_arg(addr);
+#endif
+}
+
 static void * const table_cmpxchg[(MO_SIZE | MO_BSWAP) + 1] = {
     [MO_8] = gen_helper_atomic_cmpxchgb,
     [MO_16 | MO_LE] = gen_helper_atomic_cmpxchgw_le,
@@ -3167,11 +3195,16 @@ void tcg_gen_atomic_cmpxchg_i32(TCGv_i32 retv, TCGv addr, TCGv_i32 cmpv,
         gen_atomic_cx_i32 gen;
         MemOpIdx oi;
 
-        gen = table_cmpxchg[memop & (MO_SIZE | MO_BSWAP)];
-        tcg_debug_assert(gen != NULL);
-
         oi = make_memop_idx(memop & ~MO_SIGN, idx);
-        gen(retv, cpu_env, addr, cmpv, newv, tcg_constant_i32(oi));
+        if (tcg_atomic_inline(memop)) {
+            tcg_gen_op5(INDEX_op_qemu_cmpxchg_i32, tcgv_i32_arg(retv),
+                        tcg_atomic_addr_arg(addr), tcgv_i32_arg(cmpv),
+                        tcgv_i32_arg(newv), oi);
+        } else {
+            gen = table_cmpxchg[memop & (MO_SIZE | MO_BSWAP)];
+            tcg_debug_assert(gen != NULL);
+            gen(retv, cpu_env, addr, cmpv, newv, tcg_constant_i32(oi));
+        }
 
         if (memop & MO_SIGN) {
             tcg_gen_ext_i32(retv, retv, memop);
@@ -3206,11 +3239,16 @@ void tcg_gen_atomic_cmpxchg_i64(TCGv_i64 retv, TCGv addr, TCGv_i64 cmpv,
         gen_atomic_cx_i64 gen;
         MemOpIdx oi;
 
-        gen = table_cmpxchg[memop & (MO_SIZE | MO_BSWAP)];
-        tcg_debug_assert(gen != NULL);
-
         oi = make_memop_idx(memop, idx);
-        gen(retv, cpu_env, addr, cmpv, newv, tcg_constant_i32(oi));
+        if (tcg_atomic_inline(memop)) {
+            tcg_gen_op5(INDEX_op_qemu_cmpxchg_i64, tcgv_i64_arg(retv),
+                        tcg_atomic_addr_arg(addr), tcgv_i64_arg(cmpv),
+                        tcgv_i64_arg(newv), oi);
+        } else {
+            gen = table_cmpxchg[memop & (MO_SIZE | MO_BSWAP)];
+            tcg_debug_assert(gen != NULL);
+            gen(retv, cpu_env, addr, cmpv, newv, tcg_constant_i32(oi));
+        }
 #else
         gen_helper_exit_atomic(cpu_env);
         /* Produce a result, so that we have a well-formed opcode stream
@@ -3256,19 +3294,25 @@ static void do_nonatomic_op_i32(TCGv_i32 ret, TCGv addr, TCGv_i32 val,
     tcg_temp_free_i32(t2);
 }
 
+/* @opc_i32 is the inline opcode for the operation, or NB_OPS for none.  */
 static void do_atomic_op_i32(TCGv_i32 ret, TCGv addr, TCGv_i32 val,
-                             TCGArg idx, MemOp memop, void * const table[])
+                             TCGArg idx, MemOp memop, void * const table[],
+                             TCGOpcode opc_i32)
 {
     gen_atomic_op_i32 gen;
     MemOpIdx oi;
 
     memop = tcg_canonicalize_memop(memop, 0, 0);
 
-    gen = table[memop & (MO_SIZE | MO_BSWAP)];
-    tcg_debug_assert(gen != NULL);
-
     oi = make_memop_idx(memop & ~MO_SIGN, idx);
-    gen(ret, cpu_env, addr, val, tcg_constant_i32(oi));
+    if (opc_i32 != NB_OPS && tcg_atomic_inline(memop)) {
+        tcg_gen_op4(opc_i32, tcgv_i32_arg(ret), tcg_atomic_addr_arg(addr),
+                    tcgv_i32_arg(val), oi);
+    } else {
+        gen = table[memop & (MO_SIZE | MO_BSWAP)];
+        tcg_debug_assert(gen != NULL);
+        gen(ret, cpu_env, addr, val, tcg_constant_i32(oi));
+    }
 
     if (memop & MO_SIGN) {
         tcg_gen_ext_i32(ret, ret, memop);
@@ -3295,7 +3339,8 @@ static void do_nonatomic_op_i64(TCGv_i64 ret, TCGv addr, TCGv_i64 val,
 }
 
 static void do_atomic_op_i64(TCGv_i64 ret, TCGv addr, TCGv_i64 val,
-                             TCGArg idx, MemOp memop, void * const table[])
+                             TCGArg idx, MemOp memop, void * const table[],
+                             TCGOpcode opc_i32, TCGOpcode opc_i64)
 {
     memop = tcg_canonicalize_memop(memop, 1, 0);
 
@@ -3304,11 +3349,15 @@ static void do_atomic_op_i64(TCGv_i64 ret, TCGv addr, TCGv_i64 val,
         gen_atomic_op_i64 gen;
         MemOpIdx oi;
 
-        gen = table[memop & (MO_SIZE | MO_BSWAP)];
-        tcg_debug_assert(gen != NULL);
-
         oi = make_memop_idx(memop & ~MO_SIGN, idx);
-        gen(ret, cpu_env, addr, val, tcg_constant_i32(oi));
+        if (opc_i64 != NB_OPS && tcg_atomic_inline(memop)) {
+            tcg_gen_op4(opc_i64, tcgv_i64_arg(ret), tcg_atomic_addr_arg(addr),
+                        tcgv_i64_arg(val), oi);
+        } else {
+            gen = table[memop & (MO_SIZE | MO_BSWAP)];
+            tcg_debug_assert(gen != NULL);
+            gen(ret, cpu_env, addr, val, tcg_constant_i32(oi));
+        }
 #else
         gen_helper_exit_atomic(cpu_env);
         /* Produce a result, so that we have a well-formed opcode stream
@@ -3320,7 +3369,8 @@ static void do_atomic_op_i64(TCGv_i64 ret, TCGv addr, TCGv_i64 val,
         TCGv_i32 r32 = tcg_temp_new_i32();
 
         tcg_gen_extrl_i64_i32(v32, val);
-        do_atomic_op_i32(r32, addr, v32, idx, memop & ~MO_SIGN, table);
+        do_atomic_op_i32(r32, addr, v32, idx, memop & ~MO_SIGN, table,
+                         opc_i32);
         tcg_temp_free_i32(v32);
 
         tcg_gen_extu_i32_i64(ret, r32);
@@ -3332,7 +3382,7 @@ static void do_atomic_op_i64(TCGv_i64 ret, TCGv addr, TCGv_i64 val,
     }
 }
 
-#define GEN_ATOMIC_HELPER(NAME, OP, NEW)                                \
+#define GEN_ATOMIC_HELPER_INLINE(NAME, OP, NEW, OPC_I32, OPC_I64)       \
 static void * const table_##NAME[(MO_SIZE | MO_BSWAP) + 1] = {          \
     [MO_8] = gen_helper_atomic_##NAME##b,                               \
     [MO_16 | MO_LE] = gen_helper_atomic_##NAME##w_le,                   \
@@ -3346,7 +3396,8 @@ void tcg_gen_atomic_##NAME##_i32                                        \
     (TCGv_i32 ret, TCGv addr, TCGv_i32 val, TCGArg idx, MemOp memop)    \
 {                                                                       \
     if (tcg_ctx->tb_cflags & CF_PARALLEL) {                             \
-        do_atomic_op_i32(ret, addr, val, idx, memop, table_##NAME);     \
+        do_atomic_op_i32(ret, addr, val, idx, memop, table_##NAME,      \
+                         OPC_I32);                                      \
     } else {                                                            \
         do_nonatomic_op_i32(ret, addr, val, idx, memop, NEW,            \
                             tcg_gen_##OP##_i32);                        \
@@ -3356,14 +3407,19 @@ void tcg_gen_atomic_##NAME##_i64                                        \
     (TCGv_i64 ret, TCGv addr, TCGv_i64 val, TCGArg idx, MemOp memop)    \
 {                                                                       \
     if (tcg_ctx->tb_cflags & CF_PARALLEL) {                             \
-        do_atomic_op_i64(ret, addr, val, idx, memop, table_##NAME);     \
+        do_atomic_op_i64(ret, addr, val, idx, memop, table_##NAME,      \
+                         OPC_I32, OPC_I64);                             \
     } else {                                                            \
         do_nonatomic_op_i64(ret, addr, val, idx, memop, NEW,            \
                             tcg_gen_##OP##_i64);                        \
     }                                                                   \
 }
 
-GEN_ATOMIC_HELPER(fetch_add, add, 0)
+#define GEN_ATOMIC_HELPER(NAME, OP, NEW) \
+    GEN_ATOMIC_HELPER_INLINE(NAME, OP, NEW, NB_OPS, NB_OPS)
+
+GEN_ATOMIC_HELPER_INLINE(fetch_add, add, 0, INDEX_op_qemu_fetch_add_i32,
+                         INDEX_op_qemu_fetch_add_i64)
 GEN_ATOMIC_HELPER(fetch_and, and, 0)
 GEN_ATOMIC_HELPER(fetch_or, or, 0)
 GEN_ATOMIC_HELPER(fetch_xor, xor, 0)
@@ -3391,6 +3447,8 @@ static void tcg_gen_mov2_i64(TCGv_i64 r, TCGv_i64 a, TCGv_i64 b)
     tcg_gen_mov_i64(r, b);
 }
 
-GEN_ATOMIC_HELPER(xchg, mov2, 0)
+GEN_ATOMIC_HELPER_INLINE(xchg, mov2, 0, INDEX_op_qemu_xchg_i32,
+                         INDEX_op_qemu_xchg_i64)
 
 #undef GEN_ATOMIC_HELPER
+#undef GEN_ATOMIC_HELPER_INLINE
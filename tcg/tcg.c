@@ -1003,6 +1003,9 @@ TCGv_vec tcg_temp_new_vec(TCGType type)
     case TCG_TYPE_V256:
         assert(TCG_TARGET_HAS_v256);
         break;
+    case TCG_TYPE_V512:
+        assert(TCG_TARGET_HAS_v512);
+        break;
     default:
         g_assert_not_reached();
     }
@@ -1177,7 +1180,8 @@ int tcg_check_temp_count(void)
 bool tcg_op_supported(TCGOpcode op)
 {
     const bool have_vec
-        = TCG_TARGET_HAS_v64 | TCG_TARGET_HAS_v128 | TCG_TARGET_HAS_v256;
+        = (TCG_TARGET_HAS_v64 | TCG_TARGET_HAS_v128 | TCG_TARGET_HAS_v256 |
+           TCG_TARGET_HAS_v512);
 
     switch (op) {
     case INDEX_op_discard:
@@ -1198,6 +1202,16 @@ bool tcg_op_supported(TCGOpcode op)
     case INDEX_op_qemu_st8_i32:
         return TCG_TARGET_HAS_qemu_st8_i32;
 
+    case INDEX_op_qemu_cmpxchg_i32:
+    case INDEX_op_qemu_xchg_i32:
+    case INDEX_op_qemu_fetch_add_i32:
+        return TCG_TARGET_HAS_qemu_atomic;
+
+    case INDEX_op_qemu_cmpxchg_i64:
+    case INDEX_op_qemu_xchg_i64:
+    case INDEX_op_qemu_fetch_add_i64:
+        return TCG_TARGET_REG_BITS == 64 && TCG_TARGET_HAS_qemu_atomic;
+
     case INDEX_op_mov_i32:
     case INDEX_op_setcond_i32:
     case INDEX_op_brcond_i32:
@@ -1662,6 +1676,7 @@ static char *tcg_get_arg_str_ptr(TCGContext *s, char *buf, int buf_size,
         case TCG_TYPE_V64:
         case TCG_TYPE_V128:
         case TCG_TYPE_V256:
+        case TCG_TYPE_V512:
             snprintf(buf, buf_size, "v%d$0x%" PRIx64,
                      64 << (ts->type - TCG_TYPE_V64), ts->val);
             break;
@@ -1864,6 +1879,12 @@ static void tcg_dump_ops(TCGContext *s, FILE *f, bool have_prefs)
             case INDEX_op_qemu_st8_i32:
             case INDEX_op_qemu_ld_i64:
             case INDEX_op_qemu_st_i64:
+            case INDEX_op_qemu_cmpxchg_i32:
+            case INDEX_op_qemu_cmpxchg_i64:
+            case INDEX_op_qemu_xchg_i32:
+            case INDEX_op_qemu_xchg_i64:
+            case INDEX_op_qemu_fetch_add_i32:
+            case INDEX_op_qemu_fetch_add_i64:
                 {
                     MemOpIdx oi = op->args[k++];
                     MemOp op = get_memop(oi);
@@ -2173,6 +2194,13 @@ static TCGOp *tcg_op_alloc(TCGOpcode opc)
 TCGOp *tcg_emit_op(TCGOpcode opc)
 {
     TCGOp *op = tcg_op_alloc(opc);
+
+#ifdef CONFIG_PLUGIN
+    if (tcg_ctx->emit_before_op) {
+        QTAILQ_INSERT_BEFORE(tcg_ctx->emit_before_op, op, link);
+        return op;
+    }
+#endif
     QTAILQ_INSERT_TAIL(&tcg_ctx->ops, op, link);
     return op;
 }
@@ -2270,6 +2298,15 @@ static void reachable_code_pass(TCGContext *s)
 #define IS_DEAD_ARG(n)   (arg_life & (DEAD_ARG << (n)))
 #define NEED_SYNC_ARG(n) (arg_life & (SYNC_ARG << (n)))
 
+/* The target of a branch opcode is its last constant argument.  */
+static TCGLabel *op_branch_label(const TCGOp *op)
+{
+    const TCGOpDef *def = &tcg_op_defs[op->opc];
+
+    return arg_label(op->args[def->nb_oargs + def->nb_iargs
+                              + def->nb_cargs - 1]);
+}
+
 /* For liveness_pass_1, the register preferences for a given temp.  */
 static inline TCGRegSet *la_temp_pref(TCGTemp *ts)
 {
@@ -2379,6 +2416,61 @@ static void la_bb_sync(TCGContext *s, int ng, int nt)
     }
 }
 
+/*
+ * liveness analysis: label: temps are dead and local temps are in memory,
+ * as at the end of any basic block.  Globals must be in memory too, but
+ * they remain live so that the register allocator can keep them in a
+ * register across the label; the state on entry is recorded for the
+ * branches to the label.  Indirect globals are dead: liveness_pass_2
+ * loads them again after the label.
+ */
+static void la_label(TCGContext *s, TCGLabel *l, int ng, int nt)
+{
+    uint8_t *state = tcg_malloc(ng);
+    int i;
+
+    la_global_sync(s, ng);
+    for (i = 0; i < ng; ++i) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (ts->indirect_reg) {
+            ts->state = TS_DEAD | TS_MEM;
+            la_reset_pref(ts);
+        }
+        state[i] = ts->state;
+    }
+    for (i = ng; i < nt; ++i) {
+        TCGTemp *ts = &s->temps[i];
+
+        ts->state = ts->kind == TEMP_LOCAL ? TS_DEAD | TS_MEM : TS_DEAD;
+        la_reset_pref(ts);
+    }
+    l->la_state = state;
+}
+
+/*
+ * liveness analysis: unconditional branch.  If the label has been seen,
+ * the globals that are live on entry to it are live here, and synced;
+ * otherwise the branch goes backward and everything is saved, as at the
+ * end of any basic block.
+ */
+static void la_br(TCGContext *s, TCGLabel *l, int ng, int nt)
+{
+    int i;
+
+    la_bb_end(s, ng, nt);
+    if (!l->la_state) {
+        l->backward = true;
+        return;
+    }
+    for (i = 0; i < ng; ++i) {
+        if (!(l->la_state[i] & TS_DEAD)) {
+            s->temps[i].state = l->la_state[i];
+            la_reset_pref(&s->temps[i]);
+        }
+    }
+}
+
 /* liveness analysis: sync globals back to memory and kill.  */
 static void la_global_kill(TCGContext *s, int ng)
 {
@@ -2421,6 +2513,7 @@ static void liveness_pass_1(TCGContext *s)
     int nb_temps = s->nb_temps;
     TCGOp *op, *op_prev;
     TCGRegSet *prefs;
+    TCGLabel *l;
     int i;
 
     prefs = tcg_malloc(sizeof(TCGRegSet) * nb_temps);
@@ -2428,6 +2521,11 @@ static void liveness_pass_1(TCGContext *s)
         s->temps[i].state_ptr = prefs + i;
     }
 
+    QSIMPLEQ_FOREACH(l, &s->labels, next) {
+        l->backward = false;
+        l->la_state = NULL;
+    }
+
     /* ??? Should be redundant with the exit_tb that ends the TB.  */
     la_func_end(s, nb_globals, nb_temps);
 
@@ -2657,6 +2755,14 @@ static void liveness_pass_1(TCGContext *s)
                 la_func_end(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_COND_BRANCH) {
                 la_bb_sync(s, nb_globals, nb_temps);
+                l = op_branch_label(op);
+                if (!l->la_state) {
+                    l->backward = true;
+                }
+            } else if (opc == INDEX_op_set_label) {
+                la_label(s, arg_label(op->args[0]), nb_globals, nb_temps);
+            } else if (opc == INDEX_op_br) {
+                la_br(s, arg_label(op->args[0]), nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_BB_END) {
                 la_bb_end(s, nb_globals, nb_temps);
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
@@ -3008,6 +3114,10 @@ static void temp_allocate_frame(TCGContext *s, TCGTemp *ts)
         /* Note that we do not require aligned storage for V256. */
         size = 32, align = 16;
         break;
+    case TCG_TYPE_V512:
+        /* Nor for V512. */
+        size = 64, align = 16;
+        break;
     default:
         g_assert_not_reached();
     }
@@ -3085,12 +3195,13 @@ static void temp_sync(TCGContext *s, TCGTemp *ts, TCGRegSet allocated_regs,
         }
         switch (ts->val_type) {
         case TEMP_VAL_CONST:
-            /* If we're going to free the temp immediately, then we won't
-               require it later in a register, so attempt to store the
-               constant to memory directly.  */
-            if (free_or_dead
-                && tcg_out_sti(s, ts->type, ts->val,
-                               ts->mem_base->reg, ts->mem_offset)) {
+            /*
+             * Attempt to store the constant to memory directly.  If the
+             * temp stays live, it remains a constant and does not tie up
+             * a register until it is used, e.g. across a label.
+             */
+            if (tcg_out_sti(s, ts->type, ts->val,
+                            ts->mem_base->reg, ts->mem_offset)) {
                 break;
             }
             temp_load(s, ts, tcg_target_available_regs[ts->type],
@@ -3231,7 +3342,7 @@ static void temp_load(TCGContext *s, TCGTemp *ts, TCGRegSet desired_regs,
 
             tcg_out_dupi_vec(s, ts->type, vece, reg, ts->val);
         }
-        ts->mem_coherent = 0;
+        /* A constant that has been synced stays coherent.  */
         break;
     case TEMP_VAL_MEM:
         reg = tcg_reg_alloc(s, desired_regs, allocated_regs,
@@ -3284,9 +3395,11 @@ static void sync_globals(TCGContext *s, TCGRegSet allocated_regs)
     }
 }
 
-/* at the end of a basic block, we assume all temporaries are dead and
-   all globals are stored at their canonical location. */
-static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
+/*
+ * At the end of a basic block, we assume all temporaries are dead and
+ * local temporaries are stored at their canonical location.
+ */
+static void save_temps(TCGContext *s, TCGRegSet allocated_regs)
 {
     int i;
 
@@ -3311,10 +3424,124 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
             g_assert_not_reached();
         }
     }
+}
 
+/* at the end of a basic block, we assume all temporaries are dead and
+   all globals are stored at their canonical location. */
+static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
+{
+    save_temps(s, allocated_regs);
     save_globals(s, allocated_regs);
 }
 
+/*
+ * At a forward branch, record the globals that are in a register for
+ * the target label, keeping only those on which all the branches seen
+ * so far agree.  Liveness ensures that they are synced to memory.
+ */
+static void tcg_reg_alloc_branch(TCGContext *s, TCGLabel *l)
+{
+    TCGTemp **state = l->reg_state;
+    int i;
+
+    if (l->backward) {
+        return;
+    }
+    if (!state) {
+        state = tcg_malloc(sizeof(TCGTemp *) * TCG_TARGET_NB_REGS);
+        for (i = 0; i < TCG_TARGET_NB_REGS; i++) {
+            TCGTemp *ts = s->reg_to_temp[i];
+
+            if (ts && ts->kind == TEMP_GLOBAL) {
+                tcg_debug_assert(ts->mem_coherent);
+                state[i] = ts;
+            } else {
+                state[i] = NULL;
+            }
+        }
+        l->reg_state = state;
+    } else {
+        for (i = 0; i < TCG_TARGET_NB_REGS; i++) {
+            if (state[i] != s->reg_to_temp[i]) {
+                state[i] = NULL;
+            }
+        }
+    }
+}
+
+/*
+ * After an unconditional branch, forget the globals that liveness kept
+ * live for the target label.  They are all synced to memory.
+ */
+static void release_globals(TCGContext *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_globals; i++) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (ts->kind == TEMP_GLOBAL && ts->val_type != TEMP_VAL_MEM) {
+            tcg_debug_assert(ts->mem_coherent);
+            temp_free_or_dead(s, ts, 1);
+        }
+    }
+}
+
+/*
+ * At a label, keep in its register each live global that is there on
+ * all the incoming edges: the branches recorded by tcg_reg_alloc_branch
+ * and, if it is reachable, the fallthrough path.  All other globals are
+ * in memory, as at the end of any basic block.  No code is emitted.
+ */
+static void tcg_reg_alloc_label(TCGContext *s, TCGLabel *l,
+                                bool fallthrough)
+{
+    TCGTemp *keep[TCG_TARGET_NB_REGS];
+    int i;
+
+    save_temps(s, s->reserved_regs);
+
+    for (i = 0; i < TCG_TARGET_NB_REGS; i++) {
+        TCGTemp *ts = NULL;
+
+        if (l->backward) {
+            /* The state at the backward branches is not known yet.  */
+        } else if (!fallthrough) {
+            ts = l->reg_state ? l->reg_state[i] : NULL;
+        } else if (!l->reg_state || l->reg_state[i] == s->reg_to_temp[i]) {
+            ts = s->reg_to_temp[i];
+        }
+        if (ts && (ts->kind != TEMP_GLOBAL
+                   || (l->la_state[temp_idx(ts)] & TS_DEAD))) {
+            ts = NULL;
+        }
+        keep[i] = ts;
+    }
+
+    for (i = 0; i < s->nb_globals; i++) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (ts->kind == TEMP_GLOBAL && ts->val_type != TEMP_VAL_MEM
+            && !(ts->val_type == TEMP_VAL_REG && keep[ts->reg] == ts)) {
+            tcg_debug_assert(!fallthrough || ts->mem_coherent);
+            temp_free_or_dead(s, ts, 1);
+        }
+    }
+
+    /* Without a fallthrough path, the kept globals are not in place yet.  */
+    for (i = 0; i < TCG_TARGET_NB_REGS; i++) {
+        TCGTemp *ts = keep[i];
+
+        if (ts && ts->val_type != TEMP_VAL_REG) {
+            tcg_debug_assert(s->reg_to_temp[i] == NULL);
+            ts->val_type = TEMP_VAL_REG;
+            ts->reg = i;
+            ts->mem_coherent = 1;
+            s->reg_to_temp[i] = ts;
+        }
+    }
+}
+
 /*
  * At a conditional branch, we assume all temporaries are dead unless
  * explicitly live-across-conditional-branch; all globals and local
@@ -3688,7 +3915,12 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
 
     if (def->flags & TCG_OPF_COND_BRANCH) {
         tcg_reg_alloc_cbranch(s, i_allocated_regs);
+        tcg_reg_alloc_branch(s, op_branch_label(op));
     } else if (def->flags & TCG_OPF_BB_END) {
+        if (op->opc == INDEX_op_br) {
+            tcg_reg_alloc_branch(s, arg_label(op->args[0]));
+            release_globals(s);
+        }
         tcg_reg_alloc_bb_end(s, i_allocated_regs);
     } else {
         if (def->flags & TCG_OPF_CALL_CLOBBER) {
@@ -4123,6 +4355,7 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, target_ulong pc_start)
     TCGProfile *prof = &s->prof;
 #endif
     int i, num_insns;
+    bool reachable = true;
     TCGOp *op;
 
 #ifdef CONFIG_PROFILER
@@ -4296,11 +4529,25 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, target_ulong pc_start)
             temp_dead(s, arg_temp(op->args[0]));
             break;
         case INDEX_op_set_label:
-            tcg_reg_alloc_bb_end(s, s->reserved_regs);
+            tcg_reg_alloc_label(s, arg_label(op->args[0]), reachable);
             tcg_out_label(s, arg_label(op->args[0]));
+            reachable = true;
             break;
         case INDEX_op_call:
             tcg_reg_alloc_call(s, op);
+            if (tcg_call_flags(op) & TCG_CALL_NO_RETURN) {
+                reachable = false;
+            }
+            break;
+        case INDEX_op_br:
+        case INDEX_op_exit_tb:
+        case INDEX_op_goto_ptr:
+            /*
+             * Code after an unconditional branch is only reached
+             * through a label.
+             */
+            tcg_reg_alloc_op(s, op);
+            reachable = false;
             break;
         case INDEX_op_dup2_vec:
             if (tcg_reg_alloc_dup2(s, op)) {
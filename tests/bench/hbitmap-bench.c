@@ -0,0 +1,172 @@
+/*
+ * HBitmap micro-benchmark
+ *
+ * Times the operations that dominate dirty bitmap handling on large
+ * disks: range set/reset, merge, dirty area scans and deserialization.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/hbitmap.h"
+#include "qemu/host-utils.h"
+#include "qemu/timer.h"
+
+static uint64_t n_bits = 1ULL << 28;
+static unsigned int n_ops = 1 << 20;
+static unsigned int max_range = 1024;
+static unsigned int density = 50;
+
+static const char commands_string[] =
+    " -s = bitmap size in bits (default 2^28)\n"
+    " -o = number of set/reset operations\n"
+    " -r = maximum length of a set/reset range\n"
+    " -p = percentage of the bitmap that is dirtied before scans";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+/*
+ * From: https://en.wikipedia.org/wiki/Xorshift
+ * This is faster than rand_r(), and gives us a wider range (RAND_MAX is only
+ * guaranteed to be >= INT_MAX).
+ */
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    return x * UINT64_C(2685821657736338717);
+}
+
+static void pr_result(const char *name, int64_t ns, uint64_t ops)
+{
+    printf(" %-22s %10.3f ms", name, ns / 1e6);
+    if (ops > 1) {
+        printf("  %10.2f Mops/s", ns ? ops * 1e3 / ns : 0.0);
+    }
+    printf("\n");
+}
+
+static void fill(HBitmap *hb, uint64_t *r)
+{
+    uint64_t dirty = n_bits / 100 * density;
+    uint64_t done = 0;
+
+    while (done < dirty) {
+        uint64_t len = MIN(dirty - done, 1 + (*r = xorshift64star(*r)) % 4096);
+        uint64_t start = (*r = xorshift64star(*r)) % (n_bits - len);
+
+        hbitmap_set(hb, start, len);
+        done += len;
+    }
+}
+
+static void run_test(void)
+{
+    HBitmap *a = hbitmap_alloc(n_bits, 0);
+    HBitmap *b = hbitmap_alloc(n_bits, 0);
+    uint64_t r = 0x1234567;
+    uint64_t size, areas = 0;
+    int64_t offset, count, t;
+    uint8_t *buf;
+    unsigned int i;
+
+    printf("Results:\n");
+
+    t = get_clock();
+    for (i = 0; i < n_ops; i++) {
+        uint64_t len = 1 + (r = xorshift64star(r)) % max_range;
+        uint64_t start = (r = xorshift64star(r)) % (n_bits - len);
+
+        if (i & 1) {
+            hbitmap_reset(a, start, len);
+        } else {
+            hbitmap_set(a, start, len);
+        }
+    }
+    pr_result("set/reset", get_clock() - t, n_ops);
+
+    hbitmap_reset_all(a);
+    fill(a, &r);
+    fill(b, &r);
+
+    t = get_clock();
+    hbitmap_merge(a, b, a);
+    pr_result("merge", get_clock() - t, 1);
+
+    t = get_clock();
+    for (offset = 0;
+         hbitmap_next_dirty_area(a, offset, n_bits, INT64_MAX,
+                                 &offset, &count);
+         offset += count) {
+        areas++;
+    }
+    pr_result("next_dirty_area scan", get_clock() - t, areas);
+
+    size = hbitmap_serialization_size(a, 0, n_bits);
+    buf = g_malloc(size);
+    hbitmap_serialize_part(a, buf, 0, n_bits);
+    t = get_clock();
+    hbitmap_deserialize_part(b, buf, 0, n_bits, true);
+    pr_result("deserialize", get_clock() - t, 1);
+    g_assert(hbitmap_count(a) == hbitmap_count(b));
+
+    g_free(buf);
+    hbitmap_free(a);
+    hbitmap_free(b);
+}
+
+static void pr_params(void)
+{
+    printf("Parameters:\n");
+    printf(" bitmap size:       %" PRIu64 " bits\n", n_bits);
+    printf(" set/reset ops:     %u\n", n_ops);
+    printf(" max range:         %u\n", max_range);
+    printf(" scan density:      %u%%\n", density);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hs:o:r:p:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 's':
+            if (qemu_strtou64(optarg, NULL, 0, &n_bits) < 0) {
+                usage_complete(argv);
+                exit(1);
+            }
+            n_bits = MAX(n_bits, 1ULL << 13);
+            break;
+        case 'o':
+            n_ops = atoi(optarg);
+            break;
+        case 'r':
+            max_range = MAX(atoi(optarg), 1);
+            break;
+        case 'p':
+            density = MIN(atoi(optarg), 100);
+            break;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+    pr_params();
+    run_test();
+    return 0;
+}
@@ -0,0 +1,303 @@
+/*
+ * TB lookup cache benchmark
+ *
+ * Models the lookups that vCPU threads do after a miss in their jump
+ * cache: each thread looks up keys from a shared QHT, either directly
+ * or through a private 2-way set-associative cache indexed by the QHT
+ * hash, like the per-vCPU TB lookup cache in accel/tcg.  An optional
+ * invalidation thread removes and re-adds keys, clearing them from all
+ * the private caches as TB invalidation does.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/processor.h"
+#include "qemu/atomic.h"
+#include "qemu/qht.h"
+#include "qemu/rcu.h"
+#include "qemu/xxhash.h"
+#include "qemu/memalign.h"
+#include "qemu/host-utils.h"
+
+#define CACHE_WAYS 2
+
+typedef struct CacheSet {
+    long *key[CACHE_WAYS];
+} CacheSet;
+
+struct thread_info {
+    uint64_t seed;
+    size_t lookups;
+    size_t hits;
+    CacheSet *cache;
+} QEMU_ALIGNED(64); /* avoid false sharing among threads */
+
+static struct qht ht;
+static long *keys;
+static struct thread_info *info;
+static QemuThread *threads;
+
+static unsigned int duration = 1;
+static unsigned int n_threads = 1;
+static unsigned long n_keys = 1 << 14;
+static unsigned long cache_size = 1 << 13;
+static unsigned long inval_delay;
+static size_t n_ready_threads;
+static size_t n_invals;
+
+static bool test_start;
+static bool test_stop;
+
+static const char commands_string[] =
+    " -d = duration, in seconds\n"
+    " -n = number of lookup threads\n"
+    " -k = number of keys (will be rounded up to pow2)\n"
+    " -c = entries of the per-thread cache, 0 to disable\n"
+    " -i = delay (in us) between invalidations, 0 to disable";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+static bool is_equal(const void *ap, const void *bp)
+{
+    const long *a = ap;
+    const long *b = bp;
+
+    return *a == *b;
+}
+
+/*
+ * From: https://en.wikipedia.org/wiki/Xorshift
+ * This is faster than rand_r(), and gives us a wider range (RAND_MAX is only
+ * guaranteed to be >= INT_MAX).
+ */
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    return x * UINT64_C(2685821657736338717);
+}
+
+static CacheSet *cache_set(CacheSet *cache, uint32_t hash)
+{
+    return &cache[hash & (cache_size / CACHE_WAYS - 1)];
+}
+
+static long *lookup(struct thread_info *ti, long *key)
+{
+    uint32_t hash = qemu_xxhash2(*key);
+    CacheSet *set = NULL;
+    long *p;
+    int i;
+
+    if (ti->cache) {
+        set = cache_set(ti->cache, hash);
+        for (i = 0; i < CACHE_WAYS; i++) {
+            p = qatomic_rcu_read(&set->key[i]);
+            if (p && *p == *key) {
+                ti->hits++;
+                return p;
+            }
+        }
+    }
+
+    p = qht_lookup(&ht, key, hash);
+    if (p && set) {
+        qatomic_set(&set->key[1], qatomic_read(&set->key[0]));
+        qatomic_set(&set->key[0], p);
+    }
+    return p;
+}
+
+static void *thread_func(void *arg)
+{
+    struct thread_info *ti = arg;
+
+    rcu_register_thread();
+
+    qatomic_inc(&n_ready_threads);
+    while (!qatomic_read(&test_start)) {
+        cpu_relax();
+    }
+
+    rcu_read_lock();
+    while (!qatomic_read(&test_stop)) {
+        ti->seed = xorshift64star(ti->seed);
+        lookup(ti, &keys[ti->seed & (n_keys - 1)]);
+        ti->lookups++;
+    }
+    rcu_read_unlock();
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void invalidate(long *p)
+{
+    uint32_t hash = qemu_xxhash2(*p);
+    unsigned int i;
+    int j;
+
+    qht_remove(&ht, p, hash);
+    for (i = 0; i < n_threads && info[i].cache; i++) {
+        CacheSet *set = cache_set(info[i].cache, hash);
+
+        for (j = 0; j < CACHE_WAYS; j++) {
+            if (qatomic_read(&set->key[j]) == p) {
+                qatomic_set(&set->key[j], NULL);
+            }
+        }
+    }
+    qht_insert(&ht, p, hash, NULL);
+}
+
+static void *inval_func(void *arg)
+{
+    uint64_t r = 1;
+
+    qatomic_inc(&n_ready_threads);
+    while (!qatomic_read(&test_start)) {
+        cpu_relax();
+    }
+
+    while (!qatomic_read(&test_stop)) {
+        r = xorshift64star(r);
+        invalidate(&keys[r & (n_keys - 1)]);
+        n_invals++;
+        g_usleep(inval_delay);
+    }
+    return NULL;
+}
+
+static void run_test(void)
+{
+    QemuThread inval_thread;
+    unsigned int i;
+    unsigned int n = n_threads + !!inval_delay;
+
+    threads = g_new(QemuThread, n_threads);
+    info = qemu_memalign(64, sizeof(*info) * n_threads);
+    for (i = 0; i < n_threads; i++) {
+        memset(&info[i], 0, sizeof(info[i]));
+        info[i].seed = (i + 1) ^ time(NULL);
+        if (cache_size) {
+            info[i].cache = g_new0(CacheSet, cache_size / CACHE_WAYS);
+        }
+        qemu_thread_create(&threads[i], "lookup", thread_func, &info[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+    if (inval_delay) {
+        qemu_thread_create(&inval_thread, "inval", inval_func, NULL,
+                           QEMU_THREAD_JOINABLE);
+    }
+
+    while (qatomic_read(&n_ready_threads) != n) {
+        cpu_relax();
+    }
+
+    qatomic_set(&test_start, true);
+    g_usleep(duration * G_USEC_PER_SEC);
+    qatomic_set(&test_stop, true);
+
+    for (i = 0; i < n_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+    if (inval_delay) {
+        qemu_thread_join(&inval_thread);
+    }
+}
+
+static void htable_init(void)
+{
+    unsigned long i;
+
+    keys = g_new(long, n_keys);
+    qht_init(&ht, is_equal, n_keys, 0);
+    for (i = 0; i < n_keys; i++) {
+        keys[i] = i;
+        qht_insert(&ht, &keys[i], qemu_xxhash2(keys[i]), NULL);
+    }
+}
+
+static void pr_params(void)
+{
+    printf("Parameters:\n");
+    printf(" duration:          %u s\n", duration);
+    printf(" # of threads:      %u\n", n_threads);
+    printf(" # of keys:         %lu\n", n_keys);
+    printf(" cache entries:     %lu\n", cache_size);
+    printf(" inval delay:       %lu us\n", inval_delay);
+}
+
+static void pr_stats(void)
+{
+    size_t lookups = 0, hits = 0;
+    unsigned int i;
+    double tx;
+
+    for (i = 0; i < n_threads; i++) {
+        lookups += info[i].lookups;
+        hits += info[i].hits;
+    }
+
+    tx = lookups / 1e6 / duration;
+    printf("Results:\n");
+    printf(" Cache hits:        %.2f%%\n",
+           lookups ? (double)hits / lookups * 100 : 0.0);
+    printf(" Invalidations:     %zu\n", n_invals);
+    printf(" Throughput:        %.2f MT/s\n", tx);
+    printf(" Throughput/thread: %.2f MT/s/thread\n", tx / n_threads);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "c:d:hi:k:n:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'c':
+            cache_size = atol(optarg);
+            if (cache_size) {
+                cache_size = pow2ceil(MAX(cache_size, CACHE_WAYS));
+            }
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'i':
+            inval_delay = atol(optarg);
+            break;
+        case 'k':
+            n_keys = pow2ceil(MAX(atol(optarg), 1));
+            break;
+        case 'n':
+            n_threads = MAX(atoi(optarg), 1);
+            break;
+        default:
+            usage_complete(argv);
+            exit(1);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+    pr_params();
+    htable_init();
+    run_test();
+    pr_stats();
+    return 0;
+}
@@ -34,6 +34,9 @@ enum op {
     OP_FMA,
     OP_SQRT,
     OP_CMP,
+    OP_MAXNUM,
+    OP_RINT,
+    OP_TO_INT32,
     OP_MAX_NR,
 };
 
@@ -45,6 +48,9 @@ static const char * const op_names[] = {
     [OP_FMA] = "mulAdd",
     [OP_SQRT] = "sqrt",
     [OP_CMP] = "cmp",
+    [OP_MAXNUM] = "maxNum",
+    [OP_RINT] = "roundToInt",
+    [OP_TO_INT32] = "to_i32",
     [OP_MAX_NR] = NULL,
 };
 
@@ -270,6 +276,15 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_MAXNUM:
+                    res.f = fmaxf(a, b);
+                    break;
+                case OP_RINT:
+                    res.f = rintf(a);
+                    break;
+                case OP_TO_INT32:
+                    res.u64 = (int32_t)lrintf(a);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -305,6 +320,15 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_MAXNUM:
+                    res.d = fmax(a, b);
+                    break;
+                case OP_RINT:
+                    res.d = rint(a);
+                    break;
+                case OP_TO_INT32:
+                    res.u64 = (int32_t)lrint(a);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -340,6 +364,15 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float32_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_MAXNUM:
+                    res.f32 = float32_maxnum(a, b, &soft_status);
+                    break;
+                case OP_RINT:
+                    res.f32 = float32_round_to_int(a, &soft_status);
+                    break;
+                case OP_TO_INT32:
+                    res.u64 = float32_to_int32(a, &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -375,6 +408,15 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float64_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_MAXNUM:
+                    res.f64 = float64_maxnum(a, b, &soft_status);
+                    break;
+                case OP_RINT:
+                    res.f64 = float64_round_to_int(a, &soft_status);
+                    break;
+                case OP_TO_INT32:
+                    res.u64 = float64_to_int32(a, &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -410,6 +452,15 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float128_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_MAXNUM:
+                    res.f128 = float128_maxnum(a, b, &soft_status);
+                    break;
+                case OP_RINT:
+                    res.f128 = float128_round_to_int(a, &soft_status);
+                    break;
+                case OP_TO_INT32:
+                    res.u64 = float128_to_int32(a, &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -448,6 +499,9 @@ GEN_BENCH_ALL_TYPES(mul, OP_MUL, 2)
 GEN_BENCH_ALL_TYPES(div, OP_DIV, 2)
 GEN_BENCH_ALL_TYPES(fma, OP_FMA, 3)
 GEN_BENCH_ALL_TYPES(cmp, OP_CMP, 2)
+GEN_BENCH_ALL_TYPES(maxnum, OP_MAXNUM, 2)
+GEN_BENCH_ALL_TYPES(rint, OP_RINT, 1)
+GEN_BENCH_ALL_TYPES(to_int32, OP_TO_INT32, 1)
 #undef GEN_BENCH_ALL_TYPES
 
 #define GEN_BENCH_ALL_TYPES_NO_NEG(name, op, n)                         \
@@ -480,6 +534,9 @@ static const bench_func_t bench_funcs[OP_MAX_NR][PREC_MAX_NR] = {
     GEN_BENCH_FUNCS(fma, OP_FMA),
     GEN_BENCH_FUNCS(sqrt, OP_SQRT),
     GEN_BENCH_FUNCS(cmp, OP_CMP),
+    GEN_BENCH_FUNCS(maxnum, OP_MAXNUM),
+    GEN_BENCH_FUNCS(rint, OP_RINT),
+    GEN_BENCH_FUNCS(to_int32, OP_TO_INT32),
 };
 
 #undef GEN_BENCH_FUNCS
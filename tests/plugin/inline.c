@@ -0,0 +1,178 @@
+/*
+ * Check per-vCPU inline operations and conditional callbacks
+ *
+ * Every event is counted twice, once by an inline op on a per-vCPU
+ * scoreboard and once by a regular callback, and the two counts must
+ * match for each vCPU when the program exits. The scoreboard entry of
+ * each vCPU is also used by its init callback, which must run first;
+ * run with many vCPUs to check that the scoreboard has grown by then.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+/* instructions between two calls of the conditional callback */
+#define SAMPLE_PERIOD 1000
+
+typedef struct {
+    uint64_t initialized;
+    uint64_t tb_cb;
+    uint64_t tb_inline;
+    uint64_t insn_cb;
+    uint64_t insn_inline;
+    uint64_t mem_cb;
+    uint64_t mem_inline;
+    /* set inline to the vaddr of the last instruction executed */
+    uint64_t last_insn;
+    uint64_t last_insn_cb;
+    /* instructions since the last sample, and number of samples */
+    uint64_t sample_count;
+    uint64_t samples;
+} CPUCount;
+
+static struct qemu_plugin_scoreboard *counts;
+static qemu_plugin_u64 tb_inline;
+static qemu_plugin_u64 insn_inline;
+static qemu_plugin_u64 mem_inline;
+static qemu_plugin_u64 last_insn;
+static qemu_plugin_u64 sample_count;
+
+static void plugin_exit(qemu_plugin_id_t id, void *p)
+{
+    g_autoptr(GString) report = g_string_new("");
+    uint64_t insns = qemu_plugin_u64_sum(insn_inline);
+    unsigned int i;
+
+    for (i = 0; insns; i++) {
+        CPUCount *count = qemu_plugin_scoreboard_find(counts, i);
+
+        g_assert(count->initialized || !count->insn_inline);
+        g_assert(count->tb_cb == count->tb_inline);
+        g_assert(count->insn_cb == count->insn_inline);
+        g_assert(count->mem_cb == count->mem_inline);
+        g_assert(count->samples * SAMPLE_PERIOD + count->sample_count ==
+                 count->insn_inline);
+        insns -= count->insn_inline;
+    }
+
+    g_string_printf(report, "tb: %" PRIu64 ", insn: %" PRIu64
+                    ", mem: %" PRIu64 "\n",
+                    qemu_plugin_u64_sum(tb_inline),
+                    qemu_plugin_u64_sum(insn_inline),
+                    qemu_plugin_u64_sum(mem_inline));
+    qemu_plugin_outs(report->str);
+    qemu_plugin_scoreboard_free(counts);
+}
+
+static void vcpu_init(qemu_plugin_id_t id, unsigned int cpu_index)
+{
+    CPUCount *count = qemu_plugin_scoreboard_find(counts, cpu_index);
+
+    count->initialized = true;
+}
+
+static void vcpu_tb_exec(unsigned int cpu_index, void *udata)
+{
+    CPUCount *count = qemu_plugin_scoreboard_find(counts, cpu_index);
+
+    g_assert(count->initialized);
+    count->tb_cb++;
+}
+
+static void vcpu_insn_exec(unsigned int cpu_index, void *udata)
+{
+    CPUCount *count = qemu_plugin_scoreboard_find(counts, cpu_index);
+
+    /* regular callbacks run before the inline ops of an instruction */
+    g_assert(count->last_insn == count->last_insn_cb);
+    count->last_insn_cb = (uintptr_t)udata;
+    count->insn_cb++;
+}
+
+static void vcpu_mem_access(unsigned int cpu_index,
+                            qemu_plugin_meminfo_t info,
+                            uint64_t vaddr, void *udata)
+{
+    CPUCount *count = qemu_plugin_scoreboard_find(counts, cpu_index);
+
+    count->mem_cb++;
+}
+
+static void vcpu_sample(unsigned int cpu_index, void *udata)
+{
+    CPUCount *count = qemu_plugin_scoreboard_find(counts, cpu_index);
+
+    g_assert(count->sample_count == SAMPLE_PERIOD);
+    count->sample_count = 0;
+    count->samples++;
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    size_t n = qemu_plugin_tb_n_insns(tb);
+    size_t i;
+
+    qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_tb_exec,
+                                         QEMU_PLUGIN_CB_NO_REGS, NULL);
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, tb_inline, 1);
+
+    for (i = 0; i < n; i++) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+        uintptr_t vaddr = qemu_plugin_insn_vaddr(insn);
+
+        qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
+                                               QEMU_PLUGIN_CB_NO_REGS,
+                                               (void *)vaddr);
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_ADD_U64, insn_inline, 1);
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_STORE_U64, last_insn, vaddr);
+
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_ADD_U64, sample_count, 1);
+        qemu_plugin_register_vcpu_insn_exec_cond_cb(
+            insn, vcpu_sample, QEMU_PLUGIN_CB_NO_REGS,
+            QEMU_PLUGIN_COND_GE, sample_count, SAMPLE_PERIOD, NULL);
+
+        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
+                                         QEMU_PLUGIN_CB_NO_REGS,
+                                         QEMU_PLUGIN_MEM_RW, NULL);
+        qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+            insn, QEMU_PLUGIN_MEM_RW, QEMU_PLUGIN_INLINE_ADD_U64,
+            mem_inline, 1);
+    }
+}
+
+QEMU_PLUGIN_EXPORT
+int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+                        int argc, char **argv)
+{
+    counts = qemu_plugin_scoreboard_new(sizeof(CPUCount));
+    tb_inline = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, tb_inline);
+    insn_inline = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, insn_inline);
+    mem_inline = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, mem_inline);
+    last_insn = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, last_insn);
+    sample_count = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, sample_count);
+
+    qemu_plugin_register_vcpu_init_cb(id, vcpu_init);
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
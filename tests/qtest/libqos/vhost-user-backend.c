@@ -0,0 +1,128 @@
+/*
+ * libqos helpers to run a vhost-user back-end next to QEMU
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "tests/qtest/libqtest-single.h"
+#include "qgraph.h"
+#include "vhost-user-backend.h"
+
+typedef struct QOSVhostUserBackend {
+    pid_t pid;
+    char *name;
+} QOSVhostUserBackend;
+
+const char *qos_vhost_user_backend_binary(const char *env)
+{
+    const char *bin;
+
+    bin = getenv(env);
+    if (!bin) {
+        fprintf(stderr, "Environment variable %s required\n", env);
+        exit(0);
+    }
+
+    /* If we've got a path to the binary, check whether we can access it */
+    if (strchr(bin, '/') && access(bin, X_OK) != 0) {
+        fprintf(stderr, "ERROR: '%s' is not accessible\n", bin);
+        exit(1);
+    }
+
+    return bin;
+}
+
+void qos_destroy_file(void *path)
+{
+    unlink(path);
+    g_free(path);
+    qos_invalidate_command_line();
+}
+
+char *qos_vhost_user_create_listen_socket(int *fd)
+{
+    int tmp_fd;
+    char *path;
+
+    /* No race because our pid makes the path unique */
+    path = g_strdup_printf("%s/qtest-%d-sock.XXXXXX",
+                           g_get_tmp_dir(), getpid());
+    tmp_fd = mkstemp(path);
+    g_assert_cmpint(tmp_fd, >=, 0);
+    close(tmp_fd);
+    unlink(path);
+
+    *fd = qtest_socket_server(path);
+    g_test_queue_destroy(qos_destroy_file, path);
+    return path;
+}
+
+/*
+ * g_test_queue_destroy() and qtest_add_abrt_handler() cleanup function for
+ * the back-end.
+ */
+static void qos_vhost_user_backend_quit(void *data)
+{
+    QOSVhostUserBackend *backend = data;
+    int wstatus;
+    pid_t pid;
+
+    /*
+     * If we were invoked as a g_test_queue_destroy() cleanup function we need
+     * to remove the abrt handler to avoid being called again if the code below
+     * aborts. Also, we must not leave the abrt handler installed after
+     * cleanup.
+     */
+    qtest_remove_abrt_handler(data);
+
+    /* Before quitting the back-end, quit qemu to avoid dubious messages */
+    qtest_kill_qemu(global_qtest);
+
+    kill(backend->pid, SIGTERM);
+    pid = waitpid(backend->pid, &wstatus, 0);
+    g_assert_cmpint(pid, ==, backend->pid);
+    if (!WIFEXITED(wstatus)) {
+        fprintf(stderr, "%s: expected %s to exit\n", __func__, backend->name);
+        abort();
+    }
+    if (WEXITSTATUS(wstatus) != 0) {
+        fprintf(stderr, "%s: expected %s to exit successfully, got %d\n",
+                __func__, backend->name, WEXITSTATUS(wstatus));
+        abort();
+    }
+
+    g_free(backend->name);
+    g_free(backend);
+}
+
+void qos_vhost_user_backend_start(const char *name, const char *command)
+{
+    QOSVhostUserBackend *backend;
+    pid_t pid;
+
+    g_test_message("starting vhost-user backend: %s", command);
+    pid = fork();
+    if (pid == 0) {
+        /*
+         * Close standard file descriptors so tap-driver.pl pipe detects when
+         * our parent terminates.
+         */
+        close(0);
+        close(1);
+        open("/dev/null", O_RDONLY);
+        open("/dev/null", O_WRONLY);
+
+        execlp("/bin/sh", "sh", "-c", command, NULL);
+        exit(1);
+    }
+
+    backend = g_new(QOSVhostUserBackend, 1);
+    backend->pid = pid;
+    backend->name = g_strdup(name);
+
+    /* Make sure the back-end is stopped */
+    qtest_add_abrt_handler(qos_vhost_user_backend_quit, backend);
+    g_test_queue_destroy(qos_vhost_user_backend_quit, backend);
+}
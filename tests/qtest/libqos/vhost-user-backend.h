@@ -0,0 +1,49 @@
+/*
+ * libqos helpers to run a vhost-user back-end next to QEMU
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef TESTS_LIBQOS_VHOST_USER_BACKEND_H
+#define TESTS_LIBQOS_VHOST_USER_BACKEND_H
+
+/**
+ * qos_vhost_user_backend_binary:
+ * @env: environment variable holding the path of the back-end
+ *
+ * Returns the back-end binary.  If @env is not set, the test is skipped
+ * by exiting successfully; if the binary cannot be executed, it fails.
+ */
+const char *qos_vhost_user_backend_binary(const char *env);
+
+/**
+ * qos_destroy_file:
+ * @path: file to remove, allocated with g_malloc()
+ *
+ * g_test_queue_destroy() cleanup function for temporary files that
+ * appear on the command line.
+ */
+void qos_destroy_file(void *path);
+
+/**
+ * qos_vhost_user_create_listen_socket:
+ * @fd: returns the listening socket, to pass to the back-end
+ *
+ * Returns the path of a new UNIX socket for QEMU to connect to.  The
+ * socket file is removed at the end of the test.
+ */
+char *qos_vhost_user_create_listen_socket(int *fd);
+
+/**
+ * qos_vhost_user_backend_start:
+ * @name: name of the back-end for messages
+ * @command: shell command that execs the back-end
+ *
+ * Starts the back-end in the background.  At the end of the test, or if
+ * it aborts, QEMU is killed first, then the back-end gets SIGTERM and
+ * must exit successfully.
+ */
+void qos_vhost_user_backend_start(const char *name, const char *command);
+
+#endif
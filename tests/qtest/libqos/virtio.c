@@ -392,6 +392,45 @@ void qvirtqueue_kick(QTestState *qts, QVirtioDevice *d, QVirtQueue *vq,
     }
 }
 
+/*
+ * qvirtqueue_kick_batch:
+ * @free_heads: The first descriptor of each request
+ * @num: Number of requests
+ *
+ * Make all requests available with a single update of the avail index, so
+ * that the device sees them at the same time, and notify the device once.
+ */
+void qvirtqueue_kick_batch(QTestState *qts, QVirtioDevice *d, QVirtQueue *vq,
+                           const uint32_t *free_heads, unsigned int num)
+{
+    /* vq->avail->idx */
+    uint16_t idx = qvirtio_readw(d, qts, vq->avail + 2);
+    uint16_t new_idx = idx + num;
+    uint16_t flags;
+    uint16_t avail_event;
+    unsigned int i;
+
+    for (i = 0; i < num; i++) {
+        /* vq->avail->ring[(idx + i) % vq->size] */
+        qvirtio_writew(d, qts,
+                       vq->avail + 4 + (2 * ((uint16_t)(idx + i) % vq->size)),
+                       free_heads[i]);
+    }
+    /* vq->avail->idx */
+    qvirtio_writew(d, qts, vq->avail + 2, new_idx);
+
+    /* Must read after idx is updated */
+    flags = qvirtio_readw(d, qts, vq->avail);
+    avail_event = qvirtio_readw(d, qts, vq->used + 4 +
+                                sizeof(struct vring_used_elem) * vq->size);
+
+    if ((flags & VRING_USED_F_NO_NOTIFY) == 0 &&
+        (!vq->event ||
+         (uint16_t)(new_idx - avail_event - 1) < (uint16_t)(new_idx - idx))) {
+        d->bus->virtqueue_kick(d, vq);
+    }
+}
+
 /*
  * qvirtqueue_get_buf:
  * @desc_idx: A pointer that is filled with the vq->desc[] index, may be NULL
@@ -0,0 +1,84 @@
+/*
+ * QTest testcase for the options of the af-xdp netdev
+ *
+ * Only invalid combinations are tried, which are rejected before any
+ * AF_XDP socket is created, so no privileges or special network devices
+ * are needed.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qapi/qmp/qdict.h"
+
+/* Add an af-xdp netdev with @args and check that it fails with @desc */
+static void check_netdev_add_error(QTestState *qts, const char *args,
+                                   const char *desc)
+{
+    QDict *response, *error;
+    const char *got;
+
+    response = qtest_qmp(qts, "{'execute': 'netdev_add',"
+                         " 'arguments': {'type': 'af-xdp', 'id': 'xdp0', %s}}",
+                         args);
+    g_assert(response);
+    error = qdict_get_qdict(response, "error");
+    g_assert(error);
+    got = qdict_get_str(error, "desc");
+    if (!g_str_has_prefix(got, desc)) {
+        g_test_message("'%s' failed with '%s', expected '%s'", args, got,
+                       desc);
+        g_assert_not_reached();
+    }
+    qobject_unref(response);
+
+    /* Nothing was left behind */
+    response = qtest_qmp(qts, "{'execute': 'netdev_del',"
+                         " 'arguments': {'id': 'xdp0'}}");
+    g_assert(qdict_haskey(response, "error"));
+    qobject_unref(response);
+}
+
+static void test_af_xdp_options(void)
+{
+    QTestState *qts = qtest_init("-nodefaults");
+
+    check_netdev_add_error(qts, "'mode': 'native'",
+                           "Parameter 'ifname' is missing");
+    check_netdev_add_error(qts, "'ifname': 'lo', 'mode': 'generic'",
+                           "Parameter 'mode' does not accept value 'generic'");
+    check_netdev_add_error(qts, "'ifname': 'lo', 'queues': 'two'",
+                           "Invalid parameter type for 'queues'");
+    check_netdev_add_error(qts, "'ifname': 'qtest-no-such-if'",
+                           "failed to get ifindex for 'qtest-no-such-if'");
+    check_netdev_add_error(qts, "'ifname': 'lo', 'queues': 0",
+                           "invalid number of queues (0) for 'lo'");
+
+    /* inhibit and sock-fds go together */
+    check_netdev_add_error(qts, "'ifname': 'lo', 'inhibit': true",
+                           "'inhibit=on' requires 'sock-fds' and vice versa");
+    check_netdev_add_error(qts, "'ifname': 'lo', 'sock-fds': 'fd0'",
+                           "'inhibit=on' requires 'sock-fds' and vice versa");
+
+    /* One socket per queue, passed with getfd */
+    check_netdev_add_error(qts, "'ifname': 'lo', 'queues': 2,"
+                           " 'inhibit': true, 'sock-fds': 'fd0'",
+                           "expected 2 socket fds, got 1");
+    check_netdev_add_error(qts, "'ifname': 'lo', 'queues': 2,"
+                           " 'inhibit': true, 'sock-fds': 'fd0:fd1:fd2'",
+                           "expected 2 socket fds, got 3");
+    check_netdev_add_error(qts, "'ifname': 'lo', 'queues': 2,"
+                           " 'inhibit': true, 'sock-fds': 'fd0:fd1'",
+                           "File descriptor named 'fd0' has not been found");
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    qtest_add_func("/netdev/af-xdp/options", test_af_xdp_options);
+    return g_test_run();
+}
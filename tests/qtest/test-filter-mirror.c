@@ -74,6 +74,81 @@ static void test_mirror(void)
     qtest_quit(qts);
 }
 
+static void send_frame(int sock, const uint8_t *frame, uint32_t frame_len)
+{
+    uint32_t size = htonl(frame_len);
+    struct iovec iov[] = {
+        {
+            .iov_base = &size,
+            .iov_len = sizeof(size),
+        }, {
+            .iov_base = (void *)frame,
+            .iov_len = frame_len,
+        },
+    };
+    ssize_t ret;
+
+    ret = iov_send(sock, iov, 2, 0, sizeof(size) + frame_len);
+    g_assert_cmpint(ret, ==, sizeof(size) + frame_len);
+}
+
+static void test_mirror_match(void)
+{
+    int send_sock[2], recv_sock[2];
+    uint32_t ret = 0, len = 0;
+    /* ARP request, must bypass the filter */
+    uint8_t arp_frame[60] = {
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x52, 0x54, 0x00, 0x12, 0x34, 0x56,
+        0x08, 0x06,
+    };
+    /* UDP datagram from 10.0.2.15:1024 to 10.0.2.3:53 */
+    uint8_t udp_frame[60] = {
+        0x52, 0x55, 0x0a, 0x00, 0x02, 0x03, 0x52, 0x54, 0x00, 0x12, 0x34, 0x56,
+        0x08, 0x00,
+        0x45, 0x00, 0x00, 0x1c, 0x00, 0x00, 0x00, 0x00, 0x40, 0x11, 0x00, 0x00,
+        0x0a, 0x00, 0x02, 0x0f, 0x0a, 0x00, 0x02, 0x03,
+        0x04, 0x00, 0x00, 0x35, 0x00, 0x08, 0x00, 0x00,
+    };
+    uint8_t *recv_buf;
+    QTestState *qts;
+
+    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, send_sock);
+    g_assert_cmpint(ret, !=, -1);
+
+    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, recv_sock);
+    g_assert_cmpint(ret, !=, -1);
+
+    qts = qtest_initf(
+        "-nic socket,id=qtest-bn0,fd=%d "
+        "-chardev socket,id=mirror0,fd=%d "
+        "-object filter-mirror,id=qtest-f0,netdev=qtest-bn0,queue=tx,"
+        "outdev=mirror0,match-proto=udp,match-dst=10.0.2.0/24,match-dport=53 "
+        , send_sock[1], recv_sock[1]);
+
+    /* send a qmp command to guarantee that 'connected' is setting to true. */
+    qmp_discard_response(qts, "{ 'execute' : 'query-status'}");
+    send_frame(send_sock[0], arp_frame, sizeof(arp_frame));
+    send_frame(send_sock[0], udp_frame, sizeof(udp_frame));
+
+    /* Only the UDP datagram must have been mirrored */
+    ret = recv(recv_sock[0], &len, sizeof(len), 0);
+    g_assert_cmpint(ret, ==, sizeof(len));
+    len = ntohl(len);
+
+    g_assert_cmpint(len, ==, sizeof(udp_frame));
+    recv_buf = g_malloc(len);
+    ret = recv(recv_sock[0], recv_buf, len, MSG_WAITALL);
+    g_assert_cmpint(ret, ==, len);
+    g_assert(!memcmp(recv_buf, udp_frame, len));
+
+    g_free(recv_buf);
+    close(send_sock[0]);
+    close(send_sock[1]);
+    close(recv_sock[0]);
+    close(recv_sock[1]);
+    qtest_quit(qts);
+}
+
 int main(int argc, char **argv)
 {
     int ret;
@@ -81,6 +156,7 @@ int main(int argc, char **argv)
     g_test_init(&argc, &argv, NULL);
 
     qtest_add_func("/netfilter/mirror", test_mirror);
+    qtest_add_func("/netfilter/mirror-match", test_mirror_match);
     ret = g_test_run();
 
     return ret;
@@ -20,15 +20,12 @@
 #include "libqos/qgraph.h"
 #include "libqos/vhost-user-blk.h"
 #include "libqos/libqos-pc.h"
+#include "libqos/vhost-user-backend.h"
 
 #define TEST_IMAGE_SIZE         (64 * 1024 * 1024)
 #define QVIRTIO_BLK_TIMEOUT_US  (30 * 1000 * 1000)
 #define PCI_SLOT_HP             0x06
 
-typedef struct {
-    pid_t pid;
-} QemuStorageDaemonState;
-
 typedef struct QVirtioBlkReq {
     uint32_t type;
     uint32_t ioprio;
@@ -788,36 +785,6 @@ static void test_nonexistent_virtqueue(void *obj, void *data,
     g_free(dev);
 }
 
-static const char *qtest_qemu_storage_daemon_binary(void)
-{
-    const char *qemu_storage_daemon_bin;
-
-    qemu_storage_daemon_bin = getenv("QTEST_QEMU_STORAGE_DAEMON_BINARY");
-    if (!qemu_storage_daemon_bin) {
-        fprintf(stderr, "Environment variable "
-                        "QTEST_QEMU_STORAGE_DAEMON_BINARY required\n");
-        exit(0);
-    }
-
-    /* If we've got a path to the binary, check whether we can access it */
-    if (strchr(qemu_storage_daemon_bin, '/') &&
-        access(qemu_storage_daemon_bin, X_OK) != 0) {
-        fprintf(stderr, "ERROR: '%s' is not accessible\n",
-                qemu_storage_daemon_bin);
-        exit(1);
-    }
-
-    return qemu_storage_daemon_bin;
-}
-
-/* g_test_queue_destroy() cleanup function for files */
-static void destroy_file(void *path)
-{
-    unlink(path);
-    g_free(path);
-    qos_invalidate_command_line();
-}
-
 static char *drive_create(void)
 {
     int fd, ret;
@@ -831,129 +798,67 @@ static char *drive_create(void)
     g_assert_cmpint(ret, ==, 0);
     close(fd);
 
-    g_test_queue_destroy(destroy_file, t_path);
+    g_test_queue_destroy(qos_destroy_file, t_path);
     return t_path;
 }
 
-static char *create_listen_socket(int *fd)
-{
-    int tmp_fd;
-    char *path;
-
-    /* No race because our pid makes the path unique */
-    path = g_strdup_printf("%s/qtest-%d-sock.XXXXXX",
-                           g_get_tmp_dir(), getpid());
-    tmp_fd = mkstemp(path);
-    g_assert_cmpint(tmp_fd, >=, 0);
-    close(tmp_fd);
-    unlink(path);
-
-    *fd = qtest_socket_server(path);
-    g_test_queue_destroy(destroy_file, path);
-    return path;
-}
-
-/*
- * g_test_queue_destroy() and qtest_add_abrt_handler() cleanup function for
- * qemu-storage-daemon.
- */
-static void quit_storage_daemon(void *data)
-{
-    QemuStorageDaemonState *qsd = data;
-    int wstatus;
-    pid_t pid;
-
-    /*
-     * If we were invoked as a g_test_queue_destroy() cleanup function we need
-     * to remove the abrt handler to avoid being called again if the code below
-     * aborts. Also, we must not leave the abrt handler installed after
-     * cleanup.
-     */
-    qtest_remove_abrt_handler(data);
-
-    /* Before quitting storage-daemon, quit qemu to avoid dubious messages */
-    qtest_kill_qemu(global_qtest);
-
-    kill(qsd->pid, SIGTERM);
-    pid = waitpid(qsd->pid, &wstatus, 0);
-    g_assert_cmpint(pid, ==, qsd->pid);
-    if (!WIFEXITED(wstatus)) {
-        fprintf(stderr, "%s: expected qemu-storage-daemon to exit\n",
-                __func__);
-        abort();
-    }
-    if (WEXITSTATUS(wstatus) != 0) {
-        fprintf(stderr, "%s: expected qemu-storage-daemon to exit "
-                "successfully, got %d\n",
-                __func__, WEXITSTATUS(wstatus));
-        abort();
-    }
-
-    g_free(data);
-}
-
 static void start_vhost_user_blk(GString *cmd_line, int vus_instances,
-                                 int num_queues)
+                                 int num_queues, int num_iothreads)
 {
-    const char *vhost_user_blk_bin = qtest_qemu_storage_daemon_binary();
+    const char *vhost_user_blk_bin =
+        qos_vhost_user_backend_binary("QTEST_QEMU_STORAGE_DAEMON_BINARY");
     int i;
     gchar *img_path;
     GString *storage_daemon_command = g_string_new(NULL);
-    QemuStorageDaemonState *qsd;
 
     g_string_append_printf(storage_daemon_command,
                            "exec %s ",
                            vhost_user_blk_bin);
 
+    for (i = 0; i < num_iothreads; i++) {
+        g_string_append_printf(storage_daemon_command,
+                               "--object iothread,id=iothread%d ", i);
+    }
+
     g_string_append_printf(cmd_line,
             " -object memory-backend-memfd,id=mem,size=256M,share=on "
             " -M memory-backend=mem -m 256M ");
 
     for (i = 0; i < vus_instances; i++) {
         int fd;
-        char *sock_path = create_listen_socket(&fd);
+        char *sock_path = qos_vhost_user_create_listen_socket(&fd);
 
         /* create image file */
         img_path = drive_create();
         g_string_append_printf(storage_daemon_command,
             "--blockdev driver=file,node-name=disk%d,filename=%s "
             "--export type=vhost-user-blk,id=disk%d,addr.type=fd,addr.str=%d,"
-            "node-name=disk%i,writable=on,num-queues=%d ",
+            "node-name=disk%i,writable=on,num-queues=%d",
             i, img_path, i, fd, i, num_queues);
+        for (int j = 0; j < num_iothreads; j++) {
+            g_string_append_printf(storage_daemon_command,
+                                   ",queue-iothreads.%d=iothread%d", j, j);
+        }
+        g_string_append_c(storage_daemon_command, ' ');
 
         g_string_append_printf(cmd_line, "-chardev socket,id=char%d,path=%s ",
                                i + 1, sock_path);
     }
 
-    g_test_message("starting vhost-user backend: %s",
-                   storage_daemon_command->str);
-    pid_t pid = fork();
-    if (pid == 0) {
-        /*
-         * Close standard file descriptors so tap-driver.pl pipe detects when
-         * our parent terminates.
-         */
-        close(0);
-        close(1);
-        open("/dev/null", O_RDONLY);
-        open("/dev/null", O_WRONLY);
-
-        execlp("/bin/sh", "sh", "-c", storage_daemon_command->str, NULL);
-        exit(1);
-    }
+    qos_vhost_user_backend_start("qemu-storage-daemon",
+                                 storage_daemon_command->str);
     g_string_free(storage_daemon_command, true);
-
-    qsd = g_new(QemuStorageDaemonState, 1);
-    qsd->pid = pid;
-
-    /* Make sure qemu-storage-daemon is stopped */
-    qtest_add_abrt_handler(quit_storage_daemon, qsd);
-    g_test_queue_destroy(quit_storage_daemon, qsd);
 }
 
 static void *vhost_user_blk_test_setup(GString *cmd_line, void *arg)
 {
-    start_vhost_user_blk(cmd_line, 1, 1);
+    start_vhost_user_blk(cmd_line, 1, 1, 0);
+    return arg;
+}
+
+static void *vhost_user_blk_iothread_test_setup(GString *cmd_line, void *arg)
+{
+    start_vhost_user_blk(cmd_line, 1, 1, 1);
     return arg;
 }
 
@@ -967,13 +872,20 @@ static void *vhost_user_blk_test_setup(GString *cmd_line, void *arg)
 static void *vhost_user_blk_hotplug_test_setup(GString *cmd_line, void *arg)
 {
     /* "-chardev socket,id=char2" is used for pci_hotplug*/
-    start_vhost_user_blk(cmd_line, 2, 1);
+    start_vhost_user_blk(cmd_line, 2, 1, 0);
     return arg;
 }
 
 static void *vhost_user_blk_multiqueue_test_setup(GString *cmd_line, void *arg)
 {
-    start_vhost_user_blk(cmd_line, 2, 8);
+    start_vhost_user_blk(cmd_line, 2, 8, 0);
+    return arg;
+}
+
+static void *vhost_user_blk_multiqueue_iothread_test_setup(GString *cmd_line,
+                                                           void *arg)
+{
+    start_vhost_user_blk(cmd_line, 2, 8, 2);
     return arg;
 }
 
@@ -1003,6 +915,15 @@ static void register_vhost_user_blk_test(void)
 
     opts.before = vhost_user_blk_multiqueue_test_setup;
     qos_add_test("multiqueue", "vhost-user-blk-pci", multiqueue, &opts);
+
+    /* the same tests with the virtqueues processed in IOThreads */
+    opts.before = vhost_user_blk_iothread_test_setup;
+    qos_add_test("basic-iothread", "vhost-user-blk", basic, &opts);
+    qos_add_test("indirect-iothread", "vhost-user-blk", indirect, &opts);
+
+    opts.before = vhost_user_blk_multiqueue_iothread_test_setup;
+    qos_add_test("multiqueue-iothread", "vhost-user-blk-pci", multiqueue,
+                 &opts);
 }
 
 libqos_init(register_vhost_user_blk_test);
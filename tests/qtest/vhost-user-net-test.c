@@ -0,0 +1,300 @@
+/*
+ * QTest testcase and packet rate benchmark for vhost-user-net
+ *
+ * Drives contrib/vhost-user-net in its reflect, sink and generate modes
+ * through a virtio-net device, checks the packets that come back and
+ * reports packets per second and latency percentiles.  Run with "-m perf"
+ * for a longer measurement.  Guest memory is accessed through the qtest
+ * protocol, so the numbers are only meaningful relative to each other.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest-single.h"
+#include "qemu/bswap.h"
+#include "qemu/module.h"
+#include "standard-headers/linux/virtio_net.h"
+#include "libqos/qgraph.h"
+#include "libqos/virtio-net.h"
+#include "libqos/vhost-user-backend.h"
+
+#define VHOST_USER_NET_TIMEOUT_US   (30 * 1000 * 1000)
+#define VNET_HDR_SIZE               sizeof(struct virtio_net_hdr_mrg_rxbuf)
+#define FRAME_SIZE                  64
+#define BUF_SIZE                    2048
+#define BATCH                       32
+#define ETH_P_EXPERIMENTAL          0x88b5
+
+typedef struct {
+    GArray *latency;
+    gint64 start;
+    unsigned int packets;
+} Measurement;
+
+static const uint8_t guest_mac[6] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x56 };
+static const uint8_t peer_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+
+static void *vhost_user_net_test_setup(GString *cmd_line, void *arg)
+{
+    const char *mode = arg;
+    g_autoptr(GString) backend_command = g_string_new(NULL);
+    char *sock_path;
+    int fd;
+
+    sock_path = qos_vhost_user_create_listen_socket(&fd);
+    g_string_printf(backend_command, "exec %s --fd=%d --mode=%s "
+                    "--size=%d --batch=%d",
+                    qos_vhost_user_backend_binary(
+                        "QTEST_VHOST_USER_NET_BINARY"),
+                    fd, mode, FRAME_SIZE, BATCH);
+
+    g_string_append_printf(cmd_line,
+            " -object memory-backend-memfd,id=mem,size=256M,share=on "
+            " -M memory-backend=mem -m 256M "
+            " -chardev socket,id=char1,path=%s "
+            " -netdev vhost-user,id=hs0,chardev=char1,vhostforce=on ",
+            sock_path);
+
+    qos_vhost_user_backend_start("vhost-user-net", backend_command->str);
+    close(fd);
+    return arg;
+}
+
+static unsigned int test_packets(void)
+{
+    return g_test_perf() ? 64 * 1024 : 1024;
+}
+
+/* Every buffer has been used, so descriptors can be taken from the start */
+static void recycle_descs(QVirtQueue *vq)
+{
+    vq->free_head = 0;
+    vq->num_free = vq->size;
+}
+
+static void post_buffers(QVirtioDevice *dev, QVirtQueue *vq, uint64_t addr,
+                         uint32_t len, bool write)
+{
+    uint32_t free_head[BATCH];
+    int i;
+
+    recycle_descs(vq);
+    for (i = 0; i < BATCH; i++) {
+        free_head[i] = qvirtqueue_add(global_qtest, vq, addr + i * BUF_SIZE,
+                                      len, write, false);
+    }
+    qvirtqueue_kick_batch(global_qtest, dev, vq, free_head, BATCH);
+}
+
+/* Poll the used ring, which the back-end fills without going through QEMU */
+static uint32_t wait_used(QVirtQueue *vq, uint32_t *len)
+{
+    gint64 start_time = g_get_monotonic_time();
+    uint32_t idx;
+
+    while (!qvirtqueue_get_buf(global_qtest, vq, &idx, len)) {
+        g_assert(g_get_monotonic_time() - start_time <=
+                 VHOST_USER_NET_TIMEOUT_US);
+    }
+    g_assert_cmpint(idx, <, BATCH);
+    return idx;
+}
+
+static void write_frame(uint64_t addr, uint64_t seq)
+{
+    uint8_t frame[VNET_HDR_SIZE + FRAME_SIZE] = { 0 };
+    uint8_t *eth = frame + VNET_HDR_SIZE;
+
+    memcpy(eth, peer_mac, sizeof(peer_mac));
+    memcpy(eth + 6, guest_mac, sizeof(guest_mac));
+    stw_be_p(eth + 12, ETH_P_EXPERIMENTAL);
+    stq_be_p(eth + 14, seq);
+    memwrite(addr, frame, sizeof(frame));
+}
+
+static uint64_t read_frame(uint64_t addr, uint32_t len,
+                           const uint8_t *dst, const uint8_t *src)
+{
+    uint8_t frame[VNET_HDR_SIZE + FRAME_SIZE];
+    uint8_t *eth = frame + VNET_HDR_SIZE;
+
+    g_assert_cmpint(len, ==, sizeof(frame));
+    memread(addr, frame, sizeof(frame));
+    g_assert_cmpint(lduw_le_p(frame + offsetof(struct virtio_net_hdr_mrg_rxbuf,
+                                               num_buffers)), ==, 1);
+    g_assert(memcmp(eth, dst, 6) == 0);
+    if (src) {
+        g_assert(memcmp(eth + 6, src, 6) == 0);
+    }
+    g_assert_cmpint(lduw_be_p(eth + 12), ==, ETH_P_EXPERIMENTAL);
+    return ldq_be_p(eth + 14);
+}
+
+static void measurement_start(Measurement *m)
+{
+    m->latency = g_array_new(false, false, sizeof(gint64));
+    m->packets = 0;
+    m->start = g_get_monotonic_time();
+}
+
+static void measurement_add(Measurement *m, gint64 kick)
+{
+    gint64 latency = g_get_monotonic_time() - kick;
+
+    g_array_append_val(m->latency, latency);
+}
+
+static gint compare_latency(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static gint64 percentile(GArray *sorted, unsigned int pct)
+{
+    return g_array_index(sorted, gint64, (sorted->len - 1) * pct / 100);
+}
+
+static void measurement_report(Measurement *m, const char *name)
+{
+    double secs = MAX(g_get_monotonic_time() - m->start, 1) /
+                  (double)G_USEC_PER_SEC;
+
+    g_test_message("%s: %u packets in %.3f s, %.0f pps",
+                   name, m->packets, secs, m->packets / secs);
+    if (m->latency->len) {
+        g_array_sort(m->latency, compare_latency);
+        g_test_message("%s: latency p50 %" PRId64 " us, p90 %" PRId64
+                       " us, p99 %" PRId64 " us", name,
+                       percentile(m->latency, 50), percentile(m->latency, 90),
+                       percentile(m->latency, 99));
+    }
+    g_array_free(m->latency, true);
+}
+
+/* Send batches of frames and check that each comes back with swapped MACs */
+static void reflect(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNet *net = obj;
+    QVirtioDevice *dev = net->vdev;
+    QVirtQueue *rx = net->queues[0];
+    QVirtQueue *tx = net->queues[1];
+    uint64_t rx_addr = guest_alloc(t_alloc, BATCH * BUF_SIZE);
+    uint64_t tx_addr = guest_alloc(t_alloc, BATCH * BUF_SIZE);
+    unsigned int count = test_packets();
+    Measurement m;
+    uint64_t seq = 0;
+    gint64 kick;
+    uint32_t idx, len;
+    int i;
+
+    measurement_start(&m);
+    while (m.packets < count) {
+        post_buffers(dev, rx, rx_addr, BUF_SIZE, true);
+        for (i = 0; i < BATCH; i++) {
+            write_frame(tx_addr + i * BUF_SIZE, seq + i);
+        }
+
+        kick = g_get_monotonic_time();
+        post_buffers(dev, tx, tx_addr, VNET_HDR_SIZE + FRAME_SIZE, false);
+
+        for (i = 0; i < BATCH; i++) {
+            idx = wait_used(rx, &len);
+            measurement_add(&m, kick);
+            g_assert_cmpint(read_frame(rx_addr + idx * BUF_SIZE, len,
+                                       guest_mac, peer_mac), ==, seq + idx);
+        }
+        for (i = 0; i < BATCH; i++) {
+            wait_used(tx, NULL);
+        }
+
+        seq += BATCH;
+        m.packets += BATCH;
+    }
+    measurement_report(&m, "reflect");
+
+    guest_free(t_alloc, tx_addr);
+    guest_free(t_alloc, rx_addr);
+}
+
+/* Send batches of frames and wait for the back-end to consume them */
+static void sink(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNet *net = obj;
+    QVirtQueue *tx = net->queues[1];
+    uint64_t tx_addr = guest_alloc(t_alloc, BATCH * BUF_SIZE);
+    unsigned int count = test_packets();
+    Measurement m;
+    gint64 kick;
+    int i;
+
+    for (i = 0; i < BATCH; i++) {
+        write_frame(tx_addr + i * BUF_SIZE, i);
+    }
+
+    measurement_start(&m);
+    while (m.packets < count) {
+        kick = g_get_monotonic_time();
+        post_buffers(net->vdev, tx, tx_addr, VNET_HDR_SIZE + FRAME_SIZE,
+                     false);
+        for (i = 0; i < BATCH; i++) {
+            wait_used(tx, NULL);
+            measurement_add(&m, kick);
+        }
+        m.packets += BATCH;
+    }
+    measurement_report(&m, "sink");
+
+    guest_free(t_alloc, tx_addr);
+}
+
+/* Post receive buffers and check that the generated frames are in order */
+static void generate(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNet *net = obj;
+    QVirtQueue *rx = net->queues[0];
+    uint64_t rx_addr = guest_alloc(t_alloc, BATCH * BUF_SIZE);
+    unsigned int count = test_packets();
+    static const uint8_t broadcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    Measurement m;
+    uint64_t seq = 0;
+    gint64 kick;
+    uint32_t idx, len;
+    int i;
+
+    measurement_start(&m);
+    while (m.packets < count) {
+        kick = g_get_monotonic_time();
+        post_buffers(net->vdev, rx, rx_addr, BUF_SIZE, true);
+        for (i = 0; i < BATCH; i++) {
+            idx = wait_used(rx, &len);
+            measurement_add(&m, kick);
+            g_assert_cmpint(idx, ==, i);
+            g_assert_cmpint(read_frame(rx_addr + idx * BUF_SIZE, len,
+                                       broadcast, NULL), ==, seq++);
+        }
+        m.packets += BATCH;
+    }
+    measurement_report(&m, "generate");
+
+    guest_free(t_alloc, rx_addr);
+}
+
+static void register_vhost_user_net_test(void)
+{
+    QOSGraphTestOptions opts = {
+        .before = vhost_user_net_test_setup,
+    };
+
+    opts.arg = (void *)"reflect";
+    qos_add_test("vhost-user-net/reflect", "virtio-net", reflect, &opts);
+    opts.arg = (void *)"sink";
+    qos_add_test("vhost-user-net/sink", "virtio-net", sink, &opts);
+    opts.arg = (void *)"generate";
+    qos_add_test("vhost-user-net/generate", "virtio-net", generate, &opts);
+}
+
+libqos_init(register_vhost_user_net_test);
@@ -348,6 +348,75 @@ static void basic(void *obj, void *data, QGuestAllocator *t_alloc)
 
 }
 
+/*
+ * Make more requests available at once than the device pops from the
+ * virtqueue in one go, and check that they all complete.  The requests
+ * can complete in any order.
+ */
+#define BATCH_REQS 20
+
+static void batch_rw(QVirtioDevice *dev, QVirtQueue *vq,
+                     QGuestAllocator *alloc, bool read)
+{
+    QTestState *qts = global_qtest;
+    uint64_t req_addr[BATCH_REQS];
+    uint32_t free_head[BATCH_REQS];
+    QVirtioBlkReq req;
+    char data[512], expected[512];
+    int i;
+
+    for (i = 0; i < BATCH_REQS; i++) {
+        req.type = read ? VIRTIO_BLK_T_IN : VIRTIO_BLK_T_OUT;
+        req.ioprio = 1;
+        req.sector = 2 + i;
+        req.data = g_malloc0(512);
+        if (!read) {
+            snprintf(req.data, 512, "TEST%d", i);
+        }
+
+        req_addr[i] = virtio_blk_request(alloc, dev, &req, 512);
+
+        g_free(req.data);
+
+        free_head[i] = qvirtqueue_add(qts, vq, req_addr[i], 16, false, true);
+        qvirtqueue_add(qts, vq, req_addr[i] + 16, 512, read, true);
+        qvirtqueue_add(qts, vq, req_addr[i] + 528, 1, true, false);
+    }
+
+    qvirtqueue_kick_batch(qts, dev, vq, free_head, BATCH_REQS);
+
+    for (i = 0; i < BATCH_REQS; i++) {
+        gint64 start_time = g_get_monotonic_time();
+        uint8_t status;
+
+        while ((status = readb(req_addr[i] + 528)) == 0xff) {
+            qtest_clock_step(qts, 100);
+            g_assert(g_get_monotonic_time() - start_time <=
+                     QVIRTIO_BLK_TIMEOUT_US);
+        }
+        g_assert_cmpint(status, ==, 0);
+
+        if (read) {
+            memread(req_addr[i] + 16, data, 512);
+            snprintf(expected, sizeof(expected), "TEST%d", i);
+            g_assert_cmpstr(data, ==, expected);
+        }
+
+        guest_free(alloc, req_addr[i]);
+    }
+}
+
+static void batch(void *obj, void *u_data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlk *blk_if = obj;
+    QVirtQueue *vq;
+
+    vq = test_basic(blk_if->vdev, t_alloc);
+    batch_rw(blk_if->vdev, vq, t_alloc, false);
+    batch_rw(blk_if->vdev, vq, t_alloc, true);
+    qvirtqueue_cleanup(blk_if->vdev->bus, vq, t_alloc);
+}
+
 static void indirect(void *obj, void *u_data, QGuestAllocator *t_alloc)
 {
     QVirtQueue *vq;
@@ -794,6 +863,7 @@ static void register_virtio_blk_test(void)
     qos_add_test("indirect", "virtio-blk", indirect, &opts);
     qos_add_test("config", "virtio-blk", config, &opts);
     qos_add_test("basic", "virtio-blk", basic, &opts);
+    qos_add_test("batch", "virtio-blk", batch, &opts);
     qos_add_test("resize", "virtio-blk", resize, &opts);
 
     /* tests just for virtio-blk-pci */
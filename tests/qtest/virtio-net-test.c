@@ -16,6 +16,13 @@
 #include "libqos/qgraph.h"
 #include "libqos/virtio-net.h"
 
+#ifdef CONFIG_LINUX
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_tun.h>
+#endif
+
 #ifndef ETH_P_RARP
 #define ETH_P_RARP 0x8035
 #endif
@@ -65,6 +72,59 @@ static void rx_test(QVirtioDevice *dev,
     guest_free(alloc, req_addr);
 }
 
+#define RX_BURST 4
+
+/* Several packets in one read from the backend, received as a burst */
+static void rx_burst_test(QVirtioDevice *dev,
+                          QGuestAllocator *alloc, QVirtQueue *vq,
+                          int socket)
+{
+    QTestState *qts = global_qtest;
+    uint64_t req_addr[RX_BURST];
+    uint32_t free_head[RX_BURST];
+    char test[RX_BURST][5];
+    char buffer[64];
+    int len = htonl(sizeof(test[0]));
+    struct iovec iov[RX_BURST * 2];
+    int i, ret;
+
+    for (i = 0; i < RX_BURST; i++) {
+        req_addr[i] = guest_alloc(alloc, 64);
+        free_head[i] = qvirtqueue_add(qts, vq, req_addr[i], 64, true, false);
+
+        snprintf(test[i], sizeof(test[i]), "PKT%d", i);
+        iov[i * 2].iov_base = &len;
+        iov[i * 2].iov_len = sizeof(len);
+        iov[i * 2 + 1].iov_base = test[i];
+        iov[i * 2 + 1].iov_len = sizeof(test[i]);
+    }
+    qvirtqueue_kick_batch(qts, dev, vq, free_head, RX_BURST);
+
+    ret = iov_send(socket, iov, RX_BURST * 2, 0,
+                   RX_BURST * (sizeof(len) + sizeof(test[0])));
+    g_assert_cmpint(ret, ==, RX_BURST * (sizeof(len) + sizeof(test[0])));
+
+    qvirtio_wait_used_elem(qts, dev, vq, free_head[0], NULL,
+                           QVIRTIO_NET_TIMEOUT_US);
+    for (i = 0; i < RX_BURST; i++) {
+        gint64 start_time = g_get_monotonic_time();
+        uint32_t desc_idx;
+
+        /* The guest is notified once for the whole burst */
+        if (i) {
+            while (!qvirtqueue_get_buf(qts, vq, &desc_idx, NULL)) {
+                qtest_clock_step(qts, 100);
+                g_assert(g_get_monotonic_time() - start_time <=
+                         QVIRTIO_NET_TIMEOUT_US);
+            }
+            g_assert_cmpint(desc_idx, ==, free_head[i]);
+        }
+        memread(req_addr[i] + VNET_HDR_SIZE, buffer, sizeof(test[i]));
+        g_assert_cmpstr(buffer, ==, test[i]);
+        guest_free(alloc, req_addr[i]);
+    }
+}
+
 static void tx_test(QVirtioDevice *dev,
                     QGuestAllocator *alloc, QVirtQueue *vq,
                     int socket)
@@ -155,6 +215,302 @@ static void send_recv_test(void *obj, void *data, QGuestAllocator *t_alloc)
     tx_test(dev, t_alloc, tx, sv[0]);
 }
 
+static void burst_test(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNet *net_if = obj;
+    int *sv = data;
+
+    rx_burst_test(net_if->vdev, t_alloc, net_if->queues[0], sv[0]);
+}
+
+static void iothread_test(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNetPCI *net_pci = obj;
+
+    send_recv_test(&net_pci->net, data, t_alloc);
+}
+
+static void iothreads_test(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNetPCI *net_pci = obj;
+    QVirtioNet *net_if = &net_pci->net;
+    QTestState *qts = net_pci->pci_vdev.pdev->bus->qts;
+    int *sv = data;
+    QDict *rsp;
+
+    send_recv_test(net_if, data, t_alloc);
+    rx_burst_test(net_if->vdev, t_alloc, net_if->queues[0], sv[0]);
+
+    /* Software RSS could steer packets to a queue of another IOThread */
+    rsp = qtest_qmp(qts, "{'execute': 'device_add', 'arguments': {"
+                    " 'driver': 'virtio-net-pci', 'id': 'net1',"
+                    " 'netdev': 'hs1', 'rss': true, 'len-iothreads': 2,"
+                    " 'iothreads[0]': 'iot0', 'iothreads[1]': 'iot1' } }");
+    g_assert(strstr(qdict_get_str(qdict_get_qdict(rsp, "error"), "desc"),
+                    "rss=on with iothreads"));
+    qobject_unref(rsp);
+
+    /* Net filters would touch the queues from the main loop */
+    rsp = qtest_qmp(qts, "{'execute': 'object-add', 'arguments': {"
+                    " 'qom-type': 'filter-buffer', 'id': 'fb0',"
+                    " 'netdev': 'hs0', 'interval': 1000 } }");
+    g_assert(strstr(qdict_get_str(qdict_get_qdict(rsp, "error"), "desc"),
+                    "is used by a NIC with iothreads"));
+    qobject_unref(rsp);
+
+    rsp = qtest_qmp(qts, "{'execute': 'object-add', 'arguments': {"
+                    " 'qom-type': 'filter-buffer', 'id': 'fb1',"
+                    " 'netdev': 'hs1', 'interval': 1000 } }");
+    g_assert(qdict_haskey(rsp, "return"));
+    qobject_unref(rsp);
+
+    rsp = qtest_qmp(qts, "{'execute': 'device_add', 'arguments': {"
+                    " 'driver': 'virtio-net-pci', 'id': 'net1',"
+                    " 'netdev': 'hs1', 'len-iothreads': 1,"
+                    " 'iothreads[0]': 'iot0' } }");
+    g_assert(strstr(qdict_get_str(qdict_get_qdict(rsp, "error"), "desc"),
+                    "not compatible with the net filters"));
+    qobject_unref(rsp);
+}
+
+#ifdef CONFIG_LINUX
+/*
+ * Receiving straight from a tap device into the guest's buffers.  The
+ * test creates the tap device, passes it to QEMU with rx-direct=on and
+ * sends packets out of it with a packet socket, which also lets it set
+ * the vnet header.
+ */
+
+#define RX_DIRECT_MTU 16000
+#define RX_DIRECT_BUFS 32
+#define RX_DIRECT_BUF_SIZE 4096
+
+typedef struct TapTest {
+    int tap_fd;             /* -1 if no tap device could be created */
+    int pkt_fd;
+} TapTest;
+
+typedef struct RxDirect {
+    QTestState *qts;
+    QVirtioDevice *dev;
+    QVirtQueue *vq;
+    uint8_t mac[ETH_ALEN];
+    uint64_t addr[RX_DIRECT_BUFS];
+    uint32_t head[RX_DIRECT_BUFS];
+    unsigned next;          /* first buffer of the next packet */
+} RxDirect;
+
+static uint32_t rx_direct_csum_add(uint32_t sum, const uint8_t *buf,
+                                   size_t len)
+{
+    size_t i;
+
+    for (i = 0; i + 1 < len; i += 2) {
+        sum += lduw_be_p(buf + i);
+    }
+    if (len & 1) {
+        sum += buf[len - 1] << 8;
+    }
+    return sum;
+}
+
+static uint16_t rx_direct_csum_fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return sum;
+}
+
+/* An IPv4 UDP packet whose payload is @len bytes of @fill */
+static size_t rx_direct_build(uint8_t *buf, const uint8_t *dst_mac,
+                              uint16_t src_port, uint8_t fill, size_t len)
+{
+    uint8_t *ip = buf + ETH_HLEN;
+    uint8_t *udp = ip + 20;
+
+    memcpy(buf, dst_mac, ETH_ALEN);
+    memcpy(buf + ETH_ALEN, "\x52\x54\x00\x12\x34\x99", ETH_ALEN);
+    stw_be_p(buf + 12, ETH_P_IP);
+
+    memset(ip, 0, 20);
+    ip[0] = 0x45;
+    stw_be_p(ip + 2, 20 + 8 + len);
+    ip[8] = 64;
+    ip[9] = IPPROTO_UDP;
+    stl_be_p(ip + 12, 0x0a000001);
+    stl_be_p(ip + 16, 0x0a000002);
+    stw_be_p(ip + 10, ~rx_direct_csum_fold(rx_direct_csum_add(0, ip, 20)));
+
+    stw_be_p(udp, src_port);
+    stw_be_p(udp + 2, 68);
+    stw_be_p(udp + 4, 8 + len);
+    stw_be_p(udp + 6, 0);
+    memset(udp + 8, fill, len);
+
+    return ETH_HLEN + 20 + 8 + len;
+}
+
+static void rx_direct_send(TapTest *tt, const uint8_t *frame, size_t len,
+                           bool needs_csum)
+{
+    g_autofree uint8_t *buf = g_malloc(sizeof(struct virtio_net_hdr) + len);
+    struct virtio_net_hdr hdr = { };
+    ssize_t ret;
+
+    if (needs_csum) {
+        hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr.csum_start = ETH_HLEN + 20;
+        hdr.csum_offset = 6;
+    }
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), frame, len);
+
+    ret = send(tt->pkt_fd, buf, sizeof(hdr) + len, 0);
+    g_assert_cmpint(ret, ==, sizeof(hdr) + len);
+}
+
+/*
+ * Wait for the next packet and gather it from as many buffers as its
+ * header says.  Returns the length of the frame.
+ */
+static size_t rx_direct_recv(RxDirect *rx, struct virtio_net_hdr_mrg_rxbuf *hdr,
+                             uint8_t *frame, size_t size)
+{
+    uint32_t len, id;
+    size_t total;
+    unsigned i, n;
+
+    qvirtio_wait_used_elem(rx->qts, rx->dev, rx->vq, rx->head[rx->next],
+                           &len, QVIRTIO_NET_TIMEOUT_US);
+    g_assert_cmpint(len, >=, VNET_HDR_SIZE);
+    qtest_memread(rx->qts, rx->addr[rx->next], hdr, VNET_HDR_SIZE);
+    total = len - VNET_HDR_SIZE;
+    g_assert_cmpint(total, <=, size);
+    qtest_memread(rx->qts, rx->addr[rx->next] + VNET_HDR_SIZE, frame, total);
+
+    /* The device fills the used ring for all buffers before notifying */
+    n = le16_to_cpu(hdr->num_buffers);
+    g_assert_cmpint(n, >=, 1);
+    for (i = 1; i < n; i++) {
+        g_assert_true(qvirtqueue_get_buf(rx->qts, rx->vq, &id, &len));
+        g_assert_cmpint(id, ==, rx->head[rx->next + i]);
+        g_assert_cmpint(total + len, <=, size);
+        qtest_memread(rx->qts, rx->addr[rx->next + i], frame + total, len);
+        total += len;
+    }
+
+    rx->next += n;
+    return total;
+}
+
+static void rx_direct_ctrl_promisc(RxDirect *rx, QGuestAllocator *alloc,
+                                   QVirtQueue *vq, bool on)
+{
+    uint8_t cmd[] = { VIRTIO_NET_CTRL_RX, VIRTIO_NET_CTRL_RX_PROMISC, on };
+    uint64_t addr = guest_alloc(alloc, sizeof(cmd) + 1);
+    uint32_t head;
+
+    qtest_memwrite(rx->qts, addr, cmd, sizeof(cmd));
+    qtest_writeb(rx->qts, addr + sizeof(cmd), VIRTIO_NET_ERR);
+    head = qvirtqueue_add(rx->qts, vq, addr, 2, false, true);
+    qvirtqueue_add(rx->qts, vq, addr + 2, 1, false, true);
+    qvirtqueue_add(rx->qts, vq, addr + 3, 1, true, false);
+    qvirtqueue_kick(rx->qts, rx->dev, vq, head);
+    qvirtio_wait_used_elem(rx->qts, rx->dev, vq, head, NULL,
+                           QVIRTIO_NET_TIMEOUT_US);
+    g_assert_cmpint(qtest_readb(rx->qts, addr + sizeof(cmd)), ==,
+                    VIRTIO_NET_OK);
+    guest_free(alloc, addr);
+}
+
+static void rx_direct_test(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNet *net_if = obj;
+    TapTest *tt = data;
+    RxDirect rx = {
+        .qts = global_qtest,
+        .dev = net_if->vdev,
+        .vq = net_if->queues[0],
+    };
+    static const uint8_t other_mac[ETH_ALEN] = {
+        0x52, 0x54, 0x00, 0x12, 0x34, 0x57
+    };
+    g_autofree uint8_t *frame = g_malloc(RX_DIRECT_MTU);
+    g_autofree uint8_t *got = g_malloc(RX_DIRECT_MTU);
+    struct virtio_net_hdr_mrg_rxbuf hdr;
+    uint8_t *udp;
+    size_t len;
+    uint32_t sum;
+    int i;
+
+    if (tt->tap_fd < 0) {
+        g_test_skip("cannot create a tap device");
+        return;
+    }
+
+    for (i = 0; i < ETH_ALEN; i++) {
+        rx.mac[i] = qvirtio_config_readb(rx.dev, i);
+    }
+
+    /* Enough buffers for the largest packet, several times over */
+    for (i = 0; i < RX_DIRECT_BUFS; i++) {
+        rx.addr[i] = guest_alloc(t_alloc, RX_DIRECT_BUF_SIZE);
+        rx.head[i] = qvirtqueue_add(rx.qts, rx.vq, rx.addr[i],
+                                    RX_DIRECT_BUF_SIZE, true, false);
+    }
+    qvirtqueue_kick_batch(rx.qts, rx.dev, rx.vq, rx.head, RX_DIRECT_BUFS);
+
+    /* A packet spread over three mergeable buffers */
+    len = rx_direct_build(frame, rx.mac, 1234, 0xaa, 10000);
+    rx_direct_send(tt, frame, len, false);
+    g_assert_cmpint(rx_direct_recv(&rx, &hdr, got, RX_DIRECT_MTU), ==, len);
+    g_assert_cmpint(le16_to_cpu(hdr.num_buffers), ==, 3);
+    g_assert_cmpint(hdr.hdr.flags, ==, 0);
+    g_assert(!memcmp(got, frame, len));
+
+    /* The buffers left unused were given back, in order */
+    len = rx_direct_build(frame, rx.mac, 1234, 0xbb, 64);
+    rx_direct_send(tt, frame, len, false);
+    g_assert_cmpint(rx_direct_recv(&rx, &hdr, got, RX_DIRECT_MTU), ==, len);
+    g_assert_cmpint(le16_to_cpu(hdr.num_buffers), ==, 1);
+    g_assert(!memcmp(got, frame, len));
+
+    /* A partial checksum is passed on to the guest... */
+    len = rx_direct_build(frame, rx.mac, 1234, 0xcc, 100);
+    rx_direct_send(tt, frame, len, true);
+    g_assert_cmpint(rx_direct_recv(&rx, &hdr, got, RX_DIRECT_MTU), ==, len);
+    g_assert_cmpint(hdr.hdr.flags, ==, VIRTIO_NET_HDR_F_NEEDS_CSUM);
+
+    /* ...except for DHCP replies, which old dhclient versions drop */
+    len = rx_direct_build(frame, rx.mac, 67, 0xdd, 300);
+    rx_direct_send(tt, frame, len, true);
+    g_assert_cmpint(rx_direct_recv(&rx, &hdr, got, RX_DIRECT_MTU), ==, len);
+    g_assert_cmpint(hdr.hdr.flags, ==, 0);
+    udp = got + ETH_HLEN + 20;
+    g_assert_cmpint(lduw_be_p(udp + 6), !=, 0);
+    sum = rx_direct_csum_add(0, got + ETH_HLEN + 12, 8);
+    sum += IPPROTO_UDP + lduw_be_p(udp + 4);
+    sum = rx_direct_csum_add(sum, udp, lduw_be_p(udp + 4));
+    g_assert_cmphex(rx_direct_csum_fold(sum), ==, 0xffff);
+    g_assert(!memcmp(udp + 8, frame + ETH_HLEN + 28, 300));
+
+    /* Without promiscuous mode, the packet for another MAC is dropped */
+    rx_direct_ctrl_promisc(&rx, t_alloc, net_if->queues[net_if->n_queues - 1],
+                           false);
+    len = rx_direct_build(frame, other_mac, 1234, 0xee, 100);
+    rx_direct_send(tt, frame, len, false);
+    len = rx_direct_build(frame, rx.mac, 1234, 0xff, 100);
+    rx_direct_send(tt, frame, len, false);
+    g_assert_cmpint(rx_direct_recv(&rx, &hdr, got, RX_DIRECT_MTU), ==, len);
+    g_assert(!memcmp(got, frame, len));
+
+    for (i = 0; i < RX_DIRECT_BUFS; i++) {
+        guest_free(t_alloc, rx.addr[i]);
+    }
+}
+#endif /* CONFIG_LINUX */
+
 static void stop_cont_test(void *obj, void *data, QGuestAllocator *t_alloc)
 {
     QVirtioNet *net_if = obj;
@@ -284,6 +640,124 @@ static void *virtio_net_test_setup(GString *cmd_line, void *arg)
     return sv;
 }
 
+static void *virtio_net_test_setup_iothread(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line, " -object iothread,id=iot0 ");
+    return virtio_net_test_setup(cmd_line, arg);
+}
+
+static void *virtio_net_test_setup_iothreads(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line, " -object iothread,id=iot0 "
+                    "-object iothread,id=iot1 "
+                    "-netdev socket,id=hs1,udp=127.0.0.1:9,"
+                    "localaddr=127.0.0.1:0 ");
+    return virtio_net_test_setup(cmd_line, arg);
+}
+
+#ifdef CONFIG_LINUX
+static void virtio_net_test_cleanup_tap(void *opaque)
+{
+    TapTest *tt = opaque;
+
+    qos_invalidate_command_line();
+    if (tt->tap_fd >= 0) {
+        close(tt->pkt_fd);
+        close(tt->tap_fd);
+    }
+    g_free(tt);
+}
+
+/*
+ * Bring up a tap device with a large MTU and a packet socket to send on
+ * it.  The host must not send packets of its own to the guest, so IPv6
+ * is disabled on the device before it goes up.
+ */
+static bool virtio_net_test_open_tap(TapTest *tt)
+{
+    struct ifreq ifr = { .ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR };
+    struct sockaddr_ll sll = { .sll_family = AF_PACKET };
+    g_autofree char *path = NULL;
+    int one = 1;
+    int fd, ret;
+
+    tt->tap_fd = open("/dev/net/tun", O_RDWR);
+    if (tt->tap_fd < 0) {
+        return false;
+    }
+    g_strlcpy(ifr.ifr_name, "qtest%d", IFNAMSIZ);
+    if (ioctl(tt->tap_fd, TUNSETIFF, &ifr) < 0) {
+        goto fail_tap;
+    }
+
+    path = g_strdup_printf("/proc/sys/net/ipv6/conf/%s/disable_ipv6",
+                           ifr.ifr_name);
+    fd = open(path, O_WRONLY);
+    if (fd >= 0) {
+        ret = write(fd, "1", 1);
+        close(fd);
+        if (ret != 1) {
+            goto fail_tap;
+        }
+    }
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        goto fail_tap;
+    }
+    ifr.ifr_mtu = RX_DIRECT_MTU;
+    ret = ioctl(fd, SIOCSIFMTU, &ifr);
+    if (!ret) {
+        ret = ioctl(fd, SIOCGIFFLAGS, &ifr);
+    }
+    if (!ret) {
+        ifr.ifr_flags |= IFF_UP;
+        ret = ioctl(fd, SIOCSIFFLAGS, &ifr);
+    }
+    if (!ret) {
+        ret = ioctl(fd, SIOCGIFINDEX, &ifr);
+    }
+    close(fd);
+    if (ret < 0) {
+        goto fail_tap;
+    }
+
+    tt->pkt_fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (tt->pkt_fd < 0) {
+        goto fail_tap;
+    }
+    sll.sll_ifindex = ifr.ifr_ifindex;
+    if (bind(tt->pkt_fd, (struct sockaddr *)&sll, sizeof(sll)) < 0 ||
+        setsockopt(tt->pkt_fd, SOL_PACKET, PACKET_VNET_HDR,
+                   &one, sizeof(one)) < 0) {
+        close(tt->pkt_fd);
+        goto fail_tap;
+    }
+    return true;
+
+fail_tap:
+    close(tt->tap_fd);
+    tt->tap_fd = -1;
+    return false;
+}
+
+static void *virtio_net_test_setup_tap(GString *cmd_line, void *arg)
+{
+    TapTest *tt = g_new0(TapTest, 1);
+
+    /* Creating the tap device needs CAP_NET_ADMIN; the test is skipped */
+    if (virtio_net_test_open_tap(tt)) {
+        g_string_append_printf(cmd_line, " -netdev tap,fd=%d,id=hs0,"
+                               "rx-direct=on ", tt->tap_fd);
+    } else {
+        g_string_append(cmd_line, " -netdev hubport,hubid=0,id=hs0 ");
+    }
+
+    g_test_queue_destroy(virtio_net_test_cleanup_tap, tt);
+    return tt;
+}
+#endif /* CONFIG_LINUX */
+
 #endif /* _WIN32 */
 
 static void large_tx(void *obj, void *data, QGuestAllocator *t_alloc)
@@ -327,6 +801,26 @@ static void register_virtio_net_test(void)
     qos_add_test("basic", "virtio-net", send_recv_test, &opts);
     qos_add_test("rx_stop_cont", "virtio-net", stop_cont_test, &opts);
     qos_add_test("announce-self", "virtio-net", announce_self, &opts);
+    qos_add_test("rx_burst", "virtio-net", burst_test, &opts);
+
+    opts.before = virtio_net_test_setup_iothread;
+    opts.edge = (QOSGraphEdgeOptions) {
+        .extra_device_opts = "len-iothreads=1,iothreads[0]=iot0",
+    };
+    qos_add_test("iothread", "virtio-net-pci", iothread_test, &opts);
+
+    opts.before = virtio_net_test_setup_iothreads;
+    opts.edge = (QOSGraphEdgeOptions) {
+        .extra_device_opts = "len-iothreads=2,iothreads[0]=iot0,"
+                             "iothreads[1]=iot1",
+    };
+    qos_add_test("iothreads", "virtio-net-pci", iothreads_test, &opts);
+    opts.edge = (QOSGraphEdgeOptions) { };
+
+#ifdef CONFIG_LINUX
+    opts.before = virtio_net_test_setup_tap;
+    qos_add_test("rx_direct", "virtio-net", rx_direct_test, &opts);
+#endif
 #endif
 
     /* These tests do not need a loopback backend.  */
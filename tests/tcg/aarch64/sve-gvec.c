@@ -0,0 +1,176 @@
+/*
+ * SVE unpredicated vector operations at every vector length
+ *
+ * Unpredicated SVE operations are expanded by the generic vector code,
+ * so with vectors of 64 bytes and more they use the widest vector type
+ * of the host, e.g. 512-bit AVX-512 instructions on x86, and lengths
+ * that are not a power of two leave tails for the narrower types.
+ * Compare the results with the scalar computation and check that
+ * nothing is written past the vector.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <sys/prctl.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_VL 256
+#define GUARD 16
+#define GUARD_BYTE 0x5a
+
+static uint8_t a[MAX_VL], b[MAX_VL];
+static uint8_t res[MAX_VL + GUARD], ref[MAX_VL];
+
+/* Run @insn on z0 and z1 loaded from @a and @b, and store z2 to @res */
+#define SVE_OP(insn)                                                    \
+    asm volatile("ptrue p0.b\n\t"                                       \
+                 "ld1b {z0.b}, p0/z, [%1]\n\t"                          \
+                 "ld1b {z1.b}, p0/z, [%2]\n\t"                          \
+                 insn "\n\t"                                            \
+                 "st1b {z2.b}, p0, [%0]"                                \
+                 : : "r"(res), "r"(a), "r"(b)                           \
+                 : "memory", "p0", "z0", "z1", "z2")
+
+/* Compute @expr of the elements x[i] and y[i] of @a and @b into @ref */
+#define REF_OP(T, expr)                                                 \
+    do {                                                                \
+        const T *x = (const T *)a, *y = (const T *)b;                   \
+        T *r = (T *)ref;                                                \
+        int i, n = vl / (int)sizeof(T);                                 \
+        (void)x;                                                        \
+        (void)y;                                                        \
+        for (i = 0; i < n; i++) {                                       \
+            r[i] = (expr);                                              \
+        }                                                               \
+    } while (0)
+
+static int8_t sat8(int v)
+{
+    return v > INT8_MAX ? INT8_MAX : v < INT8_MIN ? INT8_MIN : v;
+}
+
+static bool check(const char *name, int vl)
+{
+    bool ok = true;
+    int i;
+
+    for (i = 0; i < vl; i++) {
+        if (res[i] != ref[i]) {
+            printf("FAIL: %s vl=%d byte %d: got 0x%02x, expected 0x%02x\n",
+                   name, vl, i, res[i], ref[i]);
+            ok = false;
+            break;
+        }
+    }
+    for (i = vl; i < vl + GUARD; i++) {
+        if (res[i] != GUARD_BYTE) {
+            printf("FAIL: %s vl=%d wrote byte %d past the vector\n",
+                   name, vl, i);
+            ok = false;
+            break;
+        }
+    }
+    memset(res, GUARD_BYTE, sizeof(res));
+    return ok;
+}
+
+static bool test_vl(int vl)
+{
+    bool ok = true;
+
+    SVE_OP("add z2.b, z0.b, z1.b");
+    REF_OP(uint8_t, x[i] + y[i]);
+    ok &= check("add.b", vl);
+
+    SVE_OP("sub z2.h, z0.h, z1.h");
+    REF_OP(uint16_t, x[i] - y[i]);
+    ok &= check("sub.h", vl);
+
+    SVE_OP("add z2.d, z0.d, z1.d");
+    REF_OP(uint64_t, x[i] + y[i]);
+    ok &= check("add.d", vl);
+
+    SVE_OP("sqadd z2.b, z0.b, z1.b");
+    REF_OP(int8_t, sat8(x[i] + y[i]));
+    ok &= check("sqadd.b", vl);
+
+    SVE_OP("uqsub z2.h, z0.h, z1.h");
+    REF_OP(uint16_t, x[i] > y[i] ? x[i] - y[i] : 0);
+    ok &= check("uqsub.h", vl);
+
+    SVE_OP("and z2.d, z0.d, z1.d");
+    REF_OP(uint64_t, x[i] & y[i]);
+    ok &= check("and", vl);
+
+    SVE_OP("orr z2.d, z0.d, z1.d");
+    REF_OP(uint64_t, x[i] | y[i]);
+    ok &= check("orr", vl);
+
+    SVE_OP("eor z2.d, z0.d, z1.d");
+    REF_OP(uint64_t, x[i] ^ y[i]);
+    ok &= check("eor", vl);
+
+    SVE_OP("bic z2.d, z0.d, z1.d");
+    REF_OP(uint64_t, x[i] & ~y[i]);
+    ok &= check("bic", vl);
+
+    SVE_OP("mov z2.d, z1.d");
+    REF_OP(uint64_t, y[i]);
+    ok &= check("mov", vl);
+
+    SVE_OP("lsl z2.s, z0.s, #7");
+    REF_OP(uint32_t, x[i] << 7);
+    ok &= check("lsl.s", vl);
+
+    SVE_OP("lsr z2.s, z0.s, #9");
+    REF_OP(uint32_t, x[i] >> 9);
+    ok &= check("lsr.s", vl);
+
+    SVE_OP("asr z2.h, z1.h, #3");
+    REF_OP(int16_t, y[i] >> 3);
+    ok &= check("asr.h", vl);
+
+    SVE_OP("mov z2.d, #-2");
+    REF_OP(int64_t, -2);
+    ok &= check("dup.d", vl);
+
+    return ok;
+}
+
+int main(void)
+{
+    bool ok = true;
+    int i, vl;
+
+    if (!(getauxval(AT_HWCAP) & HWCAP_SVE)) {
+        printf("SKIP: no HWCAP_SVE on this system\n");
+        return 0;
+    }
+
+    for (i = 0; i < MAX_VL; i++) {
+        a[i] = i * 37 + 11;
+        b[i] = 255 - i * 13;
+    }
+    memset(res, GUARD_BYTE, sizeof(res));
+
+    /* 48 and 96 bytes do not fill a power of two */
+    for (vl = 16; vl <= MAX_VL; vl += 16) {
+        int ret = prctl(PR_SVE_SET_VL, vl, 0, 0, 0, 0);
+
+        if (ret < 0) {
+            printf("FAIL: PR_SVE_SET_VL %d\n", vl);
+            return 1;
+        }
+        if ((ret & PR_SVE_VL_LEN_MASK) != vl) {
+            continue;
+        }
+        ok &= test_vl(vl);
+    }
+
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
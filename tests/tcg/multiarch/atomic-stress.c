@@ -0,0 +1,250 @@
+/*
+ * Atomic operation stress test
+ *
+ * Several threads hammer the same location with fetch-add,
+ * compare-and-swap and exchange, and we check that no update was lost
+ * and that every thread saw a consistent old value. Each operation is
+ * run at every access size, and on x86, which allows it, also on
+ * unaligned and page crossing locations that TCG has to handle out of
+ * line.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define NR_THREADS 4
+
+#if defined(__i386__) || defined(__x86_64__)
+#define CHECK_UNALIGNED 1
+#else
+#define CHECK_UNALIGNED 0
+#endif
+
+typedef enum {
+    OP_FETCH_ADD,
+    OP_CMPXCHG,
+    OP_XCHG,
+} AtomicOp;
+
+static const char *op_names[] = {
+    [OP_FETCH_ADD] = "fetch-add",
+    [OP_CMPXCHG] = "cmpxchg",
+    [OP_XCHG] = "xchg",
+};
+
+typedef struct {
+    AtomicOp op;
+    int size;
+    void *ptr;
+    unsigned iters;
+    unsigned index;
+    uint64_t sum;           /* of the old values returned */
+} ThreadArg;
+
+static pthread_barrier_t barrier;
+static int errors;
+
+/*
+ * Each thread adds one @iters times, so that the old values it sees are
+ * distinct from those seen by all other threads; for exchange, thread
+ * @index stores the values index * iters + 1 .. (index + 1) * iters.
+ */
+#define GEN_THREAD_FN(T)                                                \
+static void thread_##T(ThreadArg *arg)                                  \
+{                                                                       \
+    T *p = arg->ptr;                                                    \
+    T old;                                                              \
+    unsigned i;                                                         \
+                                                                        \
+    for (i = 0; i < arg->iters; i++) {                                  \
+        switch (arg->op) {                                              \
+        case OP_FETCH_ADD:                                              \
+            old = __atomic_fetch_add(p, 1, __ATOMIC_SEQ_CST);           \
+            break;                                                      \
+        case OP_CMPXCHG:                                                \
+            old = __atomic_load_n(p, __ATOMIC_RELAXED);                 \
+            while (!__atomic_compare_exchange_n(p, &old, (T)(old + 1),  \
+                                                false, __ATOMIC_SEQ_CST,\
+                                                __ATOMIC_SEQ_CST)) {    \
+                /* old has been updated */                              \
+            }                                                           \
+            break;                                                      \
+        case OP_XCHG:                                                   \
+            old = __atomic_exchange_n(p, (T)(arg->index * arg->iters    \
+                                             + i + 1),                  \
+                                      __ATOMIC_SEQ_CST);                \
+            break;                                                      \
+        default:                                                        \
+            abort();                                                    \
+        }                                                               \
+        arg->sum += old;                                                \
+    }                                                                   \
+}
+
+GEN_THREAD_FN(uint8_t)
+GEN_THREAD_FN(uint16_t)
+GEN_THREAD_FN(uint32_t)
+#if __SIZEOF_POINTER__ >= 8
+GEN_THREAD_FN(uint64_t)
+#endif
+
+static void *thread_fn(void *varg)
+{
+    ThreadArg *arg = varg;
+
+    pthread_barrier_wait(&barrier);
+
+    switch (arg->size) {
+    case 1:
+        thread_uint8_t(arg);
+        break;
+    case 2:
+        thread_uint16_t(arg);
+        break;
+    case 4:
+        thread_uint32_t(arg);
+        break;
+#if __SIZEOF_POINTER__ >= 8
+    case 8:
+        thread_uint64_t(arg);
+        break;
+#endif
+    default:
+        abort();
+    }
+    return NULL;
+}
+
+static uint64_t load(const void *ptr, int size)
+{
+    uint8_t b;
+    uint16_t w;
+    uint32_t l;
+    uint64_t q;
+
+    switch (size) {
+    case 1:
+        memcpy(&b, ptr, 1);
+        return b;
+    case 2:
+        memcpy(&w, ptr, 2);
+        return w;
+    case 4:
+        memcpy(&l, ptr, 4);
+        return l;
+    default:
+        memcpy(&q, ptr, 8);
+        return q;
+    }
+}
+
+static uint64_t zext(uint64_t val, int size)
+{
+    return size == 8 ? val : val & ((1ull << (size * 8)) - 1);
+}
+
+static void run_test(AtomicOp op, int size, void *ptr, const char *where,
+                     unsigned iters)
+{
+    pthread_t threads[NR_THREADS];
+    ThreadArg args[NR_THREADS];
+    uint64_t seen = 0, expected = 0, final;
+    unsigned total = NR_THREADS * iters;
+    unsigned i;
+
+    memset(ptr, 0, size);
+    pthread_barrier_init(&barrier, NULL, NR_THREADS);
+
+    for (i = 0; i < NR_THREADS; i++) {
+        args[i] = (ThreadArg) {
+            .op = op,
+            .size = size,
+            .ptr = ptr,
+            .iters = iters,
+            .index = i,
+        };
+        pthread_create(&threads[i], NULL, thread_fn, &args[i]);
+    }
+    for (i = 0; i < NR_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        seen += args[i].sum;
+    }
+    pthread_barrier_destroy(&barrier);
+
+    final = load(ptr, size);
+    if (op == OP_XCHG) {
+        /* Every value stored was returned once, except the last one */
+        for (i = 1; i <= total; i++) {
+            expected += zext(i, size);
+        }
+        seen += final;
+        if (seen != expected) {
+            printf("FAIL: %s %d bytes %s: exchanged values sum to 0x%llx, "
+                   "expected 0x%llx\n", op_names[op], size, where,
+                   (unsigned long long)seen, (unsigned long long)expected);
+            errors++;
+        }
+        return;
+    }
+
+    /* Every intermediate count was returned exactly once */
+    for (i = 0; i < total; i++) {
+        expected += zext(i, size);
+    }
+    if (final != zext(total, size) || seen != expected) {
+        printf("FAIL: %s %d bytes %s: final 0x%llx, expected 0x%llx; "
+               "old values sum to 0x%llx, expected 0x%llx\n",
+               op_names[op], size, where, (unsigned long long)final,
+               (unsigned long long)zext(total, size),
+               (unsigned long long)seen, (unsigned long long)expected);
+        errors++;
+    }
+}
+
+int main(void)
+{
+    static const int sizes[] = {
+        1, 2, 4,
+#if __SIZEOF_POINTER__ >= 8
+        8,
+#endif
+    };
+    long page_size = getpagesize();
+    uint8_t *buf;
+    AtomicOp op;
+    int i;
+
+    buf = mmap(NULL, 2 * page_size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+
+    for (op = OP_FETCH_ADD; op <= OP_XCHG; op++) {
+        for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            int size = sizes[i];
+
+            run_test(op, size, buf + 64, "aligned", 100000);
+            if (CHECK_UNALIGNED && size > 1) {
+                /* These stop all other threads, so do fewer of them */
+                run_test(op, size, buf + 64 + 1, "unaligned", 500);
+                run_test(op, size, buf + page_size - size / 2,
+                         "page crossing", 500);
+            }
+        }
+    }
+
+    munmap(buf, 2 * page_size);
+
+    printf("%s\n", errors ? "FAIL" : "PASS");
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
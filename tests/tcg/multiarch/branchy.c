@@ -0,0 +1,194 @@
+/*
+ * Branch-heavy integer kernels
+ *
+ * Small loops whose bodies are dominated by short forward branches, in
+ * the style of string scanning and conditionally executed sequences.
+ * The results are checked against known values.  With -d in_asm,out_asm
+ * the bench_* functions also serve to measure the host code that TCG
+ * generates for branches inside a TB, see
+ * scripts/performance/tcg_expansion.py.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdint.h>
+#include <stdio.h>
+
+#define BUF_SIZE 4096
+#define ROUNDS   16
+
+static unsigned char buf[BUF_SIZE];
+
+/* From: https://en.wikipedia.org/wiki/Xorshift */
+static uint32_t xorshift32(uint32_t x)
+{
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+/* Length of each NUL-terminated run, like strlen.  */
+static uint32_t __attribute__((noinline))
+bench_strlen(const unsigned char *p, size_t n)
+{
+    uint32_t sum = 0, len = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (p[i] == 0) {
+            sum = sum * 33 + len;
+            len = 0;
+        } else {
+            len++;
+        }
+    }
+    return sum + len;
+}
+
+/* Classify bytes, like isalpha/isdigit/isspace chains.  */
+static uint32_t __attribute__((noinline))
+bench_classify(const unsigned char *p, size_t n)
+{
+    uint32_t alpha = 0, digit = 0, space = 0, other = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        unsigned char c = p[i];
+
+        if ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') {
+            alpha++;
+        } else if (c >= '0' && c <= '9') {
+            digit++;
+        } else if (c == ' ' || c == '\t' || c == '\n') {
+            space++;
+        } else {
+            other++;
+        }
+    }
+    return alpha ^ (digit << 8) ^ (space << 16) ^ (other << 24);
+}
+
+/* Saturating and clamping arithmetic, like conditional execution.  */
+static uint32_t __attribute__((noinline))
+bench_clamp(const unsigned char *p, size_t n)
+{
+    int32_t acc = 0, lo = 0, hi = 0;
+    size_t i;
+
+    for (i = 0; i + 1 < n; i += 2) {
+        int32_t d = (int32_t)p[i] - (int32_t)p[i + 1];
+
+        if (d > 64) {
+            d = 64;
+        }
+        if (d < -64) {
+            d = -64;
+        }
+        acc += d;
+        if (acc > 1000) {
+            acc -= 2000;
+            hi++;
+        }
+        if (acc < -1000) {
+            acc += 2000;
+            lo++;
+        }
+    }
+    return (uint32_t)acc ^ ((uint32_t)lo << 12) ^ ((uint32_t)hi << 20);
+}
+
+/* Compare two buffers byte by byte with an early exit, like memcmp.  */
+static uint32_t __attribute__((noinline))
+bench_compare(const unsigned char *p, size_t n)
+{
+    uint32_t diffs = 0;
+    size_t i, j;
+
+    for (i = 0; i + 64 <= n; i += 64) {
+        for (j = 0; j < 32; j++) {
+            if (p[i + j] != p[i + 32 + j]) {
+                diffs += (p[i + j] < p[i + 32 + j]) ? j : 32 + j;
+                break;
+            }
+        }
+    }
+    return diffs;
+}
+
+/* A small state machine, like a tokenizer.  */
+static uint32_t __attribute__((noinline))
+bench_tokens(const unsigned char *p, size_t n)
+{
+    uint32_t words = 0, numbers = 0, state = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        unsigned char c = p[i] & 0x3f;
+
+        switch (state) {
+        case 0:
+            if (c < 10) {
+                state = 2;
+                numbers++;
+            } else if (c < 40) {
+                state = 1;
+                words++;
+            }
+            break;
+        case 1:
+            if (c >= 40) {
+                state = 0;
+            }
+            break;
+        default:
+            if (c >= 10) {
+                state = c < 40 ? 1 : 0;
+                words += state;
+            }
+            break;
+        }
+    }
+    return words * 65536 + numbers;
+}
+
+static const struct {
+    const char *name;
+    uint32_t (*fn)(const unsigned char *, size_t);
+    uint32_t expect;
+} kernels[] = {
+    { "strlen",   bench_strlen,   0x35554173 },
+    { "classify", bench_classify, 0x4d25abe3 },
+    { "clamp",    bench_clamp,    0xff0f1e8c },
+    { "compare",  bench_compare,  0x000004c9 },
+    { "tokens",   bench_tokens,   0x0349013f },
+};
+
+int main(void)
+{
+    uint32_t x = 0x12345678;
+    unsigned int i, r;
+    int err = 0;
+
+    for (i = 0; i < BUF_SIZE; i++) {
+        x = xorshift32(x);
+        /* Mostly printable text, with some NULs and repeated blocks.  */
+        buf[i] = (x & 0xf) == 0 ? 0 : 0x20 + (x >> 8) % 0x5f;
+        if ((i & 63) >= 32 && (x & 0x70)) {
+            buf[i] = buf[i - 32];
+        }
+    }
+
+    for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        uint32_t res = 0;
+
+        for (r = 0; r < ROUNDS; r++) {
+            res = kernels[i].fn(buf, BUF_SIZE);
+        }
+        if (res != kernels[i].expect) {
+            printf("%s: got 0x%08x, expected 0x%08x\n",
+                   kernels[i].name, res, kernels[i].expect);
+            err = 1;
+        }
+    }
+    return err;
+}
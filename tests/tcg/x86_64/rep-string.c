@@ -0,0 +1,83 @@
+/*
+ * REP string instructions
+ *
+ * Each REP iteration is translated with branches inside the TB, which
+ * makes these loops a good workload for the code TCG generates around
+ * internal labels.  The results are checked against plain C loops.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BUF_SIZE 4096
+#define ROUNDS   16
+
+static unsigned char src[BUF_SIZE], dst[BUF_SIZE];
+
+static void __attribute__((noinline)) bench_movsb(void *d, const void *s,
+                                                  size_t n)
+{
+    asm volatile("rep movsb"
+                 : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+}
+
+static void __attribute__((noinline)) bench_stosq(void *d, uint64_t v,
+                                                  size_t n)
+{
+    asm volatile("rep stosq"
+                 : "+D"(d), "+c"(n) : "a"(v) : "memory");
+}
+
+static size_t __attribute__((noinline)) bench_scasb(const void *d, int c,
+                                                    size_t n)
+{
+    size_t left = n;
+
+    asm volatile("repne scasb"
+                 : "+D"(d), "+c"(left) : "a"(c) : "memory", "cc");
+    return n - left;
+}
+
+static size_t __attribute__((noinline)) bench_cmpsb(const void *a,
+                                                    const void *b, size_t n)
+{
+    size_t left = n;
+
+    asm volatile("repe cmpsb"
+                 : "+D"(a), "+S"(b), "+c"(left) : : "memory", "cc");
+    return n - left;
+}
+
+int main(void)
+{
+    size_t i, r;
+
+    for (i = 0; i < BUF_SIZE; i++) {
+        src[i] = i % 255 + 1;
+    }
+    src[BUF_SIZE - 100] = 0;
+
+    for (r = 0; r < ROUNDS; r++) {
+        bench_stosq(dst, 0x0101010101010101ull, BUF_SIZE / 8);
+        for (i = 0; i < BUF_SIZE; i++) {
+            assert(dst[i] == 1);
+        }
+
+        bench_movsb(dst, src, BUF_SIZE);
+        for (i = 0; i < BUF_SIZE; i++) {
+            assert(dst[i] == src[i]);
+        }
+
+        /* Stops after the NUL, or at the end of the buffer.  */
+        assert(bench_scasb(src, 0, BUF_SIZE) == BUF_SIZE - 99);
+        assert(bench_scasb(src, 0, BUF_SIZE - 100) == BUF_SIZE - 100);
+
+        /* Stops after the first difference.  */
+        assert(bench_cmpsb(dst, src, BUF_SIZE) == BUF_SIZE);
+        dst[1000] ^= 1;
+        assert(bench_cmpsb(dst, src, BUF_SIZE) == 1001);
+    }
+    return 0;
+}
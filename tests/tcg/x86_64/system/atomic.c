@@ -0,0 +1,189 @@
+/*
+ * Atomic operation test
+ *
+ * Check the result of locked fetch-add, exchange and compare-and-swap
+ * at every access size on guest memory that TCG can access inline and
+ * on memory that needs the out of line helpers:
+ *
+ *   - aligned accesses, the first one to each page missing in the TLB
+ *   - unaligned accesses within a page
+ *   - unaligned accesses spanning two pages
+ *   - MMIO, using the index register of the IOAPIC
+ *
+ * The bytes around the location must not change. Run with more than one
+ * CPU for MTTCG to emit the parallel (atomic) version of the operations.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <minilib.h>
+
+#define MEM_PAGE_SIZE 4096
+#define TEST_PAGES 16
+#define GUARD 16
+#define GUARD_BYTE 0x5a
+
+#define IOAPIC_IOREGSEL 0xfec00000
+
+#define ARRAY_SIZE(x) ((sizeof(x) / sizeof((x)[0])))
+
+__attribute__((aligned(MEM_PAGE_SIZE)))
+static uint8_t test_data[TEST_PAGES * MEM_PAGE_SIZE];
+
+/* The high bit of each access size is set, to catch sign extension */
+static const uint64_t pattern = 0xf1e2d3c4b5a69788ull;
+
+static bool check(const char *what, int size, const char *where,
+                  unsigned long long got, unsigned long long expected)
+{
+    if (got != expected) {
+        ml_printf("FAIL: %s %d bytes %s: got 0x%llx, expected 0x%llx\n",
+                  what, size, where, got, expected);
+        return false;
+    }
+    return true;
+}
+
+#define GEN_TEST(T)                                                     \
+static bool test_##T(void *ptr, const char *where)                      \
+{                                                                       \
+    volatile T *p = ptr;    /* check what is really in memory */        \
+    T val = (T)pattern;                                                 \
+    T old, cmp;                                                         \
+    bool ok = true;                                                     \
+                                                                        \
+    *p = val;                                                           \
+    old = __atomic_fetch_add(p, 1, __ATOMIC_SEQ_CST);                   \
+    ok &= check("fetch-add old", sizeof(T), where, old, val);           \
+    ok &= check("fetch-add new", sizeof(T), where, *p, (T)(val + 1));   \
+                                                                        \
+    *p = (T)-1;                                                         \
+    old = __atomic_fetch_add(p, 1, __ATOMIC_SEQ_CST);                   \
+    ok &= check("fetch-add wrap old", sizeof(T), where, old, (T)-1);    \
+    ok &= check("fetch-add wrap new", sizeof(T), where, *p, 0);         \
+                                                                        \
+    *p = val;                                                           \
+    old = __atomic_exchange_n(p, (T)~val, __ATOMIC_SEQ_CST);            \
+    ok &= check("xchg old", sizeof(T), where, old, val);                \
+    ok &= check("xchg new", sizeof(T), where, *p, (T)~val);             \
+                                                                        \
+    cmp = (T)~val;                                                      \
+    ok &= check("cmpxchg success", sizeof(T), where,                    \
+                __atomic_compare_exchange_n(p, &cmp, val, false,        \
+                                            __ATOMIC_SEQ_CST,           \
+                                            __ATOMIC_SEQ_CST), true);   \
+    ok &= check("cmpxchg success old", sizeof(T), where, cmp, (T)~val); \
+    ok &= check("cmpxchg success new", sizeof(T), where, *p, val);      \
+                                                                        \
+    cmp = 0;                                                            \
+    ok &= check("cmpxchg failure", sizeof(T), where,                    \
+                __atomic_compare_exchange_n(p, &cmp, (T)~val, false,    \
+                                            __ATOMIC_SEQ_CST,           \
+                                            __ATOMIC_SEQ_CST), false);  \
+    ok &= check("cmpxchg failure old", sizeof(T), where, cmp, val);     \
+    ok &= check("cmpxchg failure new", sizeof(T), where, *p, val);      \
+                                                                        \
+    return ok;                                                          \
+}
+
+GEN_TEST(uint8_t)
+GEN_TEST(uint16_t)
+GEN_TEST(uint32_t)
+GEN_TEST(uint64_t)
+
+static bool test_size(uint8_t *ptr, int size, const char *where)
+{
+    bool ok;
+    int i;
+
+    for (i = -GUARD; i < size + GUARD; i++) {
+        ptr[i] = GUARD_BYTE;
+    }
+
+    switch (size) {
+    case 1:
+        ok = test_uint8_t(ptr, where);
+        break;
+    case 2:
+        ok = test_uint16_t(ptr, where);
+        break;
+    case 4:
+        ok = test_uint32_t(ptr, where);
+        break;
+    default:
+        ok = test_uint64_t(ptr, where);
+        break;
+    }
+
+    for (i = -GUARD; i < 0; i++) {
+        ok &= check("guard byte before", size, where, ptr[i], GUARD_BYTE);
+    }
+    for (i = size; i < size + GUARD; i++) {
+        ok &= check("guard byte after", size, where, ptr[i], GUARD_BYTE);
+    }
+    return ok;
+}
+
+/* IOREGSEL reads back the low 8 bits of the last value written */
+static bool test_mmio(void)
+{
+    volatile uint32_t *p = (void *)IOAPIC_IOREGSEL;     /* MMIO */
+    uint32_t old, cmp;
+    bool ok = true;
+
+    *p = 0x10;
+    old = __atomic_fetch_add(p, 1, __ATOMIC_SEQ_CST);
+    ok &= check("fetch-add old", 4, "mmio", old, 0x10);
+    ok &= check("fetch-add new", 4, "mmio", *p, 0x11);
+
+    old = __atomic_exchange_n(p, 0x20, __ATOMIC_SEQ_CST);
+    ok &= check("xchg old", 4, "mmio", old, 0x11);
+    ok &= check("xchg new", 4, "mmio", *p, 0x20);
+
+    cmp = 0x20;
+    ok &= check("cmpxchg success", 4, "mmio",
+                __atomic_compare_exchange_n(p, &cmp, 0x30, false,
+                                            __ATOMIC_SEQ_CST,
+                                            __ATOMIC_SEQ_CST), true);
+    ok &= check("cmpxchg success new", 4, "mmio", *p, 0x30);
+
+    cmp = 0x20;
+    ok &= check("cmpxchg failure", 4, "mmio",
+                __atomic_compare_exchange_n(p, &cmp, 0x40, false,
+                                            __ATOMIC_SEQ_CST,
+                                            __ATOMIC_SEQ_CST), false);
+    ok &= check("cmpxchg failure old", 4, "mmio", cmp, 0x30);
+    ok &= check("cmpxchg failure new", 4, "mmio", *p, 0x30);
+
+    return ok;
+}
+
+int main(void)
+{
+    static const int sizes[] = { 1, 2, 4, 8 };
+    bool ok = true;
+    int i, page;
+
+    for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+        int size = sizes[i];
+
+        ml_printf("Testing %d byte atomics\n", size);
+        for (page = 0; page < TEST_PAGES; page++) {
+            ok &= test_size(&test_data[page * MEM_PAGE_SIZE + 64], size,
+                            "aligned");
+        }
+        if (size > 1) {
+            ok &= test_size(&test_data[64 + 1], size, "unaligned");
+            ok &= test_size(&test_data[MEM_PAGE_SIZE - size / 2], size,
+                            "page crossing");
+        }
+    }
+
+    ml_printf("Testing MMIO atomics\n");
+    ok &= test_mmio();
+
+    ml_printf("Test complete: %s\n", ok ? "PASSED" : "FAILED");
+    return ok ? 0 : -1;
+}
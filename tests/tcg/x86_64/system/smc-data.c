@@ -0,0 +1,144 @@
+/*
+ * Self-modifying code on a page that also holds data
+ *
+ * TCG filters the writes to a page with code through a bitmap of the
+ * bytes its TBs were translated from.  Check that code changes are still
+ * seen once the bitmap is in use, and that data writes to the page become
+ * as fast as writes to any other page once its last TB went away.  The TB
+ * spans two pages and is invalidated by a write to the second one, so the
+ * first page only loses it through the TB being removed.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <minilib.h>
+
+#define MEM_PAGE_SIZE 4096
+#define DATA_SIZE 1024
+
+/* More writes than TCG needs to start using the bitmap */
+#define BITMAP_WRITES 64
+#define TIMED_WRITES 100000
+
+/*
+ * Slow writes go through a helper that looks up and locks the page, fast
+ * ones are a few host instructions; be generous with the difference.
+ */
+#define MAX_SLOWDOWN 4
+
+/* Every write must happen, both to patch the code and to be timed */
+typedef volatile uint8_t vbyte;
+
+__attribute__((aligned(MEM_PAGE_SIZE)))
+static uint8_t pages[3 * MEM_PAGE_SIZE];
+
+/* "mov $imm32, %eax; ret", with the immediate spanning the first two pages */
+static vbyte *const code = &pages[MEM_PAGE_SIZE - 3];
+static vbyte *const data = &pages[0];
+static vbyte *const other = &pages[2 * MEM_PAGE_SIZE];
+
+static bool check(const char *what, unsigned long long got,
+                  unsigned long long expected)
+{
+    if (got != expected) {
+        ml_printf("FAIL: %s: got 0x%llx, expected 0x%llx\n",
+                  what, got, expected);
+        return false;
+    }
+    return true;
+}
+
+static void write_code(uint32_t imm)
+{
+    int i;
+
+    code[0] = 0xb8;
+    for (i = 0; i < 4; i++) {
+        code[1 + i] = imm >> (i * 8);
+    }
+    code[5] = 0xc3;
+}
+
+static uint32_t run_code(void)
+{
+    uint32_t (*fn)(void) = (void *)code;
+
+    return fn();
+}
+
+static void write_data(vbyte *p, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        p[i % DATA_SIZE] = i;
+    }
+}
+
+static bool check_data(const char *what, vbyte *p, int n)
+{
+    bool ok = true;
+    int i;
+
+    for (i = n > DATA_SIZE ? n - DATA_SIZE : 0; i < n; i++) {
+        ok &= check(what, p[i % DATA_SIZE], (uint8_t)i);
+    }
+    return ok;
+}
+
+static uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static uint64_t time_writes(vbyte *p)
+{
+    uint64_t start = rdtsc();
+
+    write_data(p, TIMED_WRITES);
+    return rdtsc() - start;
+}
+
+int main(void)
+{
+    uint64_t t_data, t_other;
+    bool ok = true;
+
+    ml_printf("Testing code changes with data on the page\n");
+    write_code(0x11223344);
+    ok &= check("first run", run_code(), 0x11223344);
+
+    write_data(data, BITMAP_WRITES);
+    ok &= check_data("data", data, BITMAP_WRITES);
+    ok &= check("run after data writes", run_code(), 0x11223344);
+
+    /* Hits the code bytes of the first page in the bitmap */
+    code[1] = 0x55;
+    ok &= check("run after write to first page", run_code(), 0x11223355);
+
+    /* Invalidates the TB through its second page only */
+    write_data(data, BITMAP_WRITES);
+    code[4] = 0x66;
+
+    ml_printf("Testing data writes to the page without code\n");
+    t_other = time_writes(other);
+    t_data = time_writes(data);
+    ok &= check_data("data", data, TIMED_WRITES);
+    ok &= check_data("other data", other, TIMED_WRITES);
+    ml_printf("%d writes: %lld ticks to the page, %lld to another page\n",
+              TIMED_WRITES, (long long)t_data, (long long)t_other);
+    if (t_data > MAX_SLOWDOWN * t_other) {
+        ml_printf("FAIL: writes to the page are still slow\n");
+        ok = false;
+    }
+
+    ok &= check("run after write to second page", run_code(), 0x66223355);
+
+    ml_printf("Test complete: %s\n", ok ? "PASSED" : "FAILED");
+    return ok ? 0 : -1;
+}
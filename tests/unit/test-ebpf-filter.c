@@ -0,0 +1,279 @@
+/*
+ * eBPF network filter classifier unit tests
+ *
+ * The programs are attached to a packet socket on the loopback device,
+ * which sees each frame sent on it twice: once going out
+ * (PACKET_OUTGOING, like the packets the host sends to the guest out of
+ * a tap device) and once coming in (like the packets of the guest).
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <poll.h>
+#include <netinet/in.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include "qapi/error.h"
+#include "qemu/bswap.h"
+#include "ebpf/ebpf_filter.h"
+
+#define POLL_MS 200
+
+static const uint8_t guest_mac[ETH_ALEN] = {
+    0x52, 0x54, 0x00, 0x12, 0x34, 0x56
+};
+static const uint8_t other_mac[ETH_ALEN] = {
+    0x52, 0x54, 0x00, 0x12, 0x34, 0x57
+};
+static const char marker[] = "QEMU eBPF filter test";
+
+typedef struct TestFrame {
+    const uint8_t *dst_mac;
+    int vlan;               /* -1 for untagged */
+    uint8_t proto;
+    uint32_t src_addr;
+    uint16_t src_port;
+    uint16_t dst_port;
+} TestFrame;
+
+static int lo_ifindex;
+
+static size_t build_frame(uint8_t *buf, const TestFrame *f)
+{
+    uint8_t *p = buf;
+
+    memcpy(p, f->dst_mac, ETH_ALEN);
+    memcpy(p + ETH_ALEN, other_mac, ETH_ALEN);
+    p += 2 * ETH_ALEN;
+    if (f->vlan >= 0) {
+        stw_be_p(p, ETH_P_8021Q);
+        stw_be_p(p + 2, f->vlan);
+        p += 4;
+    }
+    stw_be_p(p, ETH_P_IP);
+    p += 2;
+
+    /* IPv4 header without options, then the ports */
+    memset(p, 0, 20);
+    p[0] = 0x45;
+    stw_be_p(p + 2, 20 + 8 + sizeof(marker));
+    p[8] = 64;
+    p[9] = f->proto;
+    stl_be_p(p + 12, f->src_addr);
+    stl_be_p(p + 16, 0x0a000002);
+    p += 20;
+
+    memset(p, 0, 8);
+    stw_be_p(p, f->src_port);
+    stw_be_p(p + 2, f->dst_port);
+    p += 8;
+
+    memcpy(p, marker, sizeof(marker));
+    p += sizeof(marker);
+
+    return p - buf;
+}
+
+static int open_packet_socket(void)
+{
+    struct sockaddr_ll sll = {
+        .sll_family = AF_PACKET,
+        .sll_protocol = htons(ETH_P_ALL),
+        .sll_ifindex = lo_ifindex,
+    };
+    int fd;
+
+    fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    g_assert_cmpint(fd, >=, 0);
+    g_assert_cmpint(bind(fd, (struct sockaddr *)&sll, sizeof(sll)), ==, 0);
+    return fd;
+}
+
+/*
+ * Send @frame on the loopback device and count how many of its copies
+ * pass the filter, going out and coming in.
+ */
+static void run_filter(const NetFilterMatch *match,
+                       NetFilterDirection direction, const TestFrame *frame,
+                       int expect_out, int expect_in)
+{
+    struct EBPFFilterContext ctx;
+    struct sockaddr_ll sll = {
+        .sll_family = AF_PACKET,
+        .sll_ifindex = lo_ifindex,
+        .sll_halen = ETH_ALEN,
+    };
+    uint8_t buf[256];
+    size_t size;
+    int rx, tx, n_out = 0, n_in = 0;
+
+    ebpf_filter_init(&ctx);
+    g_assert_true(ebpf_filter_load(&ctx, match, direction, &error_abort));
+
+    rx = open_packet_socket();
+    g_assert_cmpint(setsockopt(rx, SOL_SOCKET, SO_ATTACH_BPF,
+                               &ctx.program_fd, sizeof(ctx.program_fd)),
+                    ==, 0);
+    tx = open_packet_socket();
+
+    size = build_frame(buf, frame);
+    memcpy(sll.sll_addr, frame->dst_mac, ETH_ALEN);
+    g_assert_cmpint(sendto(tx, buf, size, 0, (struct sockaddr *)&sll,
+                           sizeof(sll)), ==, size);
+
+    for (;;) {
+        struct pollfd pfd = { .fd = rx, .events = POLLIN };
+        socklen_t len = sizeof(sll);
+        ssize_t ret;
+
+        if (poll(&pfd, 1, POLL_MS) <= 0) {
+            break;
+        }
+        ret = recvfrom(rx, buf, sizeof(buf), 0, (struct sockaddr *)&sll,
+                       &len);
+        g_assert_cmpint(ret, >, 0);
+
+        /* Ignore unrelated traffic on the loopback device */
+        if (!memmem(buf, ret, marker, sizeof(marker))) {
+            continue;
+        }
+        if (sll.sll_pkttype == PACKET_OUTGOING) {
+            n_out++;
+        } else {
+            n_in++;
+        }
+    }
+
+    g_assert_cmpint(n_out, ==, expect_out);
+    g_assert_cmpint(n_in, ==, expect_in);
+
+    close(tx);
+    close(rx);
+    ebpf_filter_unload(&ctx);
+}
+
+static const TestFrame udp_frame = {
+    .dst_mac = guest_mac,
+    .vlan = -1,
+    .proto = IPPROTO_UDP,
+    .src_addr = 0x0a000001,
+    .src_port = 1234,
+    .dst_port = 4789,
+};
+
+static void test_direction(void)
+{
+    NetFilterMatch match = { };
+
+    run_filter(&match, NET_FILTER_DIRECTION_ALL, &udp_frame, 1, 1);
+    /* tx: sent by the netdev, i.e. going out of the tap device */
+    run_filter(&match, NET_FILTER_DIRECTION_TX, &udp_frame, 1, 0);
+    /* rx: sent to the netdev, i.e. received by the tap device */
+    run_filter(&match, NET_FILTER_DIRECTION_RX, &udp_frame, 0, 1);
+}
+
+static void test_mac(void)
+{
+    NetFilterMatch match = { .has_dst_mac = true };
+    TestFrame frame = udp_frame;
+
+    memcpy(match.dst_mac, guest_mac, ETH_ALEN);
+    run_filter(&match, NET_FILTER_DIRECTION_ALL, &frame, 1, 1);
+    frame.dst_mac = other_mac;
+    run_filter(&match, NET_FILTER_DIRECTION_ALL, &frame, 0, 0);
+
+    match = (NetFilterMatch) { .has_src_mac = true };
+    memcpy(match.src_mac, other_mac, ETH_ALEN);
+    run_filter(&match, NET_FILTER_DIRECTION_ALL, &frame, 1, 1);
+    memcpy(match.src_mac, guest_mac, ETH_ALEN);
+    run_filter(&match, NET_FILTER_DIRECTION_ALL, &frame, 0, 0);
+}
+
+/* Outgoing frames carry the tag, incoming ones have it in the metadata */
+static void test_vlan(void)
+{
+    NetFilterMatch match = { .has_vlan = true, .vlan = 5 };
+    TestFrame frame = udp_frame;
+
+    run_filter(&match, NET_FILTER_DIRECTION_ALL, &frame, 0, 0);
+    frame.vlan = 5;
+    run_filter(&match, NET_FILTER_DIRECTION_ALL, &frame, 1, 1);
+    frame.vlan = 6;
+    run_filter(&match, NET_FILTER_DIRECTION_ALL, &frame, 0, 0);
+
+    /* The IP header follows the tag */
+    match = (NetFilterMatch) { .has_dst_port = true, .dst_port = 4789 };
+    frame.vlan = 6;
+    run_filter(&match, NET_FILTER_DIRECTION_ALL, &frame, 1, 1);
+}
+
+static void test_ip(void)
+{
+    NetFilterMatch match = {
+        .has_proto = true,
+        .proto = IPPROTO_UDP,
+        .src_addr = 0x0a000000,
+        .src_mask = 0xff000000,
+        .has_dst_port = true,
+        .dst_port = 4789,
+    };
+    TestFrame frame = udp_frame;
+
+    run_filter(&match, NET_FILTER_DIRECTION_ALL, &frame, 1, 1);
+    frame.dst_port = 4790;
+    run_filter(&match, NET_FILTER_DIRECTION_ALL, &frame, 0, 0);
+    frame = udp_frame;
+    frame.proto = IPPROTO_TCP;
+    run_filter(&match, NET_FILTER_DIRECTION_ALL, &frame, 0, 0);
+    frame = udp_frame;
+    frame.src_addr = 0xc0a80001;
+    run_filter(&match, NET_FILTER_DIRECTION_ALL, &frame, 0, 0);
+
+    /* Ports without a protocol match both TCP and UDP */
+    match = (NetFilterMatch) { .has_src_port = true, .src_port = 1234 };
+    frame = udp_frame;
+    frame.proto = IPPROTO_TCP;
+    run_filter(&match, NET_FILTER_DIRECTION_TX, &frame, 1, 0);
+    frame.proto = IPPROTO_ICMP;
+    run_filter(&match, NET_FILTER_DIRECTION_TX, &frame, 0, 0);
+}
+
+int main(int argc, char **argv)
+{
+    struct EBPFFilterContext ctx;
+    NetFilterMatch match = { };
+    int fd;
+
+    g_test_init(&argc, &argv, NULL);
+
+    /* Loading programs and opening packet sockets needs privileges */
+    ebpf_filter_init(&ctx);
+    if (!ebpf_filter_load(&ctx, &match, NET_FILTER_DIRECTION_ALL, NULL)) {
+        g_test_message("Skipping: cannot load eBPF programs");
+        return 0;
+    }
+    ebpf_filter_unload(&ctx);
+
+    fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (fd < 0) {
+        g_test_message("Skipping: cannot open packet sockets");
+        return 0;
+    }
+    close(fd);
+
+    lo_ifindex = if_nametoindex("lo");
+    if (!lo_ifindex) {
+        g_test_message("Skipping: no loopback device");
+        return 0;
+    }
+
+    g_test_add_func("/ebpf-filter/direction", test_direction);
+    g_test_add_func("/ebpf-filter/mac", test_mac);
+    g_test_add_func("/ebpf-filter/vlan", test_vlan);
+    g_test_add_func("/ebpf-filter/ip", test_ip);
+
+    return g_test_run();
+}
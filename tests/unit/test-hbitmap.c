@@ -793,6 +793,68 @@ static void test_hbitmap_serialize_zeroes(TestHBitmapData *data,
     }
 }
 
+static void test_hbitmap_serialize_ones_tail(TestHBitmapData *data,
+                                             const void *unused)
+{
+    uint64_t size = L2 + 17;
+    uint64_t start = QEMU_ALIGN_DOWN(size - 1, 64);
+
+    hbitmap_test_init(data, size, 0);
+    g_assert(hbitmap_is_serializable(data->hb));
+
+    /*
+     * The last chunk may fill bits past the end of the bitmap; they must
+     * not be accounted in the dirty count.
+     */
+    hbitmap_deserialize_ones(data->hb, start, size - start, true);
+    hbitmap_test_set(data, start, size - start);
+    hbitmap_test_set(data, 0, 1);
+    hbitmap_test_check_get(data);
+}
+
+static void hbitmap_test_merge_do(TestHBitmapData *data, int granularity)
+{
+    HBitmap *hb_a = hbitmap_alloc(L3, 0);
+    HBitmap *hb_b = hbitmap_alloc(L3, granularity);
+
+    hbitmap_test_init(data, L3, 0);
+
+    /* Keep ranges aligned to the coarsest granularity under test */
+    hbitmap_set(hb_a, 0, L1 + 2);
+    hbitmap_set(hb_a, L2, L2);
+    hbitmap_set(hb_b, L1, L2 + 8);
+    hbitmap_set(hb_b, L3 - 4, 4);
+
+    hbitmap_test_set(data, 0, L1 + 2);
+    hbitmap_test_set(data, L2, L2);
+    hbitmap_test_set(data, L1, L2 + 8);
+    hbitmap_test_set(data, L3 - 4, 4);
+
+    /* Only the shadow bitmap is left with the expected result */
+    hbitmap_reset_all(data->hb);
+    hbitmap_merge(hb_a, hb_b, data->hb);
+    hbitmap_test_check(data, 0);
+
+    /* Merge into one of the operands */
+    hbitmap_merge(hb_a, hb_b, hb_a);
+    g_assert_cmpint(hbitmap_count(hb_a), ==, hbitmap_count(data->hb));
+
+    hbitmap_free(hb_a);
+    hbitmap_free(hb_b);
+}
+
+static void test_hbitmap_merge_0(TestHBitmapData *data, const void *unused)
+{
+    hbitmap_test_merge_do(data, 0);
+}
+
+static void test_hbitmap_merge_granularity(TestHBitmapData *data,
+                                           const void *unused)
+{
+    /* Different granularities take the sparse merge path */
+    hbitmap_test_merge_do(data, 1);
+}
+
 static void hbitmap_test_add(const char *testpath,
                                    void (*test_func)(TestHBitmapData *data, const void *user_data))
 {
@@ -1093,6 +1155,12 @@ int main(int argc, char **argv)
                      test_hbitmap_serialize_part);
     hbitmap_test_add("/hbitmap/serialize/zeroes",
                      test_hbitmap_serialize_zeroes);
+    hbitmap_test_add("/hbitmap/serialize/ones_tail",
+                     test_hbitmap_serialize_ones_tail);
+
+    hbitmap_test_add("/hbitmap/merge/0", test_hbitmap_merge_0);
+    hbitmap_test_add("/hbitmap/merge/granularity",
+                     test_hbitmap_merge_granularity);
 
     hbitmap_test_add("/hbitmap/iter/iter_and_reset",
                      test_hbitmap_iter_and_reset);
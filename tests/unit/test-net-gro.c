@@ -0,0 +1,329 @@
+/*
+ * Generic receive offload unit tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "net/gro.h"
+#include "net/eth.h"
+#include "net/checksum.h"
+
+#define MSS             1000
+#define MAX_OUTPUTS     16
+#define SPORT           1234
+
+typedef struct Output {
+    struct virtio_net_hdr hdr;
+    uint8_t *buf;
+    size_t size;
+} Output;
+
+static Output outputs[MAX_OUTPUTS];
+static int n_outputs;
+
+static void output(void *opaque, const struct virtio_net_hdr *hdr,
+                   const uint8_t *buf, size_t size)
+{
+    g_assert_cmpint(n_outputs, <, MAX_OUTPUTS);
+    outputs[n_outputs].hdr = *hdr;
+    outputs[n_outputs].buf = g_memdup2(buf, size);
+    outputs[n_outputs].size = size;
+    n_outputs++;
+}
+
+static void reset_outputs(void)
+{
+    int i;
+
+    for (i = 0; i < n_outputs; i++) {
+        g_free(outputs[i].buf);
+    }
+    n_outputs = 0;
+}
+
+static size_t l4_offset(bool ipv6)
+{
+    return ETH_HLEN + (ipv6 ? sizeof(struct ip6_header) :
+                              sizeof(struct ip_header));
+}
+
+/* Checksum of the TCP segment in @buf; 0 if the checksum field is right */
+static uint16_t tcp_csum(uint8_t *buf, size_t size, bool ipv6)
+{
+    size_t tcp_len = size - l4_offset(ipv6);
+    uint32_t sum;
+
+    if (ipv6) {
+        sum = net_checksum_add(32, buf + ETH_HLEN + 8);
+    } else {
+        sum = net_checksum_add(8, buf + ETH_HLEN + 12);
+    }
+    sum += net_checksum_add(tcp_len, buf + l4_offset(ipv6));
+    return net_checksum_finish(sum + IP_PROTO_TCP + tcp_len);
+}
+
+/* Payload bytes depend on their sequence number */
+static uint8_t payload_byte(uint32_t seq)
+{
+    return seq * 7 + (seq >> 8);
+}
+
+static size_t build_segment(uint8_t *buf, bool ipv6, uint16_t sport,
+                            uint32_t seq, uint8_t flags, size_t len)
+{
+    size_t l4_off = l4_offset(ipv6);
+    size_t size = l4_off + sizeof(struct tcp_header) + len;
+    uint8_t *l3 = buf + ETH_HLEN;
+    uint8_t *tcp = buf + l4_off;
+    size_t i;
+
+    memset(buf, 0, size);
+    memset(buf, 0x52, ETH_ALEN);
+    memset(buf + ETH_ALEN, 0x54, ETH_ALEN);
+    stw_be_p(buf + 2 * ETH_ALEN, ipv6 ? ETH_P_IPV6 : ETH_P_IP);
+
+    if (ipv6) {
+        l3[0] = 0x60;
+        stw_be_p(l3 + 4, size - l4_off);
+        l3[6] = IP_PROTO_TCP;
+        l3[7] = 64;
+        l3[8 + 15] = 1;
+        l3[24 + 15] = 2;
+    } else {
+        l3[0] = 0x45;
+        stw_be_p(l3 + 2, size - ETH_HLEN);
+        stw_be_p(l3 + 4, seq);
+        stw_be_p(l3 + 6, IP_DF);
+        l3[8] = 64;
+        l3[9] = IP_PROTO_TCP;
+        stl_be_p(l3 + 12, 0x0a000001);
+        stl_be_p(l3 + 16, 0x0a000002);
+        stw_be_p(l3 + 10, net_raw_checksum(l3, sizeof(struct ip_header)));
+    }
+
+    stw_be_p(tcp, sport);
+    stw_be_p(tcp + 2, 80);
+    stl_be_p(tcp + 4, seq);
+    stl_be_p(tcp + 8, 1);
+    tcp[12] = 5 << 4;
+    tcp[13] = flags;
+    stw_be_p(tcp + 14, 512);
+    for (i = 0; i < len; i++) {
+        tcp[sizeof(struct tcp_header) + i] = payload_byte(seq + i);
+    }
+    stw_be_p(tcp + 16, tcp_csum(buf, size, ipv6));
+    return size;
+}
+
+/* Check that @out is a valid segment carrying [@seq, @seq + @len) */
+static void check_segment(Output *out, bool ipv6, uint32_t seq, size_t len)
+{
+    size_t hdr_len = l4_offset(ipv6) + sizeof(struct tcp_header);
+    uint8_t *tcp = out->buf + l4_offset(ipv6);
+    size_t i;
+
+    g_assert_cmpint(out->size, ==, hdr_len + len);
+    g_assert_cmpint(out->hdr.flags, ==, VIRTIO_NET_HDR_F_DATA_VALID);
+    if (ipv6) {
+        g_assert_cmpint(lduw_be_p(out->buf + ETH_HLEN + 4), ==,
+                        out->size - l4_offset(ipv6));
+    } else {
+        g_assert_cmpint(lduw_be_p(out->buf + ETH_HLEN + 2), ==,
+                        out->size - ETH_HLEN);
+        g_assert_cmpint(net_raw_checksum(out->buf + ETH_HLEN,
+                                         sizeof(struct ip_header)), ==, 0);
+    }
+    g_assert_cmpint(ldl_be_p(tcp + 4), ==, seq);
+    g_assert_cmpint(tcp_csum(out->buf, out->size, ipv6), ==, 0);
+    for (i = 0; i < len; i++) {
+        g_assert_cmpint(out->buf[hdr_len + i], ==, payload_byte(seq + i));
+    }
+}
+
+static void test_coalesce(bool ipv6, size_t mss)
+{
+    NetGRO *gro = net_gro_new(output, NULL);
+    uint8_t buf[2048];
+    size_t size;
+    int i;
+
+    net_gro_set_offloads(gro, true, true);
+    for (i = 0; i < 8; i++) {
+        size = build_segment(buf, ipv6, SPORT, i * mss, TH_ACK, mss);
+        g_assert_true(net_gro_receive(gro, buf, size));
+    }
+    g_assert_cmpint(n_outputs, ==, 0);
+    g_assert_cmpint(net_gro_pending(gro), ==, size + 7 * mss);
+
+    net_gro_flush(gro);
+    g_assert_cmpint(n_outputs, ==, 1);
+    g_assert_cmpint(net_gro_pending(gro), ==, 0);
+    g_assert_cmpint(outputs[0].hdr.gso_type, ==,
+                    ipv6 ? VIRTIO_NET_HDR_GSO_TCPV6 : VIRTIO_NET_HDR_GSO_TCPV4);
+    g_assert_cmpint(outputs[0].hdr.gso_size, ==, mss);
+    g_assert_cmpint(outputs[0].hdr.hdr_len, ==, size - mss);
+    check_segment(&outputs[0], ipv6, 0, 8 * mss);
+
+    reset_outputs();
+    net_gro_free(gro);
+}
+
+static void test_coalesce_ipv4(void)
+{
+    test_coalesce(false, MSS);
+}
+
+static void test_coalesce_ipv6(void)
+{
+    test_coalesce(true, MSS);
+}
+
+/* Segments at odd offsets have their checksum bytes swapped */
+static void test_coalesce_odd(void)
+{
+    test_coalesce(false, MSS - 1);
+}
+
+/* A short segment or the PSH flag release the flow immediately */
+static void test_end_of_flow(void)
+{
+    NetGRO *gro = net_gro_new(output, NULL);
+    uint8_t buf[2048];
+    size_t size;
+
+    net_gro_set_offloads(gro, true, true);
+
+    size = build_segment(buf, false, SPORT, 0, TH_ACK, MSS);
+    g_assert_true(net_gro_receive(gro, buf, size));
+    size = build_segment(buf, false, SPORT, MSS, TH_ACK, MSS / 2);
+    g_assert_true(net_gro_receive(gro, buf, size));
+    g_assert_cmpint(n_outputs, ==, 1);
+    check_segment(&outputs[0], false, 0, MSS + MSS / 2);
+
+    size = build_segment(buf, false, SPORT, 2 * MSS, TH_ACK, MSS);
+    g_assert_true(net_gro_receive(gro, buf, size));
+    size = build_segment(buf, false, SPORT, 3 * MSS, TH_ACK | TH_PUSH, MSS);
+    g_assert_true(net_gro_receive(gro, buf, size));
+    g_assert_cmpint(n_outputs, ==, 2);
+    check_segment(&outputs[1], false, 2 * MSS, 2 * MSS);
+    g_assert_cmpint(outputs[1].buf[l4_offset(false) + 13], ==,
+                    TH_ACK | TH_PUSH);
+
+    g_assert_cmpint(net_gro_pending(gro), ==, 0);
+    reset_outputs();
+    net_gro_free(gro);
+}
+
+/* Packets that cannot be coalesced are left to the caller, in order */
+static void test_passthrough(void)
+{
+    NetGRO *gro = net_gro_new(output, NULL);
+    uint8_t buf[2048];
+    size_t size;
+
+    /* Nothing is coalesced until offloads are enabled */
+    size = build_segment(buf, false, SPORT, 0, TH_ACK, MSS);
+    g_assert_false(net_gro_receive(gro, buf, size));
+
+    net_gro_set_offloads(gro, true, false);
+    size = build_segment(buf, true, SPORT, 0, TH_ACK, MSS);
+    g_assert_false(net_gro_receive(gro, buf, size));
+
+    /* Not TCP */
+    memset(buf, 0xff, 64);
+    stw_be_p(buf + 2 * ETH_ALEN, ETH_P_ARP);
+    g_assert_false(net_gro_receive(gro, buf, 64));
+
+    /* FIN releases the data that precedes it */
+    size = build_segment(buf, false, SPORT, 0, TH_ACK, MSS);
+    g_assert_true(net_gro_receive(gro, buf, size));
+    size = build_segment(buf, false, SPORT, MSS, TH_ACK | TH_FIN, 0);
+    g_assert_false(net_gro_receive(gro, buf, size));
+    g_assert_cmpint(n_outputs, ==, 1);
+    g_assert_cmpint(outputs[0].hdr.gso_type, ==, VIRTIO_NET_HDR_GSO_NONE);
+    check_segment(&outputs[0], false, 0, MSS);
+
+    /* So does a segment with a bad checksum */
+    size = build_segment(buf, false, SPORT, 0, TH_ACK, MSS);
+    g_assert_true(net_gro_receive(gro, buf, size));
+    size = build_segment(buf, false, SPORT, MSS, TH_ACK, MSS);
+    buf[size - 1] ^= 1;
+    g_assert_false(net_gro_receive(gro, buf, size));
+    g_assert_cmpint(n_outputs, ==, 2);
+
+    g_assert_cmpint(net_gro_pending(gro), ==, 0);
+    reset_outputs();
+    net_gro_free(gro);
+}
+
+/* A gap in the sequence starts a new packet */
+static void test_out_of_order(void)
+{
+    NetGRO *gro = net_gro_new(output, NULL);
+    uint8_t buf[2048];
+    size_t size;
+
+    net_gro_set_offloads(gro, true, true);
+    size = build_segment(buf, false, SPORT, 0, TH_ACK, MSS);
+    g_assert_true(net_gro_receive(gro, buf, size));
+    size = build_segment(buf, false, SPORT, 2 * MSS, TH_ACK, MSS);
+    g_assert_true(net_gro_receive(gro, buf, size));
+    g_assert_cmpint(n_outputs, ==, 1);
+    check_segment(&outputs[0], false, 0, MSS);
+
+    net_gro_flush(gro);
+    g_assert_cmpint(n_outputs, ==, 2);
+    check_segment(&outputs[1], false, 2 * MSS, MSS);
+
+    reset_outputs();
+    net_gro_free(gro);
+}
+
+/* Flows are tracked separately, and evicted when there are too many */
+static void test_flows(void)
+{
+    NetGRO *gro = net_gro_new(output, NULL);
+    uint8_t buf[2048];
+    size_t size;
+    int i, j;
+
+    net_gro_set_offloads(gro, true, true);
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < NET_GRO_MAX_FLOWS; j++) {
+            size = build_segment(buf, false, SPORT + j, i * MSS, TH_ACK, MSS);
+            g_assert_true(net_gro_receive(gro, buf, size));
+        }
+    }
+    g_assert_cmpint(n_outputs, ==, 0);
+
+    size = build_segment(buf, false, SPORT + NET_GRO_MAX_FLOWS, 0,
+                         TH_ACK, MSS);
+    g_assert_true(net_gro_receive(gro, buf, size));
+    g_assert_cmpint(n_outputs, ==, 1);
+    check_segment(&outputs[0], false, 0, 2 * MSS);
+
+    net_gro_flush(gro);
+    g_assert_cmpint(n_outputs, ==, NET_GRO_MAX_FLOWS + 1);
+    for (i = 1; i <= NET_GRO_MAX_FLOWS; i++) {
+        check_segment(&outputs[i], false, 0,
+                      outputs[i].hdr.gso_size ? 2 * MSS : MSS);
+    }
+
+    reset_outputs();
+    net_gro_free(gro);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/gro/coalesce/ipv4", test_coalesce_ipv4);
+    g_test_add_func("/net/gro/coalesce/ipv6", test_coalesce_ipv6);
+    g_test_add_func("/net/gro/coalesce/odd", test_coalesce_odd);
+    g_test_add_func("/net/gro/end-of-flow", test_end_of_flow);
+    g_test_add_func("/net/gro/passthrough", test_passthrough);
+    g_test_add_func("/net/gro/out-of-order", test_out_of_order);
+    g_test_add_func("/net/gro/flows", test_flows);
+    return g_test_run();
+}
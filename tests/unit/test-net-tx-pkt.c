@@ -0,0 +1,271 @@
+/*
+ * TX packet software segmentation unit tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/iov.h"
+#include "exec/memory.h"
+#include "net/net.h"
+#include "net/eth.h"
+#include "net/checksum.h"
+#include "../../hw/net/net_tx_pkt.h"
+
+#define MAX_SEGMENTS    128
+#define TCP_HDR_LEN     32      /* with a timestamp option */
+#define FIRST_SEQ       0xfffff000  /* wraps around in large packets */
+#define FIRST_IP_ID     0xfffe      /* wraps around too */
+#define FRAG_LEN        3001    /* guest buffers, not aligned to segments */
+
+typedef struct Segment {
+    uint8_t *buf;
+    size_t size;
+} Segment;
+
+static Segment segments[MAX_SEGMENTS];
+static int n_segments;
+
+/* Packets sent by net_tx_pkt_send() end up here */
+ssize_t qemu_sendv_packet(NetClientState *nc, const struct iovec *iov,
+                          int iovcnt)
+{
+    size_t size = iov_size(iov, iovcnt);
+
+    g_assert_cmpint(n_segments, <, MAX_SEGMENTS);
+    segments[n_segments].buf = g_malloc(size);
+    segments[n_segments].size = size;
+    iov_to_buf(iov, iovcnt, 0, segments[n_segments].buf, size);
+    n_segments++;
+    return size;
+}
+
+ssize_t qemu_receive_packet_iov(NetClientState *nc, const struct iovec *iov,
+                                int iovcnt)
+{
+    g_assert_not_reached();
+}
+
+/* The packets are built in host memory, without a PCI device */
+void *address_space_map(AddressSpace *as, hwaddr addr, hwaddr *plen,
+                        bool is_write, MemTxAttrs attrs)
+{
+    g_assert_not_reached();
+}
+
+void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
+                         bool is_write, hwaddr access_len)
+{
+    g_assert_not_reached();
+}
+
+static void reset_segments(void)
+{
+    int i;
+
+    for (i = 0; i < n_segments; i++) {
+        g_free(segments[i].buf);
+    }
+    n_segments = 0;
+}
+
+static size_t l4_offset(bool ipv6)
+{
+    return ETH_HLEN + (ipv6 ? sizeof(struct ip6_header) :
+                              sizeof(struct ip_header));
+}
+
+/* Checksum of the TCP segment in @buf; 0 if the checksum field is right */
+static uint16_t tcp_csum(const uint8_t *buf, size_t size, bool ipv6)
+{
+    size_t tcp_len = size - l4_offset(ipv6);
+    uint32_t sum;
+
+    if (ipv6) {
+        sum = net_checksum_add(32, (uint8_t *)buf + ETH_HLEN + 8);
+    } else {
+        sum = net_checksum_add(8, (uint8_t *)buf + ETH_HLEN + 12);
+    }
+    sum += net_checksum_add(tcp_len, (uint8_t *)buf + l4_offset(ipv6));
+    return net_checksum_finish(sum + IP_PROTO_TCP + tcp_len);
+}
+
+static uint8_t payload_byte(size_t offset)
+{
+    return offset * 13 + (offset >> 9);
+}
+
+/* A TSO packet with @len bytes of payload and the TCP checksum unset */
+static size_t build_packet(uint8_t *buf, bool ipv6, uint8_t flags, size_t len)
+{
+    size_t l4_off = l4_offset(ipv6);
+    size_t size = l4_off + TCP_HDR_LEN + len;
+    uint8_t *l3 = buf + ETH_HLEN;
+    uint8_t *tcp = buf + l4_off;
+    size_t i;
+
+    memset(buf, 0, l4_off + TCP_HDR_LEN);
+    memset(buf, 0x52, ETH_ALEN);
+    memset(buf + ETH_ALEN, 0x54, ETH_ALEN);
+    stw_be_p(buf + 2 * ETH_ALEN, ipv6 ? ETH_P_IPV6 : ETH_P_IP);
+
+    if (ipv6) {
+        l3[0] = 0x60;
+        stw_be_p(l3 + 4, size - l4_off);
+        l3[6] = IP_PROTO_TCP;
+        l3[7] = 64;
+        l3[8 + 15] = 1;
+        l3[24 + 15] = 2;
+    } else {
+        l3[0] = 0x45;
+        stw_be_p(l3 + 2, size - ETH_HLEN);
+        stw_be_p(l3 + 4, FIRST_IP_ID);
+        stw_be_p(l3 + 6, IP_DF);
+        l3[8] = 64;
+        l3[9] = IP_PROTO_TCP;
+        stl_be_p(l3 + 12, 0x0a000001);
+        stl_be_p(l3 + 16, 0x0a000002);
+    }
+
+    stw_be_p(tcp, 1234);
+    stw_be_p(tcp + 2, 80);
+    stl_be_p(tcp + 4, FIRST_SEQ);
+    stl_be_p(tcp + 8, 0x01020304);
+    tcp[12] = (TCP_HDR_LEN / 4) << 4;
+    tcp[13] = flags;
+    stw_be_p(tcp + 14, 512);
+    tcp[20] = 1;                /* NOP */
+    tcp[21] = 1;                /* NOP */
+    tcp[22] = 8;                /* timestamp */
+    tcp[23] = 10;
+    stl_be_p(tcp + 24, 0x11223344);
+    stl_be_p(tcp + 28, 0x55667788);
+    for (i = 0; i < len; i++) {
+        tcp[TCP_HDR_LEN + i] = payload_byte(i);
+    }
+    return size;
+}
+
+/*
+ * Segment a TSO packet carrying @len bytes of payload into @mss sized
+ * segments, and check that they are what a NIC would send.
+ */
+static void test_segmentation(bool ipv6, uint8_t flags, size_t len,
+                              uint16_t mss)
+{
+    size_t l4_off = l4_offset(ipv6);
+    size_t hdr_len = l4_off + TCP_HDR_LEN;
+    g_autofree uint8_t *pkt = g_malloc(hdr_len + len);
+    size_t size = build_packet(pkt, ipv6, flags, len);
+    int expected = DIV_ROUND_UP(len, mss);
+    struct NetTxPkt *tx;
+    size_t offset, i;
+    int n;
+
+    net_tx_pkt_init(&tx, NULL, 64, false);
+    for (offset = 0; offset < size; offset += FRAG_LEN) {
+        g_assert_true(net_tx_pkt_add_raw_fragment_host(tx, pkt + offset,
+                                          MIN(FRAG_LEN, size - offset)));
+    }
+    g_assert_true(net_tx_pkt_parse(tx));
+    net_tx_pkt_build_vheader(tx, true, true, mss);
+    g_assert_true(net_tx_pkt_send(tx, NULL));
+    net_tx_pkt_reset(tx);
+    net_tx_pkt_uninit(tx);
+
+    g_assert_cmpint(n_segments, ==, expected);
+    for (n = 0, offset = 0; n < n_segments; n++, offset += mss) {
+        const uint8_t *seg = segments[n].buf;
+        const uint8_t *l3 = seg + ETH_HLEN;
+        const uint8_t *tcp = seg + l4_off;
+        size_t seg_len = MIN(mss, len - offset);
+        uint8_t seg_flags = flags;
+
+        g_assert_cmpint(segments[n].size, ==, hdr_len + seg_len);
+
+        /* Ethernet header and the IP fields that do not change */
+        g_assert(!memcmp(seg, pkt, ETH_HLEN));
+        if (ipv6) {
+            g_assert_cmpint(lduw_be_p(l3 + 4), ==, TCP_HDR_LEN + seg_len);
+            g_assert(!memcmp(l3 + 6, pkt + ETH_HLEN + 6, 34));
+        } else {
+            g_assert_cmpint(lduw_be_p(l3 + 2), ==,
+                            sizeof(struct ip_header) + TCP_HDR_LEN + seg_len);
+            g_assert_cmphex(lduw_be_p(l3 + 4), ==,
+                            (uint16_t)(FIRST_IP_ID + n));
+            g_assert_cmphex(lduw_be_p(l3 + 6), ==, IP_DF);
+            g_assert(!memcmp(l3 + 8, pkt + ETH_HLEN + 8, 2));
+            g_assert(!memcmp(l3 + 12, pkt + ETH_HLEN + 12, 8));
+            g_assert_cmphex(net_raw_checksum((uint8_t *)l3,
+                                             sizeof(struct ip_header)),
+                            ==, 0);
+        }
+
+        /* TCP header, with the options copied to every segment */
+        g_assert(!memcmp(tcp, pkt + l4_off, 4));
+        g_assert_cmphex(ldl_be_p(tcp + 4), ==, (uint32_t)(FIRST_SEQ + offset));
+        g_assert(!memcmp(tcp + 8, pkt + l4_off + 8, 5));
+        if (n) {
+            seg_flags &= ~TH_CWR;
+        }
+        if (n < n_segments - 1) {
+            seg_flags &= ~(TH_FIN | TH_PUSH);
+        }
+        g_assert_cmphex(tcp[13], ==, seg_flags);
+        g_assert(!memcmp(tcp + 14, pkt + l4_off + 14, 2));
+        g_assert(!memcmp(tcp + 18, pkt + l4_off + 18, TCP_HDR_LEN - 18));
+        g_assert_cmphex(tcp_csum(seg, segments[n].size, ipv6), ==, 0);
+
+        for (i = 0; i < seg_len; i++) {
+            g_assert_cmphex(tcp[TCP_HDR_LEN + i], ==,
+                            payload_byte(offset + i));
+        }
+    }
+
+    reset_segments();
+}
+
+#define ALL_FLAGS       (TH_ACK | TH_PUSH | TH_FIN | TH_CWR)
+
+static void test_ipv4(void)
+{
+    /* 6 full segments and a shorter one */
+    test_segmentation(false, ALL_FLAGS, 10000, 1448);
+    /* The largest packet, with an odd MSS */
+    test_segmentation(false, ALL_FLAGS,
+                      ETH_MAX_IP_DGRAM_LEN - sizeof(struct ip_header) -
+                      TCP_HDR_LEN, 1447);
+}
+
+static void test_ipv6(void)
+{
+    test_segmentation(true, ALL_FLAGS, 10000, 1440);
+    test_segmentation(true, ALL_FLAGS,
+                      ETH_MAX_IP_DGRAM_LEN - sizeof(struct ip6_header) -
+                      TCP_HDR_LEN, 999);
+}
+
+/* The payload ends on a segment boundary: no empty segment is sent */
+static void test_exact(void)
+{
+    test_segmentation(false, ALL_FLAGS, 4 * 1448, 1448);
+    test_segmentation(true, TH_ACK | TH_PUSH, 4 * 1440, 1440);
+}
+
+/* A packet shorter than the MSS keeps all of its flags */
+static void test_single(void)
+{
+    test_segmentation(false, ALL_FLAGS, 100, 1448);
+    test_segmentation(true, ALL_FLAGS, 1, 1440);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/tx-pkt/segmentation/ipv4", test_ipv4);
+    g_test_add_func("/net/tx-pkt/segmentation/ipv6", test_ipv6);
+    g_test_add_func("/net/tx-pkt/segmentation/exact", test_exact);
+    g_test_add_func("/net/tx-pkt/segmentation/single", test_single);
+    return g_test_run();
+}
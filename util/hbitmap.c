@@ -349,69 +349,79 @@ uint64_t hbitmap_count(const HBitmap *hb)
     return hb->count << hb->granularity;
 }
 
-/**
- * hbitmap_iter_next_word:
- * @hbi: HBitmapIter to operate on.
- * @p_cur: Location where to store the next non-zero word.
- *
- * Return the index of the next nonzero word that is set in @hbi's
- * associated HBitmap, and set *p_cur to the content of that word
- * (bits before the index that was passed to hbitmap_iter_init are
- * trimmed on the first call).  Return -1, and set *p_cur to zero,
- * if all remaining words are zero.
+/*
+ * Count the number of set bits in @n words.  This is the kernel used
+ * whenever the whole last level has to be recounted (merge and
+ * deserialization), so it is written to stream through memory.
  */
-static size_t hbitmap_iter_next_word(HBitmapIter *hbi, unsigned long *p_cur)
+static uint64_t hb_popcount_int(const unsigned long *words, size_t n)
 {
-    unsigned long cur = hbi->cur[HBITMAP_LEVELS - 1];
+    uint64_t count = 0;
+    size_t i;
 
-    if (cur == 0) {
-        cur = hbitmap_iter_skip_words(hbi);
-        if (cur == 0) {
-            *p_cur = 0;
-            return -1;
-        }
+    for (i = 0; i < n; i++) {
+        count += ctpopl(words[i]);
     }
-
-    /* The next call will resume work from the next word.  */
-    hbi->cur[HBITMAP_LEVELS - 1] = 0;
-    *p_cur = cur;
-    return hbi->pos;
+    return count;
 }
 
-/* Count the number of set bits between start and end, not accounting for
- * the granularity.  Also an example of how to use hbitmap_iter_next_word.
+#if defined(CONFIG_CPUID_H) && (defined(HOST_I386) || defined(HOST_X86_64)) && \
+    !defined(__POPCNT__)
+#include "qemu/cpuid.h"
+
+/*
+ * Without -mpopcnt, ctpopl() expands to a libgcc call per word.  Use
+ * the POPCNT instruction when the host has it.
  */
-static uint64_t hb_count_between(HBitmap *hb, uint64_t start, uint64_t last)
+static uint64_t __attribute__((target("popcnt")))
+hb_popcount_popcnt(const unsigned long *words, size_t n)
 {
-    HBitmapIter hbi;
     uint64_t count = 0;
-    uint64_t end = last + 1;
-    unsigned long cur;
-    size_t pos;
+    size_t i;
 
-    hbitmap_iter_init(&hbi, hb, start << hb->granularity);
-    for (;;) {
-        pos = hbitmap_iter_next_word(&hbi, &cur);
-        if (pos >= (end >> BITS_PER_LEVEL)) {
-            break;
-        }
-        count += ctpopl(cur);
+    for (i = 0; i < n; i++) {
+        count += __builtin_popcountl(words[i]);
     }
+    return count;
+}
+
+static uint64_t (*hb_popcount)(const unsigned long *, size_t) = hb_popcount_int;
 
-    if (pos == (end >> BITS_PER_LEVEL)) {
-        /* Drop bits representing the END-th and subsequent items.  */
-        int bit = end & (BITS_PER_LONG - 1);
-        cur &= (1UL << bit) - 1;
-        count += ctpopl(cur);
+static void __attribute__((constructor)) hb_init_popcount(void)
+{
+    unsigned a, b, c, d;
+
+    if (__get_cpuid(1, &a, &b, &c, &d) && (c & bit_POPCNT)) {
+        hb_popcount = hb_popcount_popcnt;
     }
+}
+#else
+#define hb_popcount hb_popcount_int
+#endif
 
+/*
+ * Count the number of set bits in the last level, not accounting for
+ * the granularity.  Bits past the end of the bitmap in the last word
+ * (which hbitmap_deserialize_ones may leave behind) are ignored.
+ */
+static uint64_t hb_count_all(const HBitmap *hb)
+{
+    const unsigned long *words = hb->levels[HBITMAP_LEVELS - 1];
+    uint64_t n = hb->size >> BITS_PER_LEVEL;
+    unsigned bit = hb->size & (BITS_PER_LONG - 1);
+    uint64_t count = hb_popcount(words, n);
+
+    if (bit) {
+        count += ctpopl(words[n] & ((1UL << bit) - 1));
+    }
     return count;
 }
 
 /* Setting starts at the last layer and propagates up if an element
  * changes.
  */
-static inline bool hb_set_elem(unsigned long *elem, uint64_t start, uint64_t last)
+static inline bool hb_set_elem(unsigned long *elem, uint64_t start,
+                               uint64_t last, uint64_t *count)
 {
     unsigned long mask;
     unsigned long old;
@@ -423,34 +433,47 @@ static inline bool hb_set_elem(unsigned long *elem, uint64_t start, uint64_t las
     mask -= 1UL << (start & (BITS_PER_LONG - 1));
     old = *elem;
     *elem |= mask;
+    if (count) {
+        *count += ctpopl(mask & ~old);
+    }
     return old != *elem;
 }
 
 /* The recursive workhorse (the depth is limited to HBITMAP_LEVELS)...
- * Returns true if at least one bit is changed. */
+ * Returns true if at least one bit is changed.  While updating the last
+ * level, also account the newly set bits in hb->count, so that callers
+ * need not walk the range a second time.
+ */
 static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
                            uint64_t last)
 {
     size_t pos = start >> BITS_PER_LEVEL;
     size_t lastpos = last >> BITS_PER_LEVEL;
+    uint64_t *count = level == HBITMAP_LEVELS - 1 ? &hb->count : NULL;
     bool changed = false;
     size_t i;
 
     i = pos;
     if (i < lastpos) {
         uint64_t next = (start | (BITS_PER_LONG - 1)) + 1;
-        changed |= hb_set_elem(&hb->levels[level][i], start, next - 1);
+        changed |= hb_set_elem(&hb->levels[level][i], start, next - 1, count);
         for (;;) {
+            unsigned long old;
+
             start = next;
             next += BITS_PER_LONG;
             if (++i == lastpos) {
                 break;
             }
-            changed |= (hb->levels[level][i] == 0);
+            old = hb->levels[level][i];
+            changed |= (old == 0);
+            if (count) {
+                *count += BITS_PER_LONG - ctpopl(old);
+            }
             hb->levels[level][i] = ~0UL;
         }
     }
-    changed |= hb_set_elem(&hb->levels[level][i], start, last);
+    changed |= hb_set_elem(&hb->levels[level][i], start, last, count);
 
     /* If there was any change in this layer, we may have to update
      * the one above.
@@ -464,7 +487,7 @@ static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
 void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count)
 {
     /* Compute range in the last layer.  */
-    uint64_t first, n;
+    uint64_t first;
     uint64_t last = start + count - 1;
 
     if (count == 0) {
@@ -477,9 +500,7 @@ void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count)
     first = start >> hb->granularity;
     last >>= hb->granularity;
     assert(last < hb->size);
-    n = last - first + 1;
 
-    hb->count += n - hb_count_between(hb, first, last);
     if (hb_set_between(hb, HBITMAP_LEVELS - 1, first, last) &&
         hb->meta) {
         hbitmap_set(hb->meta, start, count);
@@ -489,7 +510,8 @@ void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count)
 /* Resetting works the other way round: propagate up if the new
  * value is zero.
  */
-static inline bool hb_reset_elem(unsigned long *elem, uint64_t start, uint64_t last)
+static inline bool hb_reset_elem(unsigned long *elem, uint64_t start,
+                                 uint64_t last, uint64_t *count)
 {
     unsigned long mask;
     bool blanked;
@@ -499,18 +521,24 @@ static inline bool hb_reset_elem(unsigned long *elem, uint64_t start, uint64_t l
 
     mask = 2UL << (last & (BITS_PER_LONG - 1));
     mask -= 1UL << (start & (BITS_PER_LONG - 1));
+    if (count) {
+        *count -= ctpopl(*elem & mask);
+    }
     blanked = *elem != 0 && ((*elem & ~mask) == 0);
     *elem &= ~mask;
     return blanked;
 }
 
 /* The recursive workhorse (the depth is limited to HBITMAP_LEVELS)...
- * Returns true if at least one bit is changed. */
+ * Returns true if at least one bit is changed.  As in hb_set_between,
+ * hb->count is updated while walking the last level.
+ */
 static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
                              uint64_t last)
 {
     size_t pos = start >> BITS_PER_LEVEL;
     size_t lastpos = last >> BITS_PER_LEVEL;
+    uint64_t *count = level == HBITMAP_LEVELS - 1 ? &hb->count : NULL;
     bool changed = false;
     size_t i;
 
@@ -523,25 +551,31 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
          * unless the lower-level word became entirely zero.  So, remove pos
          * from the upper-level range if bits remain set.
          */
-        if (hb_reset_elem(&hb->levels[level][i], start, next - 1)) {
+        if (hb_reset_elem(&hb->levels[level][i], start, next - 1, count)) {
             changed = true;
         } else {
             pos++;
         }
 
         for (;;) {
+            unsigned long old;
+
             start = next;
             next += BITS_PER_LONG;
             if (++i == lastpos) {
                 break;
             }
-            changed |= (hb->levels[level][i] != 0);
+            old = hb->levels[level][i];
+            changed |= (old != 0);
+            if (count) {
+                *count -= ctpopl(old);
+            }
             hb->levels[level][i] = 0UL;
         }
     }
 
     /* Same as above, this time for lastpos.  */
-    if (hb_reset_elem(&hb->levels[level][i], start, last)) {
+    if (hb_reset_elem(&hb->levels[level][i], start, last, count)) {
         changed = true;
     } else {
         lastpos--;
@@ -576,7 +610,6 @@ void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count)
     last >>= hb->granularity;
     assert(last < hb->size);
 
-    hb->count -= hb_count_between(hb, first, last);
     if (hb_reset_between(hb, HBITMAP_LEVELS - 1, first, last) &&
         hb->meta) {
         hbitmap_set(hb->meta, start, count);
@@ -778,7 +811,7 @@ void hbitmap_deserialize_finish(HBitmap *bitmap)
     }
 
     bitmap->levels[0][0] |= 1UL << (BITS_PER_LONG - 1);
-    bitmap->count = hb_count_between(bitmap, 0, bitmap->size - 1);
+    bitmap->count = hb_count_all(bitmap);
 }
 
 void hbitmap_free(HBitmap *hb)
@@ -941,7 +974,7 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
     }
 
     /* Recompute the dirty count */
-    result->count = hb_count_between(result, 0, result->size - 1);
+    result->count = hb_count_all(result);
 }
 
 char *hbitmap_sha256(const HBitmap *bitmap, Error **errp)
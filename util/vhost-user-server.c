@@ -43,6 +43,14 @@
  * dev->broken flag. Both vu_client_trip() and kick fd processing stop when
  * the dev->broken flag is set.
  *
+ * With vhost_user_server_set_queue_aio_contexts() the kick fds are instead
+ * handled in per-virtqueue AioContexts, typically those of IOThreads, with
+ * the AioContext lock held.  libvhost-user is not thread-safe, so while a
+ * vhost-user message is processed vu_client_trip() holds the locks of all
+ * these AioContexts.  Message processing does not yield, which allows the
+ * locks to be taken in vu_message_read() once a message has been received
+ * and to be dropped at the start of the next vu_message_read().
+ *
  * It is possible to switch AioContexts using
  * vhost_user_server_detach_aio_context() and
  * vhost_user_server_attach_aio_context(). They stop monitoring fds in the old
@@ -74,16 +82,45 @@ static void panic_cb(VuDev *vu_dev, const char *buf)
     error_report("vu_panic: %s", buf);
 }
 
+static void vu_lock_queues(VuServer *server)
+{
+    unsigned int i;
+
+    assert(!server->queues_locked);
+    for (i = 0; i < server->num_queue_ctx; i++) {
+        aio_context_acquire(server->queue_ctx[i]);
+    }
+    server->queues_locked = true;
+}
+
+static void vu_unlock_queues(VuServer *server)
+{
+    unsigned int i;
+
+    if (!server->queues_locked) {
+        return;
+    }
+    for (i = server->num_queue_ctx; i-- > 0; ) {
+        aio_context_release(server->queue_ctx[i]);
+    }
+    server->queues_locked = false;
+}
+
+static AioContext *vu_fd_watch_ctx(VuServer *server, VuFdWatch *vu_fd_watch)
+{
+    return vu_fd_watch->ctx ?: server->ctx;
+}
+
 void vhost_user_server_ref(VuServer *server)
 {
-    assert(!server->wait_idle);
-    server->refcount++;
+    assert(!qatomic_read(&server->wait_idle));
+    qatomic_inc(&server->refcount);
 }
 
 void vhost_user_server_unref(VuServer *server)
 {
-    server->refcount--;
-    if (server->wait_idle && !server->refcount) {
+    if (qatomic_fetch_dec(&server->refcount) == 1 &&
+        qatomic_read(&server->wait_idle)) {
         aio_co_wake(server->co_trip);
     }
 }
@@ -101,6 +138,9 @@ vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
     VuServer *server = container_of(vu_dev, VuServer, vu_dev);
     QIOChannel *ioc = server->ioc;
 
+    /* The previous message has been processed */
+    vu_unlock_queues(server);
+
     vmsg->fd_num = 0;
     if (!ioc) {
         error_report_err(local_err);
@@ -174,6 +214,7 @@ vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
         }
     }
 
+    vu_lock_queues(server);
     return true;
 
 fail:
@@ -186,18 +227,30 @@ static coroutine_fn void vu_client_trip(void *opaque)
 {
     VuServer *server = opaque;
     VuDev *vu_dev = &server->vu_dev;
+    VuFdWatch *vu_fd_watch;
 
     while (!vu_dev->broken && vu_dispatch(vu_dev)) {
         /* Keep running */
     }
+    vu_unlock_queues(server);
 
-    if (server->refcount) {
-        /* Wait for requests to complete before we can unmap the memory */
-        server->wait_idle = true;
+    /* No new requests may come from the queue AioContexts after this */
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        if (vu_fd_watch->ctx) {
+            aio_context_acquire(vu_fd_watch->ctx);
+            aio_set_fd_handler(vu_fd_watch->ctx, vu_fd_watch->fd, true,
+                               NULL, NULL, NULL, NULL, NULL);
+            aio_context_release(vu_fd_watch->ctx);
+        }
+    }
+
+    /* Wait for requests to complete before we can unmap the memory */
+    qatomic_mb_set(&server->wait_idle, true);
+    if (qatomic_read(&server->refcount)) {
         qemu_coroutine_yield();
-        server->wait_idle = false;
     }
-    assert(server->refcount == 0);
+    qatomic_set(&server->wait_idle, false);
+    assert(qatomic_read(&server->refcount) == 0);
 
     vu_deinit(vu_dev);
 
@@ -229,6 +282,10 @@ static void kick_handler(void *opaque)
     VuFdWatch *vu_fd_watch = opaque;
     VuDev *vu_dev = vu_fd_watch->vu_dev;
 
+    if (vu_fd_watch->ctx) {
+        aio_context_acquire(vu_fd_watch->ctx);
+    }
+
     vu_fd_watch->cb(vu_dev, 0, vu_fd_watch->pvt);
 
     /* Stop vu_client_trip() if an error occurred in vu_fd_watch->cb() */
@@ -237,6 +294,10 @@ static void kick_handler(void *opaque)
 
         qio_channel_shutdown(server->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
     }
+
+    if (vu_fd_watch->ctx) {
+        aio_context_release(vu_fd_watch->ctx);
+    }
 }
 
 static VuFdWatch *find_vu_fd_watch(VuServer *server, int fd)
@@ -270,9 +331,14 @@ set_watch(VuDev *vu_dev, int fd, int vu_evt,
 
         vu_fd_watch->fd = fd;
         vu_fd_watch->cb = cb;
+        /* libvhost-user only watches kick fds, pvt is the queue index */
+        if (server->num_queue_ctx) {
+            vu_fd_watch->ctx = server->queue_ctx[(uintptr_t)pvt %
+                                                 server->num_queue_ctx];
+        }
         qemu_socket_set_nonblock(fd);
-        aio_set_fd_handler(server->ioc->ctx, fd, true, kick_handler,
-                           NULL, NULL, NULL, vu_fd_watch);
+        aio_set_fd_handler(vu_fd_watch->ctx ?: server->ioc->ctx, fd, true,
+                           kick_handler, NULL, NULL, NULL, vu_fd_watch);
         vu_fd_watch->vu_dev = vu_dev;
         vu_fd_watch->pvt = pvt;
     }
@@ -292,7 +358,7 @@ static void remove_watch(VuDev *vu_dev, int fd)
     if (!vu_fd_watch) {
         return;
     }
-    aio_set_fd_handler(server->ioc->ctx, fd, true,
+    aio_set_fd_handler(vu_fd_watch->ctx ?: server->ioc->ctx, fd, true,
                        NULL, NULL, NULL, NULL, NULL);
 
     QTAILQ_REMOVE(&server->vu_fd_watches, vu_fd_watch, next);
@@ -356,7 +422,8 @@ void vhost_user_server_stop(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd, true,
+            aio_set_fd_handler(vu_fd_watch_ctx(server, vu_fd_watch),
+                               vu_fd_watch->fd, true,
                                NULL, NULL, NULL, NULL, vu_fd_watch);
         }
 
@@ -399,6 +466,9 @@ void vhost_user_server_attach_aio_context(VuServer *server, AioContext *ctx)
     qio_channel_attach_aio_context(server->ioc, ctx);
 
     QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        if (vu_fd_watch->ctx) {
+            continue; /* stays in its queue AioContext */
+        }
         aio_set_fd_handler(ctx, vu_fd_watch->fd, true, kick_handler, NULL,
                            NULL, NULL, vu_fd_watch);
     }
@@ -413,6 +483,9 @@ void vhost_user_server_detach_aio_context(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+            if (vu_fd_watch->ctx) {
+                continue;
+            }
             aio_set_fd_handler(server->ctx, vu_fd_watch->fd, true,
                                NULL, NULL, NULL, NULL, vu_fd_watch);
         }
@@ -467,3 +540,17 @@ bool vhost_user_server_start(VuServer *server,
     QTAILQ_INIT(&server->vu_fd_watches);
     return true;
 }
+
+/*
+ * Process virtqueue i in @queue_ctx[i % @num_queue_ctx] instead of the
+ * AioContext of the server.  The array must outlive the server.  Call
+ * before the server accepts a connection.
+ */
+void vhost_user_server_set_queue_aio_contexts(VuServer *server,
+                                              AioContext **queue_ctx,
+                                              unsigned int num_queue_ctx)
+{
+    assert(!server->sioc);
+    server->queue_ctx = queue_ctx;
+    server->num_queue_ctx = num_queue_ctx;
+}